@@ -0,0 +1,82 @@
+/**
+ * @file Arena.cpp - implementation of Arena
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <new>
+#include "Arena.h"
+
+using namespace std;
+
+const size_t Arena::CHUNK_SIZE;
+const size_t Arena::MAX_SIZE;
+
+static thread_local Arena *current_arena = nullptr;
+
+Arena::~Arena() {
+    for (char *chunk: this->chunks)
+        delete[] chunk;
+}
+
+void *Arena::allocate(size_t size) {
+    size = (size + sizeof(Header) - 1) / sizeof(Header) * sizeof(Header);
+    Arena *arena = current_arena;
+    Header *header;
+    if (arena != nullptr && size <= MAX_SIZE) {
+        header = arena->take(size);
+    } else {
+        header = static_cast<Header *>(::operator new(sizeof(Header) + size));
+        arena = nullptr;
+    }
+    header->arena = arena;
+    header->size = size;
+    return header + 1;
+}
+
+void Arena::release(void *memory) {
+    if (memory == nullptr)
+        return;
+    Header *header = static_cast<Header *>(memory) - 1;
+    if (header->arena == nullptr)
+        ::operator delete(header);
+    else
+        header->arena->give_back(header);
+}
+
+Arena *Arena::current() {
+    return current_arena;
+}
+
+// the last released of the size if there is one, else the next free space, else a new chunk's
+Arena::Header *Arena::take(size_t size) {
+    auto found = this->free_lists.find(size);
+    if (found != this->free_lists.end() && found->second != nullptr) {
+        Header *header = found->second;
+        found->second = *reinterpret_cast<Header **>(header);
+        return header;
+    }
+    size_t needed = sizeof(Header) + size;
+    if (this->next == nullptr || (size_t) (this->end - this->next) < needed) {
+        char *chunk = new char[CHUNK_SIZE];   // as aligned as operator new's
+        this->chunks.push_back(chunk);
+        this->next = chunk;
+        this->end = chunk + CHUNK_SIZE;
+    }
+    Header *header = reinterpret_cast<Header *>(this->next);
+    this->next += needed;
+    return header;
+}
+
+void Arena::give_back(Header *header) {
+    Header *&head = this->free_lists[header->size];
+    *reinterpret_cast<Header **>(header) = head;
+    head = header;
+}
+
+Arena::Scope::Scope(Arena *arena) : previous(current_arena) {
+    if (arena != nullptr)
+        current_arena = arena;
+}
+
+Arena::Scope::~Scope() {
+    current_arena = this->previous;
+}
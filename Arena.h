@@ -0,0 +1,96 @@
+/**
+ * @file Arena.h - memory for the blocks a statement reads, released when the statement is done
+ * Arena
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @class Arena - memory handed out from large chunks, all of it freed at once when the arena goes.
+ *
+ * Each statement has one (see SQLExec::execute), owned by its QueryResult and current on the
+ * thread while the statement runs and while its rows are fetched. The SlottedPages the statement
+ * reads, and the copies of their blocks, come from it: a scan gets and deletes a page per block,
+ * and these are the biggest and most frequent allocations it makes. Released memory goes on a
+ * list for its size and is handed out again, so an arena grows to what the statement has in use
+ * at once, not to all it ever read; and whatever an error path leaked is freed with the rest.
+ *
+ * An arena is only used by the thread running its statement. Memory asked for with no arena
+ * current (on another thread, or outside any statement), or more than MAX_SIZE of it, comes from
+ * the heap instead; release works out which it was, so it can be called on either.
+ */
+class Arena {
+public:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+    static const size_t MAX_SIZE = CHUNK_SIZE / 4;   // larger allocations go to the heap
+
+    Arena() : chunks(), next(nullptr), end(nullptr), free_lists() {}
+
+    virtual ~Arena();
+
+    Arena(const Arena &other) = delete;
+
+    Arena &operator=(const Arena &other) = delete;
+
+    /**
+     * @param size  how many bytes
+     * @returns     memory from the current thread's arena, or from the heap if it has none
+     *              (freed by caller with release; aligned as operator new's)
+     */
+    static void *allocate(size_t size);
+
+    /**
+     * Give back memory from allocate.
+     * @param memory  from allocate, or nullptr
+     */
+    static void release(void *memory);
+
+    /**
+     * @returns  the current thread's arena, or nullptr if there is none
+     */
+    static Arena *current();
+
+    /**
+     * @returns  bytes taken from the heap for chunks
+     */
+    size_t get_reserved() const { return chunks.size() * CHUNK_SIZE; }
+
+    /**
+     * @class Scope - makes an arena the current thread's for as long as it lives (a nullptr
+     * arena leaves the current one as it is)
+     */
+    class Scope {
+    public:
+        explicit Scope(Arena *arena);
+
+        ~Scope();
+
+        Scope(const Scope &other) = delete;
+
+        Scope &operator=(const Scope &other) = delete;
+
+    protected:
+        Arena *previous;
+    };
+
+protected:
+    // before each allocation: the arena it came from (nullptr for the heap), and its size
+    struct alignas(16) Header {
+        Arena *arena;
+        size_t size;
+    };
+
+    std::vector<char *> chunks;
+    char *next;                                     // free space in the last chunk
+    char *end;
+    std::unordered_map<size_t, Header *> free_lists;  // released, by size, each holding the next
+
+    Header *take(size_t size);
+
+    void give_back(Header *header);
+};
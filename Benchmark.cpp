@@ -0,0 +1,410 @@
+/**
+ * @file Benchmark.cpp - micro-benchmarks of the storage layer, for comparing builds
+ *
+ * Times SlottedPage's add, get, del and slide, HeapFile's get_new, get and put, HeapTable's
+ * marshal and unmarshal at several row widths, and inserting and scanning whole tables. Each
+ * benchmark is run once to warm up and then REPEATS times; its result is written to standard
+ * output as a line of JSON:
+ *
+ *     {"benchmark": "SlottedPage::add", "params": "width=64", "ops": 6200, "repeats": 5,
+ *      "ns_per_op": 41.2, "min_ns_per_op": 40.8, "max_ns_per_op": 44.0, "ops_per_sec": 24271844.7}
+ *
+ * ns_per_op is the median of the repeats. Results from two builds can be joined on benchmark and
+ * params to see what got slower.
+ *
+ * Built like sql5300, from the same sources but with this main instead of SQL5300.cpp's.
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include "db_cxx.h"
+#include "heap_storage.h"
+
+using namespace std;
+
+DbEnv *_DB_ENV; // Global DB environment
+const u_int32_t ENV_FLAGS = DB_CREATE | DB_INIT_MPOOL | DB_INIT_CDB | DB_THREAD;
+
+const int REPEATS = 5;
+const int PAGES = 200;       // pages filled (or emptied) per run of the page benchmarks
+const int PASSES = 100;      // times over a full page per run of the page benchmarks that don't change it
+const int BLOCKS = 1000;     // blocks per run of the file benchmarks
+const int ROWS = 10000;      // rows per run of the record and table benchmarks
+const vector<uint> WIDTHS = {16, 64, 256, 1024};  // encoded bytes per record
+
+string filter;               // only run benchmarks whose names contain this
+
+/**
+ * @class Clock - adds up the time a benchmark run spends between start() and stop(), so that its
+ * set-up and clean-up aren't counted
+ */
+class Clock {
+public:
+    Clock() : started(), elapsed(0) {}
+
+    void start() { started = chrono::steady_clock::now(); }
+
+    void stop() { elapsed += chrono::steady_clock::now() - started; }
+
+    chrono::steady_clock::duration get_elapsed() const { return elapsed; }
+
+protected:
+    chrono::steady_clock::time_point started;
+    chrono::steady_clock::duration elapsed;
+};
+
+/**
+ * One run of a benchmark
+ * @param clock  to start and stop around the work being timed
+ * @returns      how many operations it timed
+ */
+typedef function<uint64_t(Clock &clock)> Run;
+
+/**
+ * Runs a benchmark (unless it is filtered out) and writes its result
+ * @param name    what is being timed, e.g. "HeapFile::get"
+ * @param params  how, e.g. "width=64"
+ * @param run     one run of it
+ */
+void bench(const string &name, const string &params, const Run &run)
+{
+    if (name.find(filter) == string::npos)
+        return;
+    Clock warm_up;
+    run(warm_up);
+
+    vector<double> ns_per_op;
+    uint64_t ops = 0;
+    for (int i = 0; i < REPEATS; i++) {
+        Clock clock;
+        ops = run(clock);
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(clock.get_elapsed()).count();
+        ns_per_op.push_back(ops == 0 ? 0.0 : (double) ns / ops);
+    }
+    sort(ns_per_op.begin(), ns_per_op.end());
+    double median = ns_per_op[REPEATS / 2];
+
+    char line[512];
+    snprintf(line, sizeof(line),
+             "{\"benchmark\": \"%s\", \"params\": \"%s\", \"ops\": %llu, \"repeats\": %d, \"ns_per_op\": %.1f, "
+             "\"min_ns_per_op\": %.1f, \"max_ns_per_op\": %.1f, \"ops_per_sec\": %.1f}",
+             name.c_str(), params.c_str(), (unsigned long long) ops, REPEATS, median, ns_per_op.front(),
+             ns_per_op.back(), median == 0.0 ? 0.0 : 1e9 / median);
+    cout << line << endl;
+}
+
+/**
+ * @class Page - a slotted page in a buffer of its own, not in any file
+ */
+class Page {
+public:
+    Page() : buffer(), dbt(buffer, sizeof(buffer)), page() { clear(); }
+
+    /**
+     * Make the page new again
+     */
+    void clear() {
+        memset(buffer, 0, sizeof(buffer));
+        page.reset(new SlottedPage(dbt, 1, true));
+    }
+
+    SlottedPage *operator->() { return page.get(); }
+
+protected:
+    char buffer[DbBlock::BLOCK_SZ];
+    Dbt dbt;
+    unique_ptr<SlottedPage> page;
+};
+
+/**
+ * @param width  the record's size
+ * @returns      how many records of that size fit on a page
+ */
+uint fitting(uint width)
+{
+    vector<char> bytes(width, 'x');
+    Dbt record(bytes.data(), width);
+    Page page;
+    uint n = 0;
+    try {
+        while (true) {
+            page->add(&record);
+            n++;
+        }
+    } catch (DbBlockNoRoomError &e) {
+        return n;
+    }
+}
+
+void bench_slotted_page()
+{
+    for (uint width: WIDTHS) {
+        string params = "width=" + to_string(width);
+        vector<char> bytes(width, 'x'), longer(width + 8, 'y');
+        Dbt record(bytes.data(), width), longer_record(longer.data(), width + 8);
+        uint n = fitting(width);
+
+        bench("SlottedPage::add", params, [&](Clock &clock) {
+            Page page;
+            for (int i = 0; i < PAGES; i++) {
+                page.clear();
+                clock.start();
+                for (uint j = 0; j < n; j++)
+                    page->add(&record);
+                clock.stop();
+            }
+            return (uint64_t) PAGES * n;
+        });
+
+        bench("SlottedPage::get", params, [&](Clock &clock) {
+            Page page;
+            for (uint j = 0; j < n; j++)
+                page->add(&record);
+            clock.start();
+            for (int i = 0; i < PASSES; i++) {
+                for (RecordID id = 1; id <= n; id++)
+                    delete page->get(id);
+            }
+            clock.stop();
+            return (uint64_t) PASSES * n;
+        });
+
+        // in the order they were added, so each slides all the rest
+        bench("SlottedPage::del", params, [&](Clock &clock) {
+            Page page;
+            for (int i = 0; i < PAGES; i++) {
+                page.clear();
+                for (uint j = 0; j < n; j++)
+                    page->add(&record);
+                clock.start();
+                for (RecordID id = 1; id <= n; id++)
+                    page->del(id);
+                clock.stop();
+            }
+            return (uint64_t) PAGES * n;
+        });
+
+        // slide is protected, so it is driven by growing and shrinking the first record of a full
+        // page (less its last, to make room), each of which slides every record after it
+        bench("SlottedPage::slide", params, [&](Clock &clock) {
+            Page page;
+            for (uint j = 0; j < n; j++)
+                page->add(&record);
+            page->del(n);
+            clock.start();
+            for (int i = 0; i < PASSES * (int) n; i++)
+                page->put(1, i % 2 == 0 ? longer_record : record);
+            clock.stop();
+            return (uint64_t) PASSES * n;
+        });
+    }
+}
+
+/**
+ * @returns  the numbers 1 to BLOCKS, shuffled the same way every time
+ */
+vector<BlockID> shuffled_block_ids()
+{
+    vector<BlockID> block_ids(BLOCKS);
+    iota(block_ids.begin(), block_ids.end(), 1);
+    shuffle(block_ids.begin(), block_ids.end(), mt19937(5300));
+    return block_ids;
+}
+
+void bench_heap_file()
+{
+    string params = "blocks=" + to_string(BLOCKS);
+    vector<BlockID> block_ids = shuffled_block_ids();
+
+    // a dropped file can't be used again, so each run has a file of its own
+    auto new_file = []() {
+        HeapFile *file = new HeapFile("_bench_file");
+        file->create();
+        return file;
+    };
+
+    bench("HeapFile::get_new", params, [&](Clock &clock) {
+        unique_ptr<HeapFile> file(new_file());
+        clock.start();
+        for (int i = 1; i < BLOCKS; i++)   // create() made the first
+            delete file->get_new();
+        clock.stop();
+        file->drop();
+        return (uint64_t) BLOCKS - 1;
+    });
+
+    bench("HeapFile::get", params, [&](Clock &clock) {
+        unique_ptr<HeapFile> file(new_file());
+        for (int i = 1; i < BLOCKS; i++)
+            delete file->get_new();
+        clock.start();
+        for (BlockID block_id: block_ids)
+            delete file->get(block_id);
+        clock.stop();
+        file->drop();
+        return (uint64_t) BLOCKS;
+    });
+
+    bench("HeapFile::put", params, [&](Clock &clock) {
+        unique_ptr<HeapFile> file(new_file());
+        for (int i = 1; i < BLOCKS; i++)
+            delete file->get_new();
+        for (BlockID block_id: block_ids) {
+            SlottedPage *block = file->get(block_id);
+            clock.start();
+            file->put(block);
+            clock.stop();
+            delete block;
+        }
+        file->drop();
+        return (uint64_t) BLOCKS;
+    });
+}
+
+/**
+ * @class CodecTable - a HeapTable whose record encoding can be called directly
+ */
+class CodecTable : public HeapTable {
+public:
+    CodecTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes)
+            : HeapTable(table_name, column_names, column_attributes) {}
+
+    using HeapTable::marshal;
+    using HeapTable::unmarshal;
+};
+
+/**
+ * Columns (id INT, text TEXT), and a row of them that encodes to a given width
+ * @param width  the encoded row's size, at least 6
+ */
+struct RowOfWidth {
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    ValueDict row;
+
+    explicit RowOfWidth(uint width) : column_names({"id", "text"}), column_attributes(), row() {
+        column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+        column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+        row["id"] = Value(5300);
+        row["text"] = Value(string(width - sizeof(int32_t) - sizeof(uint16_t), 'x'));
+    }
+};
+
+void free_record(Dbt *record)
+{
+    delete[] (char *) record->get_data();
+    delete record;
+}
+
+void bench_heap_table()
+{
+    for (uint width: WIDTHS) {
+        string params = "width=" + to_string(width);
+        RowOfWidth row_of_width(width);
+        CodecTable codec("_bench_codec", row_of_width.column_names, row_of_width.column_attributes);
+        const ValueDict *row = &row_of_width.row;
+
+        bench("HeapTable::marshal", params, [&](Clock &clock) {
+            vector<Dbt *> records(ROWS);
+            clock.start();
+            for (int i = 0; i < ROWS; i++)
+                records[i] = codec.marshal(row);
+            clock.stop();
+            for (Dbt *record: records)
+                free_record(record);
+            return (uint64_t) ROWS;
+        });
+
+        bench("HeapTable::unmarshal", params, [&](Clock &clock) {
+            Dbt *record = codec.marshal(row);
+            vector<ValueDict *> rows(ROWS);
+            clock.start();
+            for (int i = 0; i < ROWS; i++)
+                rows[i] = codec.unmarshal(record);
+            clock.stop();
+            for (ValueDict *unmarshalled: rows)
+                delete unmarshalled;
+            free_record(record);
+            return (uint64_t) ROWS;
+        });
+
+        // a dropped table can't be used again, so each run has a table of its own
+        auto new_table = [&]() {
+            HeapTable *table = new HeapTable("_bench_table", row_of_width.column_names,
+                                             row_of_width.column_attributes);
+            table->create();
+            return table;
+        };
+        string table_params = params + ",rows=" + to_string(ROWS);
+
+        bench("HeapTable::insert", table_params, [&](Clock &clock) {
+            unique_ptr<HeapTable> table(new_table());
+            clock.start();
+            for (int i = 0; i < ROWS; i++)
+                table->insert(row);
+            clock.stop();
+            table->drop();
+            return (uint64_t) ROWS;
+        });
+
+        // select every row and project each, as a SELECT * without a WHERE would
+        bench("HeapTable::scan", table_params, [&](Clock &clock) {
+            unique_ptr<HeapTable> table(new_table());
+            for (int i = 0; i < ROWS; i++)
+                table->insert(row);
+            clock.start();
+            Handles *handles = table->select();
+            for (Handle handle: *handles)
+                delete table->project(handle);
+            clock.stop();
+            uint64_t ops = handles->size();
+            delete handles;
+            table->drop();
+            return ops;
+        });
+    }
+}
+
+/**
+ * Main
+ */
+int main(int argc, char **argv)
+{
+    if (argc != 2 && argc != 3) {
+        cerr << "USAGE: " << argv[0] << " db_environment [benchmark_name_filter]\n";
+        return EXIT_FAILURE;
+    }
+    if (argc == 3)
+        filter = argv[2];
+
+    _DB_ENV = new DbEnv(0U);
+    _DB_ENV->set_message_stream(&cerr);
+    _DB_ENV->set_error_stream(&cerr);
+    try {
+        _DB_ENV->open(argv[1], ENV_FLAGS, 0);
+    } catch (DbException &e) {
+        cerr << "(benchmark: " << e.what() << ")" << endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        bench_slotted_page();
+        bench_heap_file();
+        bench_heap_table();
+    } catch (exception &e) {
+        cerr << "(benchmark: " << e.what() << ")" << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
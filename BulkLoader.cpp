@@ -0,0 +1,298 @@
+/**
+ * @file BulkLoader.cpp - implementation of BulkLoader
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <thread>
+#include "BulkLoader.h"
+
+using namespace std;
+
+const size_t BulkLoader::CHUNK_SIZE;
+const size_t BulkLoader::WINDOW_PER_THREAD;
+
+typedef vector<char *> Pages;
+
+static void free_pages(Pages *pages) {
+    if (pages == nullptr)
+        return;
+    for (char *page: *pages)
+        delete[] page;
+    delete pages;
+}
+
+BulkLoader::BulkLoader(HeapTable &table, vector<shared_ptr<DbIndex>> indices, bool header, char delimiter)
+        : table(table), indices(indices), header(header), delimiter(delimiter),
+          column_names(table.get_column_names()), column_attributes(table.get_column_attributes()) {}
+
+// Reading is sequential (on this thread), packing is in parallel, appending is in order (on this thread).
+size_t BulkLoader::load(const string &path) {
+    ifstream in(path, ios::in | ios::binary);
+    if (!in)
+        throw DbRelationError("cannot open " + path);
+
+    size_t window = WINDOW_PER_THREAD * max(1U, thread::hardware_concurrency());
+    deque<future<Pages *>> in_flight;
+    Handles *handles = this->indices.empty() ? nullptr : new Handles();
+    size_t count = 0;
+
+    // append the oldest chunk's pages
+    auto append_next = [&]() {
+        Pages *pages = in_flight.front().get();
+        in_flight.pop_front();
+        try {
+            count += this->table.append_pages(*pages, handles);
+        } catch (...) {
+            free_pages(pages);
+            throw;
+        }
+        free_pages(pages);
+    };
+
+    try {
+        string pending;
+        size_t line = 1;
+        vector<char> buffer(CHUNK_SIZE);
+        bool more = true;
+        while (more) {
+            in.read(buffer.data(), buffer.size());
+            size_t got = (size_t) in.gcount();
+            more = got > 0;
+            pending.append(buffer.data(), got);
+            if (pending.empty())
+                break;
+
+            Chunk chunk;
+            chunk.first_line = line;
+            size_t lines = 0;
+            size_t end = more ? record_end(pending, lines) : pending.size();
+            if (end == 0)
+                continue;  // a record longer than a chunk; read more of it
+            if (end == pending.size()) {
+                chunk.text.swap(pending);
+                pending.clear();
+            } else {
+                chunk.text = pending.substr(0, end);
+                pending.erase(0, end);
+            }
+            line += lines;
+
+            if (in_flight.size() >= window)
+                append_next();
+            in_flight.push_back(async(launch::async, [this](Chunk c) { return this->pack_chunk(c); },
+                                      move(chunk)));
+        }
+        while (!in_flight.empty())
+            append_next();
+
+        // deferred index builds
+        if (handles != nullptr)
+            for (const shared_ptr<DbIndex> &index: this->indices)
+                for (auto const &handle: *handles)
+                    index->insert(handle);
+    } catch (...) {
+        while (!in_flight.empty()) {
+            try {
+                free_pages(in_flight.front().get());
+            } catch (...) {
+                // only the first error is reported
+            }
+            in_flight.pop_front();
+        }
+        delete handles;
+        throw;
+    }
+    delete handles;
+    return count;
+}
+
+// Scan for line breaks outside quotes. Doubled quotes inside a quoted field toggle twice, so
+// they leave the state as it was.
+size_t BulkLoader::record_end(const string &text, size_t &lines) const {
+    bool quoted = false;
+    size_t end = 0, breaks = 0;
+    lines = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '"') {
+            quoted = !quoted;
+        } else if (c == '\n') {
+            breaks++;
+            if (!quoted) {
+                end = i + 1;
+                lines = breaks;
+            }
+        }
+    }
+    return end;
+}
+
+Pages *BulkLoader::pack_chunk(const Chunk &chunk) const {
+    ValueDicts rows;
+    Pages *pages = nullptr;
+    try {
+        const string &text = chunk.text;
+        size_t line = chunk.first_line;
+        size_t i = 0, n = text.size();
+        bool skip = this->header && chunk.first_line == 1;
+        vector<string> fields;
+        while (i < n) {
+            // one record
+            size_t record_line = line;
+            fields.clear();
+            string field;
+            bool in_quotes = false, was_quoted = false;
+            for (; i < n; i++) {
+                char c = text[i];
+                if (in_quotes) {
+                    if (c == '"') {
+                        if (i + 1 < n && text[i + 1] == '"') {
+                            field += '"';
+                            i++;
+                        } else {
+                            in_quotes = false;
+                        }
+                    } else {
+                        if (c == '\n')
+                            line++;
+                        field += c;
+                    }
+                } else if (c == '"' && field.empty() && !was_quoted) {
+                    in_quotes = was_quoted = true;
+                } else if (c == this->delimiter) {
+                    fields.push_back(field);
+                    field.clear();
+                    was_quoted = false;
+                } else if (c == '\n') {
+                    line++;
+                    i++;
+                    break;
+                } else if (c != '\r' || (i + 1 < n && text[i + 1] != '\n')) {
+                    field += c;
+                }
+            }
+            if (in_quotes)
+                throw DbRelationError("line " + to_string(record_line) + ": unterminated quoted field");
+            fields.push_back(field);
+
+            if (skip) {
+                skip = false;
+                continue;
+            }
+            if (fields.size() == 1 && fields[0].empty() && !was_quoted)
+                continue;  // blank line
+            if (fields.size() != this->column_names.size())
+                throw DbRelationError("line " + to_string(record_line) + ": expected " +
+                                      to_string(this->column_names.size()) + " fields, found " +
+                                      to_string(fields.size()));
+            ValueDict *row = new ValueDict();
+            rows.push_back(row);
+            for (size_t c = 0; c < fields.size(); c++)
+                (*row)[this->column_names[c]] = convert(fields[c], c, record_line);
+        }
+        pages = this->table.pack_pages(rows);
+    } catch (...) {
+        for (ValueDict *row: rows)
+            delete row;
+        throw;
+    }
+    for (ValueDict *row: rows)
+        delete row;
+    return pages;
+}
+
+Value BulkLoader::convert(const string &field, size_t column, size_t line) const {
+    ColumnAttribute attribute = this->column_attributes[column];
+    switch (attribute.get_data_type()) {
+        case ColumnAttribute::INT: {
+            const char *start = field.c_str();
+            char *end = nullptr;
+            errno = 0;
+            long n = strtol(start, &end, 10);
+            if (field.empty() || *end != '\0' || errno == ERANGE || n < INT_MIN || n > INT_MAX)
+                throw DbRelationError("line " + to_string(line) + ": " + this->column_names[column] +
+                                      " must be an integer, not '" + field + "'");
+            return Value((int32_t) n);
+        }
+        case ColumnAttribute::TEXT:
+            if (field.size() > UINT16_MAX)
+                throw DbRelationError("line " + to_string(line) + ": " + this->column_names[column] +
+                                      " is too long");
+            return Value(field);
+        default:
+            throw DbRelationError("can only load INT and TEXT columns");
+    }
+}
+
+// Write text to a file, load it, and return the rows loaded (as a -> b) or the error.
+static string test_load(HeapTable &table, const string &text, bool header, map<int32_t, string> &rows) {
+    const string path = "_test_copy_cpp.csv";
+    {
+        ofstream out(path, ios::binary);
+        out << text;
+    }
+    string error;
+    try {
+        BulkLoader(table, {}, header).load(path);
+    } catch (DbRelationError &e) {
+        error = e.what();
+    }
+    remove(path.c_str());
+    rows.clear();
+    Handles *handles = table.select();
+    for (auto const &handle: *handles) {
+        ValueDict *row = table.project(handle);
+        rows[row->at("a").n] = row->at("b").s;
+        delete row;
+    }
+    delete handles;
+    return error;
+}
+
+bool test_bulk_loader() {
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable table("_test_copy_cpp", column_names, column_attributes);
+    table.create();
+    bool ok = true;
+    try {
+        // header skipped; quoted line breaks, delimiters and quotes; CRLF, a blank line, no final line break
+        map<int32_t, string> rows;
+        string error = test_load(table, "a,b\r\n"
+                                        "1,plain\n"
+                                        "2,\"two\nlines, \"\"quoted\"\"\"\r\n"
+                                        "\n"
+                                        "3,\n"
+                                        "-4,\"x,y\"", true, rows);
+        ok = ok && error.empty() && rows == map<int32_t, string>{{1, "plain"}, {2, "two\nlines, \"quoted\""},
+                                                                 {3, ""}, {-4, "x,y"}};
+        std::cout << "quoting ok" << std::endl;
+
+        // a bad record is reported by its line in the file, counting line breaks inside quotes
+        error = test_load(table, "5,a\n6,\"b\nb\"\n7x,c\n", false, rows);
+        ok = ok && error.find("line 4:") == 0;
+        error = test_load(table, "8,\"unterminated\n", false, rows);
+        ok = ok && error.find("line 1:") == 0;
+        std::cout << "bad lines ok" << std::endl;
+
+        // INTs must fit in 32 bits
+        error = test_load(table, "-2147483648,min\n2147483648,z\n", false, rows);
+        ok = ok && error.find("line 2:") == 0;
+        error = test_load(table, "-2147483648,min\n2147483647,max\n", false, rows);
+        ok = ok && error.empty() && rows[INT_MIN] == "min" && rows[INT_MAX] == "max";
+        std::cout << "int range ok" << std::endl;
+    } catch (...) {
+        table.drop();
+        throw;
+    }
+    table.drop();
+    return ok;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file BulkLoader.h - loading CSV files into tables in bulk (COPY ... FROM)
+ * BulkLoader
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class BulkLoader - loads a CSV file into a table.
+ *
+ * The file is read in chunks that end on record boundaries. Each chunk is parsed, checked against
+ * the table's columns and packed into pages (HeapTable::pack_pages) on a thread of its own, while
+ * the pages of finished chunks are appended to the table whole and strictly in file order
+ * (HeapTable::append_pages). At most WINDOW_PER_THREAD chunks per hardware thread are in flight.
+ * The table's indices are built at the end from the handles of the new rows, rather than row by row.
+ *
+ * Fields are in the order of the table's columns, separated by the delimiter, quoted as in
+ * RFC 4180. A bad record stops the load with an error naming its line; the chunks before it stay
+ * loaded.
+ */
+class BulkLoader {
+public:
+    static const size_t CHUNK_SIZE = 4 * 1024 * 1024;
+    static const size_t WINDOW_PER_THREAD = 2;
+
+    /**
+     * @param table      table to load
+     * @param indices    the table's indices, to be built after loading
+     * @param header     whether the file starts with a header line (which is skipped)
+     * @param delimiter  field separator
+     */
+    BulkLoader(HeapTable &table, std::vector<std::shared_ptr<DbIndex>> indices, bool header = false, char delimiter = ',');
+
+    virtual ~BulkLoader() {}
+
+    BulkLoader(const BulkLoader &other) = delete;
+
+    BulkLoader &operator=(const BulkLoader &other) = delete;
+
+    /**
+     * Load a file.
+     * @param path  file to read
+     * @returns     number of rows loaded
+     */
+    virtual size_t load(const std::string &path);
+
+protected:
+    // part of the file, starting at a record boundary
+    struct Chunk {
+        std::string text;
+        size_t first_line;  // line number of its first character
+    };
+
+    HeapTable &table;
+    std::vector<std::shared_ptr<DbIndex>> indices;
+    bool header;
+    char delimiter;
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+
+    /**
+     * Find where the last complete record of text ends.
+     * @param text    text starting at a record boundary
+     * @param lines   returned by reference: number of line breaks before the end found
+     * @returns       one past the end of the last complete record, or 0 if there is none
+     */
+    virtual size_t record_end(const std::string &text, size_t &lines) const;
+
+    /**
+     * Parse a chunk and pack its rows into pages (runs on a worker thread).
+     * @param chunk  the chunk
+     * @returns      the pages (freed by caller with delete[])
+     */
+    virtual std::vector<char *> *pack_chunk(const Chunk &chunk) const;
+
+    virtual Value convert(const std::string &field, size_t column, size_t line) const;
+};
+
+bool test_bulk_loader();
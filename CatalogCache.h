@@ -0,0 +1,107 @@
+/**
+ * @file CatalogCache.h - a map for the schema tables' caches that many threads can read at once
+ * CatalogCache
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+/**
+ * @class CatalogCache - a map from catalog keys (table names, index names) to the objects built
+ * for them, read without taking the writers' mutex.
+ *
+ * The map is an immutable snapshot held by a shared_ptr that is only read and replaced with
+ * std::atomic_load and std::atomic_store, so a lookup is an atomic load and a search. Changes are
+ * rare (a table's first use, DDL, ANALYZE): a writer copies the snapshot, changes the copy and
+ * publishes it, under a mutex that only writers take. Values are held by shared_ptr too, and a
+ * lookup hands out its own, so a snapshot that has been replaced, or a value that has been
+ * removed, lives on only until the last reader using it lets go.
+ *
+ * Values can be nullptr (e.g., to remember that there is nothing to find). An object that must
+ * outlive the cache (like the schema tables, which put themselves in it) can be put in with a
+ * deleter that does nothing.
+ */
+template<typename Key, typename Value>
+class CatalogCache {
+public:
+    typedef std::map<Key, std::shared_ptr<Value>> Map;
+
+    CatalogCache() : current(std::make_shared<const Map>()), mutex() {}
+
+    virtual ~CatalogCache() {}
+
+    CatalogCache(const CatalogCache &other) = delete;
+
+    CatalogCache &operator=(const CatalogCache &other) = delete;
+
+    /**
+     * Look up a key.
+     * @param key    the key
+     * @param value  returned by reference: its value, if found
+     * @returns      whether the key is in the cache
+     */
+    bool find(const Key &key, std::shared_ptr<Value> &value) const {
+        std::shared_ptr<const Map> map = std::atomic_load(&this->current);
+        auto found = map->find(key);
+        if (found == map->end())
+            return false;
+        value = found->second;
+        return true;
+    }
+
+    /**
+     * Add a value unless another thread got there first.
+     * @param key    the key
+     * @param value  the value to add
+     * @returns      the key's value in the cache: value, or the one already there
+     */
+    std::shared_ptr<Value> insert(const Key &key, const std::shared_ptr<Value> &value) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::shared_ptr<const Map> map = std::atomic_load(&this->current);
+        auto found = map->find(key);
+        if (found != map->end())
+            return found->second;
+        Map *changed = new Map(*map);
+        (*changed)[key] = value;
+        publish(changed);
+        return value;
+    }
+
+    /**
+     * Add or replace a value.
+     * @param key    the key
+     * @param value  the new value
+     */
+    void put(const Key &key, const std::shared_ptr<Value> &value) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        Map *changed = new Map(*std::atomic_load(&this->current));
+        (*changed)[key] = value;
+        publish(changed);
+    }
+
+    /**
+     * Remove a key.
+     * @param key  the key
+     */
+    void erase(const Key &key) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        std::shared_ptr<const Map> map = std::atomic_load(&this->current);
+        if (map->find(key) == map->end())
+            return;
+        Map *changed = new Map(*map);
+        changed->erase(key);
+        publish(changed);
+    }
+
+protected:
+    std::shared_ptr<const Map> current;         // only through std::atomic_load and std::atomic_store
+    std::mutex mutex;                           // taken by writers only
+
+    void publish(const Map *changed) {
+        std::atomic_store(&this->current, std::shared_ptr<const Map>(changed));
+    }
+};
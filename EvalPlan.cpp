@@ -0,0 +1,483 @@
+/**
+ * @file EvalPlan.cpp - implementation of the basic physical query operators
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include "EvalPlan.h"
+#include "ExternalSort.h"
+#include "heap_storage.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+using namespace std;
+
+size_t EvalPlan::memory_budget = 4 * 1024 * 1024;
+
+// Rough cost of one map node plus its key and value payloads.
+size_t EvalPlan::row_size(const ValueDict *row) {
+    size_t size = sizeof(ValueDict);
+    for (auto const &column: *row)
+        size += 48 + sizeof(Value) + column.first.size() + column.second.s.size();
+    return size;
+}
+
+size_t EvalPlan::hash_columns(const ValueDict *row, const ColumnNames &columns, size_t seed) {
+    size_t h = seed * 0x9e3779b97f4a7c15ULL + 0x84222325U;
+    for (auto const &column_name: columns) {
+        const Value &value = row->at(column_name);
+        size_t v = value.data_type == ColumnAttribute::TEXT ? hash<string>()(value.s) : hash<int32_t>()(value.n);
+        h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+    }
+    return h;
+}
+
+
+/*
+ * ******************
+ * Comparison
+ * ******************
+ */
+Comparison Comparison::with_parameter(Identifier column, Op op, size_t parameter) {
+    Comparison comparison(column, op, Value());
+    comparison.parameter = (int) parameter;
+    return comparison;
+}
+
+Comparison Comparison::bind(const vector<Value> &parameters) const {
+    Comparison bound = *this;
+    if (this->parameter >= 0)
+        bound.value = parameters.at((size_t) this->parameter);
+    return bound;
+}
+
+bool Comparison::matches(const ValueDict *row) const {
+    const Value &left = row->at(this->column);
+    const Value &right = this->column_to_column ? row->at(this->other_column) : this->value;
+    switch (this->op) {
+        case EQ:
+            return left == right;
+        case NE:
+            return left != right;
+        case LT:
+            return left < right;
+        case LE:
+            return !(right < left);
+        case GT:
+            return right < left;
+        case GE:
+            return !(left < right);
+    }
+    return false;
+}
+
+
+/*
+ * ******************
+ * TableScan
+ * ******************
+ */
+const size_t TableScan::FIRST_BATCH;
+const size_t TableScan::MAX_BATCH;
+
+TableScan::TableScan(std::shared_ptr<DbRelation> relation, Identifier alias, bool qualified, ValueDict *where)
+        : relation(relation), alias(alias), qualified(qualified), projection(nullptr), where(where),
+          handles(nullptr), position(0),
+          cursor(0, 0), batch_size(FIRST_BATCH), exhausted(false), produced(0), limit(0), estimate(0) {
+    this->column_attributes = relation->get_column_attributes();
+    for (auto const &column_name: relation->get_column_names())
+        this->column_names.push_back(qualified ? alias + "." + column_name : column_name);
+}
+
+TableScan::~TableScan() {
+    delete this->handles;
+    delete this->projection;
+    delete this->where;
+}
+
+void TableScan::set_columns(const ColumnNames &wanted) {
+    const ColumnNames &names = this->relation->get_column_names();
+    const ColumnAttributes &attributes = this->relation->get_column_attributes();
+    ColumnNames *projection = new ColumnNames();
+    this->column_names.clear();
+    this->column_attributes.clear();
+    for (size_t i = 0; i < names.size(); i++) {
+        Identifier column_name = this->qualified ? this->alias + "." + names[i] : names[i];
+        if (find(wanted.begin(), wanted.end(), column_name) != wanted.end()) {
+            projection->push_back(names[i]);
+            this->column_names.push_back(column_name);
+            this->column_attributes.push_back(attributes[i]);
+        }
+    }
+    delete this->projection;
+    this->projection = projection;
+}
+
+void TableScan::open() {
+    delete this->handles;
+    this->handles = nullptr;
+    this->position = 0;
+    this->cursor = Handle(0, 0);
+    this->batch_size = this->limit > 0 ? this->limit : FIRST_BATCH;
+    this->exhausted = false;
+    this->produced = 0;
+    this->estimate = this->relation->estimate_row_count();
+    if (this->limit > 0 && this->limit < this->estimate)
+        this->estimate = this->limit;
+}
+
+// Get the next batch of handles; each batch is twice the last, up to MAX_BATCH.
+bool TableScan::fetch() {
+    if (this->exhausted || (this->limit > 0 && this->produced >= this->limit))
+        return false;
+    size_t want = this->batch_size;
+    if (this->limit > 0)
+        want = min(want, this->limit - this->produced);
+    delete this->handles;
+    this->handles = this->relation->select(this->where, this->cursor, want);
+    this->position = 0;
+    this->exhausted = this->handles->size() < want;
+    this->batch_size = min(this->batch_size * 2, MAX_BATCH);
+    return !this->handles->empty();
+}
+
+ValueDict *TableScan::next() {
+    if ((this->handles == nullptr || this->position >= this->handles->size()) && !fetch())
+        return nullptr;
+    this->produced++;
+    ValueDict *row = this->relation->project((*this->handles)[this->position++], this->projection);
+    if (!this->qualified)
+        return row;
+    ValueDict *qualified_row = new ValueDict();
+    for (auto const &column: *row)
+        (*qualified_row)[this->alias + "." + column.first] = column.second;
+    delete row;
+    return qualified_row;
+}
+
+void TableScan::close() {
+    delete this->handles;
+    this->handles = nullptr;
+}
+
+// Exact once the scan has finished, otherwise the relation's estimate.
+size_t TableScan::estimated_rows() const {
+    return this->exhausted ? this->produced + (this->handles ? this->handles->size() - this->position : 0)
+                           : this->estimate;
+}
+
+
+/*
+ * ******************
+ * Select
+ * ******************
+ */
+Select::Select(EvalPlan *relation, Conjunction predicate) : relation(relation), predicate(predicate) {
+    this->column_names = relation->get_column_names();
+    this->column_attributes = relation->get_column_attributes();
+}
+
+Select::~Select() {
+    delete this->relation;
+}
+
+void Select::open() {
+    this->relation->open();
+}
+
+ValueDict *Select::next() {
+    ValueDict *row;
+    while ((row = this->relation->next()) != nullptr) {
+        bool keep = true;
+        for (auto const &term: this->predicate)
+            if (!term.matches(row)) {
+                keep = false;
+                break;
+            }
+        if (keep)
+            return row;
+        delete row;
+    }
+    return nullptr;
+}
+
+void Select::close() {
+    this->relation->close();
+}
+
+size_t Select::estimated_rows() const {
+    return this->relation->estimated_rows();
+}
+
+
+/*
+ * ******************
+ * Project
+ * ******************
+ */
+Project::Project(EvalPlan *relation, ColumnNames input_names, ColumnNames output_names)
+        : relation(relation), input_names(input_names) {
+    this->column_names = output_names;
+    const ColumnNames &names = relation->get_column_names();
+    const ColumnAttributes &attributes = relation->get_column_attributes();
+    for (auto const &input_name: input_names)
+        for (size_t i = 0; i < names.size(); i++)
+            if (names[i] == input_name) {
+                this->column_attributes.push_back(attributes[i]);
+                break;
+            }
+}
+
+Project::~Project() {
+    delete this->relation;
+}
+
+void Project::open() {
+    this->relation->open();
+}
+
+ValueDict *Project::next() {
+    ValueDict *row = this->relation->next();
+    if (row == nullptr)
+        return nullptr;
+    ValueDict *projected = new ValueDict();
+    for (size_t i = 0; i < this->input_names.size(); i++)
+        (*projected)[this->column_names[i]] = row->at(this->input_names[i]);
+    delete row;
+    return projected;
+}
+
+void Project::close() {
+    this->relation->close();
+}
+
+size_t Project::estimated_rows() const {
+    return this->relation->estimated_rows();
+}
+
+
+/*
+ * ******************
+ * Limit
+ * ******************
+ */
+Limit::Limit(EvalPlan *relation, size_t limit, size_t offset) : relation(relation), limit(limit), offset(offset),
+                                                                produced(0) {
+    this->column_names = relation->get_column_names();
+    this->column_attributes = relation->get_column_attributes();
+}
+
+Limit::~Limit() {
+    delete this->relation;
+}
+
+void Limit::open() {
+    this->relation->open();
+    this->produced = 0;
+    for (size_t skipped = 0; skipped < this->offset; skipped++) {
+        ValueDict *row = this->relation->next();
+        if (row == nullptr)
+            break;
+        delete row;
+    }
+}
+
+ValueDict *Limit::next() {
+    if (this->produced >= this->limit)
+        return nullptr;
+    ValueDict *row = this->relation->next();
+    if (row != nullptr)
+        this->produced++;
+    return row;
+}
+
+void Limit::close() {
+    this->relation->close();
+}
+
+size_t Limit::estimated_rows() const {
+    return min(this->limit, this->relation->estimated_rows());
+}
+
+
+/*
+ * ******************
+ * Instrumented
+ * ******************
+ */
+// Adds the time and storage reads from its construction to its destruction to an operator's stats.
+class Instrumented::Measurement {
+public:
+    explicit Measurement(OperatorStats &stats) : stats(stats), counters(IoCounters::current()), before(),
+                                                 start(chrono::steady_clock::now()) {
+        if (this->counters != nullptr)
+            this->before = *this->counters;
+    }
+
+    ~Measurement() {
+        auto elapsed = chrono::steady_clock::now() - this->start;
+        this->stats.nanoseconds += chrono::duration_cast<chrono::nanoseconds>(elapsed).count();
+        if (this->counters != nullptr) {
+            IoCounters read = *this->counters;
+            read -= this->before;
+            this->stats.io += read;
+        }
+    }
+
+protected:
+    OperatorStats &stats;
+    IoCounters *counters;
+    IoCounters before;
+    chrono::steady_clock::time_point start;
+};
+
+Instrumented::Instrumented(EvalPlan *relation, OperatorStats &stats)
+        : relation(relation), stats(stats), blocks_at_open(0), misses_at_open(0) {
+    this->column_names = relation->get_column_names();
+    this->column_attributes = relation->get_column_attributes();
+}
+
+Instrumented::~Instrumented() {
+    delete this->relation;
+}
+
+void Instrumented::open() {
+    if (IoCounters::current() != nullptr) {
+        this->blocks_at_open = this->stats.io.blocks_read;
+        this->misses_at_open = HeapFile::cache_misses();
+    }
+    Measurement measurement(this->stats);
+    this->relation->open();
+}
+
+ValueDict *Instrumented::next() {
+    Measurement measurement(this->stats);
+    ValueDict *row = this->relation->next();
+    if (row != nullptr)
+        this->stats.rows++;
+    return row;
+}
+
+void Instrumented::close() {
+    {
+        Measurement measurement(this->stats);
+        this->relation->close();
+    }
+    if (IoCounters::current() != nullptr) {
+        uint64_t blocks = this->stats.io.blocks_read - this->blocks_at_open;
+        uint64_t misses = HeapFile::cache_misses() - this->misses_at_open;
+        this->stats.io.buffer_hits += blocks > misses ? blocks - misses : 0;
+    }
+}
+
+size_t Instrumented::estimated_rows() const {
+    return this->relation->estimated_rows();
+}
+
+Traced::Traced(EvalPlan *relation, const string &label)
+        : relation(relation), open_name("open " + label), next_name("next " + label), close_name("close " + label) {
+    this->column_names = relation->get_column_names();
+    this->column_attributes = relation->get_column_attributes();
+}
+
+Traced::~Traced() {
+    delete this->relation;
+}
+
+void Traced::open() {
+    Trace::Span span(this->open_name.c_str(), "operator");
+    this->relation->open();
+}
+
+ValueDict *Traced::next() {
+    Trace::Span span(this->next_name.c_str(), "operator");
+    return this->relation->next();
+}
+
+void Traced::close() {
+    Trace::Span span(this->close_name.c_str(), "operator");
+    this->relation->close();
+}
+
+size_t Traced::estimated_rows() const {
+    return this->relation->estimated_rows();
+}
+
+// Run a plan and collect column a of its rows.
+static vector<int32_t> test_plan(EvalPlan *plan) {
+    vector<int32_t> values;
+    plan->open();
+    ValueDict *row;
+    while ((row = plan->next()) != nullptr) {
+        values.push_back(row->at("a").n);
+        delete row;
+    }
+    plan->close();
+    delete plan;
+    return values;
+}
+
+bool test_limit() {
+    ColumnNames column_names = {"a", "k"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT)};
+    shared_ptr<HeapTable> table = make_shared<HeapTable>("_test_limit_cpp", column_names, column_attributes);
+    table->create();
+    bool ok = true;
+    try {
+        // enough rows for several blocks; k repeats so that TopN sees ties
+        const int32_t ROWS = 1000;
+        for (int32_t i = 0; i < ROWS; i++) {
+            ValueDict row;
+            row["a"] = Value(i);
+            row["k"] = Value(i % 10);
+            table->insert(&row);
+        }
+
+        // resuming select, a few rows at a time, returns the same handles as one full select
+        Handles *all = table->select();
+        Handles pages;
+        Handle cursor(0, 0);
+        while (true) {
+            Handles *page = table->select(nullptr, cursor, 7);
+            pages.insert(pages.end(), page->begin(), page->end());
+            size_t size = page->size();
+            delete page;
+            if (size < 7)
+                break;
+        }
+        ok = ok && pages == *all && all->size() == (size_t) ROWS;
+        delete all;
+        ValueDict where;
+        where["k"] = Value(3);
+        cursor = Handle(0, 0);
+        Handles *page = table->select(&where, cursor, 2);
+        ok = ok && page->size() == 2 && cursor == page->back();
+        delete page;
+        std::cout << "select with limit ok" << std::endl;
+
+        // scan pushdown, then LIMIT with OFFSET inside, at and past the end of the input
+        TableScan *scan = new TableScan(table, "t", false);
+        scan->set_limit(10);
+        ok = ok && test_plan(scan) == vector<int32_t>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+        ok = ok && test_plan(new Limit(new TableScan(table, "t", false), 3, 500)) == vector<int32_t>{500, 501, 502};
+        ok = ok && test_plan(new Limit(new TableScan(table, "t", false), 5, 998)) == vector<int32_t>{998, 999};
+        ok = ok && test_plan(new Limit(new TableScan(table, "t", false), 5, ROWS)).empty();
+        ok = ok && test_plan(new Limit(new TableScan(table, "t", false), 0, 0)).empty();
+        std::cout << "limit ok" << std::endl;
+
+        // TopN: largest first, ties in input order, and n beyond the input size
+        ok = ok && test_plan(new TopN(new TableScan(table, "t", false), {"a"}, {true}, 3)) ==
+                   vector<int32_t>{999, 998, 997};
+        ok = ok && test_plan(new TopN(new TableScan(table, "t", false), {"k"}, {false}, 4)) ==
+                   vector<int32_t>{0, 10, 20, 30};
+        vector<int32_t> sorted = test_plan(new TopN(new TableScan(table, "t", false), {"k", "a"}, {true, false}, 5000));
+        ok = ok && sorted.size() == (size_t) ROWS && sorted.front() == 9 && sorted[1] == 19 && sorted.back() == 990;
+        std::cout << "top n ok" << std::endl;
+    } catch (...) {
+        table->drop();
+        throw;
+    }
+    table->drop();
+    return ok;
+}
@@ -0,0 +1,345 @@
+/**
+ * @file EvalPlan.h - physical query operators (iterator model)
+ * EvalPlan
+ * TableScan: EvalPlan
+ * Select: EvalPlan
+ * Project: EvalPlan
+ * Limit: EvalPlan
+ * OperatorStats
+ * Instrumented: EvalPlan
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <memory>
+#include "storage_engine.h"
+
+/**
+ * @class Comparison - one term of a conjunctive predicate:
+ *      <column> <op> <value>
+ *      <column> <op> <other_column>
+ */
+class Comparison {
+public:
+    enum Op {
+        EQ, NE, LT, LE, GT, GE
+    };
+
+    Comparison(Identifier column, Op op, Value value) : column(column), op(op), value(value), other_column(""),
+                                                        column_to_column(false), parameter(-1) {}
+
+    Comparison(Identifier column, Op op, Identifier other_column) : column(column), op(op), value(),
+                                                                    other_column(other_column),
+                                                                    column_to_column(true), parameter(-1) {}
+
+    /**
+     * A comparison with a statement parameter, whose value is only known when the plan is run.
+     * @param column     column compared
+     * @param op         comparison
+     * @param parameter  index into the statement's parameters
+     * @returns          the comparison (with no value until bound)
+     */
+    static Comparison with_parameter(Identifier column, Op op, size_t parameter);
+
+    /**
+     * @returns  whether the value comes from a statement parameter
+     */
+    bool has_parameter() const { return parameter >= 0; }
+
+    /**
+     * Fill in the value of a parameterized comparison.
+     * @param parameters  the statement's parameter values
+     * @returns           a copy of this comparison with its value set
+     */
+    Comparison bind(const std::vector<Value> &parameters) const;
+
+    /**
+     * Evaluate this term against a row.
+     * @param row  row to check (must contain column, and other_column if comparing columns)
+     * @returns    true if the row satisfies the term
+     */
+    bool matches(const ValueDict *row) const;
+
+    Identifier column;
+    Op op;
+    Value value;
+    Identifier other_column;
+    bool column_to_column;
+    int parameter;  // index of the statement parameter giving value, or -1
+};
+
+typedef std::vector<Comparison> Conjunction;
+
+
+/**
+ * @class EvalPlan - abstract base class for a physical query operator
+ *
+ * Operators form a tree and are driven with the iterator model:
+ *      open()
+ *      next()   -- next row (freed by caller), or nullptr when exhausted
+ *      close()
+ * An operator owns its children and deletes them in its destructor.
+ */
+class EvalPlan {
+public:
+    /**
+     * Memory budget in bytes for operators that spill to disk when exceeded.
+     */
+    static size_t memory_budget;
+
+    EvalPlan() {}
+
+    virtual ~EvalPlan() {}
+
+    EvalPlan(const EvalPlan &other) = delete;
+
+    EvalPlan(EvalPlan &&temp) = delete;
+
+    EvalPlan &operator=(const EvalPlan &other) = delete;
+
+    EvalPlan &operator=(EvalPlan &&temp) = delete;
+
+    virtual void open() = 0;
+
+    virtual ValueDict *next() = 0;
+
+    virtual void close() = 0;
+
+    /**
+     * Estimate of how many rows this operator will produce. Only meaningful after open().
+     * @returns  estimated row count
+     */
+    virtual size_t estimated_rows() const = 0;
+
+    virtual const ColumnNames &get_column_names() const { return column_names; }
+
+    virtual const ColumnAttributes &get_column_attributes() const { return column_attributes; }
+
+    /**
+     * Approximate in-memory footprint of a row, for comparing against memory_budget.
+     * @param row  row to measure
+     * @returns    size in bytes
+     */
+    static size_t row_size(const ValueDict *row);
+
+    /**
+     * Hash the given columns of a row.
+     * @param row      row to hash
+     * @param columns  which columns to include, in order
+     * @param seed     varies the hash function (e.g., per partitioning level)
+     * @returns        hash code
+     */
+    static size_t hash_columns(const ValueDict *row, const ColumnNames &columns, size_t seed = 0);
+
+protected:
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+};
+
+
+/**
+ * @class TableScan - produce every row of a relation, optionally filtered by equality on some columns
+ * (which is pushed down into DbRelation::select).
+ * If qualified, column names are prefixed with "<alias>." so that they are unique across a join.
+ * Handles are fetched incrementally in growing batches, so a consumer that stops pulling (e.g. Limit)
+ * also stops the scan; with set_limit() the scan never reads past the limit at all.
+ */
+class TableScan : public EvalPlan {
+public:
+    static const size_t FIRST_BATCH = 128;
+    static const size_t MAX_BATCH = 8192;
+
+    TableScan(std::shared_ptr<DbRelation> relation, Identifier alias, bool qualified, ValueDict *where = nullptr);
+
+    virtual ~TableScan();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    virtual size_t estimated_rows() const;
+
+    /**
+     * Produce at most this many rows (LIMIT pushdown). Only valid if every row produced is consumed.
+     * @param limit  maximum row count, 0 for no limit
+     */
+    virtual void set_limit(size_t limit) { this->limit = limit; }
+
+    /**
+     * Produce only these columns (projection pushdown), so the rest are never decoded.
+     * Names are as the scan reports them (i.e., qualified if the scan is); unknown names are ignored.
+     * @param wanted  columns to keep, in any order
+     */
+    virtual void set_columns(const ColumnNames &wanted);
+
+protected:
+    std::shared_ptr<DbRelation> relation;
+    Identifier alias;
+    bool qualified;
+    ColumnNames *projection;
+    ValueDict *where;
+    Handles *handles;
+    size_t position;
+    Handle cursor;
+    size_t batch_size;
+    bool exhausted;
+    size_t produced;
+    size_t limit;
+    size_t estimate;
+
+    virtual bool fetch();
+};
+
+
+/**
+ * @class Select - pass through only the rows that satisfy a conjunctive predicate
+ */
+class Select : public EvalPlan {
+public:
+    Select(EvalPlan *relation, Conjunction predicate);
+
+    virtual ~Select();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    virtual size_t estimated_rows() const;
+
+protected:
+    EvalPlan *relation;
+    Conjunction predicate;
+};
+
+
+/**
+ * @class Project - reduce each row to the given columns, renaming them as requested
+ */
+class Project : public EvalPlan {
+public:
+    Project(EvalPlan *relation, ColumnNames input_names, ColumnNames output_names);
+
+    virtual ~Project();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    virtual size_t estimated_rows() const;
+
+protected:
+    EvalPlan *relation;
+    ColumnNames input_names;
+};
+
+
+/**
+ * @class Limit - skip the first offset rows, then produce at most limit rows (and stop pulling from the input)
+ */
+class Limit : public EvalPlan {
+public:
+    Limit(EvalPlan *relation, size_t limit, size_t offset);
+
+    virtual ~Limit();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    virtual size_t estimated_rows() const;
+
+protected:
+    EvalPlan *relation;
+    size_t limit;
+    size_t offset;
+    size_t produced;
+};
+
+
+/**
+ * @class OperatorStats - what an operator did while its plan ran, its inputs' work included: rows
+ * produced, wall time spent in its open, next and close, and what it read from storage
+ */
+class OperatorStats {
+public:
+    OperatorStats() : rows(0), nanoseconds(0), io() {}
+
+    size_t rows;
+    uint64_t nanoseconds;
+    IoCounters io;      // only counted if the thread has current IoCounters
+};
+
+
+/**
+ * @class Instrumented - run an operator unchanged, adding what each call to it costs to its
+ * OperatorStats (for EXPLAIN ANALYZE). Buffer hits are the blocks read between open and close
+ * less the buffer pool's misses over that time, so the pool's statistics are read twice per
+ * operator rather than twice per block. Misses by anything else running meanwhile (another
+ * session, or the other input of a join) count against it, so the estimate errs low.
+ */
+class Instrumented : public EvalPlan {
+public:
+    /**
+     * @param relation  the operator (freed by this one)
+     * @param stats     where to add its costs (must outlive this operator)
+     */
+    Instrumented(EvalPlan *relation, OperatorStats &stats);
+
+    virtual ~Instrumented();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    virtual size_t estimated_rows() const;
+
+protected:
+    class Measurement;
+
+    EvalPlan *relation;
+    OperatorStats &stats;
+    uint64_t blocks_at_open;
+    uint64_t misses_at_open;
+};
+
+
+/**
+ * @class Traced - run an operator unchanged, recording a Trace span for each call to it
+ */
+class Traced : public EvalPlan {
+public:
+    /**
+     * @param relation  the operator (freed by this one)
+     * @param label     what to call it on the timeline
+     */
+    Traced(EvalPlan *relation, const std::string &label);
+
+    virtual ~Traced();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    virtual size_t estimated_rows() const;
+
+protected:
+    EvalPlan *relation;
+    std::string open_name;
+    std::string next_name;
+    std::string close_name;
+};
+
+bool test_limit();
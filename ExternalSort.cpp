@@ -0,0 +1,417 @@
+/**
+ * @file ExternalSort.cpp - implementation of ExternalSort, SortRun, LoserTree and TopN
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include "ExternalSort.h"
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include "HashJoin.h"
+
+using namespace std;
+
+static bool entry_less(const SortRun::Entry &a, const SortRun::Entry &b) {
+    return a.first < b.first;
+}
+
+/*
+ * ******************
+ * SortRun
+ * ******************
+ */
+const Identifier SortRun::KEY_COLUMN = "_sort_key";
+
+SortRun::SortRun(Entries *entries) : entries(entries), position(0), spill(nullptr), current("", nullptr) {}
+
+SortRun::SortRun(SpillFile *spill) : entries(nullptr), position(0), spill(spill), current("", nullptr) {}
+
+SortRun::~SortRun() {
+    delete this->current.second;
+    if (this->entries != nullptr)
+        for (auto const &entry: *this->entries)
+            delete entry.second;
+    delete this->entries;
+    delete this->spill;
+}
+
+void SortRun::rewind() {
+    this->position = 0;
+    if (this->spill != nullptr)
+        this->spill->rewind();
+}
+
+bool SortRun::advance() {
+    delete this->current.second;
+    this->current.second = nullptr;
+    if (this->entries != nullptr) {
+        if (this->position >= this->entries->size())
+            return false;
+        this->current = (*this->entries)[this->position];
+        (*this->entries)[this->position++].second = nullptr;  // ownership moves to current
+        return true;
+    }
+    ValueDict *row = this->spill->next();
+    if (row == nullptr)
+        return false;
+    this->current.first = row->at(KEY_COLUMN).s;
+    row->erase(KEY_COLUMN);
+    this->current.second = row;
+    return true;
+}
+
+ValueDict *SortRun::take_row() {
+    ValueDict *row = this->current.second;
+    this->current.second = nullptr;
+    return row;
+}
+
+
+/*
+ * ******************
+ * LoserTree
+ * ******************
+ */
+LoserTree::LoserTree(vector<SortRun *> &runs, vector<bool> &exhausted) : runs(runs), exhausted(exhausted), tree() {
+    size_t k = runs.size();
+    this->tree.assign(k > 0 ? k : 1, 0);
+    if (k > 1)
+        this->tree[0] = build(1);
+}
+
+// play the matches in the subtree at node, returning its winner
+size_t LoserTree::build(size_t node) {
+    size_t k = this->runs.size();
+    if (node >= k)
+        return node - k;
+    size_t a = build(2 * node), b = build(2 * node + 1);
+    if (beats(a, b)) {
+        this->tree[node] = b;
+        return a;
+    }
+    this->tree[node] = a;
+    return b;
+}
+
+void LoserTree::replay() {
+    size_t k = this->runs.size();
+    size_t winner = this->tree[0];
+    for (size_t node = (winner + k) / 2; node > 0; node /= 2)
+        if (beats(this->tree[node], winner))
+            swap(this->tree[node], winner);
+    this->tree[0] = winner;
+}
+
+// ties go to the earlier run, which keeps the sort stable
+bool LoserTree::beats(size_t a, size_t b) const {
+    if (this->exhausted[a])
+        return false;
+    if (this->exhausted[b])
+        return true;
+    int cmp = this->runs[a]->key().compare(this->runs[b]->key());
+    return cmp != 0 ? cmp < 0 : a < b;
+}
+
+
+/*
+ * ******************
+ * ExternalSort
+ * ******************
+ */
+ExternalSort::ExternalSort(EvalPlan *relation, ColumnNames sort_columns, vector<bool> descending,
+                           size_t memory_budget)
+        : relation(relation), sort_columns(sort_columns), descending(descending), budget(memory_budget),
+          row_count(0), runs(), exhausted(), tree(nullptr) {
+    this->column_names = relation->get_column_names();
+    this->column_attributes = relation->get_column_attributes();
+    this->descending.resize(sort_columns.size(), false);
+}
+
+ExternalSort::~ExternalSort() {
+    clear();
+    delete this->relation;
+}
+
+string ExternalSort::normalized_key(const ValueDict *row, const ColumnNames &sort_columns,
+                                    const vector<bool> &descending) {
+    string key;
+    for (size_t i = 0; i < sort_columns.size(); i++) {
+        const Value &value = row->at(sort_columns[i]);
+        size_t start = key.size();
+        if (value.data_type == ColumnAttribute::TEXT) {
+            for (char c: value.s) {
+                key += c;
+                if (c == '\0')
+                    key += '\xFF';
+            }
+            key += '\0';
+            key += '\0';
+        } else {
+            uint32_t u = (uint32_t) value.n ^ 0x80000000U;
+            key += (char) (u >> 24);
+            key += (char) (u >> 16);
+            key += (char) (u >> 8);
+            key += (char) u;
+        }
+        if (descending[i])
+            for (size_t j = start; j < key.size(); j++)
+                key[j] = (char) ~key[j];
+    }
+    return key;
+}
+
+void ExternalSort::open() {
+    clear();
+    this->relation->open();
+    generate_runs();
+    this->exhausted.assign(this->runs.size(), false);
+    for (size_t i = 0; i < this->runs.size(); i++) {
+        this->runs[i]->rewind();
+        this->exhausted[i] = !this->runs[i]->advance();
+    }
+    this->tree = new LoserTree(this->runs, this->exhausted);
+}
+
+// Fill memory, sort, spill; repeat. The last run stays in memory.
+void ExternalSort::generate_runs() {
+    SortRun::Entries *entries = new SortRun::Entries();
+    size_t bytes = 0;
+    ValueDict *row;
+    try {
+        while ((row = this->relation->next()) != nullptr) {
+            string key = normalized_key(row, this->sort_columns, this->descending);
+            bytes += row_size(row) + key.size();
+            entries->push_back(SortRun::Entry(key, row));
+            this->row_count++;
+            if (bytes > this->budget) {
+                this->runs.push_back(spill_run(entries));
+                entries = new SortRun::Entries();
+                bytes = 0;
+            }
+        }
+    } catch (...) {
+        for (auto const &entry: *entries)
+            delete entry.second;
+        delete entries;
+        throw;
+    }
+    stable_sort(entries->begin(), entries->end(), entry_less);
+    this->runs.push_back(new SortRun(entries));
+
+    // each run being merged holds a block in memory, so limit the fan-in accordingly
+    size_t fan_in = max((size_t) 2, this->budget / DbBlock::BLOCK_SZ);
+    while (this->runs.size() > fan_in) {
+        vector<SortRun *> merged;
+        for (size_t i = 0; i < this->runs.size(); i += fan_in) {
+            vector<SortRun *> group(this->runs.begin() + i,
+                                    this->runs.begin() + min(i + fan_in, this->runs.size()));
+            merged.push_back(group.size() == 1 ? group[0] : merge_runs(group));
+        }
+        this->runs = merged;
+    }
+}
+
+SortRun *ExternalSort::spill_run(SortRun::Entries *entries) {
+    stable_sort(entries->begin(), entries->end(), entry_less);
+    ColumnNames names = {SortRun::KEY_COLUMN};
+    ColumnAttributes attributes = {ColumnAttribute(ColumnAttribute::TEXT)};
+    names.insert(names.end(), this->column_names.begin(), this->column_names.end());
+    attributes.insert(attributes.end(), this->column_attributes.begin(), this->column_attributes.end());
+    SpillFile *spill = new SpillFile(names, attributes);
+    for (auto &entry: *entries) {
+        (*entry.second)[SortRun::KEY_COLUMN] = Value(entry.first);
+        spill->append_row(entry.second);
+        delete entry.second;
+        entry.second = nullptr;
+    }
+    delete entries;
+    return new SortRun(spill);
+}
+
+// Intermediate merge pass: combine the inputs (which are deleted) into one spilled run.
+SortRun *ExternalSort::merge_runs(vector<SortRun *> &inputs) {
+    ColumnNames names = {SortRun::KEY_COLUMN};
+    ColumnAttributes attributes = {ColumnAttribute(ColumnAttribute::TEXT)};
+    names.insert(names.end(), this->column_names.begin(), this->column_names.end());
+    attributes.insert(attributes.end(), this->column_attributes.begin(), this->column_attributes.end());
+    SpillFile *spill = new SpillFile(names, attributes);
+
+    vector<bool> done(inputs.size(), false);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        inputs[i]->rewind();
+        done[i] = !inputs[i]->advance();
+    }
+    LoserTree merge(inputs, done);
+    while (!done[merge.winner()]) {
+        size_t w = merge.winner();
+        string key = inputs[w]->key();
+        ValueDict *row = inputs[w]->take_row();
+        (*row)[SortRun::KEY_COLUMN] = Value(key);
+        spill->append_row(row);
+        delete row;
+        done[w] = !inputs[w]->advance();
+        merge.replay();
+    }
+    for (SortRun *run: inputs)
+        delete run;
+    return new SortRun(spill);
+}
+
+ValueDict *ExternalSort::next() {
+    if (this->tree == nullptr || this->runs.empty())
+        return nullptr;
+    size_t w = this->tree->winner();
+    if (this->exhausted[w])
+        return nullptr;
+    ValueDict *row = this->runs[w]->take_row();
+    this->exhausted[w] = !this->runs[w]->advance();
+    this->tree->replay();
+    return row;
+}
+
+void ExternalSort::close() {
+    clear();
+    this->relation->close();
+}
+
+void ExternalSort::clear() {
+    delete this->tree;
+    this->tree = nullptr;
+    for (SortRun *run: this->runs)
+        delete run;
+    this->runs.clear();
+    this->exhausted.clear();
+    this->row_count = 0;
+}
+
+size_t ExternalSort::estimated_rows() const {
+    return this->row_count;
+}
+
+
+/*
+ * ******************
+ * TopN
+ * ******************
+ */
+static bool top_n_less(const pair<pair<string, size_t>, ValueDict *> &a,
+                       const pair<pair<string, size_t>, ValueDict *> &b) {
+    return a.first < b.first;
+}
+
+TopN::TopN(EvalPlan *relation, ColumnNames sort_columns, vector<bool> descending, size_t n)
+        : relation(relation), sort_columns(sort_columns), descending(descending), n(n), heap(), position(0) {
+    this->column_names = relation->get_column_names();
+    this->column_attributes = relation->get_column_attributes();
+    this->descending.resize(sort_columns.size(), false);
+}
+
+TopN::~TopN() {
+    clear();
+    delete this->relation;
+}
+
+// Keep the n smallest in a max-heap, then sort them for output.
+void TopN::open() {
+    clear();
+    this->relation->open();
+    ValueDict *row;
+    size_t sequence = 0;
+    while ((row = this->relation->next()) != nullptr) {
+        Entry entry(make_pair(ExternalSort::normalized_key(row, this->sort_columns, this->descending), sequence++),
+                    row);
+        if (this->heap.size() < this->n) {
+            this->heap.push_back(entry);
+            push_heap(this->heap.begin(), this->heap.end(), top_n_less);
+        } else if (this->n > 0 && top_n_less(entry, this->heap.front())) {
+            pop_heap(this->heap.begin(), this->heap.end(), top_n_less);
+            delete this->heap.back().second;
+            this->heap.back() = entry;
+            push_heap(this->heap.begin(), this->heap.end(), top_n_less);
+        } else {
+            delete row;
+        }
+    }
+    sort_heap(this->heap.begin(), this->heap.end(), top_n_less);
+}
+
+ValueDict *TopN::next() {
+    if (this->position >= this->heap.size())
+        return nullptr;
+    ValueDict *row = this->heap[this->position].second;
+    this->heap[this->position++].second = nullptr;
+    return row;
+}
+
+void TopN::close() {
+    clear();
+    this->relation->close();
+}
+
+void TopN::clear() {
+    for (auto const &entry: this->heap)
+        delete entry.second;
+    this->heap.clear();
+    this->position = 0;
+}
+
+size_t TopN::estimated_rows() const {
+    return this->heap.size();
+}
+
+// Sort (t, seq) rows by the given columns, with everything in memory and again with a budget of a
+// few rows, so that there are many runs, merged two at a time in several passes. Both must give
+// the rows in the order a stable sort of the input gives them.
+static bool test_sort(const vector<pair<string, int32_t>> &rows, const ColumnNames &sort_columns,
+                      const vector<bool> &descending,
+                      const function<bool(const pair<string, int32_t> &, const pair<string, int32_t> &)> &less) {
+    vector<pair<string, int32_t>> expected = rows;
+    stable_sort(expected.begin(), expected.end(), less);
+    ColumnNames column_names = {"t", "seq"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::INT)};
+    bool same = true;
+    for (size_t budget: {EvalPlan::memory_budget, (size_t) 1024}) {
+        SpillFile *spill = new SpillFile(column_names, column_attributes);
+        for (auto const &entry: rows) {
+            ValueDict row;
+            row["t"] = Value(entry.first);
+            row["seq"] = Value(entry.second);
+            spill->append_row(&row);
+        }
+        ExternalSort sort(new SpillScan(spill, column_names, column_attributes), sort_columns, descending, budget);
+        vector<pair<string, int32_t>> sorted;
+        sort.open();
+        ValueDict *row;
+        while ((row = sort.next()) != nullptr) {
+            sorted.push_back(make_pair(row->at("t").s, row->at("seq").n));
+            delete row;
+        }
+        sort.close();
+        same = same && sorted == expected;
+    }
+    return same;
+}
+
+bool test_external_sort() {
+    // ties keep their input order, across runs and merge passes
+    vector<pair<string, int32_t>> rows;
+    for (int32_t i = 0; i < 300; i++)
+        rows.push_back(make_pair(string(1, (char) ('a' + i % 3)), i));
+    bool ties = test_sort(rows, ColumnNames{"t"}, vector<bool>{false},
+                          [](const pair<string, int32_t> &a, const pair<string, int32_t> &b) {
+                              return a.first < b.first;
+                          });
+    std::cout << "ties ok" << std::endl;
+
+    // TEXT descending, with zero and 0xFF bytes and prefixes of each other, then seq ascending
+    vector<string> texts = {"a", string("a\0", 2), string("a\0b", 3), "ab", "", "\xFF", string("\0", 1),
+                            string("b\0\0", 3), "b", string("\xFF\0", 2)};
+    rows.clear();
+    for (int32_t i = 0; i < 300; i++)
+        rows.push_back(make_pair(texts[i * 7 % texts.size()], i % 5));
+    bool bytes = test_sort(rows, ColumnNames{"t", "seq"}, vector<bool>{true, false},
+                           [](const pair<string, int32_t> &a, const pair<string, int32_t> &b) {
+                               return a.first != b.first ? b.first < a.first : a.second < b.second;
+                           });
+    std::cout << "descending text ok" << std::endl;
+    return ties && bytes;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file ExternalSort.h - ORDER BY operator with bounded memory
+ * SortRun
+ * LoserTree
+ * ExternalSort: EvalPlan
+ * TopN: EvalPlan
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include "EvalPlan.h"
+#include "SpillFile.h"
+
+/**
+ * @class SortRun - a sorted sequence of (normalized key, row) pairs, either held in memory or
+ * spilled to a SpillFile (where the key is stored as an extra leading column).
+ */
+class SortRun {
+public:
+    typedef std::pair<std::string, ValueDict *> Entry;
+    typedef std::vector<Entry> Entries;
+
+    /**
+     * Name of the key column in a spilled run.
+     */
+    static const Identifier KEY_COLUMN;
+
+    SortRun(Entries *entries);
+
+    SortRun(SpillFile *spill);
+
+    virtual ~SortRun();
+
+    SortRun(const SortRun &other) = delete;
+
+    SortRun &operator=(const SortRun &other) = delete;
+
+    /**
+     * Position before the first entry.
+     */
+    virtual void rewind();
+
+    /**
+     * Advance to the next entry.
+     * @returns  false if the run is exhausted
+     */
+    virtual bool advance();
+
+    /**
+     * Key of the current entry.
+     */
+    virtual const std::string &key() const { return current.first; }
+
+    /**
+     * Take the current row (freed by caller).
+     */
+    virtual ValueDict *take_row();
+
+protected:
+    Entries *entries;
+    size_t position;
+    SpillFile *spill;
+    Entry current;
+};
+
+
+/**
+ * @class LoserTree - tournament tree for a k-way merge.
+ *
+ * Internal node i (1 <= i < k) holds the loser of the match played there; node 0 holds the
+ * overall winner. Leaves are conceptually at k..2k-1. After the winning run advances, only the
+ * log2(k) matches on its path to the root are replayed.
+ */
+class LoserTree {
+public:
+    LoserTree(std::vector<SortRun *> &runs, std::vector<bool> &exhausted);
+
+    /**
+     * @returns  index of the run holding the smallest current key (exhausted runs never win)
+     */
+    size_t winner() const { return tree[0]; }
+
+    /**
+     * Replay the matches after the winner has advanced.
+     */
+    void replay();
+
+protected:
+    std::vector<SortRun *> &runs;
+    std::vector<bool> &exhausted;
+    std::vector<size_t> tree;
+
+    size_t build(size_t node);
+
+    bool beats(size_t a, size_t b) const;
+};
+
+
+/**
+ * @class ExternalSort - sort the input by the given columns, using at most memory_budget bytes for rows.
+ *
+ * Run generation: rows are buffered with a memcmp-comparable normalized key until the budget is
+ * reached, then sorted and written out as a SpillFile run. If everything fits, no file is written.
+ * Merge: runs are combined with a loser tree; if there are more runs than fit in the budget
+ * (one block each), intermediate merge passes reduce them first.
+ */
+class ExternalSort : public EvalPlan {
+public:
+    ExternalSort(EvalPlan *relation, ColumnNames sort_columns, std::vector<bool> descending,
+                 size_t memory_budget = EvalPlan::memory_budget);
+
+    virtual ~ExternalSort();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    virtual size_t estimated_rows() const;
+
+    /**
+     * Encode the sort columns of a row so that byte-wise comparison (memcmp) gives the sort order.
+     * INT/BOOLEAN: 4 bytes big-endian with the sign bit flipped.
+     * TEXT: bytes with 0x00 escaped as 0x00 0xFF, terminated by 0x00 0x00.
+     * Descending columns have all their bytes inverted.
+     * @param row           row to encode
+     * @param sort_columns  columns to encode, most significant first
+     * @param descending    per column, whether it sorts descending
+     * @returns             the normalized key
+     */
+    static std::string normalized_key(const ValueDict *row, const ColumnNames &sort_columns,
+                                      const std::vector<bool> &descending);
+
+protected:
+    EvalPlan *relation;
+    ColumnNames sort_columns;
+    std::vector<bool> descending;
+    size_t budget;
+    size_t row_count;
+    std::vector<SortRun *> runs;
+    std::vector<bool> exhausted;
+    LoserTree *tree;
+
+    virtual void generate_runs();
+
+    virtual SortRun *spill_run(SortRun::Entries *entries);
+
+    virtual SortRun *merge_runs(std::vector<SortRun *> &inputs);
+
+    virtual void clear();
+};
+
+
+/**
+ * @class TopN - ORDER BY ... LIMIT n: keep only the n smallest rows (by normalized key) in a bounded
+ * max-heap while reading the input, instead of sorting all of it. Memory is O(n) regardless of input size.
+ */
+class TopN : public EvalPlan {
+public:
+    TopN(EvalPlan *relation, ColumnNames sort_columns, std::vector<bool> descending, size_t n);
+
+    virtual ~TopN();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    virtual size_t estimated_rows() const;
+
+protected:
+    // (normalized key, arrival sequence) orders rows; the sequence keeps ties stable
+    typedef std::pair<std::pair<std::string, size_t>, ValueDict *> Entry;
+
+    EvalPlan *relation;
+    ColumnNames sort_columns;
+    std::vector<bool> descending;
+    size_t n;
+    std::vector<Entry> heap;
+    size_t position;
+
+    virtual void clear();
+};
+
+bool test_external_sort();
@@ -0,0 +1,586 @@
+/**
+ * @file HashAggregate.cpp - implementation of HashAggregate and AggregateTable
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include "HashAggregate.h"
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "HashJoin.h"
+
+using namespace std;
+
+/*
+ * ******************
+ * AggregateTable
+ * ******************
+ */
+AggregateTable::AggregateTable(const ColumnNames &group_columns, const Aggregates &aggregates)
+        : group_columns(group_columns), aggregates(aggregates), slots(), groups(), byte_count(0) {}
+
+void AggregateTable::add_row(const ValueDict *row, size_t hash) {
+    vector<Value> key;
+    for (auto const &column_name: this->group_columns)
+        key.push_back(row->at(column_name));
+    Group &group = find_or_add(hash, key);
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        State &state = group.states[i];
+        if (this->aggregates[i].column.empty()) {
+            state.count++;
+            continue;
+        }
+        const Value &value = row->at(this->aggregates[i].column);
+        if (state.count++ == 0) {
+            state.min = value;
+            state.max = value;
+        } else if (value < state.min) {
+            state.min = value;
+        } else if (state.max < value) {
+            state.max = value;
+        }
+        state.sum += value.n;
+    }
+}
+
+void AggregateTable::merge_group(const Group &other) {
+    Group &group = find_or_add(other.hash, other.key);
+    for (size_t i = 0; i < other.states.size(); i++) {
+        State &state = group.states[i];
+        const State &partial = other.states[i];
+        if (partial.count == 0)
+            continue;
+        if (state.count == 0) {
+            state = partial;
+            continue;
+        }
+        state.count += partial.count;
+        state.sum += partial.sum;
+        if (partial.min < state.min)
+            state.min = partial.min;
+        if (state.max < partial.max)
+            state.max = partial.max;
+    }
+}
+
+AggregateTable::Group &AggregateTable::find_or_add(size_t hash, const vector<Value> &key) {
+    if (this->slots.empty())
+        this->slots.assign(1024, -1);
+    size_t mask = this->slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        int64_t slot = this->slots[i];
+        if (slot < 0) {
+            this->slots[i] = (int64_t) this->groups.size();
+            this->groups.push_back(Group{hash, key, vector<State>(this->aggregates.size(), State{0, 0, Value(), Value()})});
+            this->byte_count += sizeof(Group) + sizeof(int64_t) + this->aggregates.size() * sizeof(State);
+            for (auto const &value: key)
+                this->byte_count += sizeof(Value) + value.s.size();
+            if (this->groups.size() * 10 > this->slots.size() * 7)
+                grow();
+            return this->groups.back();
+        }
+        Group &group = this->groups[slot];
+        if (group.hash == hash && group.key == key)
+            return group;
+    }
+}
+
+// double the slot array and reinsert (groups themselves don't move)
+void AggregateTable::grow() {
+    this->byte_count += this->slots.size() * sizeof(int64_t);
+    this->slots.assign(this->slots.size() * 2, -1);
+    size_t mask = this->slots.size() - 1;
+    for (size_t g = 0; g < this->groups.size(); g++) {
+        size_t i = this->groups[g].hash & mask;
+        while (this->slots[i] >= 0)
+            i = (i + 1) & mask;
+        this->slots[i] = (int64_t) g;
+    }
+}
+
+void AggregateTable::clear() {
+    this->slots.clear();
+    this->groups.clear();
+    this->byte_count = 0;
+}
+
+
+/*
+ * ******************
+ * HashAggregate::Worker
+ * ******************
+ */
+class HashAggregate::Worker {
+public:
+    Worker(HashAggregate &aggregate) : aggregate(aggregate), table(aggregate.group_columns, aggregate.aggregates),
+                                       partitions(PARTITIONS, nullptr), spilled(false) {}
+
+    ~Worker() {
+        for (SpillFile *spill: this->partitions)
+            delete spill;
+    }
+
+    // fold a row into the local table, spilling if over this worker's share of the budget
+    void add_row(const ValueDict *row) {
+        this->table.add_row(row, hash_columns(row, this->aggregate.group_columns));
+        if (this->table.bytes() > EvalPlan::memory_budget / max(1U, HashAggregate::workers))
+            spill();
+    }
+
+    // write out all partial groups, partitioned by hash
+    void spill() {
+        for (auto const &group: this->table.get_groups())
+            this->aggregate.spill_group(group, this->partitions, 0);
+        this->table.clear();
+        this->spilled = true;
+    }
+
+    HashAggregate &aggregate;
+    AggregateTable table;
+    vector<SpillFile *> partitions;
+    bool spilled;
+};
+
+
+/*
+ * ******************
+ * HashAggregate
+ * ******************
+ */
+// The 64-bit counts and sums of a partial group are spilled as a pair of INT columns.
+static void put_int64(ValueDict &row, const Identifier &column_name, int64_t n) {
+    row[column_name + "_high"] = Value((int32_t) (n >> 32));
+    row[column_name + "_low"] = Value((int32_t) (uint32_t) n);
+}
+
+static int64_t get_int64(const ValueDict *row, const Identifier &column_name) {
+    uint64_t high = (uint32_t) row->at(column_name + "_high").n;
+    return (int64_t) (high << 32 | (uint32_t) row->at(column_name + "_low").n);
+}
+
+// COUNT and SUM come out as INTs; a total too big for one is an error rather than wrapping around.
+static Value int_result(int64_t n, const Aggregate &aggregate) {
+    if (n < INT32_MIN || n > INT32_MAX)
+        throw DbRelationError(aggregate.output_name + " is out of range for INT");
+    return Value((int32_t) n);
+}
+
+uint HashAggregate::workers = max(1U, min(4U, thread::hardware_concurrency()));
+
+HashAggregate::HashAggregate(EvalPlan *relation, ColumnNames group_columns, Aggregates aggregates)
+        : relation(relation), group_columns(group_columns), aggregates(aggregates), spill_names(),
+          spill_attributes(), worker_list(), result(nullptr), position(0), spilled(false), pending(),
+          group_count(0) {
+    const ColumnNames &input_names = relation->get_column_names();
+    const ColumnAttributes &input_attributes = relation->get_column_attributes();
+    auto attribute_of = [&](const Identifier &column_name) {
+        for (size_t i = 0; i < input_names.size(); i++)
+            if (input_names[i] == column_name)
+                return input_attributes[i];
+        throw DbRelationError("unknown column " + column_name);
+    };
+
+    for (auto const &column_name: group_columns) {
+        this->column_names.push_back(column_name);
+        this->column_attributes.push_back(attribute_of(column_name));
+    }
+    this->spill_names = this->column_names;
+    this->spill_attributes = this->column_attributes;
+
+    for (size_t i = 0; i < aggregates.size(); i++) {
+        const Aggregate &aggregate = aggregates[i];
+        ColumnAttribute attribute(ColumnAttribute::INT);
+        if (!aggregate.column.empty())
+            attribute = attribute_of(aggregate.column);
+        if ((aggregate.function == Aggregate::SUM || aggregate.function == Aggregate::AVG) &&
+            attribute.get_data_type() != ColumnAttribute::INT)
+            throw DbRelationError("SUM and AVG need an INT column");
+        if (aggregate.column.empty() && aggregate.function != Aggregate::COUNT)
+            throw DbRelationError("only COUNT can be applied to *");
+        this->column_names.push_back(aggregate.output_name);
+        bool keeps_type = aggregate.function == Aggregate::MIN || aggregate.function == Aggregate::MAX;
+        this->column_attributes.push_back(keeps_type ? attribute : ColumnAttribute(ColumnAttribute::INT));
+
+        string n = to_string(i);
+        for (auto const &column_name: {"_count" + n, "_sum" + n}) {
+            this->spill_names.push_back(column_name + "_high");
+            this->spill_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+            this->spill_names.push_back(column_name + "_low");
+            this->spill_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+        }
+        this->spill_names.push_back("_min" + n);
+        this->spill_attributes.push_back(attribute);
+        this->spill_names.push_back("_max" + n);
+        this->spill_attributes.push_back(attribute);
+    }
+}
+
+HashAggregate::~HashAggregate() {
+    clear();
+    delete this->relation;
+}
+
+void HashAggregate::open() {
+    clear();
+    this->relation->open();
+    aggregate_input();
+
+    for (Worker *worker: this->worker_list)
+        this->spilled = this->spilled || worker->spilled;
+    if (this->spilled) {
+        // everything goes through the partitions so that each group is merged in one place
+        for (Worker *worker: this->worker_list)
+            worker->spill();
+        for (uint i = 0; i < PARTITIONS; i++) {
+            Partition partition{{}, 0};
+            for (Worker *worker: this->worker_list) {
+                if (worker->partitions[i] != nullptr)
+                    partition.spills.push_back(worker->partitions[i]);
+                worker->partitions[i] = nullptr;
+            }
+            if (!partition.spills.empty())
+                this->pending.push_back(partition);
+        }
+        this->result = new AggregateTable(this->group_columns, this->aggregates);
+        load_partition();
+    } else {
+        this->result = new AggregateTable(this->group_columns, this->aggregates);
+        for (Worker *worker: this->worker_list) {
+            for (auto const &group: worker->table.get_groups())
+                this->result->merge_group(group);
+            worker->table.clear();
+        }
+        // aggregates without GROUP BY always produce one row, even over no input
+        if (this->group_columns.empty() && this->result->get_groups().empty())
+            this->result->merge_group(AggregateTable::Group{hash_columns(nullptr, this->group_columns), {},
+                                                            vector<AggregateTable::State>()});
+        this->group_count = this->result->get_groups().size();
+    }
+}
+
+// Read the input in batches and fold it into the workers' tables.
+void HashAggregate::aggregate_input() {
+    uint n = max(1U, HashAggregate::workers);
+    for (uint i = 0; i < n; i++)
+        this->worker_list.push_back(new Worker(*this));
+
+    ValueDict *row;
+    if (n == 1) {
+        while ((row = this->relation->next()) != nullptr) {
+            this->worker_list[0]->add_row(row);
+            delete row;
+        }
+        return;
+    }
+
+    typedef vector<ValueDict *> Batch;
+    deque<Batch *> queue;
+    mutex queue_mutex;
+    condition_variable not_empty, not_full;
+    bool done = false;
+    exception_ptr error = nullptr;
+
+    vector<thread> threads;
+    for (Worker *worker: this->worker_list)
+        threads.push_back(thread([&, worker]() {
+            while (true) {
+                Batch *batch;
+                {
+                    unique_lock<mutex> lock(queue_mutex);
+                    not_empty.wait(lock, [&]() { return !queue.empty() || done; });
+                    if (queue.empty())
+                        return;
+                    batch = queue.front();
+                    queue.pop_front();
+                }
+                not_full.notify_one();
+                try {
+                    for (ValueDict *batch_row: *batch)
+                        worker->add_row(batch_row);
+                } catch (...) {
+                    lock_guard<mutex> lock(queue_mutex);
+                    if (error == nullptr)
+                        error = current_exception();
+                    done = true;
+                    not_full.notify_all();
+                }
+                for (ValueDict *batch_row: *batch)
+                    delete batch_row;
+                delete batch;
+            }
+        }));
+
+    try {
+        bool more = true;
+        while (more) {
+            Batch *batch = new Batch();
+            while (batch->size() < BATCH_SIZE && (row = this->relation->next()) != nullptr)
+                batch->push_back(row);
+            more = batch->size() == BATCH_SIZE;
+            unique_lock<mutex> lock(queue_mutex);
+            not_full.wait(lock, [&]() { return queue.size() < 2 * n || done; });
+            if (done) {
+                for (ValueDict *batch_row: *batch)
+                    delete batch_row;
+                delete batch;
+                break;
+            }
+            queue.push_back(batch);
+            not_empty.notify_one();
+        }
+    } catch (...) {
+        lock_guard<mutex> lock(queue_mutex);
+        if (error == nullptr)
+            error = current_exception();
+    }
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        done = true;
+    }
+    not_empty.notify_all();
+    for (thread &t: threads)
+        t.join();
+    for (Batch *batch: queue) {
+        for (ValueDict *batch_row: *batch)
+            delete batch_row;
+        delete batch;
+    }
+    if (error != nullptr)
+        rethrow_exception(error);
+}
+
+// Merge the next non-empty partition's spill files into result. If its groups outgrow the memory
+// budget, the partition is split up by the next level's hash instead and its pieces merged in turn.
+bool HashAggregate::load_partition() {
+    while (!this->pending.empty()) {
+        this->result->clear();
+        this->position = 0;
+        uint depth = this->pending.back().depth;
+        vector<SpillFile *> split;
+        try {
+            vector<SpillFile *> &spills = this->pending.back().spills;
+            while (!spills.empty()) {
+                SpillFile *spill = spills.back();
+                spill->rewind();
+                ValueDict *row;
+                while ((row = spill->next()) != nullptr) {
+                    AggregateTable::Group group = spilled_group(row);
+                    delete row;
+                    if (!split.empty()) {
+                        spill_group(group, split, depth + 1);
+                        continue;
+                    }
+                    this->result->merge_group(group);
+                    if (this->result->bytes() > EvalPlan::memory_budget && depth < MAX_DEPTH) {
+                        split.assign(PARTITIONS, nullptr);
+                        for (auto const &merged: this->result->get_groups())
+                            spill_group(merged, split, depth + 1);
+                        this->result->clear();
+                    }
+                }
+                spills.pop_back();
+                delete spill;
+            }
+        } catch (...) {
+            for (SpillFile *spill: split)
+                delete spill;
+            throw;
+        }
+        this->pending.pop_back();
+        for (SpillFile *spill: split)
+            if (spill != nullptr)
+                this->pending.push_back(Partition{{spill}, depth + 1});
+        this->group_count += this->result->get_groups().size();
+        if (!this->result->get_groups().empty())
+            return true;
+    }
+    return false;
+}
+
+// Write a partial group to its partition at the given depth (each depth hashes differently).
+void HashAggregate::spill_group(const AggregateTable::Group &group, vector<SpillFile *> &partitions,
+                                uint depth) const {
+    ValueDict row;
+    for (size_t i = 0; i < group.key.size(); i++)
+        row[this->group_columns[i]] = group.key[i];
+    for (size_t i = 0; i < group.states.size(); i++) {
+        string n = to_string(i);
+        put_int64(row, "_count" + n, group.states[i].count);
+        put_int64(row, "_sum" + n, group.states[i].sum);
+        row["_min" + n] = group.states[i].min;
+        row["_max" + n] = group.states[i].max;
+    }
+    uint which = (uint) (hash_columns(&row, this->group_columns, depth + 1) % PARTITIONS);
+    if (partitions[which] == nullptr)
+        partitions[which] = new SpillFile(this->spill_names, this->spill_attributes);
+    partitions[which]->append_row(&row);
+}
+
+// Read back a partial group written by spill_group.
+AggregateTable::Group HashAggregate::spilled_group(const ValueDict *row) const {
+    AggregateTable::Group group;
+    group.hash = hash_columns(row, this->group_columns);
+    for (auto const &column_name: this->group_columns)
+        group.key.push_back(row->at(column_name));
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        string n = to_string(i);
+        group.states.push_back(AggregateTable::State{get_int64(row, "_count" + n), get_int64(row, "_sum" + n),
+                                                     row->at("_min" + n), row->at("_max" + n)});
+    }
+    return group;
+}
+
+ValueDict *HashAggregate::next() {
+    if (this->result == nullptr)
+        return nullptr;
+    while (this->position >= this->result->get_groups().size())
+        if (!this->spilled || !load_partition())
+            return nullptr;
+    return output_row(this->result->get_groups()[this->position++]);
+}
+
+ValueDict *HashAggregate::output_row(const AggregateTable::Group &group) const {
+    ValueDict *row = new ValueDict();
+    for (size_t i = 0; i < this->group_columns.size(); i++) {
+        Value value = group.key[i];
+        ColumnAttribute attribute = this->column_attributes[i];
+        value.data_type = attribute.get_data_type();  // spill files store BOOLEAN as INT
+        (*row)[this->group_columns[i]] = value;
+    }
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        AggregateTable::State state = i < group.states.size() ? group.states[i] : AggregateTable::State{0, 0, Value(), Value()};
+        Value value;
+        switch (this->aggregates[i].function) {
+            case Aggregate::COUNT:
+                value = int_result(state.count, this->aggregates[i]);
+                break;
+            case Aggregate::SUM:
+                value = int_result(state.sum, this->aggregates[i]);
+                break;
+            case Aggregate::MIN:
+                value = state.min;
+                break;
+            case Aggregate::MAX:
+                value = state.max;
+                break;
+            case Aggregate::AVG: {
+                // the mean of INTs always fits in one; round it, halves away from zero
+                int64_t average = state.count == 0 ? 0 : state.sum / state.count;
+                int64_t remainder = state.count == 0 ? 0 : state.sum % state.count;
+                if (2 * (remainder < 0 ? -remainder : remainder) >= state.count && remainder != 0)
+                    average += state.sum < 0 ? -1 : 1;
+                value = Value((int32_t) average);
+                break;
+            }
+        }
+        (*row)[this->aggregates[i].output_name] = value;
+    }
+    return row;
+}
+
+void HashAggregate::close() {
+    clear();
+    this->relation->close();
+}
+
+void HashAggregate::clear() {
+    for (Worker *worker: this->worker_list)
+        delete worker;
+    this->worker_list.clear();
+    delete this->result;
+    this->result = nullptr;
+    this->position = 0;
+    this->spilled = false;
+    for (auto const &partition: this->pending)
+        for (SpillFile *spill: partition.spills)
+            delete spill;
+    this->pending.clear();
+    this->group_count = 0;
+}
+
+size_t HashAggregate::estimated_rows() const {
+    return this->group_count;
+}
+
+// COUNT(*), SUM(v) and AVG(v) of (g, v) rows, grouped by g unless group is false, as g -> "count sum avg".
+static map<int32_t, string> test_aggregate(const vector<pair<int32_t, int32_t>> &rows, bool group) {
+    ColumnNames column_names = {"g", "v"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT)};
+    SpillFile *spill = new SpillFile(column_names, column_attributes);
+    for (auto const &entry: rows) {
+        ValueDict row;
+        row["g"] = Value(entry.first);
+        row["v"] = Value(entry.second);
+        spill->append_row(&row);
+    }
+    Aggregates aggregates = {Aggregate(Aggregate::COUNT, "", "count"), Aggregate(Aggregate::SUM, "v", "sum"),
+                             Aggregate(Aggregate::AVG, "v", "avg")};
+    HashAggregate aggregate(new SpillScan(spill, column_names, column_attributes),
+                            group ? ColumnNames{"g"} : ColumnNames{}, aggregates);
+    map<int32_t, string> results;
+    aggregate.open();
+    ValueDict *row;
+    while ((row = aggregate.next()) != nullptr) {
+        results[group ? row->at("g").n : 0] = to_string(row->at("count").n) + " " + to_string(row->at("sum").n) +
+                                              " " + to_string(row->at("avg").n);
+        delete row;
+    }
+    aggregate.close();
+    return results;
+}
+
+bool test_hash_aggregate() {
+    size_t budget = EvalPlan::memory_budget;
+    uint workers = HashAggregate::workers;
+    bool ok = true;
+    try {
+        // every budget and worker count, including spilling every row and splitting partitions
+        // all the way down to MAX_DEPTH, must give the same answers
+        for (size_t test_budget: {budget, (size_t) 4096, (size_t) 1}) {
+            for (uint test_workers: {1U, 4U}) {
+                EvalPlan::memory_budget = test_budget;
+                HashAggregate::workers = test_workers;
+
+                // no input: one row without GROUP BY, none with it
+                ok = ok && test_aggregate({}, false) == map<int32_t, string>{{0, "0 0 0"}};
+                ok = ok && test_aggregate({}, true).empty();
+
+                // AVG rounds halves away from zero; group 5's SUM is spilled while it needs more than 32 bits
+                vector<pair<int32_t, int32_t>> rows = {{1, 1}, {1, 2}, {2, -3}, {2, -4}, {3, 7}, {4, -7}};
+                rows.insert(rows.end(), 10, make_pair(5, 2000000000));
+                for (int32_t i = 0; i < 2000; i++)
+                    rows.push_back(make_pair(100 + i % 500, i));
+                rows.insert(rows.end(), 10, make_pair(5, -2000000000));
+                rows.push_back(make_pair(5, 5));
+                map<int32_t, string> results = test_aggregate(rows, true);
+                ok = ok && results.size() == 505 && results[1] == "2 3 2" && results[2] == "2 -7 -4" &&
+                     results[3] == "1 7 7" && results[4] == "1 -7 -7" && results[5] == "21 5 0" &&
+                     results[100] == "4 3000 750" && results[599] == "4 4996 1249";
+                rows.resize(6);
+                ok = ok && test_aggregate(rows, false) == map<int32_t, string>{{0, "6 -4 -1"}};
+
+                // a SUM too big for an INT is an error
+                bool overflow = false;
+                try {
+                    test_aggregate({{5, 2000000000}, {5, 2000000000}}, true);
+                } catch (DbRelationError &e) {
+                    overflow = true;
+                }
+                ok = ok && overflow;
+            }
+        }
+    } catch (...) {
+        EvalPlan::memory_budget = budget;
+        HashAggregate::workers = workers;
+        throw;
+    }
+    EvalPlan::memory_budget = budget;
+    HashAggregate::workers = workers;
+    std::cout << "aggregates ok" << std::endl;
+    return ok;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file HashAggregate.h - GROUP BY and aggregate functions
+ * Aggregate
+ * AggregateTable
+ * HashAggregate: EvalPlan
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include "EvalPlan.h"
+#include "SpillFile.h"
+
+/**
+ * @class Aggregate - one aggregate function in the select list, e.g. SUM(x) AS total
+ */
+class Aggregate {
+public:
+    enum Function {
+        COUNT, SUM, MIN, MAX, AVG
+    };
+
+    /**
+     * @param function     which aggregate
+     * @param column       input column (empty for COUNT(*))
+     * @param output_name  name of the result column
+     */
+    Aggregate(Function function, Identifier column, Identifier output_name) : function(function), column(column),
+                                                                              output_name(output_name) {}
+
+    Function function;
+    Identifier column;
+    Identifier output_name;
+};
+
+typedef std::vector<Aggregate> Aggregates;
+
+
+/**
+ * @class AggregateTable - open-addressing (linear probing) hash table of groups and their partial
+ * aggregate states. Partial states can be merged, so tables built independently (by different
+ * workers, or from different spill files) combine into the same final result.
+ */
+class AggregateTable {
+public:
+    /**
+     * Running state for one aggregate within one group (SQL has no NULLs here, so every row counts).
+     */
+    struct State {
+        int64_t count;
+        int64_t sum;
+        Value min;
+        Value max;
+    };
+
+    struct Group {
+        size_t hash;
+        std::vector<Value> key;
+        std::vector<State> states;
+    };
+
+    AggregateTable(const ColumnNames &group_columns, const Aggregates &aggregates);
+
+    /**
+     * Fold an input row into its group.
+     * @param row   input row
+     * @param hash  EvalPlan::hash_columns(row, group_columns)
+     */
+    void add_row(const ValueDict *row, size_t hash);
+
+    /**
+     * Merge a partial group (from another table or a spill file) into this one.
+     */
+    void merge_group(const Group &group);
+
+    /**
+     * Approximate memory used, for comparing against a budget.
+     */
+    size_t bytes() const { return byte_count; }
+
+    std::vector<Group> &get_groups() { return groups; }
+
+    void clear();
+
+protected:
+    const ColumnNames &group_columns;
+    const Aggregates &aggregates;
+    std::vector<int64_t> slots;  // index into groups, or -1 if empty
+    std::vector<Group> groups;
+    size_t byte_count;
+
+    Group &find_or_add(size_t hash, const std::vector<Value> &key);
+
+    void grow();
+};
+
+
+/**
+ * @class HashAggregate - hash aggregation with per-worker pre-aggregation and spilling
+ *
+ * The input is read in batches and handed to worker threads; each worker folds rows into its own
+ * AggregateTable (no locking on the hot path). If a worker's table exceeds its share of the memory
+ * budget, its partial groups are written to per-worker, hash-partitioned SpillFiles and the table
+ * is cleared. Afterwards the workers' tables are merged; if anything spilled, each partition is
+ * merged separately from all workers' spill files, so only one partition needs to fit in memory;
+ * a partition that still doesn't fit is split again with a different hash, up to MAX_DEPTH times.
+ * Output: the group columns followed by one column per aggregate. COUNT and SUM are INTs, and
+ * raise an error if the total doesn't fit in one. AVG is rounded to the nearest INT (halves away
+ * from zero).
+ */
+class HashAggregate : public EvalPlan {
+public:
+    static const uint PARTITIONS = 16;
+    static const uint MAX_DEPTH = 3;
+    static const size_t BATCH_SIZE = 1024;
+
+    /**
+     * Number of worker threads (1 means aggregate on the calling thread).
+     */
+    static uint workers;
+
+    HashAggregate(EvalPlan *relation, ColumnNames group_columns, Aggregates aggregates);
+
+    virtual ~HashAggregate();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    virtual size_t estimated_rows() const;
+
+protected:
+    class Worker;
+
+    /**
+     * Spill files which together hold every partial group of one hash partition.
+     */
+    struct Partition {
+        std::vector<SpillFile *> spills;
+        uint depth;
+    };
+
+    EvalPlan *relation;
+    ColumnNames group_columns;
+    Aggregates aggregates;
+    ColumnNames spill_names;
+    ColumnAttributes spill_attributes;
+    std::vector<Worker *> worker_list;
+    AggregateTable *result;
+    size_t position;
+    bool spilled;
+    std::vector<Partition> pending;
+    size_t group_count;
+
+    virtual void aggregate_input();
+
+    virtual bool load_partition();
+
+    virtual void spill_group(const AggregateTable::Group &group, std::vector<SpillFile *> &partitions, uint depth) const;
+
+    virtual AggregateTable::Group spilled_group(const ValueDict *row) const;
+
+    virtual ValueDict *output_row(const AggregateTable::Group &group) const;
+
+    virtual void clear();
+
+    friend class Worker;
+};
+
+bool test_hash_aggregate();
@@ -0,0 +1,266 @@
+/**
+ * @file HashJoin.cpp - implementation of HashJoin and SpillScan
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include "HashJoin.h"
+#include <iostream>
+#include <set>
+
+using namespace std;
+
+/*
+ * ******************
+ * SpillScan
+ * ******************
+ */
+SpillScan::SpillScan(SpillFile *spill, const ColumnNames &column_names, const ColumnAttributes &column_attributes)
+        : spill(spill) {
+    this->column_names = column_names;
+    this->column_attributes = column_attributes;
+}
+
+SpillScan::~SpillScan() {
+    delete this->spill;
+}
+
+void SpillScan::open() {
+    this->spill->rewind();
+}
+
+ValueDict *SpillScan::next() {
+    return this->spill->next();
+}
+
+size_t SpillScan::estimated_rows() const {
+    return this->spill->size();
+}
+
+
+/*
+ * ******************
+ * HashJoin
+ * ******************
+ */
+HashJoin::HashJoin(EvalPlan *left, EvalPlan *right, ColumnNames left_keys, ColumnNames right_keys, uint depth)
+        : left(left), right(right), left_keys(left_keys), right_keys(right_keys), depth(depth), build(nullptr),
+          probe(nullptr), build_keys(nullptr), probe_keys(nullptr), table(), table_bytes(0), probe_row(nullptr),
+          matches(), spilled(false), left_partitions(), right_partitions(), partition(0), partition_join(nullptr) {
+    if (left_keys.size() != right_keys.size() || left_keys.empty())
+        throw DbRelationError("join needs the same number of key columns on each side");
+    this->column_names = left->get_column_names();
+    this->column_attributes = left->get_column_attributes();
+    for (auto const &column_name: right->get_column_names())
+        this->column_names.push_back(column_name);
+    for (auto const &column_attribute: right->get_column_attributes())
+        this->column_attributes.push_back(column_attribute);
+}
+
+HashJoin::~HashJoin() {
+    clear();
+    delete this->left;
+    delete this->right;
+}
+
+void HashJoin::open() {
+    clear();
+    this->left->open();
+    this->right->open();
+    if (this->right->estimated_rows() < this->left->estimated_rows()) {
+        this->build = this->right;
+        this->build_keys = &this->right_keys;
+        this->probe = this->left;
+        this->probe_keys = &this->left_keys;
+    } else {
+        this->build = this->left;
+        this->build_keys = &this->left_keys;
+        this->probe = this->right;
+        this->probe_keys = &this->right_keys;
+    }
+    build_table();
+    if (this->spilled) {
+        ValueDict *row;
+        while ((row = this->probe->next()) != nullptr)
+            partition_row(this->probe, row);
+    }
+}
+
+// Load the build input; if it outgrows the memory budget, switch to partitioning.
+void HashJoin::build_table() {
+    ValueDict *row;
+    while ((row = this->build->next()) != nullptr) {
+        if (this->spilled) {
+            partition_row(this->build, row);
+            continue;
+        }
+        this->table.insert(HashTable::value_type(hash_columns(row, *this->build_keys, this->depth), row));
+        this->table_bytes += row_size(row);
+        if (this->table_bytes > EvalPlan::memory_budget && this->depth < MAX_DEPTH)
+            spill_table();
+    }
+}
+
+// Move everything in the hash table out to the build side's partitions.
+void HashJoin::spill_table() {
+    for (uint i = 0; i < PARTITIONS; i++) {
+        this->left_partitions.push_back(new SpillFile(this->left->get_column_names(),
+                                                      this->left->get_column_attributes()));
+        this->right_partitions.push_back(new SpillFile(this->right->get_column_names(),
+                                                       this->right->get_column_attributes()));
+    }
+    this->spilled = true;
+    for (auto const &entry: this->table)
+        partition_row(this->build, entry.second);
+    this->table.clear();
+    this->table_bytes = 0;
+}
+
+// Write the row to its partition and free it.
+void HashJoin::partition_row(EvalPlan *input, ValueDict *row) {
+    bool is_left = input == this->left;
+    const ColumnNames &keys = is_left ? this->left_keys : this->right_keys;
+    uint which = hash_columns(row, keys, this->depth + 1) % PARTITIONS;
+    (is_left ? this->left_partitions : this->right_partitions)[which]->append_row(row);
+    delete row;
+}
+
+ValueDict *HashJoin::next() {
+    return this->spilled ? next_partitioned() : next_in_memory();
+}
+
+ValueDict *HashJoin::next_in_memory() {
+    while (true) {
+        if (this->probe_row != nullptr) {
+            while (this->matches.first != this->matches.second) {
+                ValueDict *build_row = (this->matches.first++)->second;
+                if (!keys_equal(this->probe_row, build_row))
+                    continue;
+                ValueDict *row = new ValueDict(*this->probe_row);
+                row->insert(build_row->begin(), build_row->end());
+                return row;
+            }
+            delete this->probe_row;
+        }
+        this->probe_row = this->probe->next();
+        if (this->probe_row == nullptr)
+            return nullptr;
+        this->matches = this->table.equal_range(hash_columns(this->probe_row, *this->probe_keys, this->depth));
+    }
+}
+
+// Join each pair of partitions in turn with a nested HashJoin.
+ValueDict *HashJoin::next_partitioned() {
+    while (this->partition < PARTITIONS) {
+        if (this->partition_join == nullptr) {
+            uint i = this->partition;
+            this->partition_join = new HashJoin(
+                    new SpillScan(this->left_partitions[i], this->left->get_column_names(),
+                                  this->left->get_column_attributes()),
+                    new SpillScan(this->right_partitions[i], this->right->get_column_names(),
+                                  this->right->get_column_attributes()),
+                    this->left_keys, this->right_keys, this->depth + 1);
+            this->left_partitions[i] = nullptr;  // now owned by partition_join
+            this->right_partitions[i] = nullptr;
+            this->partition_join->open();
+        }
+        ValueDict *row = this->partition_join->next();
+        if (row != nullptr)
+            return row;
+        this->partition_join->close();
+        delete this->partition_join;
+        this->partition_join = nullptr;
+        this->partition++;
+    }
+    return nullptr;
+}
+
+bool HashJoin::keys_equal(const ValueDict *probe_row, const ValueDict *build_row) const {
+    for (size_t i = 0; i < this->probe_keys->size(); i++)
+        if (probe_row->at((*this->probe_keys)[i]) != build_row->at((*this->build_keys)[i]))
+            return false;
+    return true;
+}
+
+void HashJoin::close() {
+    clear();
+    this->left->close();
+    this->right->close();
+}
+
+void HashJoin::clear() {
+    for (auto const &entry: this->table)
+        delete entry.second;
+    this->table.clear();
+    this->table_bytes = 0;
+    delete this->probe_row;
+    this->probe_row = nullptr;
+    delete this->partition_join;
+    this->partition_join = nullptr;
+    for (auto const &spill: this->left_partitions)
+        delete spill;
+    for (auto const &spill: this->right_partitions)
+        delete spill;
+    this->left_partitions.clear();
+    this->right_partitions.clear();
+    this->spilled = false;
+    this->partition = 0;
+}
+
+size_t HashJoin::estimated_rows() const {
+    return max(this->left->estimated_rows(), this->right->estimated_rows());
+}
+
+// a SpillScan of (k, v) rows, as columns <prefix>.k and <prefix>.v
+static EvalPlan *join_input(const string &prefix, const vector<pair<int32_t, string>> &rows) {
+    ColumnNames column_names = {prefix + ".k", prefix + ".v"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT)};
+    SpillFile *spill = new SpillFile(column_names, column_attributes);
+    for (auto const &entry: rows) {
+        ValueDict row;
+        row[prefix + ".k"] = Value(entry.first);
+        row[prefix + ".v"] = Value(entry.second);
+        spill->append_row(&row);
+    }
+    return new SpillScan(spill, column_names, column_attributes);
+}
+
+// Join on k in memory, and again with a budget too small for one row, so that the join partitions
+// at every level down to MAX_DEPTH; both must give what a nested-loop join gives.
+static bool test_join(const vector<pair<int32_t, string>> &left, const vector<pair<int32_t, string>> &right) {
+    multiset<string> expected;
+    for (auto const &l: left)
+        for (auto const &r: right)
+            if (l.first == r.first)
+                expected.insert(to_string(l.first) + ":" + l.second + ":" + r.second);
+    size_t memory_budget = EvalPlan::memory_budget;
+    bool same = true;
+    for (size_t budget: {memory_budget, (size_t) 1}) {
+        multiset<string> joined;
+        EvalPlan::memory_budget = budget;
+        try {
+            HashJoin join(join_input("l", left), join_input("r", right), ColumnNames{"l.k"}, ColumnNames{"r.k"});
+            join.open();
+            ValueDict *row;
+            while ((row = join.next()) != nullptr) {
+                joined.insert(to_string(row->at("l.k").n) + ":" + row->at("l.v").s + ":" + row->at("r.v").s);
+                delete row;
+            }
+            join.close();
+        } catch (...) {
+            EvalPlan::memory_budget = memory_budget;
+            throw;
+        }
+        EvalPlan::memory_budget = memory_budget;
+        same = same && joined == expected;
+    }
+    return same;
+}
+
+bool test_hash_join() {
+    // every pair of rows with the same key, however many each side has
+    bool duplicates = test_join({{1, "a"}, {1, "b"}, {2, "c"}, {3, "d"}},
+                                {{1, "x"}, {1, "y"}, {1, "z"}, {2, "w"}, {4, "v"}});
+    std::cout << "duplicate keys ok" << std::endl;
+    bool unmatched = test_join({{1, "a"}, {2, "b"}}, {{3, "c"}, {4, "d"}}) && test_join({{1, "a"}}, {});
+    std::cout << "no matches ok" << std::endl;
+    return duplicates && unmatched;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file HashJoin.h - equi-join operator
+ * SpillScan: EvalPlan
+ * HashJoin: EvalPlan
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <unordered_map>
+#include "EvalPlan.h"
+#include "SpillFile.h"
+
+/**
+ * @class SpillScan - read back the rows of a SpillFile (which it owns)
+ */
+class SpillScan : public EvalPlan {
+public:
+    SpillScan(SpillFile *spill, const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual ~SpillScan();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close() {}
+
+    virtual size_t estimated_rows() const;
+
+protected:
+    SpillFile *spill;
+};
+
+
+/**
+ * @class HashJoin - inner equi-join of two inputs
+ *
+ * Build phase: the input with the smaller row estimate is loaded into a hash table on its join keys.
+ * Probe phase: each row of the other input looks up its matches.
+ * If the hash table grows past EvalPlan::memory_budget, the join switches to a grace hash join:
+ * both inputs are hash-partitioned into SpillFiles, and each pair of partitions is then joined
+ * by a nested HashJoin (which may partition again, with a different hash, up to MAX_DEPTH levels).
+ * Output rows carry the columns of both inputs, left then right.
+ */
+class HashJoin : public EvalPlan {
+public:
+    static const uint PARTITIONS = 16;
+    static const uint MAX_DEPTH = 3;
+
+    HashJoin(EvalPlan *left, EvalPlan *right, ColumnNames left_keys, ColumnNames right_keys, uint depth = 0);
+
+    virtual ~HashJoin();
+
+    virtual void open();
+
+    virtual ValueDict *next();
+
+    virtual void close();
+
+    virtual size_t estimated_rows() const;
+
+protected:
+    typedef std::unordered_multimap<size_t, ValueDict *> HashTable;
+
+    EvalPlan *left;
+    EvalPlan *right;
+    ColumnNames left_keys;
+    ColumnNames right_keys;
+    uint depth;
+
+    // roles chosen in open()
+    EvalPlan *build;
+    EvalPlan *probe;
+    const ColumnNames *build_keys;
+    const ColumnNames *probe_keys;
+
+    // in-memory join
+    HashTable table;
+    size_t table_bytes;
+    ValueDict *probe_row;
+    std::pair<HashTable::iterator, HashTable::iterator> matches;
+
+    // grace join
+    bool spilled;
+    std::vector<SpillFile *> left_partitions;
+    std::vector<SpillFile *> right_partitions;
+    uint partition;
+    HashJoin *partition_join;
+
+    virtual void build_table();
+
+    virtual void spill_table();
+
+    virtual void partition_row(EvalPlan *input, ValueDict *row);
+
+    virtual ValueDict *next_in_memory();
+
+    virtual ValueDict *next_partitioned();
+
+    virtual bool keys_equal(const ValueDict *probe_row, const ValueDict *build_row) const;
+
+    virtual void clear();
+};
+
+bool test_hash_join();
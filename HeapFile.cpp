@@ -5,7 +5,10 @@
  */
 #include <cstring>
 #include "db_cxx.h"
+#include "Arena.h"
 #include "HeapFile.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 using namespace std;
 typedef uint16_t u16;
@@ -47,10 +50,24 @@ void HeapFile::open(void) {
  * Close the physical file.
  */
 void HeapFile::close(void) {
+    lock_guard<mutex> lock(this->latch);
     this->db.close(0);
     this->closed = true;
 }
 
+/**
+ * Write the changed blocks out to disk.
+ */
+void HeapFile::sync(void) {
+    lock_guard<mutex> lock(this->latch);
+    if (this->closed)
+        return;
+    Trace::Span span("HeapFile::sync", "io");
+    Metrics::Stopwatch stopwatch(Metrics::SYNC);
+    Metrics::count(Metrics::SYNCS);
+    this->db.sync(0);
+}
+
 /**
  * Allocate a new block for the database file.
  * @return the new empty DbBlock that is managing the records in this block and its block id.
@@ -59,16 +76,9 @@ SlottedPage *HeapFile::get_new(void) {
     char block[DbBlock::BLOCK_SZ];
     memset(block, 0, sizeof(block));
     Dbt data(block, sizeof(block));
-
-    int block_id = ++this->last;
-    Dbt key(&block_id, sizeof(block_id));
-
-    // write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage *page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data, 0); // write it out with initialization done to it
+    SlottedPage *page = new SlottedPage(data, 0, true);  // initialize it
     delete page;
-    this->db.get(nullptr, &key, &data, 0);
-    return new SlottedPage(data, this->last);
+    return get(append(&data));
 }
 
 /**
@@ -79,7 +89,19 @@ SlottedPage *HeapFile::get_new(void) {
 SlottedPage *HeapFile::get(BlockID block_id) {
     Dbt key(&block_id, sizeof(block_id));
     Dbt data;
-    this->db.get(nullptr, &key, &data, 0);
+    // a copy of its own, which the page gives back, so threads can share the handle
+    data.set_data(Arena::allocate(DbBlock::BLOCK_SZ));
+    data.set_ulen(DbBlock::BLOCK_SZ);
+    data.set_flags(DB_DBT_USERMEM);
+    try {
+        Trace::Span span("HeapFile::get", "io");
+        Metrics::Stopwatch stopwatch(Metrics::PAGE_GET);
+        this->db.get(nullptr, &key, &data, 0);
+    } catch (...) {
+        Arena::release(data.get_data());
+        throw;
+    }
+    Metrics::count(Metrics::PAGE_GETS);
     return new SlottedPage(data, block_id, false);
 }
 
@@ -90,16 +112,35 @@ SlottedPage *HeapFile::get(BlockID block_id) {
 void HeapFile::put(DbBlock *block) {
     int block_id = block->get_block_id();
     Dbt key(&block_id, sizeof(block_id));
+    Trace::Span span("HeapFile::put", "io");
+    Metrics::Stopwatch stopwatch(Metrics::PAGE_PUT);
+    Metrics::count(Metrics::PAGE_PUTS);
     this->db.put(nullptr, &key, block->get_block(), 0);
 }
 
+/**
+ * Add a block that was filled in memory to the end of the file.
+ * @param data  the block's BLOCK_SZ bytes
+ * @return      the new block's id
+ */
+BlockID HeapFile::append(Dbt *data) {
+    lock_guard<mutex> lock(this->latch);
+    BlockID block_id = this->last.load() + 1;
+    Dbt key(&block_id, sizeof(block_id));
+    this->db.put(nullptr, &key, data, 0);
+    this->last.store(block_id, memory_order_release);  // only now can readers see it
+    Metrics::count(Metrics::BLOCKS_ALLOCATED);
+    return block_id;
+}
+
 /**
  * Sequence of all block ids.
  * @return block ids
  */
 BlockIDs *HeapFile::block_ids() const {
     BlockIDs *vec = new BlockIDs();
-    for (BlockID block_id = 1; block_id <= this->last; block_id++)
+    BlockID last = this->last.load(memory_order_acquire);
+    for (BlockID block_id = 1; block_id <= last; block_id++)
         vec->push_back(block_id);
     return vec;
 }
@@ -123,8 +164,11 @@ uint32_t HeapFile::get_block_count() {
 void HeapFile::db_open(uint flags) {
     if (!this->closed)
         return;
+    lock_guard<mutex> lock(this->latch);
+    if (!this->closed)
+        return;  // another thread opened it while we waited
     this->db.set_re_len(DbBlock::BLOCK_SZ); // record length - will be ignored if file already exists
-    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0644);
+    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags | DB_THREAD, 0644);
 
     this->last = flags ? 0 : get_block_count();
     this->closed = false;
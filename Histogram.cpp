@@ -0,0 +1,116 @@
+/**
+ * @file Histogram.cpp - implementation of ColumnHistogram
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include "Histogram.h"
+
+using namespace std;
+
+const size_t ColumnHistogram::MAX_MCV;
+const size_t ColumnHistogram::MAX_BUCKETS;
+
+// A value is "common" if it shows up more than once in the sample and more often than the average value.
+ColumnHistogram ColumnHistogram::build(vector<Value> &sample) {
+    ColumnHistogram histogram;
+    if (sample.empty())
+        return histogram;
+    sort(sample.begin(), sample.end());
+
+    vector<pair<size_t, size_t>> runs;  // (count, index of first occurrence) of each distinct value
+    for (size_t i = 0; i < sample.size();) {
+        size_t j = i + 1;
+        while (j < sample.size() && sample[j] == sample[i])
+            j++;
+        runs.push_back(make_pair(j - i, i));
+        i = j;
+    }
+    double average = (double) sample.size() / runs.size();
+    vector<pair<size_t, size_t>> common;
+    for (auto const &run: runs)
+        if (run.first > 1 && run.first > average)
+            common.push_back(run);
+    sort(common.begin(), common.end(), [](const pair<size_t, size_t> &a, const pair<size_t, size_t> &b) {
+        return a.first > b.first;
+    });
+    if (common.size() > MAX_MCV)
+        common.resize(MAX_MCV);
+
+    vector<bool> in_mcv(sample.size(), false);
+    for (auto const &run: common) {
+        histogram.mcv.push_back(make_pair(sample[run.second], (double) run.first / sample.size()));
+        for (size_t i = run.second; i < run.second + run.first; i++)
+            in_mcv[i] = true;
+    }
+
+    // equi-depth: bounds at evenly spaced ranks of the remaining (sorted) values
+    vector<Value> rest;
+    for (size_t i = 0; i < sample.size(); i++)
+        if (!in_mcv[i])
+            rest.push_back(sample[i]);
+    if (!rest.empty()) {
+        size_t buckets = min(MAX_BUCKETS, rest.size());
+        for (size_t b = 0; b <= buckets; b++)
+            histogram.bounds.push_back(rest[min(rest.size() - 1, b * (rest.size() - 1) / buckets)]);
+    }
+    return histogram;
+}
+
+double ColumnHistogram::mcv_fraction() const {
+    double total = 0;
+    for (auto const &entry: this->mcv)
+        total += entry.second;
+    return total;
+}
+
+double ColumnHistogram::equal_selectivity(const Value &value, double distinct_count) const {
+    for (auto const &entry: this->mcv)
+        if (entry.first == value)
+            return entry.second;
+    // otherwise spread what the MCVs don't cover evenly over the other distinct values
+    double others = max(1.0, distinct_count - this->mcv.size());
+    if (!this->bounds.empty() && (value < this->bounds.front() || this->bounds.back() < value))
+        return 0;
+    return (1 - mcv_fraction()) / others;
+}
+
+double ColumnHistogram::range_selectivity(Comparison::Op op, const Value &value) const {
+    switch (op) {
+        case Comparison::LT:
+            return fraction_below(value, false);
+        case Comparison::LE:
+            return fraction_below(value, true);
+        case Comparison::GT:
+            return 1 - fraction_below(value, true);
+        case Comparison::GE:
+            return 1 - fraction_below(value, false);
+        default:
+            return 1;
+    }
+}
+
+// Fraction of rows with column < value (or <= value): the MCVs below it, plus the histogram buckets
+// below it with linear interpolation inside the bucket holding it (halfway for TEXT).
+double ColumnHistogram::fraction_below(const Value &value, bool inclusive) const {
+    double fraction = 0;
+    for (auto const &entry: this->mcv)
+        if (entry.first < value || (inclusive && entry.first == value))
+            fraction += entry.second;
+
+    if (this->bounds.size() < 2)
+        return fraction;
+    double rest = 1 - mcv_fraction();
+    size_t buckets = this->bounds.size() - 1;
+    if (value < this->bounds.front())
+        return fraction;
+    if (this->bounds.back() < value || (inclusive && this->bounds.back() == value))
+        return fraction + rest;
+
+    size_t b = upper_bound(this->bounds.begin(), this->bounds.end(), value) - this->bounds.begin() - 1;
+    b = min(b, buckets - 1);
+    const Value &low = this->bounds[b], &high = this->bounds[b + 1];
+    double within = 0.5;
+    if (value.data_type != ColumnAttribute::TEXT && high.n != low.n)
+        within = ((double) value.n - low.n) / ((double) high.n - low.n);
+    return fraction + rest * (b + within) / buckets;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file Histogram.h - distribution of a column's values, for selectivity estimates
+ * ColumnHistogram
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include "EvalPlan.h"
+
+/**
+ * @class ColumnHistogram - most common values (MCV) of a column with their frequencies, plus an
+ * equi-depth histogram of the remaining values: bounds[0..B] split them into B buckets that each
+ * hold about the same number of rows. Built by ANALYZE from a sample of the table.
+ */
+class ColumnHistogram {
+public:
+    static const size_t MAX_MCV = 10;
+    static const size_t MAX_BUCKETS = 20;
+
+    ColumnHistogram() : mcv(), bounds() {}
+
+    /**
+     * Build the MCV list and histogram from a sample of the column.
+     * @param sample  sampled values (reordered by this call)
+     * @returns       the histogram
+     */
+    static ColumnHistogram build(std::vector<Value> &sample);
+
+    /**
+     * @returns  true if there is nothing to go on (e.g., the table was empty)
+     */
+    bool empty() const { return mcv.empty() && bounds.empty(); }
+
+    /**
+     * Fraction of rows where the column equals a value.
+     * @param value           value to look up
+     * @param distinct_count  estimated number of distinct values in the column
+     * @returns               selectivity in [0, 1]
+     */
+    double equal_selectivity(const Value &value, double distinct_count) const;
+
+    /**
+     * Fraction of rows where <column> <op> <value> holds, for LT, LE, GT or GE.
+     * @param op     comparison
+     * @param value  value compared against
+     * @returns      selectivity in [0, 1]
+     */
+    double range_selectivity(Comparison::Op op, const Value &value) const;
+
+    std::vector<std::pair<Value, double>> mcv;  // most common values and the fraction of rows holding each
+    std::vector<Value> bounds;                  // bucket boundaries of the values not in mcv
+
+protected:
+    double mcv_fraction() const;
+
+    double fraction_below(const Value &value, bool inclusive) const;
+};
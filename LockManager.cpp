@@ -0,0 +1,337 @@
+/**
+ * @file LockManager.cpp - implementation of LockName, EngineLock and LockManager
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include "LockManager.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+using namespace std;
+
+const size_t LockManager::PARTITIONS;
+chrono::milliseconds LockManager::wait_timeout(30 * 1000);
+const TransactionID LockManager::ENGINE;
+
+LockManager::Partition LockManager::partitions[LockManager::PARTITIONS];
+mutex LockManager::held_mutex;
+unordered_map<TransactionID, vector<LockName>> LockManager::held;
+mutex LockManager::graph_mutex;
+map<TransactionID, set<TransactionID>> LockManager::waits_for;
+
+static thread_local EngineLock *current_engine = nullptr;
+
+EngineLock::EngineLock(shared_timed_mutex *mutex, bool exclusive)
+        : mutex(mutex), exclusive(exclusive), previous(current_engine) {
+    lock();
+    current_engine = this;
+}
+
+EngineLock::~EngineLock() {
+    current_engine = this->previous;
+    unlock();
+}
+
+EngineLock *EngineLock::current() {
+    return current_engine;
+}
+
+void EngineLock::lock() {
+    if (this->mutex == nullptr || (this->exclusive ? this->mutex->try_lock() : this->mutex->try_lock_shared()))
+        return;
+
+    // only a transaction that has written can hold locks an exclusive holder is waiting for
+    Transaction *transaction = TransactionManager::current();
+    TransactionID id = TransactionManager::FROZEN;
+    if (transaction != nullptr && transaction->has_id()) {
+        id = transaction->get_id();
+        LockManager::wait_for_engine(id);
+    }
+    {
+        ThreadPool::Blocking blocking;
+        Trace::Span span("engine lock wait", "lock");
+        if (this->exclusive)
+            this->mutex->lock();
+        else
+            this->mutex->lock_shared();
+    }
+    if (id != TransactionManager::FROZEN)
+        LockManager::stop_waiting(id);
+}
+
+void EngineLock::unlock() {
+    if (this->mutex == nullptr)
+        return;
+    if (this->exclusive)
+        this->mutex->unlock();
+    else
+        this->mutex->unlock_shared();
+}
+
+EngineLock::Released::~Released() {
+    if (this->released)
+        this->engine->lock();
+}
+
+void EngineLock::Released::release() {
+    if (this->engine == nullptr || this->engine->exclusive || this->released)
+        return;
+    this->engine->unlock();
+    this->released = true;
+}
+
+size_t LockName::hash() const {
+    size_t h = std::hash<Identifier>()(this->table);
+    size_t row = ((size_t) this->row.first << 16) ^ this->row.second;
+    return h ^ (row * 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+// rows are the requests' modes, columns the modes asked for
+static const bool COMPATIBLE[5][5] = {
+        //  IS     IX     S      SIX    X
+        {true,  true,  true,  true,  false},   // IS
+        {true,  true,  false, false, false},   // IX
+        {true,  false, true,  false, false},   // S
+        {true,  false, false, false, false},   // SIX
+        {false, false, false, false, false}    // X
+};
+
+bool LockManager::compatible(Mode a, Mode b) {
+    return COMPATIBLE[a][b];
+}
+
+LockManager::Mode LockManager::supremum(Mode a, Mode b) {
+    if (a == b)
+        return a;
+    if (a == X || b == X)
+        return X;
+    if (a == SIX || b == SIX || (a == S && b == IX) || (a == IX && b == S))
+        return SIX;
+    return max(a, b);  // IS with IX or S
+}
+
+bool LockManager::lock_table(Transaction *transaction, const Identifier &table, Mode mode, bool wait) {
+    return lock(transaction, LockName(table), mode, wait);
+}
+
+void LockManager::lock_row(Transaction *transaction, const Identifier &table, Handle row, Mode mode) {
+    lock(transaction, LockName(table), mode == X ? IX : IS);
+    lock(transaction, LockName(table, row), mode);
+}
+
+// A shared engine lock given up while waiting is taken back once the partition's mutex is let go.
+bool LockManager::lock(Transaction *transaction, const LockName &name, Mode mode, bool wait) {
+    EngineLock::Released engine;
+    TransactionID id = transaction->get_id();
+    Partition &partition = partitions[name.hash() % PARTITIONS];
+    unique_lock<std::mutex> lock(partition.mutex);
+    Queue &queue = partition.queues[name];
+    auto request = find_if(queue.begin(), queue.end(), [id](const Request &r) { return r.id == id; });
+    bool upgrading = request != queue.end();  // a request of ours here has been granted
+    if (upgrading) {
+        if (supremum(request->mode, mode) == request->mode)
+            return true;
+        mode = supremum(request->mode, mode);
+    } else {
+        request = queue.insert(queue.end(), Request{id, mode, false});
+        lock_guard<std::mutex> held_lock(held_mutex);
+        held[id].push_back(name);
+    }
+
+    auto deadline = chrono::steady_clock::now() + wait_timeout;
+    bool waited = false;
+    set<TransactionID> blocking;
+    while (!(blocking = blockers(queue, request, mode)).empty()) {
+        const char *failure = nullptr;
+        if (wait && chrono::steady_clock::now() >= deadline)
+            failure = "lock wait timeout";
+        else if (wait && !wait_for(id, blocking))
+            failure = "deadlock detected";
+        if (!wait || failure != nullptr) {
+            stop_waiting(id);
+            if (!upgrading) {
+                queue.erase(request);
+                if (queue.empty())
+                    partition.queues.erase(name);
+            }
+            partition.released.notify_all();  // whoever queued behind us may go ahead now
+            if (failure == nullptr)
+                return false;
+            throw TransactionConflict(string(failure) + " locking " + name.table);
+        }
+        {
+            ThreadPool::Blocking blocking;
+            Trace::Span span("lock wait", "lock");
+            engine.release();
+            partition.released.wait_until(lock, deadline);
+        }
+        waited = true;
+    }
+    request->mode = mode;
+    request->granted = true;
+    if (waited) {
+        stop_waiting(id);
+        partition.released.notify_all();  // those queued behind us were waiting for us to go first
+    }
+    return true;
+}
+
+// A granted request blocks us if its mode conflicts; a waiting one ahead of a new request blocks
+// it regardless, so that a stream of compatible requests can't starve an incompatible one.
+set<TransactionID> LockManager::blockers(Queue &queue, Queue::iterator request, Mode mode) {
+    set<TransactionID> blocking;
+    bool ahead = true;
+    for (auto other = queue.begin(); other != queue.end(); other++) {
+        if (other == request)
+            ahead = false;
+        else if (other->granted ? !compatible(other->mode, mode) : ahead && !request->granted)
+            blocking.insert(other->id);
+    }
+    return blocking;
+}
+
+// Record the edges, then look for a way back to id from the transactions it would wait for. An
+// exclusive holder of the engine lock is waited for by those waiting for the engine lock.
+bool LockManager::wait_for(TransactionID id, const set<TransactionID> &blocking) {
+    lock_guard<std::mutex> lock(graph_mutex);
+    LockManager::waits_for[id] = blocking;
+    EngineLock *engine = EngineLock::current();
+    if (engine != nullptr && engine->is_exclusive())
+        LockManager::waits_for[ENGINE].insert(id);
+    if (!closes_cycle(id))
+        return true;
+    erase_waits(id);
+    return false;
+}
+
+void LockManager::wait_for_engine(TransactionID id) {
+    bool deadlock;
+    {
+        lock_guard<std::mutex> lock(graph_mutex);
+        LockManager::waits_for[id] = {ENGINE};
+        deadlock = closes_cycle(id);
+    }
+    if (!deadlock)
+        return;
+    for (Partition &partition: partitions) {
+        lock_guard<std::mutex> lock(partition.mutex);
+        partition.released.notify_all();
+    }
+}
+
+bool LockManager::closes_cycle(TransactionID id) {
+    const set<TransactionID> &blocking = LockManager::waits_for[id];
+    vector<TransactionID> stack(blocking.begin(), blocking.end());
+    set<TransactionID> seen;
+    while (!stack.empty()) {
+        TransactionID other = stack.back();
+        stack.pop_back();
+        if (other == id)
+            return true;
+        if (!seen.insert(other).second)
+            continue;
+        auto found = LockManager::waits_for.find(other);
+        if (found != LockManager::waits_for.end())
+            stack.insert(stack.end(), found->second.begin(), found->second.end());
+    }
+    return false;
+}
+
+void LockManager::stop_waiting(TransactionID id) {
+    lock_guard<std::mutex> lock(graph_mutex);
+    erase_waits(id);
+}
+
+void LockManager::erase_waits(TransactionID id) {
+    LockManager::waits_for.erase(id);
+    auto engine = LockManager::waits_for.find(ENGINE);
+    if (engine != LockManager::waits_for.end()) {
+        engine->second.erase(id);
+        if (engine->second.empty())
+            LockManager::waits_for.erase(engine);
+    }
+}
+
+void LockManager::release_all(TransactionID id) {
+    vector<LockName> names;
+    {
+        lock_guard<std::mutex> lock(held_mutex);
+        auto found = LockManager::held.find(id);
+        if (found == LockManager::held.end())
+            return;
+        names.swap(found->second);
+        LockManager::held.erase(found);
+    }
+    for (const LockName &name: names) {
+        Partition &partition = partitions[name.hash() % PARTITIONS];
+        lock_guard<std::mutex> lock(partition.mutex);
+        auto found = partition.queues.find(name);
+        if (found == partition.queues.end())
+            continue;
+        found->second.remove_if([id](const Request &r) { return r.id == id; });
+        if (found->second.empty())
+            partition.queues.erase(found);
+        partition.released.notify_all();
+    }
+    stop_waiting(id);
+}
+
+// Each of two transactions locks a row and then waits for the other's. Whichever closes the cycle
+// is told so and aborts, letting the other go on, so exactly one deadlock is found whoever waits
+// first.
+bool test_lock_manager() {
+    const Identifier table = "_test_locks_cpp";
+    Handle first(1, 1), second(1, 2);
+
+    // deadlock
+    shared_ptr<Transaction> t1 = TransactionManager::begin(), t2 = TransactionManager::begin();
+    LockManager::lock_row(t1.get(), table, first, LockManager::X);
+    LockManager::lock_row(t2.get(), table, second, LockManager::X);
+    auto cross = [&table](Transaction *transaction, Handle row, string &failure) {
+        try {
+            LockManager::lock_row(transaction, table, row, LockManager::X);
+            transaction->commit();
+        } catch (TransactionConflict &e) {
+            failure = e.what();
+            transaction->abort();
+        }
+    };
+    string failure1, failure2;
+    thread other(cross, t1.get(), second, ref(failure1));
+    cross(t2.get(), first, failure2);
+    other.join();
+    string failure = failure1.empty() ? failure2 : failure1;
+    std::cout << "deadlock ok " << failure << std::endl;
+    if (failure1.empty() == failure2.empty() || failure.find("deadlock detected") == string::npos)
+        return false;
+
+    // timeout
+    chrono::milliseconds wait_timeout = LockManager::wait_timeout;
+    LockManager::wait_timeout = chrono::milliseconds(100);
+    shared_ptr<Transaction> t3 = TransactionManager::begin(), t4 = TransactionManager::begin();
+    LockManager::lock_row(t3.get(), table, first, LockManager::X);
+    failure.clear();
+    auto start = chrono::steady_clock::now();
+    try {
+        LockManager::lock_row(t4.get(), table, first, LockManager::X);
+    } catch (TransactionConflict &e) {
+        failure = e.what();
+    }
+    auto waited = chrono::steady_clock::now() - start;
+    LockManager::wait_timeout = wait_timeout;
+    t4->abort();
+    std::cout << "timeout ok " << failure << std::endl;
+    if (failure.find("lock wait timeout") == string::npos || waited < chrono::milliseconds(100))
+        return false;
+
+    // release
+    shared_ptr<Transaction> t5 = TransactionManager::begin();
+    bool held = !LockManager::lock_table(t5.get(), table, LockManager::X, false);  // t3 has it IX
+    t3->commit();
+    bool freed = LockManager::lock_table(t5.get(), table, LockManager::X, false);
+    t5->commit();
+    std::cout << "release ok" << std::endl;
+    return held && freed;
+}
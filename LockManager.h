@@ -0,0 +1,243 @@
+/**
+ * @file LockManager.h - locks that keep writers from changing the same rows at once
+ * LockName, EngineLock, LockManager
+ *
+ * Locks are hierarchical: a table can be locked as a whole (S to read all of it, X to change all
+ * of it), or with an intention lock (IS, IX) that says its holder locks some of its rows, which
+ * are locked S or X in turn. Locking a row takes the table's intention lock first, so a whole-table
+ * lock and a row lock under it always meet on the table. Writers lock the rows they change (see
+ * HeapTable::del), so two statements changing different rows of a table run side by side, and
+ * two changing the same row take turns. Readers take no locks; their snapshots are enough (see
+ * Transaction.h).
+ *
+ * Locks are held by transactions, until they commit or abort (TransactionManager::finish releases
+ * them). A transaction that has to wait records whom it waits for in the waits-for graph; if that
+ * closes a cycle, waiting would never end, so it gives up at once with a TransactionConflict
+ * ("deadlock detected") instead. A wait that goes on longer than wait_timeout (perhaps for a
+ * transaction that waits on something outside the lock manager) gives up the same way.
+ *
+ * The engine lock that front ends take around each statement (see EngineLock) is in the graph too,
+ * so a cycle through it is found like any other.
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include "Transaction.h"
+
+/**
+ * @class LockName - what is locked: a table, or a row of it
+ */
+class LockName {
+public:
+    LockName(const Identifier &table, Handle row) : table(table), row(row) {}
+
+    explicit LockName(const Identifier &table) : table(table), row(0, 0) {}
+
+    Identifier table;
+    Handle row;         // (0, 0) for the table itself, which is never a row's handle
+
+    bool operator==(const LockName &other) const { return table == other.table && row == other.row; }
+
+    size_t hash() const;
+};
+
+/**
+ * @class EngineLock - a front end's engine lock (see StatementRunner), held around one statement on
+ * a thread: shared by statements that read and change rows, exclusive for those that change the
+ * catalog.
+ *
+ * A statement holding it shared gives it up while it waits in the LockManager, and takes it back
+ * after: the transaction it waits for may need it exclusively to finish (to COMMIT its DDL), and
+ * the wait holds nothing the catalog needs. A statement holding it exclusively keeps it, since it
+ * runs alone; a transaction waiting for the engine lock counts as waiting, in the waits-for graph,
+ * for whichever exclusive holders are waiting in the LockManager, so that if one of those waits
+ * for it in turn, the holder finds the deadlock and gives up.
+ */
+class EngineLock {
+public:
+    /**
+     * Take an engine lock, and make it the current thread's for as long as this lives.
+     * @param mutex      the engine lock, or nullptr for none (when there is only the one session)
+     * @param exclusive  whether to take it exclusively
+     */
+    EngineLock(std::shared_timed_mutex *mutex, bool exclusive);
+
+    virtual ~EngineLock();
+
+    EngineLock(const EngineLock &other) = delete;
+
+    EngineLock &operator=(const EngineLock &other) = delete;
+
+    /**
+     * @returns  the current thread's engine lock, or nullptr if it has none
+     */
+    static EngineLock *current();
+
+    virtual bool is_exclusive() const { return this->exclusive; }
+
+    /**
+     * @class Released - gives up the current thread's engine lock, if it is held shared, from
+     * release until this goes, when it is taken back
+     */
+    class Released {
+    public:
+        Released() : engine(current()), released(false) {}
+
+        ~Released();
+
+        Released(const Released &other) = delete;
+
+        Released &operator=(const Released &other) = delete;
+
+        void release();
+
+    protected:
+        EngineLock *engine;
+        bool released;
+    };
+
+protected:
+    std::shared_timed_mutex *mutex;
+    bool exclusive;
+    EngineLock *previous;
+
+    // a wait for it is recorded in the waits-for graph
+    virtual void lock();
+
+    virtual void unlock();
+};
+
+/**
+ * @class LockManager - grants, queues and releases locks
+ *
+ * The lock table is split into PARTITIONS partitions by the hash of the lock's name, each with its
+ * own mutex, so that locking different rows rarely contends on anything. A partition's waiters
+ * wait on its condition variable and are woken whenever a lock in it is released.
+ *
+ * Each lock has a queue of requests: the granted ones, then the waiting ones in the order they
+ * came. A request is granted when it is compatible with every granted request of other
+ * transactions and no one is waiting ahead of it. A transaction asking for a stronger mode on a
+ * lock it holds (an upgrade) goes ahead of those waiting.
+ */
+class LockManager {
+public:
+    enum Mode {
+        IS,     // intention shared: rows under it are locked S
+        IX,     // intention exclusive: rows under it are locked X
+        S,      // shared
+        SIX,    // shared, and rows under it are locked X
+        X       // exclusive
+    };
+
+    static const size_t PARTITIONS = 64;
+
+    /**
+     * How long a lock wait may go on before it gives up.
+     */
+    static std::chrono::milliseconds wait_timeout;
+
+    /**
+     * Lock a table as a whole, waiting if need be.
+     * @param transaction  the transaction to hold the lock
+     * @param table        the table's name
+     * @param mode         the mode wanted (if the transaction already has the lock, it gets the
+     *                     weakest mode that is at least as strong as both)
+     * @param wait         whether to wait if others hold the lock (false for statements that hold
+     *                     the server's engine lock, which those others may be waiting for)
+     * @returns            false if the lock wasn't free and wait was false
+     * @throws TransactionConflict  if waiting would deadlock or timed out
+     */
+    static bool lock_table(Transaction *transaction, const Identifier &table, Mode mode, bool wait = true);
+
+    /**
+     * Lock a row, first taking the table's intention lock (IS for S, IX for X), waiting if need be.
+     * @param transaction  the transaction to hold the lock
+     * @param table        the row's table's name
+     * @param row          the row's handle
+     * @param mode         S or X
+     * @throws TransactionConflict  if waiting would deadlock or timed out
+     */
+    static void lock_row(Transaction *transaction, const Identifier &table, Handle row, Mode mode);
+
+    /**
+     * Release every lock a transaction holds or is waiting for, waking whoever waits for them.
+     * @param id  the transaction's id
+     */
+    static void release_all(TransactionID id);
+
+    /**
+     * @returns  whether two transactions can hold a lock in these modes at once
+     */
+    static bool compatible(Mode a, Mode b);
+
+    /**
+     * @returns  the weakest mode at least as strong as both
+     */
+    static Mode supremum(Mode a, Mode b);
+
+protected:
+    struct Request {
+        TransactionID id;
+        Mode mode;      // granted, or wanted (an upgrade waits with the mode it was granted)
+        bool granted;
+    };
+
+    typedef std::list<Request> Queue;
+
+    struct LockNameHash {
+        size_t operator()(const LockName &name) const { return name.hash(); }
+    };
+
+    struct Partition {
+        std::mutex mutex;
+        std::condition_variable released;
+        std::unordered_map<LockName, Queue, LockNameHash> queues;
+    };
+
+    static Partition partitions[PARTITIONS];
+
+    static std::mutex held_mutex;   // guards held
+    static std::unordered_map<TransactionID, std::vector<LockName>> held;
+
+    static std::mutex graph_mutex;  // guards waits_for; taken inside a partition's mutex, never around one
+    static std::map<TransactionID, std::set<TransactionID>> waits_for;
+
+    // the engine lock's node in waits_for (no transaction has this id): it waits for the exclusive
+    // holders waiting for a lock
+    static const TransactionID ENGINE = TransactionManager::ABORTED;
+
+    static bool lock(Transaction *transaction, const LockName &name, Mode mode, bool wait = true);
+
+    static std::set<TransactionID> blockers(Queue &queue, Queue::iterator request, Mode mode);
+
+    static bool wait_for(TransactionID id, const std::set<TransactionID> &blockers);
+
+    /**
+     * Record that a transaction waits for the engine lock; if that closes a cycle, wake the lock
+     * waiters, so that the exclusive holder among them finds it and gives up.
+     * @param id  the transaction's id
+     */
+    static void wait_for_engine(TransactionID id);
+
+    // under graph_mutex: whether there is a way back to id from the transactions it waits for
+    static bool closes_cycle(TransactionID id);
+
+    static void stop_waiting(TransactionID id);
+
+    // under graph_mutex
+    static void erase_waits(TransactionID id);
+
+    friend class EngineLock;
+};
+
+bool test_lock_manager();
@@ -0,0 +1,246 @@
+/**
+ * @file Metrics.cpp - implementation of Metrics
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include "Metrics.h"
+#include "storage_engine.h"
+
+using namespace std;
+
+const size_t Metrics::BUCKETS;
+const chrono::seconds Metrics::DEFAULT_DUMP_INTERVAL(60);
+
+static const char *const COUNTER_NAMES[Metrics::COUNTERS] = {
+        "page_gets", "page_puts", "blocks_allocated", "syncs", "slides", "slide_bytes", "marshals", "marshal_bytes",
+        "unmarshals", "unmarshal_bytes"
+};
+
+static const char *const TIMER_NAMES[Metrics::TIMERS] = {"page_get", "page_put", "sync"};
+
+// A thread's shard, registered for as long as the thread runs.
+class Metrics::Registration {
+public:
+    Registration() : shard(new Shard()) {
+        lock_guard<std::mutex> lock(Metrics::mutex);
+        Metrics::shards.push_back(this->shard);
+    }
+
+    ~Registration() {
+        lock_guard<std::mutex> lock(Metrics::mutex);
+        Metrics::retired.add(*this->shard);
+        for (auto it = Metrics::shards.begin(); it != Metrics::shards.end(); it++)
+            if (*it == this->shard) {
+                Metrics::shards.erase(it);
+                break;
+            }
+        delete this->shard;
+    }
+
+    Shard *shard;
+};
+
+// Appends a report to a file every interval, on a thread of its own, until destroyed.
+class Metrics::Dumper {
+public:
+    Dumper(const string &path, chrono::seconds interval) : path(path), interval(interval), mutex(), wake(),
+                                                           stopping(false), thread([this] { run(); }) {}
+
+    ~Dumper() {
+        {
+            lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->wake.notify_all();
+        this->thread.join();
+    }
+
+    Dumper(const Dumper &other) = delete;
+
+    Dumper &operator=(const Dumper &other) = delete;
+
+protected:
+    string path;
+    chrono::seconds interval;
+    std::mutex mutex;
+    condition_variable wake;
+    bool stopping;
+    std::thread thread;     // last, so it starts once the rest is ready
+
+    void run() {
+        unique_lock<std::mutex> lock(this->mutex);
+        while (!this->wake.wait_for(lock, this->interval, [this] { return this->stopping; })) {
+            lock.unlock();
+            write();
+            lock.lock();
+        }
+        lock.unlock();
+        write();  // so that what happened since the last one isn't lost
+    }
+
+    void write() {
+        ostringstream line;
+        line << "{\"time\": " << ::time(nullptr);
+        for (auto const &item: Metrics::report())
+            line << ", \"" << item.first << "\": " << item.second;
+        line << "}\n";
+        ofstream out(this->path, ios::app);
+        out << line.str();
+    }
+};
+
+std::mutex Metrics::mutex;
+vector<Metrics::Shard *> Metrics::shards;
+Metrics::Shard Metrics::retired;
+string Metrics::dump_path;
+chrono::seconds Metrics::dump_interval(Metrics::DEFAULT_DUMP_INTERVAL);
+unique_ptr<Metrics::Dumper> Metrics::dumper;
+
+Metrics::Shard::Shard() {
+    for (auto &counter: this->counters)
+        counter = 0;
+    for (auto &timer: this->buckets)
+        for (auto &bucket: timer)
+            bucket = 0;
+    for (auto &total: this->nanoseconds)
+        total = 0;
+}
+
+void Metrics::Shard::add(const Shard &other) {
+    for (size_t i = 0; i < COUNTERS; i++)
+        Metrics::add(this->counters[i], other.counters[i].load(memory_order_relaxed));
+    for (size_t t = 0; t < TIMERS; t++) {
+        for (size_t i = 0; i < BUCKETS; i++)
+            Metrics::add(this->buckets[t][i], other.buckets[t][i].load(memory_order_relaxed));
+        Metrics::add(this->nanoseconds[t], other.nanoseconds[t].load(memory_order_relaxed));
+    }
+}
+
+Metrics::Shard &Metrics::shard() {
+    static thread_local Registration registration;
+    return *registration.shard;
+}
+
+// Only the shard's own thread writes it (or a thread holding the mutex, for retired), so there is
+// no need for a locked add; the atomics just let other threads read it.
+void Metrics::add(atomic<uint64_t> &value, uint64_t n) {
+    value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+void Metrics::count(Counter counter, uint64_t n) {
+    add(shard().counters[counter], n);
+}
+
+uint64_t Metrics::counted(Counter counter) {
+    return shard().counters[counter].load(memory_order_relaxed);
+}
+
+const char *Metrics::name(Counter counter) {
+    return COUNTER_NAMES[counter];
+}
+
+void Metrics::time(Timer timer, chrono::steady_clock::duration elapsed) {
+    uint64_t nanoseconds = (uint64_t) max((int64_t) 0,
+                                          (int64_t) chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+    size_t bucket = 0;
+    for (uint64_t n = nanoseconds >> 1; n != 0 && bucket < BUCKETS - 1; n >>= 1)
+        bucket++;
+    Shard &shard = Metrics::shard();
+    add(shard.buckets[timer][bucket], 1);
+    add(shard.nanoseconds[timer], nanoseconds);
+}
+
+static string microseconds(double nanoseconds) {
+    ostringstream out;
+    out << fixed << setprecision(3) << nanoseconds / 1000;
+    return out.str();
+}
+
+vector<pair<string, string>> Metrics::report() {
+    Shard total;
+    {
+        lock_guard<std::mutex> lock(Metrics::mutex);
+        total.add(Metrics::retired);
+        for (const Shard *shard: Metrics::shards)
+            total.add(*shard);
+    }
+
+    vector<pair<string, string>> items;
+    for (size_t i = 0; i < COUNTERS; i++)
+        items.emplace_back(COUNTER_NAMES[i], to_string(total.counters[i].load()));
+
+    for (size_t t = 0; t < TIMERS; t++) {
+        string name = TIMER_NAMES[t];
+        uint64_t count = 0;
+        for (auto const &bucket: total.buckets[t])
+            count += bucket.load();
+        // the upper bound of the bucket the given fraction of the latencies fall in or below
+        auto percentile = [&](double fraction) {
+            uint64_t seen = 0;
+            for (size_t i = 0; i < BUCKETS; i++) {
+                seen += total.buckets[t][i].load();
+                if (seen > 0 && seen >= fraction * count)
+                    return microseconds((double) (2ULL << i));
+            }
+            return microseconds(0);
+        };
+        items.emplace_back(name + "_count", to_string(count));
+        items.emplace_back(name + "_mean_us",
+                           microseconds(count == 0 ? 0 : (double) total.nanoseconds[t].load() / count));
+        items.emplace_back(name + "_p50_us", percentile(0.5));
+        items.emplace_back(name + "_p99_us", percentile(0.99));
+        items.emplace_back(name + "_max_us", percentile(1.0));
+    }
+
+    DB_MPOOL_STAT *stat = nullptr;
+    if (_DB_ENV != nullptr && _DB_ENV->memp_stat(&stat, nullptr, 0) == 0 && stat != nullptr) {
+        uint64_t hits = stat->st_cache_hit, misses = stat->st_cache_miss;
+        ostringstream ratio;
+        ratio << fixed << setprecision(4) << (hits + misses == 0 ? 0.0 : (double) hits / (hits + misses));
+        items.emplace_back("mpool_cache_hits", to_string(hits));
+        items.emplace_back("mpool_cache_misses", to_string(misses));
+        items.emplace_back("mpool_hit_ratio", ratio.str());
+        items.emplace_back("mpool_pages_in", to_string((uint64_t) stat->st_page_in));
+        items.emplace_back("mpool_pages_out", to_string((uint64_t) stat->st_page_out));
+        items.emplace_back("mpool_pages", to_string((uint64_t) stat->st_pages));
+        items.emplace_back("mpool_dirty_pages", to_string((uint64_t) stat->st_page_dirty));
+        items.emplace_back("mpool_evictions", to_string((uint64_t) stat->st_ro_evict + stat->st_rw_evict));
+        items.emplace_back("mpool_cache_bytes",
+                           to_string(((uint64_t) stat->st_gbytes << 30) + (uint64_t) stat->st_bytes));
+        free(stat);
+    }
+    return items;
+}
+
+void Metrics::dump_to(const string &path) {
+    {
+        lock_guard<std::mutex> lock(Metrics::mutex);
+        Metrics::dump_path = path;
+    }
+    restart_dumper();
+}
+
+void Metrics::dump_every(chrono::seconds interval) {
+    {
+        lock_guard<std::mutex> lock(Metrics::mutex);
+        Metrics::dump_interval = interval;
+    }
+    restart_dumper();
+}
+
+// The old dumper is stopped outside the mutex, as its last report takes the mutex too.
+void Metrics::restart_dumper() {
+    unique_ptr<Dumper> stopped;
+    {
+        lock_guard<std::mutex> lock(Metrics::mutex);
+        stopped = move(Metrics::dumper);
+        if (!Metrics::dump_path.empty())
+            Metrics::dumper.reset(new Dumper(Metrics::dump_path, Metrics::dump_interval));
+    }
+}
@@ -0,0 +1,148 @@
+/**
+ * @file Metrics.h - counters and latency histograms for the storage layer
+ * Metrics
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @class Metrics - what the storage layer has done since the process started: blocks fetched,
+ * written and allocated, bytes slid about by compaction, records encoded and decoded, and how long
+ * fetches, writes and syncs took. Shown by SHOW STATS, together with Berkeley DB's buffer pool
+ * statistics, and written out every so often to a file if one is set (SET STATS_FILE).
+ *
+ * Counting has to be cheap enough to leave on, so each thread counts into a shard of its own,
+ * which only it writes (no locked instructions, no shared cache lines). Reading adds the shards
+ * up. A thread that ends adds its shard into the totals of threads gone before.
+ *
+ * Latencies go in histograms of power-of-two buckets of nanoseconds, so percentiles are only
+ * known to within a factor of two (each is reported as its bucket's upper bound).
+ */
+class Metrics {
+public:
+    enum Counter {
+        PAGE_GETS,
+        PAGE_PUTS,
+        BLOCKS_ALLOCATED,
+        SYNCS,
+        SLIDES,
+        SLIDE_BYTES,
+        MARSHALS,
+        MARSHAL_BYTES,
+        UNMARSHALS,
+        UNMARSHAL_BYTES,
+        COUNTERS        // how many there are
+    };
+
+    enum Timer {
+        PAGE_GET,
+        PAGE_PUT,
+        SYNC,
+        TIMERS          // how many there are
+    };
+
+    static const size_t BUCKETS = 40;  // bucket i counts latencies under 2^(i+1) ns (the last, all longer)
+    static const std::chrono::seconds DEFAULT_DUMP_INTERVAL;
+
+    /**
+     * Add to a counter.
+     * @param counter  which
+     * @param n        how much
+     */
+    static void count(Counter counter, uint64_t n = 1);
+
+    /**
+     * @param counter  which
+     * @returns        how much the calling thread has added to a counter (to find what a piece of
+     *                 work on the thread cost, from the difference before and after)
+     */
+    static uint64_t counted(Counter counter);
+
+    /**
+     * @param counter  which
+     * @returns        its name, as report() gives it
+     */
+    static const char *name(Counter counter);
+
+    /**
+     * Note how long something took.
+     * @param timer    which
+     * @param elapsed  how long
+     */
+    static void time(Timer timer, std::chrono::steady_clock::duration elapsed);
+
+    /**
+     * @class Stopwatch - times a scope, for Metrics::time
+     */
+    class Stopwatch {
+    public:
+        explicit Stopwatch(Timer timer) : timer(timer), start(std::chrono::steady_clock::now()) {}
+
+        ~Stopwatch() { Metrics::time(timer, std::chrono::steady_clock::now() - start); }
+
+        Stopwatch(const Stopwatch &other) = delete;
+
+        Stopwatch &operator=(const Stopwatch &other) = delete;
+
+    protected:
+        Timer timer;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    /**
+     * Everything counted so far, and the buffer pool's statistics, by name. Latencies are
+     * reported as the count, mean, median, 99th percentile and maximum of each timer.
+     * @returns  (name, value) pairs; every value is a number
+     */
+    static std::vector<std::pair<std::string, std::string>> report();
+
+    /**
+     * Start (or stop) appending report() to a file, as a line of JSON, every dump interval.
+     * @param path  the file, or "" to stop
+     */
+    static void dump_to(const std::string &path);
+
+    /**
+     * Change how often the dump file is written (DEFAULT_DUMP_INTERVAL until changed).
+     * @param interval  how often
+     */
+    static void dump_every(std::chrono::seconds interval);
+
+protected:
+    struct Shard {
+        std::atomic<uint64_t> counters[COUNTERS];
+        std::atomic<uint64_t> buckets[TIMERS][BUCKETS];
+        std::atomic<uint64_t> nanoseconds[TIMERS];
+
+        Shard();
+
+        void add(const Shard &other);
+    };
+
+    class Registration;
+    class Dumper;
+
+    static std::mutex mutex;                // guards shards, retired and the dump settings
+    static std::vector<Shard *> shards;     // of the threads that are running
+    static Shard retired;                   // totals of the threads that have ended
+    static std::string dump_path;
+    static std::chrono::seconds dump_interval;
+    static std::unique_ptr<Dumper> dumper;  // defined after the rest, so it stops first at exit
+
+    static Shard &shard();
+
+    static void add(std::atomic<uint64_t> &value, uint64_t n);
+
+    static void restart_dumper();
+};
@@ -0,0 +1,191 @@
+/**
+ * @file PlanCache.cpp - implementation of PlanCache
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <iostream>
+#include "PlanCache.h"
+
+using namespace std;
+
+const size_t PlanCache::DEFAULT_CAPACITY;
+
+shared_ptr<QueryPlan> PlanCache::get(const string &text, shared_ptr<hsql::SQLParserResult> &parsed) {
+    lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->index.find(text);
+    if (found == this->index.end())
+        return nullptr;
+    Entries::iterator entry = found->second;
+    if (entry->catalog_version != Tables::get_catalog_version()) {
+        this->entries.erase(entry);
+        this->index.erase(found);
+        return nullptr;
+    }
+    this->entries.splice(this->entries.begin(), this->entries, entry);
+    parsed = entry->parsed;
+    return entry->plan;
+}
+
+void PlanCache::put(const string &text, shared_ptr<QueryPlan> plan, shared_ptr<hsql::SQLParserResult> parsed) {
+    lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->index.find(text);
+    if (found != this->index.end()) {
+        this->entries.erase(found->second);
+        this->index.erase(found);
+    }
+    if (this->capacity == 0)
+        return;
+    while (this->entries.size() >= this->capacity) {
+        this->index.erase(this->entries.back().text);
+        this->entries.pop_back();
+    }
+    this->entries.push_front(Entry{text, plan, parsed, Tables::get_catalog_version()});
+    this->index[text] = this->entries.begin();
+}
+
+void PlanCache::clear() {
+    lock_guard<std::mutex> lock(this->mutex);
+    this->entries.clear();
+    this->index.clear();
+}
+
+static bool is_word_char(char c) {
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+// A single pass over the text, copying it token by token.
+bool PlanCache::normalize(const string &sql, string &text, vector<Value> &literals, bool replace_literals) {
+    text.clear();
+    literals.clear();
+    string last_word;  // the keyword or identifier just copied, upper-cased
+    bool space = false;
+    size_t n = sql.size();
+    for (size_t i = 0; i < n;) {
+        char c = sql[i];
+        if (isspace((unsigned char) c)) {
+            space = true;
+            i++;
+            continue;
+        }
+        if (c == ';') {
+            while (++i < n)
+                if (!isspace((unsigned char) sql[i]) && sql[i] != ';')
+                    return false;  // more than one statement
+            break;
+        }
+        if (space && !text.empty())
+            text += ' ';
+        space = false;
+        char previous = text.empty() ? '(' : text.back() == ' ' ? text[text.size() - 2] : text.back();
+
+        if (c == '\'') {
+            // string literal, with '' for a quote
+            string value;
+            size_t j = i + 1;
+            bool closed = false;
+            while (j < n) {
+                if (sql[j] == '\'') {
+                    if (j + 1 < n && sql[j + 1] == '\'') {
+                        value += '\'';
+                        j += 2;
+                        continue;
+                    }
+                    closed = true;
+                    j++;
+                    break;
+                }
+                value += sql[j++];
+            }
+            if (!closed)
+                return false;
+            literals.push_back(Value(value));
+            text += replace_literals ? "?" : sql.substr(i, j - i);
+            i = j;
+        } else if (c == '"' || c == '`') {
+            // quoted identifier
+            size_t j = sql.find(c, i + 1);
+            if (j == string::npos)
+                return false;
+            text += sql.substr(i, j + 1 - i);
+            i = j + 1;
+        } else if (isdigit((unsigned char) c) ||
+                   (c == '-' && i + 1 < n && isdigit((unsigned char) sql[i + 1]) && string("(,=<>").find(previous) != string::npos)) {
+            // integer literal (a minus sign counts where it can't be subtraction)
+            size_t j = i + 1;
+            while (j < n && isdigit((unsigned char) sql[j]))
+                j++;
+            bool keep = last_word == "LIMIT" || last_word == "OFFSET" || j - i > 11;
+            if (j < n && (is_word_char(sql[j]) || sql[j] == '.')) {
+                keep = true;  // not an integer, e.g. 1.5
+                while (j < n && (is_word_char(sql[j]) || sql[j] == '.'))
+                    j++;
+            }
+            long long value = keep ? 0 : stoll(sql.substr(i, j - i));
+            if (value < INT_MIN || value > INT_MAX)
+                keep = true;
+            if (keep) {
+                text += sql.substr(i, j - i);
+            } else {
+                literals.push_back(Value((int32_t) value));
+                text += replace_literals ? "?" : sql.substr(i, j - i);
+            }
+            i = j;
+        } else if (is_word_char(c)) {
+            size_t j = i;
+            while (j < n && is_word_char(sql[j]))
+                j++;
+            last_word = sql.substr(i, j - i);
+            text += last_word;
+            transform(last_word.begin(), last_word.end(), last_word.begin(), ::toupper);
+            i = j;
+            continue;
+        } else {
+            if (c == '?' && replace_literals)
+                return false;  // already has placeholders of its own
+            text += c;
+            i++;
+        }
+        last_word.clear();
+    }
+    return !text.empty();
+}
+
+bool test_plan_cache() {
+    // literals become placeholders (but not LIMIT and OFFSET counts); some texts can't be normalized
+    string text;
+    vector<Value> literals;
+    bool normalized = PlanCache::normalize("SELECT a,  b FROM t WHERE a = 5;", text, literals) &&
+                      text == "SELECT a, b FROM t WHERE a = ?" && literals.size() == 1 && literals[0].n == 5;
+    normalized = normalized &&
+                 PlanCache::normalize("select * from t where b = 'it''s' and a > -3 limit 10 offset 2", text, literals) &&
+                 text == "select * from t where b = ? and a > ? limit 10 offset 2" && literals.size() == 2 &&
+                 literals[0].s == "it's" && literals[1].n == -3;
+    normalized = normalized && !PlanCache::normalize("SELECT a FROM t; SELECT b FROM t", text, literals) &&
+                 !PlanCache::normalize("SELECT a FROM t WHERE a = ?", text, literals) &&
+                 !PlanCache::normalize("SELECT a FROM t WHERE b = 'oops", text, literals);
+    std::cout << "normalize ok" << std::endl;
+
+    // least recently used goes first; a lookup counts as a use
+    PlanCache cache(2);
+    shared_ptr<hsql::SQLParserResult> parsed;
+    shared_ptr<QueryPlan> one = make_shared<QueryPlan>(nullptr), two = make_shared<QueryPlan>(nullptr),
+            three = make_shared<QueryPlan>(nullptr);
+    cache.put("one", one, nullptr);
+    cache.put("two", two, nullptr);
+    cache.get("one", parsed);
+    cache.put("three", three, nullptr);
+    bool evicted = cache.size() == 2 && cache.get("one", parsed) == one && cache.get("two", parsed) == nullptr &&
+                   cache.get("three", parsed) == three;
+    std::cout << "eviction ok" << std::endl;
+
+    // nothing planned before a catalog change is returned after it
+    Tables::catalog_changed();
+    bool invalidated = cache.get("one", parsed) == nullptr && cache.get("three", parsed) == nullptr &&
+                       cache.size() == 0;
+    cache.put("one", one, nullptr);
+    invalidated = invalidated && cache.get("one", parsed) == one;
+    std::cout << "invalidation ok" << std::endl;
+    return normalized && evicted && invalidated;
+}
@@ -0,0 +1,98 @@
+/**
+ * @file PlanCache.h - reuse of query plans across statements of the same shape
+ * PlanCache
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "QueryPlanner.h"
+
+/**
+ * @class PlanCache - the most recently used query plans, keyed by normalized statement text.
+ *
+ * Normalizing replaces each literal of a statement with a ? placeholder and collapses white space,
+ * so "SELECT * FROM t WHERE a = 1" and "SELECT * FROM t  WHERE a = 2" share the plan for
+ * "SELECT * FROM t WHERE a = ?", which is then run with the literals as its parameters.
+ * Each plan is kept with the parse it was made from, so that a value-sensitive plan (see QueryPlan)
+ * can be made again for the literals at hand without parsing.
+ * Each plan remembers the catalog version it was made under (see Tables::get_catalog_version),
+ * and is dropped instead of returned once the catalog has changed.
+ * The cache is shared by all sessions; every method takes its mutex, since even a lookup reorders
+ * the entries. Only the lookup itself is under it: planning on a miss is done by the caller.
+ */
+class PlanCache {
+public:
+    static const size_t DEFAULT_CAPACITY = 256;
+
+    PlanCache(size_t capacity = DEFAULT_CAPACITY) : capacity(capacity), entries(), index(), mutex() {}
+
+    virtual ~PlanCache() {}
+
+    PlanCache(const PlanCache &other) = delete;
+
+    PlanCache &operator=(const PlanCache &other) = delete;
+
+    /**
+     * Look up the plan for a normalized statement.
+     * @param text    normalized statement text
+     * @param parsed  returned by reference: the parse it was made from, if found
+     * @returns       the plan, or nullptr if there is none for the current catalog
+     */
+    virtual std::shared_ptr<QueryPlan> get(const std::string &text, std::shared_ptr<hsql::SQLParserResult> &parsed);
+
+    /**
+     * Remember the plan for a normalized statement, evicting the least recently used if full.
+     * @param text    normalized statement text
+     * @param plan    its plan, made under the current catalog
+     * @param parsed  the parse it was made from
+     */
+    virtual void put(const std::string &text, std::shared_ptr<QueryPlan> plan,
+                     std::shared_ptr<hsql::SQLParserResult> parsed);
+
+    /**
+     * Forget every plan.
+     */
+    virtual void clear();
+
+    virtual size_t size() const {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return entries.size();
+    }
+
+    /**
+     * Normalize a statement: collapse white space, drop a trailing semicolon, and (if asked)
+     * replace each integer or string literal by ?. Numbers after LIMIT and OFFSET stay put, since
+     * they can't be parameters.
+     * @param sql               statement text
+     * @param text              returned by reference: the normalized text
+     * @param literals          returned by reference: the literals replaced, in order
+     * @param replace_literals  whether to replace literals (otherwise they are only collected)
+     * @returns                 false if the text can't be normalized: unterminated quotes,
+     *                          more than one statement, or (when replacing literals) placeholders
+     *                          of its own
+     */
+    static bool normalize(const std::string &sql, std::string &text, std::vector<Value> &literals,
+                          bool replace_literals = true);
+
+protected:
+    struct Entry {
+        std::string text;
+        std::shared_ptr<QueryPlan> plan;
+        std::shared_ptr<hsql::SQLParserResult> parsed;
+        uint64_t catalog_version;
+    };
+
+    typedef std::list<Entry> Entries;  // most recently used first
+
+    size_t capacity;
+    Entries entries;
+    std::map<std::string, Entries::iterator> index;
+    mutable std::mutex mutex;
+};
+
+bool test_plan_cache();
@@ -0,0 +1,195 @@
+/**
+ * @file QueryLog.cpp - implementation of QueryLog
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "QueryLog.h"
+#include "SQLExec.h"
+
+using namespace std;
+
+const size_t QueryLog::MAX_SHAPES;
+const char *const QueryLog::OTHER_SHAPES = "(other)";
+const chrono::milliseconds QueryLog::DEFAULT_SLOW_THRESHOLD(1000);
+const unsigned QueryLog::Histogram::SUB_BUCKET_BITS;
+
+mutex QueryLog::mutex;
+map<string, QueryLog::Histogram> QueryLog::shapes;
+string QueryLog::slow_path;
+chrono::steady_clock::duration QueryLog::slow_threshold(QueryLog::DEFAULT_SLOW_THRESHOLD);
+mutex QueryLog::slow_mutex;
+
+QueryLog::Timing::Timing(const string &sql) : sql(sql), start(chrono::steady_clock::now()), counts(),
+                                              cancelled(false), span(this->sql.c_str(), "statement") {
+    for (size_t i = 0; i < Metrics::COUNTERS; i++)
+        this->counts[i] = Metrics::counted((Metrics::Counter) i);
+}
+
+// Never throws: the statement is done with, and a failure to record it shouldn't fail it.
+QueryLog::Timing::~Timing() {
+    if (this->cancelled)
+        return;
+    auto elapsed = chrono::steady_clock::now() - this->start;
+    uint64_t counts[Metrics::COUNTERS];
+    for (size_t i = 0; i < Metrics::COUNTERS; i++)
+        counts[i] = Metrics::counted((Metrics::Counter) i) - this->counts[i];
+    try {
+        record(this->sql, elapsed, counts);
+    } catch (...) {
+        // nothing more to be done about it
+    }
+}
+
+// A value v of k significant bits, k > SUB_BUCKET_BITS, goes in the bucket for its top
+// SUB_BUCKET_BITS bits, of which there are 2^(SUB_BUCKET_BITS - 1) for each k.
+size_t QueryLog::Histogram::bucket(uint64_t value) {
+    const uint64_t half = 1ULL << (SUB_BUCKET_BITS - 1);
+    unsigned shift = 0;
+    while ((value >> shift) >= 2 * half)
+        shift++;
+    return shift * half + (value >> shift);
+}
+
+uint64_t QueryLog::Histogram::highest(size_t bucket) {
+    const uint64_t half = 1ULL << (SUB_BUCKET_BITS - 1);
+    if (bucket < 2 * half)
+        return bucket;
+    unsigned shift = (unsigned) (bucket / half - 1);
+    uint64_t top = bucket % half + half;
+    return ((top + 1) << shift) - 1;
+}
+
+void QueryLog::Histogram::record(uint64_t microseconds) {
+    size_t i = bucket(microseconds);
+    if (i >= this->counts.size())
+        this->counts.resize(i + 1, 0);
+    this->counts[i]++;
+    this->count++;
+    this->total += microseconds;
+    this->max = std::max(this->max, microseconds);
+}
+
+uint64_t QueryLog::Histogram::percentile(double fraction) const {
+    uint64_t rank = std::max((uint64_t) 1, (uint64_t) ceil(fraction * this->count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < this->counts.size(); i++) {
+        seen += this->counts[i];
+        if (seen >= rank)
+            return std::min(highest(i), this->max);
+    }
+    return this->max;
+}
+
+// Text the plan cache can't normalize (several statements, say) just has its white space collapsed.
+string QueryLog::shape(const string &sql) {
+    string text;
+    vector<Value> literals;
+    if (PlanCache::normalize(sql, text, literals))
+        return text;
+    text.clear();
+    bool space = false;
+    for (char c: sql) {
+        if (isspace((unsigned char) c)) {
+            space = true;
+            continue;
+        }
+        if (space && !text.empty())
+            text += ' ';
+        space = false;
+        text += c;
+    }
+    return text;
+}
+
+void QueryLog::record(const string &sql, chrono::steady_clock::duration elapsed,
+                      const uint64_t counts[Metrics::COUNTERS]) {
+    string shape = QueryLog::shape(sql);
+    uint64_t microseconds = (uint64_t) std::max((int64_t) 0,
+            (int64_t) chrono::duration_cast<chrono::microseconds>(elapsed).count());
+    string path;
+    {
+        lock_guard<std::mutex> lock(QueryLog::mutex);
+        auto found = QueryLog::shapes.find(shape);
+        if (found == QueryLog::shapes.end() && QueryLog::shapes.size() >= MAX_SHAPES)
+            found = QueryLog::shapes.insert(make_pair(string(OTHER_SHAPES), Histogram())).first;
+        else if (found == QueryLog::shapes.end())
+            found = QueryLog::shapes.insert(make_pair(shape, Histogram())).first;
+        found->second.record(microseconds);
+        if (elapsed >= QueryLog::slow_threshold)
+            path = QueryLog::slow_path;
+    }
+    if (!path.empty())
+        log_slow(path, sql, shape, elapsed, counts);
+}
+
+static double milliseconds(uint64_t microseconds) {
+    return microseconds / 1000.0;
+}
+
+vector<QueryLog::ShapeStats> QueryLog::report() {
+    vector<ShapeStats> report;
+    {
+        lock_guard<std::mutex> lock(QueryLog::mutex);
+        for (auto const &entry: QueryLog::shapes) {
+            const Histogram &histogram = entry.second;
+            report.push_back(ShapeStats{entry.first, histogram.get_count(), milliseconds(histogram.get_total()),
+                                        milliseconds(histogram.get_total()) / histogram.get_count(),
+                                        milliseconds(histogram.percentile(0.5)),
+                                        milliseconds(histogram.percentile(0.99)),
+                                        milliseconds(histogram.percentile(0.999)),
+                                        milliseconds(histogram.get_max())});
+        }
+    }
+    sort(report.begin(), report.end(), [](const ShapeStats &a, const ShapeStats &b) {
+        return a.total_ms > b.total_ms;
+    });
+    return report;
+}
+
+void QueryLog::log_slow_to(const string &path) {
+    lock_guard<std::mutex> lock(QueryLog::mutex);
+    QueryLog::slow_path = path;
+}
+
+void QueryLog::set_slow_threshold(chrono::milliseconds threshold) {
+    lock_guard<std::mutex> lock(QueryLog::mutex);
+    QueryLog::slow_threshold = threshold;
+}
+
+// One entry per statement: # lines about it, then the statement itself, as a SQL script would have it.
+void QueryLog::log_slow(const string &path, const string &sql, const string &shape,
+                        chrono::steady_clock::duration elapsed, const uint64_t counts[Metrics::COUNTERS]) {
+    time_t now = ::time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    ostringstream entry;
+    entry << "# time: " << put_time(&local, "%Y-%m-%d %H:%M:%S") << "  duration_ms: " << fixed << setprecision(3)
+          << chrono::duration_cast<chrono::microseconds>(elapsed).count() / 1000.0 << "\n";
+    entry << "# shape: " << shape << "\n";
+    entry << "#";
+    for (size_t i = 0; i < Metrics::COUNTERS; i++)
+        entry << " " << Metrics::name((Metrics::Counter) i) << ": " << counts[i];
+    entry << "\n";
+    string plan = SQLExec::describe_plan(sql);
+    if (!plan.empty()) {
+        entry << "# plan:\n";
+        istringstream lines(plan);
+        string line;
+        while (getline(lines, line))
+            entry << "#   " << line << "\n";
+    }
+    string text = sql;
+    while (!text.empty() && (text.back() == ';' || isspace((unsigned char) text.back())))
+        text.pop_back();
+    entry << text << ";\n";
+
+    lock_guard<std::mutex> lock(QueryLog::slow_mutex);
+    ofstream out(path, ios::app);
+    out << entry.str();
+}
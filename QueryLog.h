@@ -0,0 +1,159 @@
+/**
+ * @file QueryLog.h - statement latencies by shape, and the slow-query log
+ * QueryLog
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Metrics.h"
+#include "Trace.h"
+
+/**
+ * @class QueryLog - how long statements take, by shape, and a log of the slow ones.
+ *
+ * A statement's shape is its text with the literals replaced by ? and the white space collapsed
+ * (as PlanCache::normalize does it), so "SELECT * FROM t WHERE id = 7" and "... id = 8" are
+ * counted together. Each shape has a latency histogram, shown by SHOW QUERY STATS. Only the first
+ * MAX_SHAPES shapes get histograms of their own; the rest share one, under OTHER_SHAPES.
+ *
+ * A statement that takes the slow threshold or longer is written to the slow-query log, if one is
+ * set (SET SLOW_QUERY_LOG, SET SLOW_QUERY_MS), with what it cost in storage work (see Metrics) and,
+ * for a SELECT, its plan.
+ *
+ * The shell, the script runner and the server each time their statements with a Timing, from the
+ * start of execution to the last row sent, so streamed results count in full.
+ */
+class QueryLog {
+public:
+    static const size_t MAX_SHAPES = 1000;
+    static const char *const OTHER_SHAPES;
+    static const std::chrono::milliseconds DEFAULT_SLOW_THRESHOLD;
+
+    /**
+     * @class Timing - times a statement for as long as it lives, and records it when it goes
+     * (and, if the session is tracing, traces it)
+     */
+    class Timing {
+    public:
+        /**
+         * @param sql  the statement's text
+         */
+        explicit Timing(const std::string &sql);
+
+        ~Timing();
+
+        Timing(const Timing &other) = delete;
+
+        Timing &operator=(const Timing &other) = delete;
+
+        /**
+         * Don't record the statement after all (e.g. it turned out to need running another way,
+         * which will be timed itself).
+         */
+        void cancel() { cancelled = true; }
+
+    protected:
+        std::string sql;
+        std::chrono::steady_clock::time_point start;
+        uint64_t counts[Metrics::COUNTERS];   // this thread's counters at the start
+        bool cancelled;
+        Trace::Span span;                     // named by sql, so after it
+    };
+
+    /**
+     * @struct ShapeStats - one shape's line of SHOW QUERY STATS (times in milliseconds)
+     */
+    struct ShapeStats {
+        std::string shape;
+        uint64_t calls;
+        double total_ms;
+        double mean_ms;
+        double p50_ms;
+        double p99_ms;
+        double p999_ms;
+        double max_ms;
+    };
+
+    /**
+     * @param sql  a statement's text
+     * @returns    the statement's shape
+     */
+    static std::string shape(const std::string &sql);
+
+    /**
+     * Record a statement's latency, and log it if it was slow.
+     * @param sql      the statement's text
+     * @param elapsed  how long it took
+     * @param counts   the storage work it did, indexed by Metrics::Counter
+     */
+    static void record(const std::string &sql, std::chrono::steady_clock::duration elapsed,
+                       const uint64_t counts[Metrics::COUNTERS]);
+
+    /**
+     * @returns  every shape's latencies, those that took the most time in all first
+     */
+    static std::vector<ShapeStats> report();
+
+    /**
+     * Start (or stop) appending slow statements to a file.
+     * @param path  the file, or "" to stop
+     */
+    static void log_slow_to(const std::string &path);
+
+    /**
+     * @param threshold  how long a statement must take to be logged as slow
+     */
+    static void set_slow_threshold(std::chrono::milliseconds threshold);
+
+protected:
+    /**
+     * @class Histogram - latencies in microseconds, in buckets as an HDR histogram keeps them:
+     * exactly below 2^SUB_BUCKET_BITS, and above that in 2^(SUB_BUCKET_BITS - 1) equal buckets per
+     * doubling, so any percentile is within 1/2^(SUB_BUCKET_BITS - 1) of the truth.
+     */
+    class Histogram {
+    public:
+        static const unsigned SUB_BUCKET_BITS = 6;
+
+        Histogram() : counts(), count(0), total(0), max(0) {}
+
+        void record(uint64_t microseconds);
+
+        /**
+         * @param fraction  e.g. 0.99 for the 99th percentile
+         * @returns         the highest latency the bucket holding that percentile could hold
+         */
+        uint64_t percentile(double fraction) const;
+
+        uint64_t get_count() const { return count; }
+
+        uint64_t get_total() const { return total; }
+
+        uint64_t get_max() const { return max; }
+
+    protected:
+        std::vector<uint64_t> counts;   // by bucket, only as far as the highest one used
+        uint64_t count;
+        uint64_t total;
+        uint64_t max;
+
+        static size_t bucket(uint64_t value);
+
+        static uint64_t highest(size_t bucket);
+    };
+
+    static std::mutex mutex;        // guards shapes and the slow log settings
+    static std::map<std::string, Histogram> shapes;
+    static std::string slow_path;
+    static std::chrono::steady_clock::duration slow_threshold;
+    static std::mutex slow_mutex;   // held while writing to the slow log
+
+    static void log_slow(const std::string &path, const std::string &sql, const std::string &shape,
+                         std::chrono::steady_clock::duration elapsed, const uint64_t counts[Metrics::COUNTERS]);
+};
@@ -0,0 +1,893 @@
+/**
+ * @file QueryPlanner.cpp - implementation of PlanNode, QueryPlan and QueryPlanner
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <set>
+#include "QueryPlanner.h"
+#include "HashJoin.h"
+#include "ExternalSort.h"
+#include "Trace.h"
+
+using namespace std;
+using namespace hsql;
+
+static size_t bit_count(uint64_t set) {
+    size_t count = 0;
+    for (; set != 0; set &= set - 1)
+        count++;
+    return count;
+}
+
+static size_t lowest_bit(uint64_t set) {
+    size_t i = 0;
+    while ((set & (1ULL << i)) == 0)
+        i++;
+    return i;
+}
+
+
+/*
+ * ******************
+ * PlanNode
+ * ******************
+ */
+PlanNode::PlanNode(PlanType type) : type(type), children(), rows(0), cost(0), qualified(false), all_columns(true),
+                                    limit(0), offset(0) {}
+
+PlanNode::PlanNode(PlanType type, PlanNode *child) : PlanNode(type) {
+    this->children.push_back(child);
+    this->rows = child->rows;
+    this->cost = child->cost;
+}
+
+PlanNode::~PlanNode() {
+    for (PlanNode *child: this->children)
+        delete child;
+}
+
+EvalPlan *PlanNode::instantiate(const vector<Value> &parameters, QueryProfile *profile) const {
+    vector<EvalPlan *> inputs;
+    EvalPlan *plan = nullptr;
+    try {
+        for (const PlanNode *child: this->children)
+            inputs.push_back(child->instantiate(parameters, profile));
+        switch (this->type) {
+            case SCAN: {
+                ValueDict *where = nullptr;
+                if (!this->pushed.empty()) {
+                    where = new ValueDict();
+                    for (auto const &term: this->pushed)
+                        (*where)[term.column] = term.bind(parameters).value;
+                }
+                TableScan *scan = new TableScan(Tables::get_table(this->table_name), this->alias, this->qualified,
+                                                where);
+                if (!this->all_columns)
+                    scan->set_columns(this->columns);
+                if (this->limit > 0)
+                    scan->set_limit(this->limit);
+                plan = scan;
+                break;
+            }
+            case FILTER: {
+                Conjunction predicate;
+                for (auto const &term: this->predicate)
+                    predicate.push_back(term.bind(parameters));
+                plan = new Select(inputs[0], predicate);
+                break;
+            }
+            case JOIN:
+                plan = new HashJoin(inputs[0], inputs[1], this->left_keys, this->right_keys);
+                break;
+            case AGGREGATE:
+                plan = new HashAggregate(inputs[0], this->group_columns, this->aggregates);
+                break;
+            case SORT:
+                plan = new ExternalSort(inputs[0], this->sort_columns, this->descending);
+                break;
+            case TOP_N:
+                plan = new TopN(inputs[0], this->sort_columns, this->descending, this->limit);
+                break;
+            case LIMIT:
+                plan = new Limit(inputs[0], this->limit, this->offset);
+                break;
+            case PROJECT:
+                plan = new Project(inputs[0], this->input_names, this->output_names);
+                break;
+        }
+    } catch (...) {
+        for (EvalPlan *input: inputs)
+            delete input;
+        throw;
+    }
+    if (plan == nullptr)
+        throw QueryPlanError("unknown plan node");
+    if (Trace::current() != nullptr)
+        plan = new Traced(plan, describe());
+    if (profile != nullptr)
+        plan = new Instrumented(plan, profile->get_stats(this));
+    return plan;
+}
+
+static string describe(const Value &value) {
+    if (value.data_type == ColumnAttribute::TEXT)
+        return "'" + value.s + "'";
+    return to_string(value.n);
+}
+
+static string describe(const Comparison &term) {
+    static const char *const OPS[] = {"=", "<>", "<", "<=", ">", ">="};
+    string right = term.column_to_column ? term.other_column
+                                         : term.has_parameter() ? "?" : describe(term.value);
+    return term.column + " " + OPS[term.op] + " " + right;
+}
+
+static string describe(const Aggregate &aggregate) {
+    static const char *const FUNCTIONS[] = {"COUNT", "SUM", "MIN", "MAX", "AVG"};
+    return string(FUNCTIONS[aggregate.function]) + "(" + (aggregate.column.empty() ? "*" : aggregate.column) + ")";
+}
+
+// items separated by commas (or by separator)
+template<typename T>
+static string join(const vector<T> &items, const function<string(size_t)> &item, const string &separator = ", ") {
+    string joined;
+    for (size_t i = 0; i < items.size(); i++)
+        joined += (i == 0 ? "" : separator) + item(i);
+    return joined;
+}
+
+string PlanNode::describe() const {
+    auto sort_keys = [this] {
+        return join(this->sort_columns, [this](size_t i) {
+            return this->sort_columns[i] + (this->descending[i] ? " DESC" : "");
+        });
+    };
+    switch (this->type) {
+        case SCAN: {
+            string text = "Scan " + this->table_name;
+            if (this->alias != this->table_name)
+                text += " AS " + this->alias;
+            if (!this->all_columns)
+                text += " (" + join(this->columns, [this](size_t i) { return this->columns[i]; }) + ")";
+            if (!this->pushed.empty())
+                text += " where " + join(this->pushed, [this](size_t i) { return ::describe(this->pushed[i]); },
+                                         " AND ");
+            if (this->limit > 0)
+                text += " limit " + to_string(this->limit);
+            return text;
+        }
+        case FILTER:
+            return "Filter " + join(this->predicate, [this](size_t i) { return ::describe(this->predicate[i]); },
+                                    " AND ");
+        case JOIN:
+            return "Hash Join on " + join(this->left_keys, [this](size_t i) {
+                return this->left_keys[i] + " = " + this->right_keys[i];
+            }, " AND ");
+        case AGGREGATE: {
+            string text = "Hash Aggregate " + join(this->aggregates, [this](size_t i) {
+                return ::describe(this->aggregates[i]);
+            });
+            if (!this->group_columns.empty())
+                text += " by " + join(this->group_columns, [this](size_t i) { return this->group_columns[i]; });
+            return text;
+        }
+        case SORT:
+            return "Sort by " + sort_keys();
+        case TOP_N:
+            return "Top " + to_string(this->limit) + " by " + sort_keys();
+        case LIMIT:
+            return "Limit " + to_string(this->limit) + (this->offset > 0 ? " offset " + to_string(this->offset) : "");
+        case PROJECT:
+            return "Project " + join(this->output_names, [this](size_t i) {
+                return this->input_names[i] == this->output_names[i] ? this->output_names[i]
+                                                                      : this->input_names[i] + " AS " +
+                                                                        this->output_names[i];
+            });
+    }
+    return "?";
+}
+
+
+/*
+ * ******************
+ * QueryPlan
+ * ******************
+ */
+EvalPlan *QueryPlan::instantiate(const vector<Value> &parameters, QueryProfile *profile) const {
+    if (parameters.size() != this->parameter_count)
+        throw QueryPlanError("statement takes " + to_string(this->parameter_count) + " parameters, got " +
+                             to_string(parameters.size()));
+    return this->root->instantiate(parameters, profile);
+}
+
+
+/*
+ * ******************
+ * QueryPlanner
+ * ******************
+ */
+const size_t QueryPlanner::MAX_DP_TABLES;
+const double QueryPlanner::BLOCK_COST = 1.0;
+const double QueryPlanner::ROW_COST = 0.01;
+const double QueryPlanner::TERM_COST = 0.0025;
+const double QueryPlanner::HASH_COST = 0.02;
+const double QueryPlanner::SPILL_COST = 0.05;
+const double QueryPlanner::DEFAULT_DISTINCT_FRACTION = 0.1;
+const double QueryPlanner::DEFAULT_RANGE_SELECTIVITY = 1.0 / 3.0;
+
+QueryPlan *QueryPlanner::plan(const SelectStatement *statement, const vector<Value> *values) {
+    Trace::Span span("plan", "planner");
+    this->relations.clear();
+    this->column_owner.clear();
+    this->values = nullptr;
+
+    // Gather the base tables and every term of the ON and WHERE clauses
+    vector<const TableRef *> table_refs;
+    vector<const Expr *> conditions;
+    get_from_tables(statement->fromTable, table_refs, conditions);
+    if (statement->whereClause != nullptr)
+        get_conjuncts(statement->whereClause, conditions);
+    if (table_refs.size() >= 64)
+        throw QueryPlanError("too many tables in FROM");
+    bool qualified = table_refs.size() > 1;
+
+    // with more than one table, columns are named <alias>.<column>
+    ColumnNames available;
+    for (const TableRef *table_ref: table_refs) {
+        add_relation(table_ref, qualified);
+        const ColumnNames &columns = this->relations.back().columns;
+        available.insert(available.end(), columns.begin(), columns.end());
+    }
+    // placeholders are numbered in the order they appear in the text
+    map<int64_t, size_t> parameters;
+    for (const Expr *condition: conditions)
+        for (const Expr *operand: {condition->expr, condition->expr2})
+            if (operand != nullptr && operand->type == kExprPlaceholder)
+                parameters[operand->ival] = 0;
+    size_t parameter_count = 0;
+    for (auto &parameter: parameters)
+        parameter.second = parameter_count++;
+
+    if (values != nullptr && values->size() != parameter_count)
+        throw QueryPlanError("statement takes " + to_string(parameter_count) + " parameters, got " +
+                             to_string(values->size()));
+    this->values = values;
+
+    // a generic plan is value-sensitive if a parameter meets a histogram
+    Conjunction predicate;
+    bool value_sensitive = false;
+    for (const Expr *condition: conditions) {
+        predicate.push_back(get_comparison(condition, available, qualified, &parameters));
+        const Comparison &term = predicate.back();
+        const ColumnStatistics *stats = term.has_parameter() ? column_statistics(term.column) : nullptr;
+        if (values == nullptr && stats != nullptr && !stats->histogram.empty())
+            value_sensitive = true;
+    }
+
+    // Projection pushdown: unless the select list has *, the scans only decode the columns the query uses
+    ColumnNames referenced;
+    bool star = false;
+    for (const Comparison &term: predicate) {
+        referenced.push_back(term.column);
+        if (term.column_to_column)
+            referenced.push_back(term.other_column);
+    }
+    vector<const Expr *> column_exprs;
+    for (const Expr *expr: *statement->selectList) {
+        star = star || expr->type == kExprStar;
+        column_exprs.push_back(expr->type == kExprFunctionRef ? expr->expr : expr);
+    }
+    if (statement->groupBy != nullptr)
+        for (const Expr *expr: *statement->groupBy->columns)
+            column_exprs.push_back(expr);
+    if (statement->order != nullptr)
+        for (const OrderDescription *order: *statement->order)
+            column_exprs.push_back(order->expr);
+    for (const Expr *expr: column_exprs) {
+        if (expr == nullptr || expr->type != kExprColumnRef)
+            continue;
+        try {
+            referenced.push_back(get_column(expr, available, qualified));
+        } catch (QueryPlanError &) {
+            // reported with the right context below
+        }
+    }
+
+    // Terms on one table are applied at its access path, the rest where their tables are joined
+    Conjunction join_terms;
+    for (const Comparison &term: predicate) {
+        uint64_t tables = tables_of(term);
+        if (bit_count(tables) == 1)
+            this->relations[lowest_bit(tables)].local.push_back(term);
+        else
+            join_terms.push_back(term);
+    }
+
+    vector<PlanNode *> access;
+    PlanNode *plan = nullptr;
+    try {
+        for (size_t i = 0; i < this->relations.size(); i++)
+            access.push_back(access_path(i, referenced, star));
+        Candidates best = order_joins(join_terms, access);
+        plan = build_joins((1ULL << this->relations.size()) - 1, best, join_terms, access);
+    } catch (...) {
+        for (PlanNode *node: access)
+            delete node;
+        throw;
+    }
+
+    try {
+        ColumnNames columns = available;
+
+        // GROUP BY and aggregate functions
+        vector<Identifier> aggregate_names;  // output column of each function in the select list
+        bool aggregating = statement->groupBy != nullptr;
+        for (const Expr *expr: *statement->selectList)
+            aggregating = aggregating || expr->type == kExprFunctionRef;
+        if (aggregating) {
+            PlanNode *node = new PlanNode(PlanNode::AGGREGATE, plan);
+            plan = node;
+            if (statement->groupBy != nullptr) {
+                if (statement->groupBy->having != nullptr)
+                    throw QueryPlanError("HAVING is not supported");
+                for (const Expr *expr: *statement->groupBy->columns)
+                    node->group_columns.push_back(get_column(expr, columns, qualified));
+            }
+            for (const Expr *expr: *statement->selectList)
+                if (expr->type == kExprFunctionRef) {
+                    node->aggregates.push_back(get_aggregate(expr, columns, qualified));
+                    aggregate_names.push_back(node->aggregates.back().output_name);
+                }
+
+            double groups = 1;
+            for (auto const &column_name: node->group_columns)
+                groups *= distinct_count(column_name);
+            node->rows = node->group_columns.empty() ? 1 : min(groups, max(1.0, node->rows));
+            node->cost += node->children[0]->rows * HASH_COST;
+            columns = node->group_columns;
+            for (auto const &aggregate: node->aggregates)
+                columns.push_back(aggregate.output_name);
+        }
+
+        // LIMIT and OFFSET
+        bool has_limit = statement->limit != nullptr && statement->limit->limit >= 0;
+        size_t limit = has_limit ? (size_t) statement->limit->limit : 0;
+        size_t offset = statement->limit != nullptr && statement->limit->offset > 0 ? (size_t) statement->limit->offset : 0;
+
+        // ORDER BY (before projection, so it may use columns that aren't selected);
+        // with a LIMIT only the first limit + offset rows are kept, so use a bounded heap instead of a full sort
+        if (statement->order != nullptr) {
+            PlanNode *node = new PlanNode(has_limit ? PlanNode::TOP_N : PlanNode::SORT, plan);
+            plan = node;
+            for (const OrderDescription *order: *statement->order) {
+                if (order->expr->type != kExprColumnRef)
+                    throw QueryPlanError("only columns are supported in ORDER BY");
+                node->sort_columns.push_back(get_column(order->expr, columns, qualified));
+                node->descending.push_back(order->type == kOrderDesc);
+            }
+            double n = max(1.0, node->rows);
+            if (has_limit) {
+                node->limit = limit + offset;
+                node->rows = min(n, (double) node->limit);
+                node->cost += n * log2(node->limit + 2.0) * ROW_COST;
+            } else {
+                node->cost += n * log2(n + 1) * ROW_COST;
+            }
+        }
+        if (has_limit || offset > 0) {
+            // a bare scan can stop reading as soon as it has produced enough rows
+            if (plan->type == PlanNode::SCAN && has_limit)
+                plan->limit = limit + offset;
+            PlanNode *node = new PlanNode(PlanNode::LIMIT, plan);
+            plan = node;
+            node->limit = has_limit ? limit : SIZE_MAX;
+            node->offset = offset;
+            node->rows = max(0.0, min(node->rows - offset, (double) node->limit));
+        }
+
+        // Select list
+        PlanNode *node = new PlanNode(PlanNode::PROJECT, plan);
+        plan = node;
+        size_t aggregate = 0;
+        for (const Expr *expr: *statement->selectList) {
+            if (expr->type == kExprStar) {
+                for (auto const &column_name: columns) {
+                    node->input_names.push_back(column_name);
+                    node->output_names.push_back(column_name);
+                }
+            } else if (expr->type == kExprColumnRef) {
+                Identifier column_name = get_column(expr, columns, qualified);
+                node->input_names.push_back(column_name);
+                node->output_names.push_back(expr->alias != nullptr ? expr->alias : column_name);
+            } else if (expr->type == kExprFunctionRef) {
+                Identifier column_name = aggregate_names[aggregate++];
+                node->input_names.push_back(column_name);
+                node->output_names.push_back(column_name);
+            } else {
+                throw QueryPlanError("only columns, aggregates and * are supported in the select list");
+            }
+        }
+    } catch (...) {
+        delete plan;
+        throw;
+    }
+    return new QueryPlan(plan, parameter_count, value_sensitive);
+}
+
+void QueryPlanner::add_relation(const TableRef *table_ref, bool qualified) {
+    Relation relation;
+    relation.table_name = table_ref->name;
+    relation.alias = table_ref->alias != nullptr ? table_ref->alias : table_ref->name;
+    relation.qualified = qualified;
+    shared_ptr<DbRelation> table = Tables::get_table(relation.table_name);
+    relation.base_columns = table->get_column_names();
+    for (auto const &column_name: relation.base_columns) {
+        Identifier scan_name = qualified ? relation.alias + "." + column_name : column_name;
+        relation.columns.push_back(scan_name);
+        this->column_owner[scan_name] = this->relations.size();
+    }
+    relation.analyzed = this->statistics.get_statistics(relation.table_name, relation.statistics);
+    if (relation.analyzed) {
+        relation.row_count = relation.statistics.row_count;
+        relation.block_count = relation.statistics.block_count;
+    } else {
+        relation.row_count = table->estimate_row_count();
+        relation.block_count = table->get_block_count();
+    }
+    relation.width = relation.columns.size();
+    this->relations.push_back(relation);
+}
+
+uint64_t QueryPlanner::tables_of(const Comparison &term) const {
+    uint64_t tables = 1ULL << this->column_owner.at(term.column);
+    if (term.column_to_column)
+        tables |= 1ULL << this->column_owner.at(term.other_column);
+    return tables;
+}
+
+// ANALYZE's statistics for a base-table column (as the scan names it), if there are any.
+const ColumnStatistics *QueryPlanner::column_statistics(const Identifier &column) const {
+    auto owner = this->column_owner.find(column);
+    if (owner == this->column_owner.end())
+        return nullptr;
+    const Relation &relation = this->relations[owner->second];
+    if (!relation.analyzed)
+        return nullptr;
+    size_t i = find(relation.columns.begin(), relation.columns.end(), column) - relation.columns.begin();
+    auto stats = relation.statistics.columns.find(relation.base_columns[i]);
+    return stats == relation.statistics.columns.end() ? nullptr : &stats->second;
+}
+
+// Number of distinct values of a base-table column (as the scan names it).
+double QueryPlanner::distinct_count(const Identifier &column) const {
+    const ColumnStatistics *stats = column_statistics(column);
+    if (stats != nullptr)
+        return max(1.0, (double) stats->distinct_count);
+    auto owner = this->column_owner.find(column);
+    if (owner == this->column_owner.end())
+        return 1;
+    return max(1.0, this->relations[owner->second].row_count * DEFAULT_DISTINCT_FRACTION);
+}
+
+double QueryPlanner::null_fraction(const Identifier &column) const {
+    const ColumnStatistics *stats = column_statistics(column);
+    if (stats == nullptr)
+        return 0;
+    double row_count = this->relations[this->column_owner.at(column)].row_count;
+    return row_count <= 0 ? 0 : min(1.0, stats->null_count / row_count);
+}
+
+// Fraction of rows satisfying the term. Comparisons with a literal (or a parameter whose value is
+// given) use the column's MCV list and histogram when ANALYZE has built them; otherwise (including
+// comparisons with a parameter in a generic plan, which must work for whatever value it turns out
+// to be) columns are assumed uniform and independent.
+double QueryPlanner::selectivity(const Comparison &term) const {
+    bool known = !term.has_parameter() || this->values != nullptr;
+    Value value = term.has_parameter() && known ? term.bind(*this->values).value : term.value;
+    double not_null = 1 - null_fraction(term.column);
+    const ColumnStatistics *stats = column_statistics(term.column);
+    bool histogram = !term.column_to_column && known && stats != nullptr && !stats->histogram.empty();
+    double equal;
+    if (term.column_to_column) {
+        not_null *= 1 - null_fraction(term.other_column);
+        equal = 1 / max(distinct_count(term.column), distinct_count(term.other_column));
+    } else if (histogram) {
+        equal = stats->histogram.equal_selectivity(value, distinct_count(term.column));
+    } else {
+        equal = 1 / distinct_count(term.column);
+    }
+    switch (term.op) {
+        case Comparison::EQ:
+            return not_null * equal;
+        case Comparison::NE:
+            return not_null * (1 - equal);
+        default:
+            if (histogram)
+                return not_null * stats->histogram.range_selectivity(term.op, value);
+            return not_null * DEFAULT_RANGE_SELECTIVITY;
+    }
+}
+
+// There are no indices yet, so every access path is a sequential scan. The choice is which equality
+// terms to push into DbRelation::select, which checks them before decoding the rest of the row,
+// and which to leave for a Select above the scan.
+PlanNode *QueryPlanner::access_path(size_t i, const ColumnNames &referenced, bool all_columns) {
+    Relation &relation = this->relations[i];
+
+    ColumnNames columns;
+    if (!all_columns) {
+        for (auto const &column_name: relation.columns)
+            if (find(referenced.begin(), referenced.end(), column_name) != referenced.end())
+                columns.push_back(column_name);
+        relation.width = columns.size();
+    }
+
+    // candidate 1: filter everything above the scan
+    double rows = relation.row_count;
+    double filtered = rows;
+    for (auto const &term: relation.local)
+        filtered *= selectivity(term);
+    double scan_cost = relation.block_count * BLOCK_COST + rows * ROW_COST;
+    double best_cost = scan_cost + rows * TERM_COST * relation.local.size();
+
+    // candidate 2: push equality-with-value terms (at most one per column) into the scan
+    Conjunction pushed, rest;
+    set<Identifier> pushed_columns;
+    double pushed_rows = rows;
+    for (auto const &term: relation.local) {
+        if (term.op == Comparison::EQ && !term.column_to_column) {
+            size_t c = find(relation.columns.begin(), relation.columns.end(), term.column) - relation.columns.begin();
+            if (pushed_columns.insert(relation.base_columns[c]).second) {
+                Comparison base_term = term;
+                base_term.column = relation.base_columns[c];
+                pushed.push_back(base_term);
+                pushed_rows *= selectivity(term);
+                continue;
+            }
+        }
+        rest.push_back(term);
+    }
+    double pushed_cost = relation.block_count * BLOCK_COST + rows * TERM_COST * pushed.size() +
+                         pushed_rows * ROW_COST + pushed_rows * TERM_COST * rest.size();
+    bool push = !pushed.empty() && pushed_cost < best_cost;
+
+    PlanNode *scan = new PlanNode(PlanNode::SCAN);
+    scan->table_name = relation.table_name;
+    scan->alias = relation.alias;
+    scan->qualified = relation.qualified;
+    scan->all_columns = all_columns;
+    scan->columns = columns;
+    if (push) {
+        scan->pushed = pushed;
+        scan->rows = pushed_rows;
+        scan->cost = pushed_cost - pushed_rows * TERM_COST * rest.size();
+    } else {
+        rest = relation.local;
+        scan->rows = rows;
+        scan->cost = scan_cost;
+    }
+    if (rest.empty())
+        return scan;
+    PlanNode *filter = new PlanNode(PlanNode::FILTER, scan);
+    filter->predicate = rest;
+    filter->rows = filtered;
+    filter->cost = push ? pushed_cost : best_cost;
+    return filter;
+}
+
+// whether an equality term connects the two sets of relations (so they can be hash joined)
+bool QueryPlanner::connected(uint64_t left, uint64_t right, const Conjunction &join_terms) const {
+    for (auto const &term: join_terms) {
+        if (term.op != Comparison::EQ || !term.column_to_column)
+            continue;
+        uint64_t a = 1ULL << this->column_owner.at(term.column), b = 1ULL << this->column_owner.at(term.other_column);
+        if (((a & left) && (b & right)) || ((a & right) && (b & left)))
+            return true;
+    }
+    return false;
+}
+
+// Cost of hash joining the best plans for two disjoint sets; HashJoin builds on the smaller input.
+QueryPlanner::Candidate QueryPlanner::join_candidate(uint64_t left, uint64_t right, const Conjunction &join_terms,
+                                                     const Candidates &best) const {
+    const Candidate &l = best.at(left), &r = best.at(right);
+    uint64_t both = left | right;
+    double rows = l.rows * r.rows;
+    for (auto const &term: join_terms) {
+        uint64_t tables = tables_of(term);
+        if ((tables & both) == tables && (tables & left) != tables && (tables & right) != tables)
+            rows *= selectivity(term);
+    }
+
+    size_t width = 0;
+    for (size_t i = 0; i < this->relations.size(); i++)
+        if ((left >> i) & 1 || (right >> i) & 1)
+            width += this->relations[i].width;
+
+    Candidate candidate;
+    candidate.valid = true;
+    candidate.left = left;
+    candidate.right = right;
+    candidate.rows = rows;
+    candidate.cost = l.cost + r.cost + (l.rows + r.rows) * HASH_COST + rows * ROW_COST;
+    double build_bytes = min(l.rows, r.rows) * (64.0 * width + 48);
+    if (build_bytes > EvalPlan::memory_budget)
+        candidate.cost += (l.rows + r.rows) * SPILL_COST;  // Grace partitioning writes and rereads both sides
+    return candidate;
+}
+
+// Dynamic programming over subsets: the best plan for a set is the cheapest join of the best plans for
+// two complementary, connected subsets. Subsets are numerically smaller than their supersets, so
+// visiting sets in increasing order always finds the parts already solved. Too many tables for that,
+// and we greedily join whichever connected pair of partial plans is cheapest next.
+QueryPlanner::Candidates QueryPlanner::order_joins(const Conjunction &join_terms, const vector<PlanNode *> &access) {
+    size_t n = this->relations.size();
+    uint64_t all = (1ULL << n) - 1;
+    Candidates best;
+    for (size_t i = 0; i < n; i++) {
+        Candidate &base = best[1ULL << i];
+        base.valid = true;
+        base.rows = access[i]->rows;
+        base.cost = access[i]->cost;
+    }
+
+    if (n <= MAX_DP_TABLES) {
+        for (uint64_t set = 1; set <= all; set++) {
+            if (bit_count(set) < 2)
+                continue;
+            uint64_t lowest = set & (~set + 1);
+            Candidate found;
+            for (uint64_t left = (set - 1) & set; left != 0; left = (left - 1) & set) {
+                uint64_t right = set ^ left;
+                if (!(left & lowest) || right == 0)
+                    continue;  // each split once
+                auto l = best.find(left), r = best.find(right);
+                if (l == best.end() || !l->second.valid || r == best.end() || !r->second.valid ||
+                    !connected(left, right, join_terms))
+                    continue;
+                Candidate candidate = join_candidate(left, right, join_terms, best);
+                if (!found.valid || candidate.cost < found.cost)
+                    found = candidate;
+            }
+            if (found.valid)
+                best[set] = found;
+        }
+    } else {
+        vector<uint64_t> parts;
+        for (size_t i = 0; i < n; i++)
+            parts.push_back(1ULL << i);
+        while (parts.size() > 1) {
+            Candidate found;
+            size_t found_i = 0, found_j = 0;
+            for (size_t i = 0; i < parts.size(); i++)
+                for (size_t j = i + 1; j < parts.size(); j++) {
+                    if (!connected(parts[i], parts[j], join_terms))
+                        continue;
+                    Candidate candidate = join_candidate(parts[i], parts[j], join_terms, best);
+                    if (!found.valid || candidate.cost - best[parts[i]].cost - best[parts[j]].cost <
+                                        found.cost - best[found.left].cost - best[found.right].cost) {
+                        found = candidate;
+                        found_i = i;
+                        found_j = j;
+                    }
+                }
+            if (!found.valid)
+                break;
+            best[parts[found_i] | parts[found_j]] = found;
+            parts[found_i] |= parts[found_j];
+            parts.erase(parts.begin() + found_j);
+        }
+    }
+
+    auto result = best.find(all);
+    if (result == best.end() || !result->second.valid)
+        throw QueryPlanError("cross products are not supported; tables must be joined on equal columns");
+    return best;
+}
+
+// Turn the chosen candidates into plan nodes. Equality terms between the two sides become hash keys;
+// any other term is checked as soon as all of its tables have been joined.
+PlanNode *QueryPlanner::build_joins(uint64_t set, const Candidates &best, Conjunction &join_terms,
+                                    vector<PlanNode *> &access) {
+    const Candidate &candidate = best.at(set);
+    if (candidate.left == 0) {
+        size_t i = lowest_bit(set);
+        PlanNode *node = access[i];
+        access[i] = nullptr;
+        return node;
+    }
+
+    PlanNode *join = new PlanNode(PlanNode::JOIN);
+    try {
+        join->children.push_back(build_joins(candidate.left, best, join_terms, access));
+        join->children.push_back(build_joins(candidate.right, best, join_terms, access));
+    } catch (...) {
+        delete join;
+        throw;
+    }
+    join->rows = candidate.rows;
+    join->cost = candidate.cost;
+
+    Conjunction residual, remaining;
+    for (auto const &term: join_terms) {
+        uint64_t tables = tables_of(term);
+        if ((tables & set) != tables) {
+            remaining.push_back(term);
+            continue;
+        }
+        bool column_on_left = (candidate.left >> this->column_owner.at(term.column)) & 1;
+        if (term.op == Comparison::EQ && term.column_to_column &&
+            column_on_left != (bool) ((candidate.left >> this->column_owner.at(term.other_column)) & 1)) {
+            join->left_keys.push_back(column_on_left ? term.column : term.other_column);
+            join->right_keys.push_back(column_on_left ? term.other_column : term.column);
+        } else {
+            residual.push_back(term);
+        }
+    }
+    join_terms = remaining;
+    if (residual.empty())
+        return join;
+    PlanNode *filter = new PlanNode(PlanNode::FILTER, join);
+    filter->predicate = residual;
+    filter->cost += join->rows * TERM_COST * residual.size();
+    return filter;
+}
+
+// FROM clause
+void QueryPlanner::get_from_tables(const TableRef *table, vector<const TableRef *> &table_refs,
+                                   vector<const Expr *> &conditions) {
+    switch (table->type) {
+        case kTableName:
+            table_refs.push_back(table);
+            break;
+        case kTableJoin:
+            if (table->join->type != kJoinInner)
+                throw QueryPlanError("only inner joins are supported");
+            get_from_tables(table->join->left, table_refs, conditions);
+            get_from_tables(table->join->right, table_refs, conditions);
+            if (table->join->condition != nullptr)
+                get_conjuncts(table->join->condition, conditions);
+            break;
+        case kTableCrossProduct:
+            for (const TableRef *tbl: *table->list)
+                get_from_tables(tbl, table_refs, conditions);
+            break;
+        default:
+            throw QueryPlanError("subqueries are not supported");
+    }
+}
+
+// AND-tree
+void QueryPlanner::get_conjuncts(const Expr *expr, vector<const Expr *> &conditions) {
+    if (expr->type == kExprOperator && expr->opType == Expr::AND) {
+        get_conjuncts(expr->expr, conditions);
+        get_conjuncts(expr->expr2, conditions);
+    } else
+        conditions.push_back(expr);
+}
+
+// Comparison term
+Comparison QueryPlanner::get_comparison(const Expr *expr, const ColumnNames &column_names, bool qualified,
+                                        const map<int64_t, size_t> *parameters) {
+    if (expr->type != kExprOperator || expr->expr == nullptr || expr->expr2 == nullptr)
+        throw QueryPlanError("only AND of comparisons is supported in WHERE and ON");
+
+    Comparison::Op op;
+    switch (expr->opType) {
+        case Expr::SIMPLE_OP:
+            if (expr->opChar == '=')
+                op = Comparison::EQ;
+            else if (expr->opChar == '<')
+                op = Comparison::LT;
+            else if (expr->opChar == '>')
+                op = Comparison::GT;
+            else
+                throw QueryPlanError(string("unsupported operator ") + expr->opChar);
+            break;
+        case Expr::NOT_EQUALS:
+            op = Comparison::NE;
+            break;
+        case Expr::LESS_EQ:
+            op = Comparison::LE;
+            break;
+        case Expr::GREATER_EQ:
+            op = Comparison::GE;
+            break;
+        default:
+            throw QueryPlanError("unsupported operator");
+    }
+
+    // Keep the column on the left: 5 < x becomes x > 5
+    const Expr *left = expr->expr, *right = expr->expr2;
+    if (left->type != kExprColumnRef) {
+        swap(left, right);
+        if (op == Comparison::LT)
+            op = Comparison::GT;
+        else if (op == Comparison::GT)
+            op = Comparison::LT;
+        else if (op == Comparison::LE)
+            op = Comparison::GE;
+        else if (op == Comparison::GE)
+            op = Comparison::LE;
+    }
+    if (left->type != kExprColumnRef)
+        throw QueryPlanError("comparison must involve a column");
+
+    Identifier column_name = get_column(left, column_names, qualified);
+    switch (right->type) {
+        case kExprColumnRef:
+            return Comparison(column_name, op, get_column(right, column_names, qualified));
+        case kExprLiteralInt:
+            return Comparison(column_name, op, Value((int32_t) right->ival));
+        case kExprLiteralString:
+            return Comparison(column_name, op, Value(string(right->name)));
+        case kExprPlaceholder:
+            if (parameters == nullptr || parameters->find(right->ival) == parameters->end())
+                throw QueryPlanError("parameters are not allowed here");
+            return Comparison::with_parameter(column_name, op, parameters->at(right->ival));
+        default:
+            throw QueryPlanError("unsupported value in comparison");
+    }
+}
+
+// Column reference
+Identifier QueryPlanner::get_column(const Expr *expr, const ColumnNames &column_names, bool qualified) {
+    if (expr->type != kExprColumnRef)
+        throw QueryPlanError("expected a column name");
+    Identifier name = expr->name;
+    if (!qualified || (expr->table == nullptr &&
+                       find(column_names.begin(), column_names.end(), name) != column_names.end())) {
+        if (find(column_names.begin(), column_names.end(), name) == column_names.end())
+            throw QueryPlanError("unknown column " + name);
+        return name;
+    }
+    if (expr->table != nullptr) {
+        Identifier full_name = string(expr->table) + "." + name;
+        if (find(column_names.begin(), column_names.end(), full_name) == column_names.end())
+            throw QueryPlanError("unknown column " + full_name);
+        return full_name;
+    }
+    Identifier found;
+    string suffix = "." + name;
+    for (auto const &column_name: column_names) {
+        if (column_name.size() > suffix.size() &&
+            column_name.compare(column_name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            if (!found.empty())
+                throw QueryPlanError("ambiguous column " + name);
+            found = column_name;
+        }
+    }
+    if (found.empty())
+        throw QueryPlanError("unknown column " + name);
+    return found;
+}
+
+// Aggregate function call
+Aggregate QueryPlanner::get_aggregate(const Expr *expr, const ColumnNames &column_names, bool qualified) {
+    string function = expr->name;
+    transform(function.begin(), function.end(), function.begin(), ::toupper);
+    if (expr->distinct)
+        throw QueryPlanError("DISTINCT aggregates are not supported");
+    if (expr->expr == nullptr)
+        throw QueryPlanError(function + " needs an argument");
+
+    Identifier column_name;
+    if (expr->expr->type != kExprStar)
+        column_name = get_column(expr->expr, column_names, qualified);
+    Identifier output_name = expr->alias != nullptr ? string(expr->alias)
+                                                    : function + "(" + (column_name.empty() ? "*" : column_name) + ")";
+
+    if (function == "COUNT")
+        return Aggregate(Aggregate::COUNT, column_name, output_name);
+    if (function == "SUM")
+        return Aggregate(Aggregate::SUM, column_name, output_name);
+    if (function == "MIN")
+        return Aggregate(Aggregate::MIN, column_name, output_name);
+    if (function == "MAX")
+        return Aggregate(Aggregate::MAX, column_name, output_name);
+    if (function == "AVG")
+        return Aggregate(Aggregate::AVG, column_name, output_name);
+    throw QueryPlanError("unknown function " + function);
+}
@@ -0,0 +1,300 @@
+/**
+ * @file QueryPlanner.h - cost-based planning of SELECT statements
+ * QueryPlanError
+ * PlanNode
+ * QueryProfile
+ * QueryPlan
+ * QueryPlanner
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <exception>
+#include <string>
+#include "SQLParser.h"
+#include "schema_tables.h"
+#include "EvalPlan.h"
+#include "HashAggregate.h"
+
+/**
+ * @class QueryPlanError - exception for statements the planner can't handle
+ */
+class QueryPlanError : public std::runtime_error {
+public:
+    explicit QueryPlanError(std::string s) : runtime_error(s) {}
+};
+
+
+/**
+ * @class PlanNode - one operator of a logical plan, annotated with the planner's estimates.
+ * Which of the fields are used depends on the type:
+ *      SCAN       table_name, alias, qualified, all_columns/columns, pushed, limit
+ *      FILTER     predicate
+ *      JOIN       left_keys (of children[0]), right_keys (of children[1])
+ *      AGGREGATE  group_columns, aggregates
+ *      SORT       sort_columns, descending
+ *      TOP_N      sort_columns, descending, limit
+ *      LIMIT      limit, offset
+ *      PROJECT    input_names, output_names
+ */
+class QueryProfile; // forward declare
+
+class PlanNode {
+public:
+    enum PlanType {
+        SCAN, FILTER, JOIN, AGGREGATE, SORT, TOP_N, LIMIT, PROJECT
+    };
+
+    PlanNode(PlanType type);
+
+    PlanNode(PlanType type, PlanNode *child);
+
+    virtual ~PlanNode();
+
+    PlanNode(const PlanNode &other) = delete;
+
+    PlanNode &operator=(const PlanNode &other) = delete;
+
+    /**
+     * Build the physical operators for this subtree.
+     * @param parameters  values for the statement's parameters
+     * @param profile     if not nullptr, each operator is Instrumented, adding to its node's stats here
+     * @returns           the operator tree (freed by caller)
+     */
+    virtual EvalPlan *instantiate(const std::vector<Value> &parameters, QueryProfile *profile = nullptr) const;
+
+    /**
+     * @returns  a one-line description of this operator, e.g. "Hash Join (a.id = b.id)"
+     */
+    virtual std::string describe() const;
+
+    PlanType type;
+    std::vector<PlanNode *> children;
+    double rows;  // estimated output rows
+    double cost;  // estimated cost of the whole subtree
+
+    Identifier table_name;
+    Identifier alias;
+    bool qualified;
+    bool all_columns;
+    ColumnNames columns;
+    Conjunction pushed;  // equality terms checked by the scan itself, by the table's column names
+    Conjunction predicate;
+    ColumnNames left_keys;
+    ColumnNames right_keys;
+    ColumnNames group_columns;
+    Aggregates aggregates;
+    ColumnNames sort_columns;
+    std::vector<bool> descending;
+    size_t limit;
+    size_t offset;
+    ColumnNames input_names;
+    ColumnNames output_names;
+};
+
+
+/**
+ * @class QueryProfile - what each operator of a plan did in one instrumented run (EXPLAIN ANALYZE)
+ */
+class QueryProfile {
+public:
+    QueryProfile() : stats() {}
+
+    /**
+     * @param node  a node of the plan
+     * @returns     the stats of the node's operator (all zero if it has done nothing yet)
+     */
+    virtual OperatorStats &get_stats(const PlanNode *node) { return stats[node]; }
+
+protected:
+    std::map<const PlanNode *, OperatorStats> stats;
+};
+
+
+/**
+ * @class QueryPlan - the planner's choice for one statement. It holds no rows or open files,
+ * so it can be instantiated any number of times, each time with new values for the statement's
+ * parameters (the ? placeholders, numbered in the order they appear in the text).
+ *
+ * A plan made without knowing its parameters' values is generic: comparisons with them are
+ * estimated as for any value. If some are with columns that have histograms, the values would
+ * have given better estimates, and the plan is value-sensitive: a plan made for the values at hand
+ * (see QueryPlanner::plan) may be better.
+ */
+class QueryPlan {
+public:
+    QueryPlan(PlanNode *root, size_t parameter_count = 0, bool value_sensitive = false)
+            : root(root), parameter_count(parameter_count), value_sensitive(value_sensitive) {}
+
+    virtual ~QueryPlan() { delete root; }
+
+    QueryPlan(const QueryPlan &other) = delete;
+
+    QueryPlan &operator=(const QueryPlan &other) = delete;
+
+    /**
+     * Build the physical operators to run this plan.
+     * @param parameters  values for the statement's parameters
+     * @param profile     if not nullptr, where the operators add what they do (see PlanNode::instantiate)
+     * @returns           the operator tree (freed by caller)
+     */
+    virtual EvalPlan *instantiate(const std::vector<Value> &parameters, QueryProfile *profile = nullptr) const;
+
+    virtual const PlanNode *get_root() const { return root; }
+
+    virtual size_t get_parameter_count() const { return parameter_count; }
+
+    virtual bool is_value_sensitive() const { return value_sensitive; }
+
+protected:
+    PlanNode *root;
+    size_t parameter_count;
+    bool value_sensitive;
+};
+
+
+/**
+ * @class QueryPlanner - turns a SELECT's AST into a QueryPlan.
+ *
+ * Each base table gets the cheapest of its access paths, and join orders are enumerated bottom-up
+ * over subsets of the tables (dynamic programming, bushy trees allowed, no cross products).
+ * Row counts, block counts, distinct counts and null fractions come from the statistics ANALYZE
+ * stores in _statistics, and selectivities of comparisons with literals from its MCV lists and
+ * histograms; tables never analyzed fall back to cheap estimates from the storage engine.
+ */
+class QueryPlanner {
+public:
+    /**
+     * Above this many tables, join order is chosen greedily instead of exhaustively.
+     */
+    static const size_t MAX_DP_TABLES = 10;
+
+    // cost units: one block read is 1.0
+    static const double BLOCK_COST;
+    static const double ROW_COST;
+    static const double TERM_COST;
+    static const double HASH_COST;
+    static const double SPILL_COST;
+
+    // selectivities when nothing better is known
+    static const double DEFAULT_DISTINCT_FRACTION;
+    static const double DEFAULT_RANGE_SELECTIVITY;
+
+    QueryPlanner(Statistics &statistics) : statistics(statistics), relations(), column_owner(), values(nullptr) {}
+
+    virtual ~QueryPlanner() {}
+
+    /**
+     * Plan a SELECT statement.
+     * @param statement  Hyrise AST of the statement
+     * @param values     if not nullptr, the values its parameters will have, to estimate comparisons
+     *                   with them as with literals (the plan is then only meant for these values)
+     * @returns          the chosen plan (freed by caller)
+     */
+    virtual QueryPlan *plan(const hsql::SelectStatement *statement, const std::vector<Value> *values = nullptr);
+
+    /**
+     * Flatten the FROM clause into its base tables plus the conditions of any inner joins.
+     * @param table       AST table reference
+     * @param table_refs  returned by reference: base tables, left to right
+     * @param conditions  returned by reference: conjuncts of the ON clauses
+     */
+    static void get_from_tables(const hsql::TableRef *table, std::vector<const hsql::TableRef *> &table_refs,
+                                std::vector<const hsql::Expr *> &conditions);
+
+    /**
+     * Split an AND-tree into its terms.
+     * @param expr        AST expression
+     * @param conditions  returned by reference: terms are appended
+     */
+    static void get_conjuncts(const hsql::Expr *expr, std::vector<const hsql::Expr *> &conditions);
+
+    /**
+     * Translate a comparison between columns and/or literals and/or parameters.
+     * @param expr          AST comparison expression
+     * @param column_names  columns available to the expression
+     * @param qualified     whether column_names are qualified by table ("t.c")
+     * @param parameters    parameter number of each placeholder, by its position in the text
+     *                      (nullptr if placeholders aren't allowed)
+     * @returns             the equivalent Comparison (column always on the left)
+     */
+    static Comparison get_comparison(const hsql::Expr *expr, const ColumnNames &column_names, bool qualified,
+                                     const std::map<int64_t, size_t> *parameters = nullptr);
+
+    /**
+     * Resolve a column reference against the available columns.
+     * @param expr          AST column reference
+     * @param column_names  columns available to the expression
+     * @param qualified     whether column_names are qualified by table ("t.c")
+     * @returns             the matching entry of column_names
+     */
+    static Identifier get_column(const hsql::Expr *expr, const ColumnNames &column_names, bool qualified);
+
+    /**
+     * Translate an aggregate function call from the select list.
+     * @param expr          AST function reference, e.g. COUNT(*) or SUM(x)
+     * @param column_names  columns available to the expression
+     * @param qualified     whether column_names are qualified by table ("t.c")
+     * @returns             the equivalent Aggregate
+     */
+    static Aggregate get_aggregate(const hsql::Expr *expr, const ColumnNames &column_names, bool qualified);
+
+protected:
+    // a base table of the query
+    struct Relation {
+        Identifier table_name;
+        Identifier alias;
+        bool qualified;
+        ColumnNames columns;       // as the scan names them
+        ColumnNames base_columns;  // as the table names them
+        bool analyzed;
+        TableStatistics statistics;
+        double row_count;
+        double block_count;
+        size_t width;              // number of columns scanned
+        Conjunction local;         // terms on this table alone
+    };
+
+    // best plan found for a set of relations (a bitmask over relations)
+    struct Candidate {
+        Candidate() : valid(false), rows(0), cost(0), left(0), right(0) {}
+
+        bool valid;
+        double rows;
+        double cost;
+        uint64_t left;   // the two subsets joined, or 0 for a base relation
+        uint64_t right;
+    };
+
+    typedef std::map<uint64_t, Candidate> Candidates;
+
+    Statistics &statistics;
+    std::vector<Relation> relations;
+    std::map<Identifier, size_t> column_owner;  // scan column name -> index into relations
+    const std::vector<Value> *values;           // of the parameters, if planning for them
+
+    virtual void add_relation(const hsql::TableRef *table_ref, bool qualified);
+
+    virtual uint64_t tables_of(const Comparison &term) const;
+
+    virtual const ColumnStatistics *column_statistics(const Identifier &column) const;
+
+    virtual double distinct_count(const Identifier &column) const;
+
+    virtual double null_fraction(const Identifier &column) const;
+
+    virtual double selectivity(const Comparison &term) const;
+
+    virtual PlanNode *access_path(size_t relation, const ColumnNames &referenced, bool all_columns);
+
+    virtual bool connected(uint64_t left, uint64_t right, const Conjunction &join_terms) const;
+
+    virtual Candidate join_candidate(uint64_t left, uint64_t right, const Conjunction &join_terms,
+                                     const Candidates &best) const;
+
+    virtual Candidates order_joins(const Conjunction &join_terms, const std::vector<PlanNode *> &access);
+
+    virtual PlanNode *build_joins(uint64_t set, const Candidates &best, Conjunction &join_terms,
+                                  std::vector<PlanNode *> &access);
+};
@@ -0,0 +1,359 @@
+/**
+ * @file ResultWriter.cpp - implementation of ResultWriter
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include <climits>
+#include <sstream>
+#include "ResultWriter.h"
+#include "SQLExec.h"
+
+using namespace std;
+
+const size_t ResultWriter::BUFFER_SIZE;
+
+static const char DIGIT_PAIRS[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+ResultWriter::ResultWriter(ostream &out, Format format, ostream &log) : out(out), format(format), log(log), buffer(),
+                                                                      column_names(), sorted(), cells() {
+    this->buffer.reserve(BUFFER_SIZE + 1024);
+}
+
+ResultWriter::~ResultWriter() {
+    flush();
+}
+
+void ResultWriter::flush() {
+    if (!this->buffer.empty()) {
+        this->out.write(this->buffer.data(), this->buffer.size());
+        this->buffer.clear();
+    }
+    this->out.flush();
+}
+
+bool ResultWriter::parse_format(const string &name, Format &format) {
+    string lower = name;
+    transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (lower == "table")
+        format = TABLE;
+    else if (lower == "csv")
+        format = CSV;
+    else if (lower == "tsv")
+        format = TSV;
+    else if (lower == "jsonl")
+        format = JSONL;
+    else
+        return false;
+    return true;
+}
+
+string ResultWriter::format_name(Format format) {
+    switch (format) {
+        case TABLE:
+            return "table";
+        case CSV:
+            return "csv";
+        case TSV:
+            return "tsv";
+        case JSONL:
+            return "jsonl";
+    }
+    return "?";
+}
+
+char *ResultWriter::format_int(int32_t n, char *end) {
+    uint32_t u = n < 0 ? 0U - (uint32_t) n : (uint32_t) n;
+    char *p = end;
+    while (u >= 100) {
+        uint32_t pair = (u % 100) * 2;
+        u /= 100;
+        *--p = DIGIT_PAIRS[pair + 1];
+        *--p = DIGIT_PAIRS[pair];
+    }
+    if (u >= 10) {
+        *--p = DIGIT_PAIRS[u * 2 + 1];
+        *--p = DIGIT_PAIRS[u * 2];
+    } else {
+        *--p = (char) ('0' + u);
+    }
+    if (n < 0)
+        *--p = '-';
+    return p;
+}
+
+void ResultWriter::write(QueryResult &result) {
+    write_rows(result);
+    flush();
+    (this->format == TABLE ? this->out : this->log) << result.get_message() << '\n';
+}
+
+void ResultWriter::write_rows(QueryResult &result) {
+    const ColumnNames *column_names = result.get_column_names();
+    if (column_names != nullptr) {
+        begin(*column_names);
+        ValueDicts *batch;
+        while (!(batch = result.fetch())->empty()) {
+            for (ValueDict *row: *batch) {
+                write(*row);
+                delete row;
+            }
+            delete batch;
+        }
+        delete batch;
+    }
+}
+
+void ResultWriter::begin(const ColumnNames &column_names, bool header) {
+    this->column_names = column_names;
+    this->sorted.clear();
+    for (size_t i = 0; i < column_names.size(); i++)
+        this->sorted.push_back(make_pair(column_names[i], i));
+    sort(this->sorted.begin(), this->sorted.end());
+    this->cells.assign(column_names.size(), nullptr);
+    if (header)
+        write_header(column_names);
+}
+
+// Rows are std::maps ordered by column name, so the row's cells are found with one merge-like walk
+// against the column names sorted once in begin, instead of a lookup (and a copy) per cell.
+void ResultWriter::write(const ValueDict &row) {
+    auto cell = row.begin();
+    for (auto const &column: this->sorted) {
+        while (cell != row.end() && cell->first < column.first)
+            cell++;
+        if (cell == row.end() || cell->first != column.first)
+            throw DbRelationError("row is missing column " + column.first);
+        this->cells[column.second] = &cell->second;
+    }
+    write_row();
+    flush_if_full();
+}
+
+void ResultWriter::write_header(const ColumnNames &column_names) {
+    switch (this->format) {
+        case TABLE:
+            for (auto const &column_name: column_names) {
+                this->buffer += column_name;
+                this->buffer += ' ';
+            }
+            this->buffer += "\n+";
+            for (size_t i = 0; i < column_names.size(); i++)
+                this->buffer += "----------+";
+            this->buffer += '\n';
+            break;
+        case CSV:
+        case TSV:
+            for (size_t i = 0; i < column_names.size(); i++) {
+                if (i > 0)
+                    this->buffer += this->format == CSV ? ',' : '\t';
+                if (this->format == CSV)
+                    write_quoted(column_names[i], '"');
+                else
+                    write_escaped_tsv(column_names[i]);
+            }
+            this->buffer += '\n';
+            break;
+        case JSONL:
+            break;
+    }
+}
+
+void ResultWriter::write_row() {
+    const vector<const Value *> &cells = this->cells;
+    switch (this->format) {
+        case TABLE:
+            for (const Value *cell: cells) {
+                if (cell->data_type == ColumnAttribute::TEXT) {
+                    this->buffer += '"';
+                    this->buffer += cell->s;
+                    this->buffer += '"';
+                } else {
+                    write_value(*cell);
+                }
+                this->buffer += ' ';
+            }
+            break;
+        case CSV:
+        case TSV:
+            for (size_t i = 0; i < cells.size(); i++) {
+                if (i > 0)
+                    this->buffer += this->format == CSV ? ',' : '\t';
+                write_value(*cells[i]);
+            }
+            break;
+        case JSONL:
+            this->buffer += '{';
+            for (size_t i = 0; i < cells.size(); i++) {
+                if (i > 0)
+                    this->buffer += ',';
+                write_json_string(this->column_names[i]);
+                this->buffer += ':';
+                write_value(*cells[i]);
+            }
+            this->buffer += '}';
+            break;
+    }
+    this->buffer += '\n';
+}
+
+void ResultWriter::write_value(const Value &value) {
+    switch (value.data_type) {
+        case ColumnAttribute::INT:
+            write_int(value.n);
+            break;
+        case ColumnAttribute::TEXT:
+            if (this->format == CSV)
+                write_quoted(value.s, '"');
+            else if (this->format == TSV)
+                write_escaped_tsv(value.s);
+            else if (this->format == JSONL)
+                write_json_string(value.s);
+            else
+                this->buffer += value.s;
+            break;
+        case ColumnAttribute::BOOLEAN:
+            this->buffer += value.n == 0 ? "false" : "true";
+            break;
+        default:
+            this->buffer += this->format == JSONL ? "null" : "???";
+    }
+}
+
+void ResultWriter::write_int(int32_t n) {
+    char digits[12];
+    char *end = digits + sizeof(digits);
+    char *start = format_int(n, end);
+    this->buffer.append(start, end - start);
+}
+
+// CSV: quote only if needed, doubling any quotes inside
+void ResultWriter::write_quoted(const string &s, char quote) {
+    if (s.find_first_of(",\"\r\n") == string::npos && (s.empty() || (s.front() != ' ' && s.back() != ' '))) {
+        this->buffer += s;
+        return;
+    }
+    this->buffer += quote;
+    for (char c: s) {
+        if (c == quote)
+            this->buffer += quote;
+        this->buffer += c;
+    }
+    this->buffer += quote;
+}
+
+void ResultWriter::write_escaped_tsv(const string &s) {
+    for (char c: s) {
+        switch (c) {
+            case '\t':
+                this->buffer += "\\t";
+                break;
+            case '\n':
+                this->buffer += "\\n";
+                break;
+            case '\r':
+                this->buffer += "\\r";
+                break;
+            case '\\':
+                this->buffer += "\\\\";
+                break;
+            default:
+                this->buffer += c;
+        }
+    }
+}
+
+void ResultWriter::write_json_string(const string &s) {
+    static const char HEX[] = "0123456789abcdef";
+    this->buffer += '"';
+    for (char c: s) {
+        unsigned char u = (unsigned char) c;
+        if (c == '"' || c == '\\') {
+            this->buffer += '\\';
+            this->buffer += c;
+        } else if (c == '\n') {
+            this->buffer += "\\n";
+        } else if (c == '\t') {
+            this->buffer += "\\t";
+        } else if (c == '\r') {
+            this->buffer += "\\r";
+        } else if (u < 0x20) {
+            this->buffer += "\\u00";
+            this->buffer += HEX[u >> 4];
+            this->buffer += HEX[u & 0xF];
+        } else {
+            this->buffer += c;
+        }
+    }
+    this->buffer += '"';
+}
+
+// Write the rows in the format and compare with what that should give.
+static bool test_format(ResultWriter::Format format, const vector<ValueDict> &rows, const string &expected) {
+    ostringstream out, log;
+    ResultWriter writer(out, format, log);
+    writer.begin(ColumnNames{"a", "b,c"});
+    for (auto const &row: rows)
+        writer.write(row);
+    writer.flush();
+    return out.str() == expected;
+}
+
+bool test_result_writer() {
+    vector<ValueDict> rows(4);
+    rows[0]["a"] = Value(-12345);
+    rows[0]["b,c"] = Value("say \"hi\", ok\nbye");
+    rows[1]["a"] = Value(INT32_MIN);
+    rows[1]["b,c"] = Value("");
+    rows[2]["a"] = Value(0);
+    rows[2]["b,c"] = Value(" tab\there\\ ");
+    rows[3]["a"] = Value(7);
+    rows[3]["b,c"] = Value(string("\x01\r", 2));
+
+    // CSV quotes a field with a comma, quote, line break or outer spaces, doubling its quotes
+    bool csv = test_format(ResultWriter::CSV, rows,
+                           "a,\"b,c\"\n"
+                           "-12345,\"say \"\"hi\"\", ok\nbye\"\n"
+                           "-2147483648,\n"
+                           "0,\" tab\there\\ \"\n"
+                           "7,\"\x01\r\"\n");
+    std::cout << "csv ok" << std::endl;
+
+    // TSV escapes tabs, line breaks and backslashes instead
+    bool tsv = test_format(ResultWriter::TSV, rows,
+                           "a\tb,c\n"
+                           "-12345\tsay \"hi\", ok\\nbye\n"
+                           "-2147483648\t\n"
+                           "0\t tab\\there\\\\ \n"
+                           "7\t\x01\\r\n");
+    std::cout << "tsv ok" << std::endl;
+
+    // JSON escapes quotes, backslashes and every control character
+    bool jsonl = test_format(ResultWriter::JSONL, rows,
+                             "{\"a\":-12345,\"b,c\":\"say \\\"hi\\\", ok\\nbye\"}\n"
+                             "{\"a\":-2147483648,\"b,c\":\"\"}\n"
+                             "{\"a\":0,\"b,c\":\" tab\\there\\\\ \"}\n"
+                             "{\"a\":7,\"b,c\":\"\\u0001\\r\"}\n");
+    std::cout << "jsonl ok" << std::endl;
+
+    // a row without one of the columns is an error, not a partial line
+    bool missing = false;
+    try {
+        ostringstream out;
+        ResultWriter writer(out, ResultWriter::CSV);
+        writer.begin(ColumnNames{"a", "z"}, false);
+        writer.write(rows[0]);
+    } catch (DbRelationError &e) {
+        missing = true;
+    }
+    return csv && tsv && jsonl && missing;
+}
@@ -0,0 +1,123 @@
+/**
+ * @file ResultWriter.h - formatting query results for the shell and for exports
+ * ResultWriter
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <iostream>
+#include <string>
+#include "storage_engine.h"
+
+class QueryResult; // forward declare
+
+/**
+ * @class ResultWriter - writes query results to a stream in one of several formats:
+ *      TABLE  the shell's layout: column names, a rule, one line per row with text quoted
+ *      CSV    comma-separated values with a header line (RFC 4180 quoting)
+ *      TSV    tab-separated values with a header line (\t, \n, \r and \\ escaped)
+ *      JSONL  one JSON object per row
+ * Output is built in a large buffer and written in chunks, so nothing is flushed per row.
+ * For the export formats, messages ("successfully returned ...") go to a separate log stream
+ * so that the output stream holds only data.
+ */
+class ResultWriter {
+public:
+    enum Format {
+        TABLE, CSV, TSV, JSONL
+    };
+
+    static const size_t BUFFER_SIZE = 64 * 1024;
+
+    /**
+     * @param out     where to write the results
+     * @param format  how to format them
+     * @param log     where messages go for the export formats
+     */
+    ResultWriter(std::ostream &out, Format format = TABLE, std::ostream &log = std::cerr);
+
+    virtual ~ResultWriter();
+
+    ResultWriter(const ResultWriter &other) = delete;
+
+    ResultWriter &operator=(const ResultWriter &other) = delete;
+
+    /**
+     * Write a result, fetching its rows batch by batch (which uses it up).
+     * @param result  the result to write
+     */
+    virtual void write(QueryResult &result);
+
+    /**
+     * Write a result's rows but not its message, leaving the rows buffered.
+     * @param result  the result to write
+     */
+    virtual void write_rows(QueryResult &result);
+
+    /**
+     * Start writing rows with the given columns (for writing rows that don't come from a QueryResult).
+     * @param column_names  the columns, in output order
+     * @param header        whether to write the header line (if the format has one)
+     */
+    virtual void begin(const ColumnNames &column_names, bool header = true);
+
+    /**
+     * Write one row, after begin.
+     * @param row  the row, with a value for each of the columns
+     */
+    virtual void write(const ValueDict &row);
+
+    /**
+     * Write out whatever is buffered.
+     */
+    virtual void flush();
+
+    /**
+     * Look up a format by name (case-insensitive).
+     * @param name    "table", "csv", "tsv" or "jsonl"
+     * @param format  returned by reference
+     * @returns       false if there is no such format
+     */
+    static bool parse_format(const std::string &name, Format &format);
+
+    static std::string format_name(Format format);
+
+    /**
+     * Format an integer in decimal, right to left, two digits at a time.
+     * @param n    the integer
+     * @param end  one past the last character to write; there must be room for 11 before it
+     * @returns    the first character written
+     */
+    static char *format_int(int32_t n, char *end);
+
+protected:
+    std::ostream &out;
+    Format format;
+    std::ostream &log;
+    std::string buffer;
+    ColumnNames column_names;                              // as given to begin
+    std::vector<std::pair<Identifier, size_t>> sorted;     // (column name, output position), by name
+    std::vector<const Value *> cells;                      // current row's values, in output order
+
+    void write_header(const ColumnNames &column_names);
+
+    void write_row();
+
+    void write_value(const Value &value);
+
+    void write_int(int32_t n);
+
+    void write_quoted(const std::string &s, char quote);
+
+    void write_json_string(const std::string &s);
+
+    void write_escaped_tsv(const std::string &s);
+
+    void flush_if_full() {
+        if (buffer.size() >= BUFFER_SIZE)
+            flush();
+    }
+};
+
+bool test_result_writer();
@@ -7,19 +7,34 @@
  */
 
 #include <cstdlib>
+#include <csignal>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include "db_cxx.h"
+#include "BulkLoader.h"
+#include "EvalPlan.h"
+#include "ExternalSort.h"
+#include "HashAggregate.h"
+#include "HashJoin.h"
+#include "LockManager.h"
 #include "ParseTreeToString.h"
+#include "PlanCache.h"
+#include "ResultWriter.h"
 #include "SQLParser.h"
 #include "SQLExec.h"
+#include "Trace.h"
+#include "ScriptRunner.h"
+#include "SQLServer.h"
+#include "TableExporter.h"
+#include "Workload.h"
 
 using namespace hsql;
 using namespace std;
  
 DbEnv* _DB_ENV; // Global DB environment
-const u_int32_t ENV_FLAGS = DB_CREATE | DB_INIT_MPOOL;
+const u_int32_t ENV_FLAGS = DB_CREATE | DB_INIT_MPOOL | DB_INIT_CDB | DB_THREAD; // handles shared by server sessions and spill workers
 const std::string TEST = "test", QUIT = "quit";
 
 /**
@@ -34,6 +49,26 @@ void initalizeDbEnv(string);
  */
 void runSQLShell();
 
+/**
+ * Runs a script of ;-terminated statements without prompting
+ * @param path The script file, or "-" for standard input
+ * @return The number of statements that failed
+ */
+size_t runScript(string);
+
+/**
+ * Serves clients (see SQLClient.cpp) until interrupted
+ * @param address The port number or Unix-domain socket path to listen on
+ */
+void runServer(string);
+
+/**
+ * Runs a synthetic workload (see Workload.h) and reports its throughput and latencies
+ * @param args The workload's name and its name=value options
+ * @return Whether it ran
+ */
+bool runWorkload(const vector<string>&);
+
 /**
  * Processes a single SQL query
  * @param sql A SQL query (or queries) to process
@@ -41,22 +76,54 @@ void runSQLShell();
 void handleSQL(string);
 
 /**
- * Processes SQL statements within a parsed query
- * @param parsedSQL A pointer to a parsed SQL query
+ * Prints a query result as its rows are fetched (in the format chosen with SET FORMAT), then frees it
+ * @param result The query result
  */
-void handleStatements(SQLParserResult*);
+void printResult(QueryResult*);
+
+/**
+ * Runs the shell's statements (see StatementRunner), echoing each parsed one and printing its result
+ */
+class Shell : public StatementRunner {
+public:
+    Shell() : StatementRunner(nullptr) {}
+
+protected:
+    virtual void take(QueryResult* result) { printResult(result); }
+
+    virtual void fail(const string& message) { cout << "Error: " << message << endl; }
+
+    // the test command, or SQL the parser didn't accept
+    virtual void invalid(const string& sql, const SQLParserResult* parsedSQL);
+
+    virtual void starting(const SQLStatement* statement) { cout << ParseTreeToString::statement(statement) << endl; }
+};
 
 /**
  * Main
 */
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cout << "USAGE: " << argv[0] << " [db_environment]\n";
+    bool server = argc == 4 && string(argv[2]) == "--listen";
+    bool workload = argc >= 4 && string(argv[2]) == "--workload";
+    if (argc != 2 && argc != 3 && !server && !workload) {
+        std::cout << "USAGE: " << argv[0] << " [db_environment] [script_file | - | --listen port_or_socket_path"
+                  << " | --workload name [option=value ...]]\n";
         return EXIT_FAILURE;
     }
 
     initalizeDbEnv(argv[1]);
 
+    if (workload)
+        return runWorkload(vector<string>(argv + 3, argv + argc)) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (server) {
+        runServer(argv[3]);
+        return EXIT_SUCCESS;
+    }
+
+    if (argc == 3)
+        return runScript(argv[2]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
     runSQLShell();
 
     return EXIT_SUCCESS;
@@ -83,6 +150,13 @@ void initalizeDbEnv(string envDir)
 void runSQLShell() 
 {
     string sql = "";
+
+    // the shell is one session: a transaction begun with BEGIN lasts until COMMIT or ROLLBACK,
+    // and a trace begun with SET TRACE until SET TRACE off
+    TransactionBlock session;
+    TransactionBlock::Scope scope(&session);
+    Trace trace;
+    Trace::Scope trace_scope(&trace);
     
     while (sql != QUIT) 
     {
@@ -94,37 +168,113 @@ void runSQLShell()
     }
 }
 
+size_t runScript(string path)
+{
+    if (path == "-") {
+        ScriptRunner runner(cin, cout);
+        return runner.run();
+    }
+    ifstream script(path);
+    if (!script) {
+        cerr << "(sql5300: cannot open " << path << ")" << endl;
+        return 1;
+    }
+    ScriptRunner runner(script, cout);
+    return runner.run();
+}
+
+bool runWorkload(const vector<string>& args)
+{
+    try {
+        Workload workload(Workload::parse(args));
+        workload.run(cout);
+        return true;
+    } catch (WorkloadError &e) {
+        cerr << "(sql5300: " << e.what() << ")" << endl;
+        return false;
+    } catch (exception &e) {
+        cerr << "(sql5300: workload stopped: " << e.what() << ")" << endl;
+        return false;
+    }
+}
+
+static SQLServer* runningServer = nullptr;
+
+static void stopServer(int)
+{
+    if (runningServer != nullptr)
+        runningServer->stop();
+}
+
+void runServer(string address)
+{
+    try {
+        SQLServer server(address);
+        runningServer = &server;
+        signal(SIGINT, stopServer);
+        signal(SIGTERM, stopServer);
+        cout << "(sql5300: listening on " << address << ")" << endl;
+        server.run();
+        runningServer = nullptr;
+    } catch (WireError &e) {
+        runningServer = nullptr;
+        cerr << "(sql5300: " << e.what() << ")" << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
 void handleSQL(string sql) 
 {
     if (sql == QUIT || !sql.length()) return;
 
-    SQLParserResult* const parsedSQL = SQLParser::parseSQLString(sql);
+    Shell().run(sql);
+}
 
-    if (parsedSQL->isValid())
-        handleStatements(parsedSQL);
-    else if (sql == TEST)
-        cout << "test_heap_storage: " << (test_heap_storage() ? "Passed" : "Failed") << endl;
+void Shell::invalid(const string& sql, const SQLParserResult* parsedSQL)
+{
+    if (sql == TEST)
+    {
+        const pair<const char*, bool (*)()> tests[] = {
+            {"test_heap_storage", test_heap_storage},
+            {"test_transactions", test_transactions},
+            {"test_hash_join", test_hash_join},
+            {"test_external_sort", test_external_sort},
+            {"test_hash_aggregate", test_hash_aggregate},
+            {"test_limit", test_limit},
+            {"test_projection", test_projection},
+            {"test_plan_cache", test_plan_cache},
+            {"test_result_writer", test_result_writer},
+            {"test_bulk_loader", test_bulk_loader},
+            {"test_table_exporter", test_table_exporter},
+            {"test_script_runner", test_script_runner},
+            {"test_wire_protocol", test_wire_protocol},
+            {"test_lock_manager", test_lock_manager},
+            {"test_transaction_block", test_transaction_block}
+        };
+        for (auto const& test : tests)
+        {
+            bool passed;
+            try {
+                passed = test.second();
+            } catch (exception& e) {
+                cout << e.what() << endl;
+                passed = false;
+            }
+            cout << test.first << ": " << (passed ? "Passed" : "Failed") << endl;
+        }
+    }
     else
         cout << "INVALID SQL: " << sql << endl << parsedSQL->errorMsg() << endl;
-    delete parsedSQL;
 }
 
-void handleStatements(hsql::SQLParserResult* const parsedSQL)
+void printResult(QueryResult* result)
 {
-    size_t nStatements = parsedSQL->size();
-
-    for (size_t i = 0; i < nStatements; i++)
-    {
-        const SQLStatement* const statement = parsedSQL->getStatement(i);
-
-        try {
-            cout << ParseTreeToString::statement(statement) << endl;
-            QueryResult *result = SQLExec::execute(statement);
-            cout << *result << endl;
-            delete result;
-        } catch (SQLExecError &e) {
-            cout << "Error: " << e.what() << endl;
-        }
-        
+    try {
+        ResultWriter writer(cout, SQLExec::get_result_format());
+        writer.write(*result);
+    } catch (...) {
+        delete result;
+        throw;
     }
+    delete result;
 }
@@ -0,0 +1,75 @@
+/**
+ * @file SQLClient.cpp - client for sql5300's server mode: a shell that sends each line to the server
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include "WireProtocol.h"
+
+using namespace std;
+
+const string QUIT = "quit";
+
+/**
+ * Sends a query and prints the server's answer
+ * @param fd The connection to the server
+ * @param sql The query
+ */
+void query(int fd, const string &sql)
+{
+    Frame::send(fd, Frame::QUERY, sql);
+    char type;
+    string payload;
+    while (true) {
+        if (!Frame::receive(fd, type, payload))
+            throw WireError("server closed the connection");
+        switch (type) {
+            case Frame::DATA:
+                cout.write(payload.data(), payload.size());
+                break;
+            case Frame::MESSAGE:
+                cout << payload << endl;
+                break;
+            case Frame::ERROR:
+                cout << "Error: " << payload << endl;
+                break;
+            case Frame::READY:
+                cout.flush();
+                return;
+            default:
+                throw WireError("unexpected frame from server");
+        }
+    }
+}
+
+/**
+ * Main
+ */
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        cout << "USAGE: " << argv[0] << " [port | socket_path]\n";
+        return EXIT_FAILURE;
+    }
+
+    try {
+        int fd = connect_to(argv[1]);
+        bool interactive = isatty(STDIN_FILENO);
+        string sql;
+        while (true) {
+            if (interactive)
+                cout << "SQL> " << flush;
+            if (!getline(cin, sql) || sql == QUIT)
+                break;
+            if (sql.length())
+                query(fd, sql);
+        }
+        close(fd);
+    } catch (WireError &e) {
+        cerr << "(sql5300client: " << e.what() << ")" << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -6,7 +6,23 @@
  * @version     Milestone 4
  * @see "Seattle University, CPSC5300, Winter 2023"
  */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
 #include "SQLExec.h"
+#include "BulkLoader.h"
+#include "LockManager.h"
+#include "Metrics.h"
+#include "ParseTreeToString.h"
+#include "QueryLog.h"
+#include "Trace.h"
+#include "TableExporter.h"
 
 using namespace std;
 using namespace hsql;
@@ -14,93 +30,240 @@ using namespace hsql;
 // define static data
 Tables *SQLExec::tables = nullptr;
 Indices *SQLExec::indices = nullptr;
+Statistics *SQLExec::statistics = nullptr;
+PlanCache *SQLExec::plan_cache = nullptr;
+map<Identifier, string> SQLExec::prepared;
+std::mutex SQLExec::prepared_mutex;
+atomic<size_t> SQLExec::fetch_size(QueryResult::DEFAULT_FETCH_SIZE);
+atomic<ResultWriter::Format> SQLExec::result_format(ResultWriter::TABLE);
+const size_t SQLExec::ANALYZE_SAMPLE_BLOCKS;
+const unsigned int SQLExec::MAX_ATTEMPTS;
+const size_t QueryResult::DEFAULT_FETCH_SIZE;
 
 // make query result be printable
-ostream &operator<<(ostream &out, const QueryResult &qres)
+ostream &operator<<(ostream &out, QueryResult &qres)
 {
-    if (qres.column_names != nullptr)
-    {
-        for (auto const &column_name: *qres.column_names)
-            out << column_name << " ";
-        out << endl << "+";
-        for (unsigned int i = 0; i < qres.column_names->size(); i++)
-            out << "----------+";
-        out << endl;
-        for (auto const &row: *qres.rows)
-        {
-            for (auto const &column_name: *qres.column_names)
-            {
-                Value value = row->at(column_name);
-                
-                switch (value.data_type) {
-                    case ColumnAttribute::INT:
-                        out << value.n;
-                        break;
-                    case ColumnAttribute::TEXT:
-                        out << "\"" << value.s << "\"";
-                        break;
-                    case ColumnAttribute::BOOLEAN:
-                        out << (value.n == 0 ? "false" : "true");
-                        break;
-                    default:
-                        out << "???";
-                }
-                
-                out << " ";
-            }
-
-            out << endl;
-        }
-    }
-
-    out << qres.message;
-    
+    ResultWriter writer(out);
+    writer.write(qres);
     return out;
 }
 
+QueryResult::QueryResult(EvalPlan *plan, size_t fetch_size)
+        : arena(), column_names(new ColumnNames(plan->get_column_names())),
+          column_attributes(new ColumnAttributes(plan->get_column_attributes())), rows(nullptr), message(""),
+          plan(plan), fetch_size(fetch_size), position(0), row_count(0), transaction() {}
+
 // QueryResult destructor
 QueryResult::~QueryResult() 
 {
+    if (this->plan != nullptr)
+    {
+        TransactionManager::Scope scope(this->transaction.get());
+        Arena::Scope arena_scope(this->arena.get());
+        try {
+            this->plan->close();
+        } catch (DbRelationError &e) {
+            // abandoned part way through; nothing more to be done about it
+        }
+        delete this->plan;
+    }
+    // destroyed before the plan ran out: its transaction only read, so abort it rather than commit
+    // (which can fail, and nothing may be thrown from here)
+    if (this->transaction != nullptr)
+    {
+        try {
+            this->transaction->abort();
+        } catch (...) {
+            // the snapshot is released either way
+        }
+    }
     delete this->column_attributes;
     delete this->column_names;
+    if (this->rows != nullptr)
+        for (ValueDict *row: *this->rows)
+            delete row;
     delete this->rows;
 }
 
-// SQLExec::execute
-QueryResult *SQLExec::execute(const SQLStatement *statement) 
+// Next batch of rows, from the plan if still running, else what's left of rows
+ValueDicts *QueryResult::fetch()
 {
-    // Check if tables have been initialized
-    if (SQLExec::tables == nullptr)
+    ValueDicts *batch = new ValueDicts();
+    size_t limit = max((size_t) 1, this->fetch_size);
+    if (this->plan != nullptr)
     {
-        // Create tables if not yet present
-        SQLExec::tables = new Tables();
+        TransactionManager::Scope scope(this->transaction.get());
+        Arena::Scope arena_scope(this->arena.get());
+        Trace::Span span("fetch", "statement");
+        try {
+            while (batch->size() < limit)
+            {
+                ValueDict *row = this->plan->next();
+                if (row == nullptr)
+                {
+                    finish();
+                    break;
+                }
+                batch->push_back(row);
+            }
+        } catch (DbRelationError &e) {
+            for (ValueDict *row: *batch)
+                delete row;
+            delete batch;
+            throw SQLExecError(string("DbRelationError: ") + e.what());
+        }
+        this->row_count += batch->size();
+        if (this->plan == nullptr)
+            this->message = "successfully returned " + to_string(this->row_count) + " rows";
+    } else if (this->rows != nullptr)
+    {
+        while (batch->size() < limit && this->position < this->rows->size())
+        {
+            batch->push_back((*this->rows)[this->position]);
+            (*this->rows)[this->position++] = nullptr;  // ownership moves to the caller
+        }
     }
+    return batch;
+}
 
-    // Check if indicies have been initiated
-    if (SQLExec::indices == nullptr)
+// the plan has run out, so its transaction is done too
+void QueryResult::finish()
+{
+    EvalPlan *plan = this->plan;
+    this->plan = nullptr;
+    try {
+        plan->close();
+    } catch (...) {
+        delete plan;
+        throw;
+    }
+    delete plan;
+    if (this->transaction != nullptr)
     {
-        // Create indices if not yet present
-        SQLExec::indices = new Indices();
+        this->transaction->commit();
+        this->transaction.reset();
     }
+}
 
-    try {
-        switch (statement->type())
+// SQLExec::execute
+QueryResult *SQLExec::execute(const SQLStatement *statement) 
+{
+    initialize();
+
+    return autocommit([statement]() -> QueryResult * {
+        try {
+            switch (statement->type())
+            {
+                case kStmtCreate:
+                    return create((const CreateStatement *) statement);
+                case kStmtDrop:
+                    return drop((const DropStatement *) statement);
+                case kStmtShow:
+                    return show((const ShowStatement *) statement);
+                case kStmtSelect:
+                    return select((const SelectStatement *) statement);
+                case kStmtInsert:
+                    return insert((const InsertStatement *) statement);
+                case kStmtDelete:
+                    return del((const DeleteStatement *) statement);
+                case kStmtUpdate:
+                    return update((const UpdateStatement *) statement);
+                default:
+                    return new QueryResult("not implemented");
+            }
+        } catch (TransactionConflict &e)
+        {
+            throw;  // for autocommit to try again
+        } catch (DbRelationError &e)
         {
-            case kStmtCreate:
-                return create((const CreateStatement *) statement);
-            case kStmtDrop:
-                return drop((const DropStatement *) statement);
-            case kStmtShow:
-                return show((const ShowStatement *) statement);
-            default:
-                return new QueryResult("not implemented");
+            throw SQLExecError(string("DbRelationError: ") + e.what());
+        } catch (QueryPlanError &e)
+        {
+            throw SQLExecError(e.what());
+        }
+    });
+}
+
+// Once a conflicting transaction has finished, a new snapshot sees what it did, so the statement
+// can usually go ahead the second time.
+QueryResult *SQLExec::autocommit(const function<QueryResult *()> &statement)
+{
+    // the statement's arena, unless it is run by another (EXECUTE), which has one
+    if (Arena::current() == nullptr) {
+        unique_ptr<Arena> arena(new Arena());
+        QueryResult *result;
+        {
+            Arena::Scope scope(arena.get());
+            result = autocommit(statement);
+        }
+        if (result != nullptr)
+            result->adopt(move(arena));
+        return result;
+    }
+
+    // in a transaction block, a failed statement is undone, but the transaction goes on
+    Transaction *current = TransactionManager::current();
+    if (current != nullptr) {
+        size_t savepoint = current->savepoint();
+        auto undo = [current, savepoint] {
+            try {
+                current->rollback_to(savepoint);
+            } catch (DbRelationError &e) {
+                // report the statement's error, not this one
+            }
+        };
+        try {
+            return statement();
+        } catch (TransactionConflict &e) {
+            undo();
+            throw SQLExecError(string("DbRelationError: ") + e.what());
+        } catch (...) {
+            undo();
+            throw;
         }
-    } catch (DbRelationError &e)
-    {
-        throw SQLExecError(string("DbRelationError: ") + e.what());
+    }
+    auto abort = [](Transaction *transaction) {
+        try {
+            transaction->abort();
+        } catch (DbRelationError &e) {
+            // report the statement's error, not this one
+        }
+    };
+    for (unsigned int attempt = 1; ; attempt++) {
+        shared_ptr<Transaction> transaction = TransactionManager::begin();
+        QueryResult *result;
+        try {
+            TransactionManager::Scope scope(transaction.get());
+            result = statement();
+        } catch (TransactionConflict &e) {
+            abort(transaction.get());
+            if (attempt < MAX_ATTEMPTS)
+                continue;
+            throw SQLExecError(string("DbRelationError: ") + e.what());
+        } catch (...) {
+            abort(transaction.get());
+            throw;
+        }
+        if (result != nullptr && result->is_streamed())
+            result->hold(transaction);
+        else
+            transaction->commit();
+        return result;
     }
 }
 
+// once, however many sessions start at the same time
+void SQLExec::initialize()
+{
+    static once_flag initialized;
+    call_once(initialized, [] {
+        SQLExec::tables = new Tables();
+        SQLExec::indices = new Indices();
+        SQLExec::statistics = new Statistics();
+        SQLExec::plan_cache = new PlanCache();
+    });
+}
+
 // Column defintions
 void SQLExec::column_definition(const ColumnDefinition *col, Identifier &column_name, ColumnAttribute &column_attribute)
 {
@@ -121,68 +284,45 @@ void SQLExec::column_definition(const ColumnDefinition *col, Identifier &column_
 }
 
 // Create
+// If anything fails, the transaction's undo log takes back the rows added to _tables and _columns,
+// and the file if it was created.
 QueryResult *SQLExec::create(const CreateStatement *statement)
 {
     // Update _tables schema with new table
-    ValueDict row = {{"table_name", Value(statement->tableName)}};
-    Handle tableHandler = SQLExec::tables->insert(&row);
+    Identifier table_name = statement->tableName;
+    ValueDict row = {{"table_name", Value(table_name)}};
+    SQLExec::tables->insert(&row);
 
-    try {
-        // Try to make updates to _columns schema
-        Handles columnHandler;
-        DbRelation &columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
-        
-        try {
-            // Traversing through columns to update the list of all colunms and
-            // datatypes
-            for (ColumnDefinition *column : *statement->columns)
-            {
-                // Define column values
-                Identifier name;
-                ColumnAttribute attribute;
-                column_definition(column, name, attribute);
-                
-                // Determine column type
-                string type = attribute.get_data_type() == ColumnAttribute::DataType::TEXT ? "TEXT" : "INT";
-                
-                // Define columns in one row
-                row["data_type"] = Value(type);
-                row["column_name"] = Value(name);
-                
-                // Push back row
-                columnHandler.push_back(columns.insert(&row));
-            }
+    // Traversing through columns to update the list of all colunms and datatypes
+    shared_ptr<DbRelation> columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
+    for (ColumnDefinition *column : *statement->columns)
+    {
+        // Define column values
+        Identifier name;
+        ColumnAttribute attribute;
+        column_definition(column, name, attribute);
 
-            // Create table
-            DbRelation &table = SQLExec::tables->get_table(statement->tableName);
+        // Determine column type
+        string type = attribute.get_data_type() == ColumnAttribute::DataType::TEXT ? "TEXT" : "INT";
 
-            if (statement->ifNotExists)
-                table.create_if_not_exists();
-            else
-                table.create();
-        }
-        catch (DbRelationError &e) {
-            try {
-                // Attempt to undo _columns insert
-                for (Handle &columnHandle : columnHandler)
-                {
-                    columns.del(columnHandle);
-                }
-            }
-            catch (DbRelationError &e) {}
-            throw;
-        }
-    }
-    catch (DbRelationError &e) {
-        try {
-            // Attempt to undo _tables insert
-            SQLExec::tables->del(tableHandler);
-        }
-        catch (DbRelationError &e) {}
-        throw;
+        // Define columns in one row
+        row["data_type"] = Value(type);
+        row["column_name"] = Value(name);
+        columns->insert(&row);
     }
 
-    return new QueryResult("Created new table: " + string(statement->tableName));
+    // Create table
+    shared_ptr<DbRelation> table = SQLExec::tables->get_table(table_name);
+    if (statement->ifNotExists)
+        table->create_if_not_exists();
+    else
+        table->create();
+    TransactionManager::current()->on_abort([table, table_name] {
+        table->drop();
+        Tables::uncache(table_name);
+    });
+
+    return new QueryResult("Created new table: " + table_name);
 }
 
 // DROP
@@ -200,23 +340,46 @@ QueryResult *SQLExec::drop(const DropStatement *statement)
         throw SQLExecError("Cannot drop a schema table.");
 
     ValueDict where = {{"table_name", Value(name)}};
+    Handles *table_rows = SQLExec::tables->select(&where);
+    if (table_rows->empty()) {
+        delete table_rows;
+        throw SQLExecError("unknown table " + name);
+    }
+    Handle table_row = table_rows->front();
+    delete table_rows;
+
+    // No other transaction may be using it; don't wait for them, as the server holds its engine
+    // lock for DDL, and they may need that to finish
+    Transaction *transaction = TransactionManager::current();
+    if (!LockManager::lock_table(transaction, name, LockManager::X, false))
+        throw SQLExecError("table " + name + " is in use by another transaction");
+
+    // If this is rolled back, the catalog caches emptied below fill up again from the restored rows
+    transaction->on_abort([] { Tables::catalog_changed(); });
 
     // Remove columns first
-    DbRelation &columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
-    Handles *rows = columns.select(&where);
+    shared_ptr<DbRelation> columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
+    Handles *rows = columns->select(&where);
 
     for (Handle &row : *rows)
     {
-        columns.del(row);
+        columns->del(row);
     }
     delete rows;
 
-    // Remove empty table
-    DbRelation &table = SQLExec::tables->get_table(name);
-    table.drop();
+    // Statistics describe the old table, not any later one of the same name
+    SQLExec::statistics->del_statistics(name);
+
+    // Remove the file once the drop has committed (as it can't be undone). Readers' snapshots still
+    // see the table until then, so one of them may have cached it again since Tables::del below.
+    shared_ptr<DbRelation> table = SQLExec::tables->get_table(name);
+    transaction->on_commit([table, name] {
+        table->drop();
+        Tables::uncache(name);
+    });
 
     // Remove table from schema
-    SQLExec::tables->del(*SQLExec::tables->select(&where)->begin());
+    SQLExec::tables->del(table_row);
 
     return new QueryResult(nullptr, nullptr, nullptr, "Dropped table " + string(statement->name));
 }
@@ -254,8 +417,9 @@ QueryResult *SQLExec::show_tables()
         ValueDict *row = SQLExec::tables->project(table, names);
         Identifier tableName = row->at("table_name").s;
 
-        // Remove _tables and _columns from results
-        if (tableName != Tables::TABLE_NAME && tableName != Columns::TABLE_NAME)
+        // Remove _tables, _columns, _statistics and _histograms from results
+        if (tableName != Tables::TABLE_NAME && tableName != Columns::TABLE_NAME &&
+            tableName != Statistics::TABLE_NAME && tableName != Histograms::TABLE_NAME)
             rows->push_back(row);
         else
             delete row;
@@ -270,18 +434,18 @@ QueryResult *SQLExec::show_tables()
 QueryResult *SQLExec::show_columns(const ShowStatement *statement)
 {
     // Get column names and attributes
-    DbRelation &columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
+    shared_ptr<DbRelation> columns = SQLExec::tables->get_table(Columns::TABLE_NAME);
     ColumnNames *names = new ColumnNames({"table_name", "column_name", "data_type"});
     ColumnAttributes *attributes = new ColumnAttributes({ColumnAttribute(ColumnAttribute::DataType::TEXT)});
 
     // Select entries from the table
     ValueDict where = {{"table_name", Value(statement->tableName)}};
-    Handles *colResult = columns.select(&where);
+    Handles *colResult = columns->select(&where);
     ValueDicts *rows = new ValueDicts();
 
     // Traverse through the table
     for (Handle &row : *colResult)
-        rows->push_back(columns.project(row, names));
+        rows->push_back(columns->project(row, names));
 
     delete colResult;
 
@@ -317,6 +481,51 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement) { // Set up lab
             "successfully returned " + to_string(size) + " rows");
 }
 
+// SHOW STATS
+QueryResult *SQLExec::show_stats()
+{
+    ColumnNames *names = new ColumnNames({"metric", "value"});
+    ColumnAttributes *attributes = new ColumnAttributes(2, ColumnAttribute(ColumnAttribute::TEXT));
+    ValueDicts *rows = new ValueDicts();
+    for (auto const &item: Metrics::report())
+    {
+        ValueDict *row = new ValueDict();
+        (*row)["metric"] = Value(item.first);
+        (*row)["value"] = Value(item.second);
+        rows->push_back(row);
+    }
+    return new QueryResult(names, attributes, rows, "successfully returned " + to_string(rows->size()) + " rows");
+}
+
+// SHOW QUERY STATS
+QueryResult *SQLExec::show_query_stats()
+{
+    ColumnNames *names = new ColumnNames({"shape", "calls", "total_ms", "mean_ms", "p50_ms", "p99_ms", "p999_ms",
+                                          "max_ms"});
+    ColumnAttributes *attributes = new ColumnAttributes(names->size(), ColumnAttribute(ColumnAttribute::TEXT));
+    (*attributes)[1] = ColumnAttribute(ColumnAttribute::INT);
+    ValueDicts *rows = new ValueDicts();
+    auto format = [](double ms) {
+        ostringstream out;
+        out << fixed << setprecision(3) << ms;
+        return Value(out.str());
+    };
+    for (auto const &stats: QueryLog::report())
+    {
+        ValueDict *row = new ValueDict();
+        (*row)["shape"] = Value(stats.shape);
+        (*row)["calls"] = Value((int32_t) min(stats.calls, (uint64_t) INT32_MAX));
+        (*row)["total_ms"] = format(stats.total_ms);
+        (*row)["mean_ms"] = format(stats.mean_ms);
+        (*row)["p50_ms"] = format(stats.p50_ms);
+        (*row)["p99_ms"] = format(stats.p99_ms);
+        (*row)["p999_ms"] = format(stats.p999_ms);
+        (*row)["max_ms"] = format(stats.max_ms);
+        rows->push_back(row);
+    }
+    return new QueryResult(names, attributes, rows, "successfully returned " + to_string(rows->size()) + " rows");
+}
+
 QueryResult *SQLExec::drop_index(const DropStatement *statement) {
     //Double check if statement is valid DROP
     if (statement->type != DropStatement::kIndex) {
@@ -325,13 +534,13 @@ QueryResult *SQLExec::drop_index(const DropStatement *statement) {
 
     Identifier table_name = statement->name;
     Identifier index_name = statement->indexName;
-    DbIndex& index = SQLExec::indices->get_index(table_name, index_name);
+    shared_ptr<DbIndex> index = SQLExec::indices->get_index(table_name, index_name);
     ValueDict where;
     where["table_name"] = table_name;
     where["index_name"] = index_name;
 
     Handles* index_handles = SQLExec::indices->select(&where);
-    index.drop();
+    index->drop();
 
     for (unsigned int i = 0; i < index_handles->size(); i++) {
         SQLExec::indices->del(index_handles->at(i));
@@ -341,3 +550,1220 @@ QueryResult *SQLExec::drop_index(const DropStatement *statement) {
     delete index_handles;
     return new QueryResult("dropped index " + index_name);
 }
+
+// INSERT INTO table [(column, ...)] VALUES (value, ...)
+QueryResult *SQLExec::insert(const InsertStatement *statement)
+{
+    Identifier table_name = statement->tableName;
+    shared_ptr<DbRelation> table = Tables::get_table(table_name);
+    ValueDict *row = insert_row(statement, *table);
+    Handle handle;
+    try {
+        handle = table->insert(row);
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    delete row;
+
+    IndexNames index_names = SQLExec::indices->get_index_names(table_name);
+    for (auto const &index_name: index_names)
+        SQLExec::indices->get_index(table_name, index_name)->insert(handle);
+    string suffix = index_names.empty() ? "" : " and " + to_string(index_names.size()) + " indices";
+    return new QueryResult("successfully inserted 1 row into " + table_name + suffix);
+}
+
+// Several INSERTs into the same columns of the same table, packed into whole pages at once
+// (as COPY does) instead of each reading and rewriting the table's last block.
+QueryResult *SQLExec::insert_batch(const vector<const InsertStatement *> &statements)
+{
+    initialize();
+    if (statements.empty())
+        return new QueryResult("successfully inserted 0 rows");
+    for (const InsertStatement *statement: statements)
+        if (!can_batch(statements.front(), statement))
+            throw SQLExecError("statements can't be batched together");
+
+    return autocommit([&statements]() -> QueryResult * {
+        try {
+            Identifier table_name = statements.front()->tableName;
+            shared_ptr<HeapTable> table = dynamic_pointer_cast<HeapTable>(Tables::get_table(table_name));
+            if (table == nullptr)
+                throw SQLExecError("cannot batch inserts into " + table_name);
+
+            ValueDicts rows;
+            vector<char *> *pages = nullptr;
+            try {
+                for (const InsertStatement *statement: statements)
+                    rows.push_back(insert_row(statement, *table));
+                pages = table->pack_pages(rows);
+            } catch (...) {
+                for (ValueDict *row: rows)
+                    delete row;
+                throw;
+            }
+            for (ValueDict *row: rows)
+                delete row;
+
+            IndexNames index_names = SQLExec::indices->get_index_names(table_name);
+            Handles handles;
+            size_t count;
+            try {
+                count = table->append_pages(*pages, index_names.empty() ? nullptr : &handles);
+            } catch (...) {
+                for (char *page: *pages)
+                    delete[] page;
+                delete pages;
+                throw;
+            }
+            for (char *page: *pages)
+                delete[] page;
+            delete pages;
+
+            for (auto const &index_name: index_names)
+            {
+                shared_ptr<DbIndex> index = SQLExec::indices->get_index(table_name, index_name);
+                for (auto const &handle: handles)
+                    index->insert(handle);
+            }
+            string suffix = index_names.empty() ? "" : " and " + to_string(index_names.size()) + " indices";
+            return new QueryResult("successfully inserted " + to_string(count) + (count == 1 ? " row" : " rows") +
+                                   " into " + table_name + suffix);
+        } catch (DbRelationError &e)
+        {
+            throw SQLExecError(string("DbRelationError: ") + e.what());
+        }
+    });
+}
+
+bool SQLExec::can_batch(const InsertStatement *first, const InsertStatement *statement)
+{
+    if (first->type != InsertStatement::kInsertValues || statement->type != InsertStatement::kInsertValues ||
+        strcmp(first->tableName, statement->tableName) != 0 ||
+        (first->columns == nullptr) != (statement->columns == nullptr))
+        return false;
+    if (first->columns != nullptr)
+    {
+        if (first->columns->size() != statement->columns->size())
+            return false;
+        for (size_t i = 0; i < first->columns->size(); i++)
+            if (strcmp(first->columns->at(i), statement->columns->at(i)) != 0)
+                return false;
+    }
+    return true;
+}
+
+// The row for an INSERT's VALUES, checked against the table's columns
+ValueDict *SQLExec::insert_row(const InsertStatement *statement, const DbRelation &table)
+{
+    if (statement->type != InsertStatement::kInsertValues)
+        throw SQLExecError("only INSERT ... VALUES is supported");
+    const ColumnNames &table_columns = table.get_column_names();
+    ColumnAttributes attributes = table.get_column_attributes();
+    ColumnNames column_names;
+    if (statement->columns != nullptr)
+        for (char *column_name: *statement->columns)
+            column_names.push_back(column_name);
+    else
+        column_names = table_columns;
+    if (column_names.size() != statement->values->size())
+        throw SQLExecError("INSERT has " + to_string(column_names.size()) + " columns but " +
+                           to_string(statement->values->size()) + " values");
+
+    ValueDict *row = new ValueDict();
+    try {
+        for (size_t i = 0; i < column_names.size(); i++)
+        {
+            auto column = find(table_columns.begin(), table_columns.end(), column_names[i]);
+            if (column == table_columns.end())
+                throw SQLExecError("unknown column " + column_names[i]);
+            ColumnAttribute attribute = attributes[column - table_columns.begin()];
+            (*row)[column_names[i]] = column_value(statement->values->at(i), attribute, column_names[i]);
+        }
+        if (row->size() != table_columns.size())
+            throw SQLExecError("a value is needed for every column");
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    return row;
+}
+
+Value SQLExec::column_value(const Expr *expr, ColumnAttribute attribute, const Identifier &column_name)
+{
+    bool negative = expr->type == kExprOperator && expr->opType == Expr::UMINUS && expr->expr != nullptr;
+    if (negative)
+        expr = expr->expr;
+    if (attribute.get_data_type() == ColumnAttribute::INT && expr->type == kExprLiteralInt)
+    {
+        int64_t n = negative ? -expr->ival : expr->ival;
+        if (n < INT32_MIN || n > INT32_MAX)
+            throw SQLExecError("value out of range for " + column_name);
+        return Value((int32_t) n);
+    }
+    if (attribute.get_data_type() == ColumnAttribute::TEXT && expr->type == kExprLiteralString && !negative)
+        return Value(string(expr->name));
+    throw SQLExecError("wrong type of value for " + column_name);
+}
+
+// DELETE FROM table [WHERE ...]
+QueryResult *SQLExec::del(const DeleteStatement *statement)
+{
+    Identifier table_name = statement->tableName;
+    if (table_name[0] == '_')
+        throw SQLExecError("cannot delete from " + table_name);
+    shared_ptr<DbRelation> table = Tables::get_table(table_name);
+    Handles *handles = where_handles(*table, statement->expr);
+    IndexNames index_names = SQLExec::indices->get_index_names(table_name);
+    try {
+        for (auto const &handle: *handles)
+        {
+            for (auto const &index_name: index_names)
+                SQLExec::indices->get_index(table_name, index_name)->del(handle);
+            table->del(handle);
+        }
+    } catch (...) {
+        delete handles;
+        throw;
+    }
+    size_t count = handles->size();
+    delete handles;
+    string suffix = index_names.empty() ? "" : " and " + to_string(index_names.size()) + " indices";
+    return new QueryResult("successfully deleted " + to_string(count) + (count == 1 ? " row" : " rows") +
+                           " from " + table_name + suffix);
+}
+
+// UPDATE table SET column = value, ... [WHERE ...]
+QueryResult *SQLExec::update(const UpdateStatement *statement)
+{
+    Identifier table_name = statement->table->name;
+    if (table_name[0] == '_')
+        throw SQLExecError("cannot update " + table_name);
+    shared_ptr<DbRelation> table = Tables::get_table(table_name);
+    const ColumnNames &column_names = table->get_column_names();
+    ColumnAttributes attributes = table->get_column_attributes();
+    ValueDict new_values;
+    for (const UpdateClause *clause: *statement->updates)
+    {
+        auto column = find(column_names.begin(), column_names.end(), Identifier(clause->column));
+        if (column == column_names.end())
+            throw SQLExecError(string("unknown column ") + clause->column);
+        new_values[*column] = column_value(clause->value, attributes[column - column_names.begin()], *column);
+    }
+
+    // every row to change is found before any is changed, so new versions aren't changed again
+    Handles *handles = where_handles(*table, statement->where);
+    IndexNames index_names = SQLExec::indices->get_index_names(table_name);
+    try {
+        for (auto const &handle: *handles)
+        {
+            for (auto const &index_name: index_names)
+                SQLExec::indices->get_index(table_name, index_name)->del(handle);
+            Handle new_handle = table->update(handle, &new_values);
+            for (auto const &index_name: index_names)
+                SQLExec::indices->get_index(table_name, index_name)->insert(new_handle);
+        }
+    } catch (...) {
+        delete handles;
+        throw;
+    }
+    size_t count = handles->size();
+    delete handles;
+    string suffix = index_names.empty() ? "" : " and " + to_string(index_names.size()) + " indices";
+    return new QueryResult("successfully updated " + to_string(count) + (count == 1 ? " row" : " rows") +
+                           " in " + table_name + suffix);
+}
+
+// Equality terms are pushed down into the table's select; the rest are checked on just the columns they use.
+Handles *SQLExec::where_handles(DbRelation &table, const Expr *where)
+{
+    vector<const Expr *> conjuncts;
+    if (where != nullptr)
+        QueryPlanner::get_conjuncts(where, conjuncts);
+    ValueDict equalities;
+    Conjunction others;
+    ColumnNames needed;
+    for (const Expr *conjunct: conjuncts)
+    {
+        Comparison term = QueryPlanner::get_comparison(conjunct, table.get_column_names(), false);
+        if (term.op == Comparison::EQ && !term.column_to_column && equalities.count(term.column) == 0)
+        {
+            equalities[term.column] = term.value;
+            continue;
+        }
+        others.push_back(term);
+        for (const Identifier &column: {term.column, term.other_column})
+            if (!column.empty() && find(needed.begin(), needed.end(), column) == needed.end())
+                needed.push_back(column);
+    }
+
+    Handles *handles = table.select(equalities.empty() ? nullptr : &equalities);
+    if (others.empty())
+        return handles;
+    Handles *matching = new Handles();
+    try {
+        for (auto const &handle: *handles)
+        {
+            ValueDict *row = table.project(handle, &needed);
+            bool matches = all_of(others.begin(), others.end(),
+                                  [row](const Comparison &term) { return term.matches(row); });
+            delete row;
+            if (matches)
+                matching->push_back(handle);
+        }
+    } catch (...) {
+        delete handles;
+        delete matching;
+        throw;
+    }
+    delete handles;
+    return matching;
+}
+
+// SELECT
+QueryResult *SQLExec::select(const SelectStatement *statement)
+{
+    QueryPlanner planner(*SQLExec::statistics);
+    unique_ptr<QueryPlan> query_plan(planner.plan(statement));
+    return evaluate(*query_plan, vector<Value>());
+}
+
+QueryResult *SQLExec::evaluate(const QueryPlan &query_plan, const vector<Value> &parameters)
+{
+    EvalPlan *plan = query_plan.instantiate(parameters);
+
+    // Open here, so errors in starting the plan are reported by execute; the rows come as they're fetched
+    try {
+        plan->open();
+    } catch (...) {
+        delete plan;
+        throw;
+    }
+    return new QueryResult(plan, SQLExec::fetch_size);
+}
+
+// Plan cache lookup, or parse and plan
+shared_ptr<QueryPlan> SQLExec::cached_plan(const string &text, shared_ptr<SQLParserResult> *parsed)
+{
+    shared_ptr<SQLParserResult> cached_parse;
+    shared_ptr<QueryPlan> plan = SQLExec::plan_cache->get(text, cached_parse);
+    if (plan == nullptr)
+    {
+        {
+            Trace::Span span("parse", "parser");
+            cached_parse.reset(SQLParser::parseSQLString(text));
+        }
+        if (!cached_parse->isValid() || cached_parse->size() != 1 ||
+            cached_parse->getStatement(0)->type() != kStmtSelect)
+            return nullptr;
+        QueryPlanner planner(*SQLExec::statistics);
+        plan.reset(planner.plan((const SelectStatement *) cached_parse->getStatement(0)));
+        SQLExec::plan_cache->put(text, plan, cached_parse);
+    }
+    if (parsed != nullptr)
+        *parsed = cached_parse;
+    return plan;
+}
+
+// A custom plan skips the parser, not the planner. With the wrong number of values, the generic
+// plan is returned for instantiate to complain about.
+shared_ptr<QueryPlan> SQLExec::plan_for(const string &text, const vector<Value> &parameters)
+{
+    shared_ptr<SQLParserResult> parsed;
+    shared_ptr<QueryPlan> plan = cached_plan(text, &parsed);
+    if (plan == nullptr || !plan->is_value_sensitive() || parameters.size() != plan->get_parameter_count())
+        return plan;
+    QueryPlanner planner(*SQLExec::statistics);
+    return shared_ptr<QueryPlan>(planner.plan((const SelectStatement *) parsed->getStatement(0), &parameters));
+}
+
+// SELECT with its literals as parameters of the plan for its shape
+QueryResult *SQLExec::execute_cached(const string &sql)
+{
+    string text;
+    vector<Value> literals;
+    if (!PlanCache::normalize(sql, text, literals))
+        return nullptr;
+    string keyword = text.substr(0, text.find(' '));
+    transform(keyword.begin(), keyword.end(), keyword.begin(), ::toupper);
+    if (keyword != "SELECT")
+        return nullptr;
+
+    initialize();
+    return autocommit([&text, &literals]() -> QueryResult * {
+        try {
+            shared_ptr<QueryPlan> plan = plan_for(text, literals);
+            if (plan == nullptr)
+                return nullptr;
+            return evaluate(*plan, literals);
+        } catch (DbRelationError &e)
+        {
+            throw SQLExecError(string("DbRelationError: ") + e.what());
+        } catch (QueryPlanError &e)
+        {
+            throw SQLExecError(e.what());
+        }
+    });
+}
+
+// first word of sql at or after pos (letters, digits and underscores), with pos moved past it
+static string next_word(const string &sql, size_t &pos)
+{
+    while (pos < sql.size() && isspace((unsigned char) sql[pos]))
+        pos++;
+    size_t start = pos;
+    while (pos < sql.size() && (isalnum((unsigned char) sql[pos]) || sql[pos] == '_'))
+        pos++;
+    return sql.substr(start, pos - start);
+}
+
+// 'quoted string' at or after pos, with '' for a quote; pos is moved past it
+static bool next_quoted(const string &sql, size_t &pos, string &value)
+{
+    while (pos < sql.size() && isspace((unsigned char) sql[pos]))
+        pos++;
+    if (pos >= sql.size() || sql[pos] != '\'')
+        return false;
+    value.clear();
+    for (pos++; pos < sql.size(); pos++)
+    {
+        if (sql[pos] == '\'')
+        {
+            if (pos + 1 < sql.size() && sql[pos + 1] == '\'')
+                pos++;
+            else
+            {
+                pos++;
+                return true;
+            }
+        }
+        value += sql[pos];
+    }
+    return false;
+}
+
+static string upper(string word)
+{
+    transform(word.begin(), word.end(), word.begin(), ::toupper);
+    return word;
+}
+
+// Extension statements are recognized by their first word (SHOW [QUERY] STATS by the next ones
+// too, as the parser knows the other SHOWs)
+bool SQLExec::is_extension(const string &sql)
+{
+    size_t pos = 0;
+    string keyword = upper(next_word(sql, pos));
+    if (keyword == "SHOW")
+    {
+        string word = upper(next_word(sql, pos));
+        return word == "STATS" || (word == "QUERY" && upper(next_word(sql, pos)) == "STATS");
+    }
+    return keyword == "ANALYZE" || keyword == "VACUUM" || keyword == "PREPARE" || keyword == "EXECUTE" ||
+           keyword == "DEALLOCATE" || keyword == "SET" || keyword == "COPY" || keyword == "EXPLAIN" ||
+           is_transaction_control(keyword);
+}
+
+bool SQLExec::is_transaction_control(const string &keyword)
+{
+    return keyword == "BEGIN" || keyword == "COMMIT" || keyword == "ROLLBACK";
+}
+
+QueryResult *SQLExec::execute_extension(const string &sql)
+{
+    initialize();
+
+    size_t pos = 0;
+    string keyword = upper(next_word(sql, pos));
+    if (is_transaction_control(keyword))
+        return transaction_control(keyword, sql.substr(pos));
+
+    return autocommit([&sql]() -> QueryResult * {
+        // split into words, ignoring a trailing semicolon
+        string text = sql;
+        while (!text.empty() && (text.back() == ';' || isspace(text.back())))
+            text.pop_back();
+        istringstream in(text);
+        vector<string> words;
+        string word;
+        while (in >> word)
+            words.push_back(word);
+        if (words.empty())
+            throw SQLExecError("empty statement");
+        string keyword = upper(words[0]);
+
+        try {
+            if (keyword == "ANALYZE")
+            {
+                if (words.size() > 2)
+                    throw SQLExecError("usage: ANALYZE [table]");
+                return analyze(words.size() == 2 ? words[1] : "");
+            }
+            if (keyword == "VACUUM")
+            {
+                if (words.size() > 2)
+                    throw SQLExecError("usage: VACUUM [table]");
+                return vacuum(words.size() == 2 ? words[1] : "");
+            }
+            if (keyword == "COPY")
+                return copy(text);
+            if (keyword == "EXPLAIN")
+                return explain(text);
+            if (keyword == "SHOW")
+            {
+                if (words.size() == 3 && upper(words[1]) == "QUERY")
+                    return show_query_stats();
+                if (words.size() != 2)
+                    throw SQLExecError("usage: SHOW [QUERY] STATS");
+                return show_stats();
+            }
+            if (keyword == "SET")
+            {
+                if (words.size() != 3 && !(words.size() == 4 && (words[2] == "=" || upper(words[2]) == "TO")))
+                    throw SQLExecError("usage: SET name value");
+                return set(upper(words[1]), words.back());
+            }
+
+            size_t pos = 0;
+            next_word(text, pos);
+            Identifier name = next_word(text, pos);
+            if (keyword == "DEALLOCATE" && upper(name) == "PREPARE")
+                name = next_word(text, pos);
+            if (name.empty())
+                throw SQLExecError("usage: " + keyword + " name ...");
+            if (keyword == "PREPARE")
+            {
+                size_t after_name = pos;
+                string word = upper(next_word(text, pos));
+                return prepare(name, text.substr(word == "AS" || word == "FROM" ? pos : after_name));
+            }
+            if (keyword == "EXECUTE")
+                return execute_prepared(name, text.substr(pos));
+            if (keyword == "DEALLOCATE")
+                return deallocate(name);
+            throw SQLExecError("unrecognized statement " + keyword);
+        } catch (DbRelationError &e)
+        {
+            throw SQLExecError(string("DbRelationError: ") + e.what());
+        } catch (QueryPlanError &e)
+        {
+            throw SQLExecError(e.what());
+        }
+    });
+}
+
+// BEGIN, COMMIT or ROLLBACK [TRANSACTION | WORK], on the session's TransactionBlock
+QueryResult *SQLExec::transaction_control(const string &keyword, const string &rest)
+{
+    string text = rest;
+    while (!text.empty() && (text.back() == ';' || isspace(text.back())))
+        text.pop_back();
+    size_t pos = 0;
+    string word = upper(next_word(text, pos));
+    if (!(word.empty() || ((word == "TRANSACTION" || word == "WORK") && next_word(text, pos).empty())))
+        throw SQLExecError("usage: " + keyword + " [TRANSACTION]");
+
+    TransactionBlock *block = TransactionBlock::current();
+    if (block == nullptr)
+        throw SQLExecError(keyword + " is only for sessions");
+    try {
+        if (keyword == "BEGIN")
+        {
+            block->begin();
+            return new QueryResult("began transaction");
+        }
+        if (keyword == "COMMIT")
+        {
+            block->commit();
+            return new QueryResult("committed transaction");
+        }
+        block->rollback();
+        return new QueryResult("rolled back transaction");
+    } catch (DbRelationError &e)
+    {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    }
+}
+
+static string milliseconds(chrono::steady_clock::duration elapsed)
+{
+    ostringstream out;
+    out << fixed << setprecision(3) << chrono::duration<double, milli>(elapsed).count();
+    return out.str();
+}
+
+// counts that don't fit in an INT show as the largest one
+static Value count_value(uint64_t count)
+{
+    return Value((int32_t) min(count, (uint64_t) INT32_MAX));
+}
+
+// A row for node and then for each of its inputs, indented under it. With a profile, what the
+// operator did itself is what its stats say less what its inputs' stats say.
+static void explain_node(const PlanNode *node, size_t depth, QueryProfile *profile, ValueDicts &rows)
+{
+    ostringstream cost;
+    cost << fixed << setprecision(2) << node->cost;
+    ValueDict *row = new ValueDict();
+    rows.push_back(row);
+    (*row)["operator"] = Value(string(2 * depth, ' ') + (depth > 0 ? "-> " : "") + node->describe());
+    (*row)["est_rows"] = count_value((uint64_t) llround(node->rows));
+    (*row)["est_cost"] = Value(cost.str());
+    if (profile != nullptr)
+    {
+        const OperatorStats &stats = profile->get_stats(node);
+        uint64_t rows_in = 0, input_nanoseconds = 0, input_hits = 0;
+        IoCounters own = stats.io;
+        for (const PlanNode *child: node->children)
+        {
+            const OperatorStats &input = profile->get_stats(child);
+            rows_in += input.rows;
+            input_nanoseconds += input.nanoseconds;
+            input_hits += input.io.buffer_hits;
+            own -= input.io;
+        }
+        // each operator's hits are estimated on their own (see Instrumented), so they can disagree
+        own.buffer_hits = stats.io.buffer_hits > input_hits ? stats.io.buffer_hits - input_hits : 0;
+        own.buffer_hits = min(own.buffer_hits, own.blocks_read);
+        (*row)["rows_in"] = count_value(node->children.empty() ? own.records_read : rows_in);
+        (*row)["rows_out"] = count_value(stats.rows);
+        (*row)["total_ms"] = Value(milliseconds(chrono::nanoseconds(stats.nanoseconds)));
+        (*row)["self_ms"] = Value(milliseconds(chrono::nanoseconds(
+                stats.nanoseconds > input_nanoseconds ? stats.nanoseconds - input_nanoseconds : 0)));
+        (*row)["blocks_read"] = count_value(own.blocks_read);
+        (*row)["buffer_hits"] = count_value(own.buffer_hits);
+        (*row)["bytes_decoded"] = count_value(own.bytes_decoded);
+    }
+    for (const PlanNode *child: node->children)
+        explain_node(child, depth + 1, profile, rows);
+}
+
+// EXPLAIN [ANALYZE] SELECT ...
+// A scan's rows in are the records it examined.
+QueryResult *SQLExec::explain(const string &sql)
+{
+    size_t pos = 0;
+    next_word(sql, pos);
+    size_t after_explain = pos;
+    bool analyze = upper(next_word(sql, pos)) == "ANALYZE";
+    string text = sql.substr(analyze ? pos : after_explain);
+    text.erase(0, text.find_first_not_of(" \t\r\n"));
+
+    // the plan the statement would run with: through the plan cache if execute_cached takes it
+    auto start = chrono::steady_clock::now();
+    string normalized;
+    vector<Value> literals;
+    shared_ptr<QueryPlan> query_plan;
+    if (PlanCache::normalize(text, normalized, literals) &&
+        upper(normalized.substr(0, normalized.find(' '))) == "SELECT")
+        query_plan = plan_for(normalized, literals);
+    if (query_plan == nullptr)
+    {
+        unique_ptr<SQLParserResult> parsed;
+        {
+            Trace::Span span("parse", "parser");
+            parsed.reset(SQLParser::parseSQLString(text));
+        }
+        if (!parsed->isValid())
+            throw SQLExecError("invalid SQL: " + text + "\n" + parsed->errorMsg());
+        if (parsed->size() != 1 || parsed->getStatement(0)->type() != kStmtSelect)
+            throw SQLExecError("usage: EXPLAIN [ANALYZE] SELECT ...");
+        QueryPlanner planner(*SQLExec::statistics);
+        query_plan.reset(planner.plan((const SelectStatement *) parsed->getStatement(0)));
+        literals.clear();
+    }
+    string message = "planning " + milliseconds(chrono::steady_clock::now() - start) + " ms";
+
+    QueryProfile profile;
+    if (analyze)
+    {
+        IoCounters counters;
+        size_t count = 0;
+        start = chrono::steady_clock::now();
+        {
+            IoCounters::Scope scope(&counters);
+            unique_ptr<EvalPlan> plan(query_plan->instantiate(literals, &profile));
+            plan->open();
+            ValueDict *row;
+            while ((row = plan->next()) != nullptr)
+            {
+                delete row;
+                count++;
+            }
+            plan->close();
+        }
+        message += ", execution " + milliseconds(chrono::steady_clock::now() - start) + " ms, " + to_string(count) +
+                   " rows";
+    }
+
+    ColumnNames *names = new ColumnNames({"operator", "est_rows", "est_cost"});
+    ColumnAttributes *attributes = new ColumnAttributes({ColumnAttribute(ColumnAttribute::TEXT),
+                                                         ColumnAttribute(ColumnAttribute::INT),
+                                                         ColumnAttribute(ColumnAttribute::TEXT)});
+    if (analyze)
+    {
+        for (const char *name: {"rows_in", "rows_out", "total_ms", "self_ms", "blocks_read", "buffer_hits",
+                                "bytes_decoded"})
+            names->push_back(name);
+        for (auto data_type: {ColumnAttribute::INT, ColumnAttribute::INT, ColumnAttribute::TEXT,
+                              ColumnAttribute::TEXT, ColumnAttribute::INT, ColumnAttribute::INT, ColumnAttribute::INT})
+            attributes->push_back(ColumnAttribute(data_type));
+    }
+    ValueDicts *rows = new ValueDicts();
+    explain_node(query_plan->get_root(), 0, analyze ? &profile : nullptr, *rows);
+    return new QueryResult(names, attributes, rows, message);
+}
+
+// The plan the statement ran with
+string SQLExec::describe_plan(const string &sql)
+{
+    string text;
+    vector<Value> literals;
+    if (!PlanCache::normalize(sql, text, literals) || upper(text.substr(0, text.find(' '))) != "SELECT")
+        return "";
+    initialize();
+    shared_ptr<QueryPlan> plan;
+    try {
+        plan = plan_for(text, literals);
+    } catch (exception &e) {
+        return "";  // it failed when it ran, too
+    }
+    if (plan == nullptr)
+        return "";
+    ValueDicts rows;
+    explain_node(plan->get_root(), 0, nullptr, rows);
+    ostringstream out;
+    for (ValueDict *row: rows)
+    {
+        out << (*row)["operator"].s << "  (rows " << (*row)["est_rows"].n << ", cost " << (*row)["est_cost"].s
+            << ")\n";
+        delete row;
+    }
+    return out.str();
+}
+
+// PREPARE name AS SELECT ...
+QueryResult *SQLExec::prepare(const Identifier &name, const string &sql)
+{
+    string text;
+    vector<Value> literals;
+    if (!PlanCache::normalize(sql, text, literals, false))
+        throw SQLExecError("invalid statement to prepare");
+    shared_ptr<QueryPlan> plan = cached_plan(text);
+    if (plan == nullptr)
+        throw SQLExecError("only a single valid SELECT statement can be prepared");
+    lock_guard<mutex> lock(SQLExec::prepared_mutex);
+    SQLExec::prepared[name] = text;
+    return new QueryResult("prepared " + name + " with " + to_string(plan->get_parameter_count()) + " parameters");
+}
+
+// EXECUTE name (value, ...)
+QueryResult *SQLExec::execute_prepared(const Identifier &name, const string &arguments)
+{
+    string text;
+    {
+        lock_guard<mutex> lock(SQLExec::prepared_mutex);
+        auto found = SQLExec::prepared.find(name);
+        if (found == SQLExec::prepared.end())
+            throw SQLExecError("unknown prepared statement " + name);
+        text = found->second;
+    }
+
+    // arguments are literals, optionally parenthesized or after USING
+    string rest = arguments;
+    size_t pos = 0;
+    if (upper(next_word(rest, pos)) == "USING")
+        rest = rest.substr(pos);
+    string shape;
+    vector<Value> parameters;
+    if (!PlanCache::normalize(rest, shape, parameters) && rest.find_first_not_of(" \t") != string::npos)
+        throw SQLExecError("invalid parameters for " + name);
+    if (shape.find_first_not_of("?,() ") != string::npos)
+        throw SQLExecError("parameters for " + name + " must be literals");
+
+    // the plan is dropped from the cache when the catalog changes, so plan again if need be
+    shared_ptr<QueryPlan> plan = plan_for(text, parameters);
+    if (plan == nullptr)
+        throw SQLExecError("prepared statement " + name + " no longer plans");
+    return evaluate(*plan, parameters);
+}
+
+// a file name, quoted or not, or "" for off
+static string file_setting(const string &value)
+{
+    string path = value;
+    if (path.size() >= 2 && path.front() == '\'' && path.back() == '\'')
+        path = path.substr(1, path.size() - 2);
+    return upper(path) == "OFF" ? "" : path;
+}
+
+// SET name value
+QueryResult *SQLExec::set(const Identifier &name, const string &value)
+{
+    if (name == "FETCH_SIZE")
+    {
+        size_t used = 0;
+        long n = 0;
+        try {
+            n = stol(value, &used);
+        } catch (logic_error &e) {
+            used = 0;
+        }
+        if (used != value.size() || n <= 0)
+            throw SQLExecError("FETCH_SIZE must be a positive number of rows");
+        SQLExec::fetch_size = (size_t) n;
+        return new QueryResult("fetch size is " + to_string(n) + " rows");
+    }
+    if (name == "FORMAT")
+    {
+        ResultWriter::Format format;
+        if (!ResultWriter::parse_format(value, format))
+            throw SQLExecError("FORMAT must be one of table, csv, tsv or jsonl");
+        SQLExec::result_format = format;
+        return new QueryResult("format is " + ResultWriter::format_name(format));
+    }
+    if (name == "STATS_FILE")
+    {
+        string path = file_setting(value);
+        Metrics::dump_to(path);
+        return new QueryResult(path.empty() ? string("stats file is off") : "stats file is " + path);
+    }
+    if (name == "TRACE")
+    {
+        Trace *trace = Trace::session();
+        if (trace == nullptr)
+            throw SQLExecError("tracing is only for sessions");
+        string path = file_setting(value);
+        if (path.empty())
+        {
+            trace->stop();
+            return new QueryResult("trace is off");
+        }
+        if (!trace->start(path))
+            throw SQLExecError("could not write " + path);
+        return new QueryResult("tracing to " + path);
+    }
+    if (name == "SLOW_QUERY_LOG")
+    {
+        string path = file_setting(value);
+        QueryLog::log_slow_to(path);
+        return new QueryResult(path.empty() ? string("slow query log is off") : "slow query log is " + path);
+    }
+    if (name == "SLOW_QUERY_MS")
+    {
+        size_t used = 0;
+        long n = -1;
+        try {
+            n = stol(value, &used);
+        } catch (logic_error &e) {
+            used = 0;
+        }
+        if (used != value.size() || n < 0)
+            throw SQLExecError("SLOW_QUERY_MS must be a number of milliseconds");
+        QueryLog::set_slow_threshold(chrono::milliseconds(n));
+        return new QueryResult("slow query threshold is " + to_string(n) + " ms");
+    }
+    if (name == "STATS_INTERVAL")
+    {
+        size_t used = 0;
+        long n = 0;
+        try {
+            n = stol(value, &used);
+        } catch (logic_error &e) {
+            used = 0;
+        }
+        if (used != value.size() || n <= 0)
+            throw SQLExecError("STATS_INTERVAL must be a positive number of seconds");
+        Metrics::dump_every(chrono::seconds(n));
+        return new QueryResult("stats interval is " + to_string(n) + " seconds");
+    }
+    throw SQLExecError("unknown setting " + name);
+}
+
+// COPY table FROM 'file' [WITH] [(] [CSV] [HEADER] [DELIMITER 'c'] [)]
+QueryResult *SQLExec::copy(const string &sql)
+{
+    const string usage = "usage: COPY table FROM 'file' [WITH] [CSV] [HEADER] [DELIMITER 'c'] | "
+                         "COPY table TO 'file' [WITH] [CSV | BINARY] [HEADER]";
+    size_t pos = 0;
+    next_word(sql, pos);
+    Identifier table_name = next_word(sql, pos);
+    string direction = upper(next_word(sql, pos));
+    string path;
+    if (table_name.empty() || (direction != "FROM" && direction != "TO") || !next_quoted(sql, pos, path))
+        throw SQLExecError(usage);
+    bool from = direction == "FROM";
+
+    bool header = false, binary = false;
+    char delimiter = ',';
+    while (pos < sql.size())
+    {
+        if (isspace((unsigned char) sql[pos]) || sql[pos] == '(' || sql[pos] == ')' || sql[pos] == ',')
+        {
+            pos++;
+            continue;
+        }
+        string option = upper(next_word(sql, pos));
+        string value;
+        if (option == "HEADER")
+            header = true;
+        else if (option == "BINARY" && !from)
+            binary = true;
+        else if (option == "DELIMITER" && from && next_quoted(sql, pos, value) && value.size() == 1 &&
+                 value[0] != '"' && value[0] != '\n')
+            delimiter = value[0];
+        else if (option != "WITH" && option != "CSV" && option != "FORMAT")
+            throw SQLExecError(usage);
+    }
+    if (binary && header)
+        throw SQLExecError("HEADER is only for CSV");
+
+    shared_ptr<HeapTable> table = dynamic_pointer_cast<HeapTable>(Tables::get_table(table_name));
+    if (!from)
+    {
+        if (table == nullptr)
+            throw SQLExecError("cannot export " + table_name);
+        TableExporter exporter(*table, binary ? TableExporter::BINARY : TableExporter::CSV, header);
+        size_t count = exporter.save(path);
+        return new QueryResult("copied " + to_string(count) + " rows from " + table_name);
+    }
+
+    if (table == nullptr || table_name[0] == '_')
+        throw SQLExecError("cannot load " + table_name);
+    vector<shared_ptr<DbIndex>> indices;
+    for (auto const &index_name: SQLExec::indices->get_index_names(table_name))
+        indices.push_back(SQLExec::indices->get_index(table_name, index_name));
+
+    BulkLoader loader(*table, indices, header, delimiter);
+    size_t count = loader.load(path);
+    return new QueryResult("copied " + to_string(count) + " rows into " + table_name);
+}
+
+// DEALLOCATE [PREPARE] name
+QueryResult *SQLExec::deallocate(const Identifier &name)
+{
+    lock_guard<mutex> lock(SQLExec::prepared_mutex);
+    if (SQLExec::prepared.erase(name) == 0)
+        throw SQLExecError("unknown prepared statement " + name);
+    return new QueryResult("deallocated " + name);
+}
+
+// ANALYZE [table]
+QueryResult *SQLExec::analyze(const Identifier &table_name)
+{
+    vector<Identifier> table_names;
+    if (!table_name.empty())
+    {
+        ValueDict where = {{"table_name", Value(table_name)}};
+        Handles *handles = SQLExec::tables->select(&where);
+        bool found = !handles->empty();
+        delete handles;
+        if (!found)
+            throw SQLExecError("unknown table " + table_name);
+        table_names.push_back(table_name);
+    }
+    else
+    {
+        // every user table
+        Handles *handles = SQLExec::tables->select();
+        for (Handle &handle : *handles)
+        {
+            ValueDict *row = SQLExec::tables->project(handle);
+            Identifier name = row->at("table_name").s;
+            delete row;
+            if (name != Tables::TABLE_NAME && name != Columns::TABLE_NAME && name != Indices::TABLE_NAME &&
+                name != Statistics::TABLE_NAME && name != Histograms::TABLE_NAME)
+                table_names.push_back(name);
+        }
+        delete handles;
+    }
+
+    for (auto const &name : table_names)
+        SQLExec::statistics->set_statistics(name, gather_statistics(*SQLExec::tables->get_table(name)));
+    return new QueryResult("analyzed " + to_string(table_names.size()) + " tables");
+}
+
+// VACUUM [table]
+QueryResult *SQLExec::vacuum(const Identifier &table_name)
+{
+    vector<Identifier> table_names;
+    if (!table_name.empty())
+    {
+        ValueDict where = {{"table_name", Value(table_name)}};
+        Handles *handles = SQLExec::tables->select(&where);
+        bool found = !handles->empty();
+        delete handles;
+        if (!found)
+            throw SQLExecError("unknown table " + table_name);
+        table_names.push_back(table_name);
+    }
+    else
+    {
+        Handles *handles = SQLExec::tables->select();
+        for (Handle &handle : *handles)
+        {
+            ValueDict *row = SQLExec::tables->project(handle);
+            table_names.push_back(row->at("table_name").s);
+            delete row;
+        }
+        delete handles;
+    }
+
+    // anything deleted before the oldest running transaction's snapshot is gone for everyone
+    TransactionID horizon = TransactionManager::horizon();
+    size_t count = 0;
+    for (auto const &name : table_names)
+    {
+        shared_ptr<HeapTable> table = dynamic_pointer_cast<HeapTable>(SQLExec::tables->get_table(name));
+        if (table == nullptr)
+            continue;
+        vector<shared_ptr<DbIndex>> indices;
+        for (auto const &index_name: SQLExec::indices->get_index_names(name))
+            indices.push_back(SQLExec::indices->get_index(name, index_name));
+        count += table->vacuum(horizon, [&indices](Handle handle) {
+            for (const shared_ptr<DbIndex> &index: indices)
+                index->del(handle);
+        });
+    }
+    return new QueryResult("vacuumed " + to_string(table_names.size()) + " tables, removing " + to_string(count) +
+                           (count == 1 ? " row version" : " row versions"));
+}
+
+// Read a random sample of blocks. Row and null counts are scaled up by the fraction of blocks read,
+// distinct counts are estimated from how many values the sample saw exactly once (the GEE estimator),
+// and the MCV lists and histograms come from the sampled values. Small tables are read in full.
+TableStatistics SQLExec::gather_statistics(DbRelation &table)
+{
+    TableStatistics statistics;
+    size_t block_count = table.get_block_count();
+    statistics.block_count = (uint) block_count;
+    const ColumnNames &column_names = table.get_column_names();
+    vector<vector<Value>> samples(column_names.size());
+    vector<size_t> null_counts(column_names.size(), 0);
+
+    random_device seed;
+    Handles *handles = table.sample(ANALYZE_SAMPLE_BLOCKS, seed());
+    size_t sampled_rows = handles->size();
+    for (Handle &handle : *handles)
+    {
+        ValueDict *row = table.project(handle);
+        for (size_t i = 0; i < column_names.size(); i++)
+        {
+            auto value = row->find(column_names[i]);
+            if (value == row->end())
+                null_counts[i]++;
+            else
+                samples[i].push_back(value->second);
+        }
+        delete row;
+    }
+    delete handles;
+
+    double scale = block_count > ANALYZE_SAMPLE_BLOCKS ? (double) block_count / ANALYZE_SAMPLE_BLOCKS : 1.0;
+    statistics.row_count = (uint) (sampled_rows * scale + 0.5);
+    for (size_t i = 0; i < column_names.size(); i++)
+    {
+        ColumnStatistics &column = statistics.columns[column_names[i]];
+        column.null_count = (uint) (null_counts[i] * scale + 0.5);
+        column.histogram = ColumnHistogram::build(samples[i]);  // leaves the sample sorted
+
+        size_t distinct = 0, singletons = 0;
+        for (size_t j = 0; j < samples[i].size();)
+        {
+            size_t k = j + 1;
+            while (k < samples[i].size() && samples[i][k] == samples[i][j])
+                k++;
+            distinct++;
+            if (k - j == 1)
+                singletons++;
+            j = k;
+        }
+        double estimate = sqrt(scale) * singletons + (distinct - singletons);
+        column.distinct_count = (uint) min((double) statistics.row_count, estimate + 0.5);
+    }
+    return statistics;
+}
+
+void StatementRunner::run(const string &sql) {
+    if (SQLExec::is_extension(sql)) {
+        run(sql, [&sql] { return SQLExec::execute_extension(sql); }, get_access(sql));
+        return;
+    }
+    if (run(sql, [&sql] { return SQLExec::execute_cached(sql); }, ROWS))  // only SELECTs are cached
+        return;
+
+    // parsing needs no lock
+    SQLParserResult *parsed;
+    {
+        Trace::Span span("parse", "parser");
+        parsed = SQLParser::parseSQLString(sql);
+    }
+    try {
+        if (parsed->isValid())
+            run(sql, parsed);
+        else
+            invalid(sql, parsed);
+    } catch (...) {
+        delete parsed;
+        throw;
+    }
+    delete parsed;
+}
+
+void StatementRunner::run(const string &sql, const SQLParserResult *parsed) {
+    for (size_t i = 0; i < parsed->size(); i++) {
+        const SQLStatement *statement = parsed->getStatement(i);
+        starting(statement);
+        run(parsed->size() == 1 ? sql : ParseTreeToString::statement(statement),
+            [statement] { return SQLExec::execute(statement); }, get_access(statement));
+    }
+}
+
+bool StatementRunner::run(const string &sql, const function<QueryResult *()> &statement, Access access) {
+    EngineLock engine_lock(this->engine, access == CATALOG);
+    QueryLog::Timing timing(sql);
+    try {
+        QueryResult *result = statement();
+        if (result == nullptr) {
+            timing.cancel();
+            return false;
+        }
+        take(result);
+    } catch (SQLExecError &e) {
+        fail(e.what());
+    }
+    return true;
+}
+
+void StatementRunner::invalid(const string &sql, const SQLParserResult *parsed) {
+    fail("INVALID SQL: " + sql + "\n" + parsed->errorMsg());
+}
+
+StatementRunner::Access StatementRunner::get_access(const string &extension) {
+    istringstream in(extension);
+    string keyword;
+    in >> keyword;
+    transform(keyword.begin(), keyword.end(), keyword.begin(), ::toupper);
+    if (keyword == "ANALYZE")
+        return CATALOG;
+
+    // ending a transaction that ran DDL drops files or undoes changes to the catalog
+    TransactionBlock *block = TransactionBlock::current();
+    if ((keyword == "COMMIT" || keyword == "ROLLBACK") && block != nullptr && block->is_open() &&
+        block->get_transaction()->has_actions())
+        return CATALOG;
+    return ROWS;
+}
+
+StatementRunner::Access StatementRunner::get_access(const SQLStatement *statement) {
+    switch (statement->type()) {
+        case kStmtSelect:
+        case kStmtShow:
+        case kStmtInsert:
+        case kStmtUpdate:
+        case kStmtDelete:
+            return ROWS;
+        default:
+            return CATALOG;
+    }
+}
+
+// a session for test_transaction_block: its transaction block, and the last statement's rows or error
+class TestSession : public StatementRunner {
+public:
+    TestSession() : StatementRunner(nullptr), block(), rows(0), column_names(), error() {}
+
+    void test(const string &sql) {
+        TransactionBlock::Scope scope(&this->block);
+        this->rows = 0;
+        this->column_names.clear();
+        this->error.clear();
+        run(sql);
+    }
+
+    TransactionBlock block;
+    size_t rows;
+    ColumnNames column_names;
+    string error;
+
+protected:
+    virtual void take(QueryResult *result) {
+        unique_ptr<QueryResult> taken(result);
+        if (result->get_column_names() != nullptr)
+            this->column_names = *result->get_column_names();
+        ValueDicts *rows;
+        while (!(rows = result->fetch())->empty()) {
+            this->rows += rows->size();
+            for (ValueDict *row: *rows)
+                delete row;
+            delete rows;
+        }
+        delete rows;
+    }
+
+    virtual void fail(const string &message) {
+        this->error = message;
+    }
+};
+
+bool test_transaction_block() {
+    TestSession session, other;
+    session.test("CREATE TABLE test_sql_cpp (a INT, b INT)");
+    for (int a = 1; a <= 3; a++)
+        session.test("INSERT INTO test_sql_cpp VALUES (" + to_string(a) + ", 0)");
+    if (!session.error.empty())
+        return false;
+    std::cout << "create ok" << std::endl;
+
+    // ROLLBACK of DML
+    session.test("BEGIN");
+    session.test("INSERT INTO test_sql_cpp VALUES (4, 0)");
+    session.test("DELETE FROM test_sql_cpp WHERE a = 1");
+    bool deleted = session.error.empty();
+    session.test("ROLLBACK");
+    session.test("SELECT * FROM test_sql_cpp");
+    bool dml = deleted && session.rows == 3;
+    std::cout << "rollback dml ok" << std::endl;
+
+    // ROLLBACK of DDL
+    session.test("SHOW TABLES");
+    size_t table_count = session.rows;
+    session.test("BEGIN");
+    session.test("CREATE TABLE test_sql_rollback_cpp (x INT)");
+    session.test("DROP TABLE test_sql_cpp");
+    session.test("ROLLBACK");
+    session.test("SHOW TABLES");
+    bool uncreated = session.rows == table_count;
+    session.test("CREATE TABLE test_sql_rollback_cpp (x INT)");  // its file is gone too
+    uncreated = uncreated && session.error.empty();
+    session.test("DROP TABLE test_sql_rollback_cpp");
+    session.test("SELECT * FROM test_sql_cpp");
+    bool ddl = uncreated && session.error.empty() && session.rows == 3;
+    std::cout << "rollback ddl ok" << std::endl;
+
+    // a statement that fails in a block is undone (here after updating two rows), the block goes on
+    session.test("BEGIN");
+    other.test("UPDATE test_sql_cpp SET b = 1 WHERE a = 3");
+    session.test("UPDATE test_sql_cpp SET b = 2");
+    bool failed = session.error.find("could not serialize") != string::npos;
+    session.test("SELECT * FROM test_sql_cpp WHERE b = 2");
+    bool undone = session.error.empty() && session.rows == 0;
+    session.test("INSERT INTO test_sql_cpp VALUES (4, 0)");
+    session.test("COMMIT");
+    other.test("SELECT * FROM test_sql_cpp");
+    bool savepoint = failed && undone && other.rows == 4;
+    std::cout << "statement rollback ok" << std::endl;
+
+    // a plan cached before a DROP isn't used for the table created in its place
+    session.test("SELECT * FROM test_sql_cpp WHERE a = 1");
+    session.test("DROP TABLE test_sql_cpp");
+    session.test("CREATE TABLE test_sql_cpp (a INT, c TEXT)");
+    session.test("INSERT INTO test_sql_cpp VALUES (1, 'one')");
+    session.test("SELECT * FROM test_sql_cpp WHERE a = 1");
+    bool replanned = session.error.empty() && session.rows == 1 &&
+                     find(session.column_names.begin(), session.column_names.end(), "c") != session.column_names.end();
+    std::cout << "plan cache ok" << std::endl;
+
+    session.test("DROP TABLE test_sql_cpp");
+    return dml && ddl && savepoint && replanned;
+}
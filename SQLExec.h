@@ -5,10 +5,20 @@
  */
 #pragma once
 
+#include <atomic>
 #include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include "SQLParser.h"
+#include "Arena.h"
 #include "schema_tables.h"
+#include "QueryPlanner.h"
+#include "PlanCache.h"
+#include "ResultWriter.h"
+#include "Transaction.h"
 
 /**
  * @class SQLExecError - exception for SQLExec methods
@@ -20,35 +30,104 @@ public:
 
 
 /**
- * @class QueryResult - data structure to hold all the returned data for a query execution
+ * @class QueryResult - data structure to hold all the returned data for a query execution.
+ * A SELECT's result is a cursor over its running plan: rows are pulled from the plan a batch at a
+ * time by fetch, so only fetch_size rows are ever held at once. Other results are materialized
+ * up front in rows, which fetch hands out the same way.
+ * A streamed result holds on to the transaction it was started in until the plan runs out, so every
+ * row comes from the same snapshot however long the client takes to fetch them.
+ * A result also owns the Arena its statement ran in, which is current while rows are fetched and
+ * is released when the result is destroyed.
  */
 class QueryResult {
 public:
-    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message("") {}
+    static const size_t DEFAULT_FETCH_SIZE = 1000;
 
-    QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
-                                       message(message) {}
+    QueryResult() : arena(), column_names(nullptr), column_attributes(nullptr), rows(nullptr), message(""),
+                    plan(nullptr), fetch_size(DEFAULT_FETCH_SIZE), position(0), row_count(0), transaction() {}
+
+    QueryResult(std::string message) : arena(), column_names(nullptr), column_attributes(nullptr), rows(nullptr),
+                                       message(message), plan(nullptr), fetch_size(DEFAULT_FETCH_SIZE), position(0),
+                                       row_count(0), transaction() {}
 
     QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message)
-            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message) {}
+            : arena(), column_names(column_names), column_attributes(column_attributes), rows(rows), message(message),
+              plan(nullptr), fetch_size(DEFAULT_FETCH_SIZE), position(0), row_count(0), transaction() {}
+
+    /**
+     * A result streamed from a plan.
+     * @param plan        opened plan to pull the rows from (closed and freed by this result)
+     * @param fetch_size  most rows returned by each fetch
+     */
+    QueryResult(EvalPlan *plan, size_t fetch_size = DEFAULT_FETCH_SIZE);
 
     virtual ~QueryResult();
 
+    QueryResult(const QueryResult &other) = delete;
+
+    QueryResult &operator=(const QueryResult &other) = delete;
+
     ColumnNames *get_column_names() const { return column_names; }
 
     ColumnAttributes *get_column_attributes() const { return column_attributes; }
 
+    /**
+     * @returns  all the rows of a materialized result, or nullptr if the rows are streamed (use fetch)
+     */
     ValueDicts *get_rows() const { return rows; }
 
+    /**
+     * @returns  the message; for a streamed result it gives the row count once fetch has run out
+     */
     const std::string &get_message() const { return message; }
 
-    friend std::ostream &operator<<(std::ostream &stream, const QueryResult &qres);
+    /**
+     * Get the next batch of rows.
+     * @returns  up to fetch_size rows (freed by caller), none once the result is exhausted
+     */
+    virtual ValueDicts *fetch();
+
+    virtual size_t get_fetch_size() const { return fetch_size; }
+
+    virtual void set_fetch_size(size_t fetch_size) { this->fetch_size = fetch_size; }
+
+    /**
+     * @returns  whether the rows are still to be read from a running plan
+     */
+    bool is_streamed() const { return plan != nullptr; }
+
+    /**
+     * Read the rest of the rows in this transaction, and commit it once they have all been read
+     * (or abort it if the result is destroyed before then).
+     * @param transaction  the transaction the plan was started in
+     */
+    virtual void hold(std::shared_ptr<Transaction> transaction) { this->transaction = transaction; }
+
+    /**
+     * Take over the arena the statement ran in, to release when this result is destroyed.
+     * @param arena  the statement's arena
+     */
+    virtual void adopt(std::unique_ptr<Arena> arena) { this->arena = std::move(arena); }
+
+    /**
+     * Print the result in the shell's table format. Its rows are fetched as they are printed,
+     * so this uses it up.
+     */
+    friend std::ostream &operator<<(std::ostream &stream, QueryResult &qres);
 
 protected:
+    std::unique_ptr<Arena> arena;  // the statement's (first, so it is released after all the rest)
     ColumnNames *column_names;
     ColumnAttributes *column_attributes;
     ValueDicts *rows;
     std::string message;
+    EvalPlan *plan;     // still running, or nullptr
+    size_t fetch_size;
+    size_t position;    // next of rows to fetch
+    size_t row_count;   // rows fetched from plan so far
+    std::shared_ptr<Transaction> transaction;  // the plan's, or nullptr
+
+    virtual void finish();
 };
 
 
@@ -64,10 +143,105 @@ public:
      */
     static QueryResult *execute(const hsql::SQLStatement *statement);
 
+    /**
+     * Execute a SELECT through the plan cache, skipping the parser and planner when a statement
+     * of the same shape (differing only in its literals) has been planned before (only the parser,
+     * if its plan is value-sensitive; see plan_for).
+     * @param sql  the statement text
+     * @returns    the query result (freed by caller), or nullptr if the statement isn't a SELECT
+     *             the cache can handle and should be parsed and executed as usual
+     */
+    static QueryResult *execute_cached(const std::string &sql);
+
+    /**
+     * Execute a run of INSERT ... VALUES statements into the same columns of the same table as one
+     * batch: all the rows are packed into new pages and appended together, then indexed.
+     * @param statements  the INSERTs, each one acceptable to can_batch with the first
+     * @returns           the query result (freed by caller)
+     */
+    static QueryResult *insert_batch(const std::vector<const hsql::InsertStatement *> &statements);
+
+    /**
+     * @param first      an INSERT
+     * @param statement  another INSERT
+     * @returns          true if the two can go in the same insert_batch
+     */
+    static bool can_batch(const hsql::InsertStatement *first, const hsql::InsertStatement *statement);
+
+    /**
+     * Check for one of our extension statements, which the Hyrise parser doesn't know about:
+     *      ANALYZE [table]
+     *      VACUUM [table]
+     *      PREPARE name [AS] SELECT ...   (with ? for each parameter)
+     *      EXECUTE name [(value, ...)]
+     *      DEALLOCATE [PREPARE] name
+     *      SET FETCH_SIZE n
+     *      SET FORMAT table|csv|tsv|jsonl
+     *      SET STATS_FILE 'file'|off
+     *      SET STATS_INTERVAL seconds
+     *      SET SLOW_QUERY_LOG 'file'|off
+     *      SET SLOW_QUERY_MS n
+     *      SET TRACE 'file'|off
+     *      COPY table FROM 'file' [WITH] [CSV] [HEADER] [DELIMITER 'c']
+     *      COPY table TO 'file' [WITH] [CSV | BINARY] [HEADER]
+     *      BEGIN | COMMIT | ROLLBACK [TRANSACTION | WORK]
+     *      EXPLAIN [ANALYZE] SELECT ...
+     *      SHOW STATS
+     *      SHOW QUERY STATS
+     * @param sql  the statement text
+     * @returns    true if it should be run with execute_extension instead of being parsed
+     */
+    static bool is_extension(const std::string &sql);
+
+    /**
+     * @param keyword  an extension statement's first word, in upper case
+     * @returns        true for BEGIN, COMMIT and ROLLBACK, which act on the current
+     *                 TransactionBlock instead of running in a transaction of their own
+     */
+    static bool is_transaction_control(const std::string &keyword);
+
+    /**
+     * @returns  the format set with SET FORMAT, for the shell to print results in
+     */
+    static ResultWriter::Format get_result_format() { return result_format.load(); }
+
+    /**
+     * Execute one of our extension statements.
+     * @param sql  the statement text
+     * @returns    the query result (freed by caller)
+     */
+    static QueryResult *execute_extension(const std::string &sql);
+
+    /**
+     * @param sql  a statement's text
+     * @returns    if it is a SELECT, the plan for it, one operator per line as EXPLAIN shows it
+     *             (with the planner's estimates); otherwise ""
+     */
+    static std::string describe_plan(const std::string &sql);
+
 protected:
-    // the one place in the system that holds the _tables and _indices tables
+    // the one place in the system that holds the _tables, _indices and _statistics tables
     static Tables *tables;
     static Indices *indices;
+    static Statistics *statistics;
+
+    // rows per fetch for the results of SELECT
+    static std::atomic<size_t> fetch_size;
+
+    static std::atomic<ResultWriter::Format> result_format;
+
+    // plans by normalized statement text, and the text of each prepared statement by name
+    static PlanCache *plan_cache;
+    static std::map<Identifier, std::string> prepared;
+    static std::mutex prepared_mutex;
+
+    // how many blocks ANALYZE reads from each table
+    static const size_t ANALYZE_SAMPLE_BLOCKS = 300;
+
+    // how many times autocommit tries a statement that keeps running into other transactions
+    static const unsigned int MAX_ATTEMPTS = 10;
+
+    static void initialize();
 
     // recursive decent into the AST
     static QueryResult *create(const hsql::CreateStatement *statement);
@@ -84,6 +258,136 @@ protected:
 
     static QueryResult *show_index(const hsql::ShowStatement *statement);
 
+    /**
+     * SHOW STATS: the storage layer's counters and latencies, and the buffer pool's statistics
+     * (see Metrics), one per row.
+     * @returns  the query result (freed by caller)
+     */
+    static QueryResult *show_stats();
+
+    /**
+     * SHOW QUERY STATS: statement latencies by shape (see QueryLog), those that took the most
+     * time in all first.
+     * @returns  the query result (freed by caller)
+     */
+    static QueryResult *show_query_stats();
+
+    static QueryResult *select(const hsql::SelectStatement *statement);
+
+    static QueryResult *insert(const hsql::InsertStatement *statement);
+
+    static ValueDict *insert_row(const hsql::InsertStatement *statement, const DbRelation &table);
+
+    static QueryResult *del(const hsql::DeleteStatement *statement);
+
+    static QueryResult *update(const hsql::UpdateStatement *statement);
+
+    /**
+     * Find the rows a DELETE or UPDATE applies to.
+     * @param table  the table
+     * @param where  the WHERE clause: an AND of comparisons (nullptr for every row)
+     * @returns      handles of the matching rows (freed by caller)
+     */
+    static Handles *where_handles(DbRelation &table, const hsql::Expr *where);
+
+    /**
+     * Translate a literal in an INSERT or UPDATE into a value for a column.
+     * @param expr         AST literal (an INT may be negated)
+     * @param attribute    the column's attribute
+     * @param column_name  the column, for errors
+     * @returns            the value
+     */
+    static Value column_value(const hsql::Expr *expr, ColumnAttribute attribute, const Identifier &column_name);
+
+    /**
+     * Run a statement in a transaction of its own, unless this thread is in one already. If the
+     * statement fails, its changes are undone; if it failed for a TransactionConflict, it is tried
+     * again (up to MAX_ATTEMPTS times in all) with a new snapshot. A result still to be fetched
+     * holds on to the transaction (see QueryResult::hold).
+     * @param statement  runs the statement
+     * @returns          what statement returned
+     */
+    static QueryResult *autocommit(const std::function<QueryResult *()> &statement);
+
+    /**
+     * Get the generic plan for a normalized statement from the plan cache, or parse and plan it
+     * (and cache the plan).
+     * @param text    normalized statement text
+     * @param parsed  if not nullptr, returned by reference: the parse the plan was made from
+     * @returns       the plan, or nullptr if the text isn't a single valid SELECT
+     */
+    static std::shared_ptr<QueryPlan> cached_plan(const std::string &text,
+                                                  std::shared_ptr<hsql::SQLParserResult> *parsed = nullptr);
+
+    /**
+     * Get the plan to run a normalized statement with: the cached generic plan, unless it is
+     * value-sensitive (see QueryPlan), when it is planned again, from the cached parse, for the
+     * values at hand. Execution, EXPLAIN and the slow query log all get their plans here.
+     * @param text        normalized statement text
+     * @param parameters  values for its parameters
+     * @returns           the plan, or nullptr if the text isn't a single valid SELECT
+     */
+    static std::shared_ptr<QueryPlan> plan_for(const std::string &text, const std::vector<Value> &parameters);
+
+    /**
+     * Start running a plan.
+     * @param plan        the plan
+     * @param parameters  values for its parameters
+     * @returns           the query result, streaming the plan's rows (freed by caller)
+     */
+    static QueryResult *evaluate(const QueryPlan &plan, const std::vector<Value> &parameters);
+
+    static QueryResult *transaction_control(const std::string &keyword, const std::string &rest);
+
+    static QueryResult *prepare(const Identifier &name, const std::string &sql);
+
+    static QueryResult *execute_prepared(const Identifier &name, const std::string &arguments);
+
+    static QueryResult *deallocate(const Identifier &name);
+
+    static QueryResult *set(const Identifier &name, const std::string &value);
+
+    /**
+     * COPY table FROM 'file' ...: bulk load a CSV file.
+     * COPY table TO 'file' ...: export a table as CSV or in binary.
+     * @param sql  the statement text
+     * @returns    the query result (freed by caller)
+     */
+    static QueryResult *copy(const std::string &sql);
+
+    /**
+     * EXPLAIN SELECT ...: show the plan chosen for a statement, one operator per row, with the
+     * planner's estimates.
+     * EXPLAIN ANALYZE SELECT ...: also run it (discarding its rows) and show what each operator
+     * did: rows in and out, wall time (with its inputs', and its own), and blocks read, buffer
+     * hits and bytes decoded by its own reads.
+     * @param sql  the statement text
+     * @returns    the query result (freed by caller)
+     */
+    static QueryResult *explain(const std::string &sql);
+
+    /**
+     * Gather optimizer statistics for a table, or for every user table if table_name is empty.
+     * @param table_name  table to analyze
+     * @returns           the query result (freed by caller)
+     */
+    static QueryResult *analyze(const Identifier &table_name);
+
+    /**
+     * Remove the row versions no transaction can see any more, from a table or, if table_name is
+     * empty, from every table (the schema tables too).
+     * @param table_name  table to vacuum
+     * @returns           the query result (freed by caller)
+     */
+    static QueryResult *vacuum(const Identifier &table_name);
+
+    /**
+     * Sample a table and estimate its statistics.
+     * @param table  table to sample
+     * @returns      row, block, distinct and null counts, and a histogram per column
+     */
+    static TableStatistics gather_statistics(DbRelation &table);
+
     /**
      * Pull out column name and attributes from AST's column definition clause
      * @param col                AST column definition
@@ -93,3 +397,93 @@ protected:
     static void
     column_definition(const hsql::ColumnDefinition *col, Identifier &column_name, ColumnAttribute &column_attribute);
 };
+
+/**
+ * @class StatementRunner - runs a request's text the way every front end (the shell, a script, the
+ * server, the Workload driver) does it: SQLExec's extensions first, then SELECTs whose plan is
+ * cached, then the parser. Each statement runs under the engine lock it needs and is timed for
+ * the QueryLog from when it has the lock until its result has been taken. A front end derives
+ * from it to say where results and errors go.
+ */
+class StatementRunner {
+public:
+    // what a statement does, and so which locks it takes
+    enum Access {
+        ROWS,       // engine lock shared
+        CATALOG     // engine lock exclusive
+    };
+
+    /**
+     * @param engine  the lock of the sessions that run statements at once (exclusive for changes to
+     *                the catalog, shared for the rest), or nullptr if there is only the one session
+     */
+    explicit StatementRunner(std::shared_timed_mutex *engine) : engine(engine) {}
+
+    virtual ~StatementRunner() {}
+
+    StatementRunner(const StatementRunner &other) = delete;
+
+    StatementRunner &operator=(const StatementRunner &other) = delete;
+
+    /**
+     * Run one or more statements.
+     * @param sql  their text
+     */
+    virtual void run(const std::string &sql);
+
+    /**
+     * Run the statements of a valid parse (e.g., one made ahead of time on another thread).
+     * @param sql     the text that was parsed
+     * @param parsed  its statements
+     */
+    virtual void run(const std::string &sql, const hsql::SQLParserResult *parsed);
+
+    /**
+     * Run one statement under the engine lock, and hand on its result or error.
+     * @param sql        the statement's text
+     * @param statement  runs it
+     * @param access     what it does
+     * @returns          false if statement returned nullptr (and nothing was handed on)
+     */
+    virtual bool run(const std::string &sql, const std::function<QueryResult *()> &statement, Access access);
+
+    /**
+     * @param extension  a statement SQLExec::is_extension accepts
+     * @returns          which locks it takes
+     */
+    static Access get_access(const std::string &extension);
+
+    /**
+     * @param statement  a parsed statement
+     * @returns          which locks it takes
+     */
+    static Access get_access(const hsql::SQLStatement *statement);
+
+protected:
+    std::shared_timed_mutex *engine;
+
+    /**
+     * Hand on a statement's result (still under the engine lock and timed). An SQLExecError while
+     * fetching its rows is reported to fail.
+     * @param result  the result (freed by take)
+     */
+    virtual void take(QueryResult *result) = 0;
+
+    /**
+     * Report a statement that failed with an SQLExecError.
+     * @param message  what went wrong
+     */
+    virtual void fail(const std::string &message) = 0;
+
+    /**
+     * Report text the parser didn't accept (by default to fail).
+     * @param sql     the text
+     * @param parsed  the parser's result, with its error message
+     */
+    virtual void invalid(const std::string &sql, const hsql::SQLParserResult *parsed);
+
+    // a parsed statement is about to run (the shell echoes it)
+    virtual void starting(const hsql::SQLStatement * /* statement */) {}
+};
+
+bool test_transaction_block();
@@ -0,0 +1,175 @@
+/**
+ * @file SQLServer.cpp - implementation of SQLServer
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "SQLServer.h"
+#include "LockManager.h"
+#include "Trace.h"
+#include "ThreadPool.h"
+
+using namespace std;
+using namespace hsql;
+
+SQLServer::SQLServer(const string &address, size_t thread_count)
+        : address(address), thread_count(max((size_t) 1, thread_count)), listen_fd(-1), wake{-1, -1},
+          stopping(false), mutex(), returned(), engine() {
+    if (pipe(this->wake) < 0)
+        throw WireError(string("pipe failed: ") + strerror(errno));
+    fcntl(this->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(this->wake[1], F_SETFL, O_NONBLOCK);
+}
+
+SQLServer::~SQLServer() {
+    close(this->wake[0]);
+    close(this->wake[1]);
+}
+
+void SQLServer::stop() {
+    this->stopping = true;
+    char c = 's';
+    ssize_t ignored = write(this->wake[1], &c, 1);
+    (void) ignored;
+}
+
+void SQLServer::run() {
+    this->listen_fd = listen_on(this->address);
+    map<int, Session *> idle;
+    {
+        ThreadPool pool(this->thread_count);
+        while (!this->stopping) {
+            vector<pollfd> fds = {{this->listen_fd, POLLIN, 0}, {this->wake[0], POLLIN, 0}};
+            for (auto const &entry: idle)
+                fds.push_back({entry.first, POLLIN, 0});
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+
+            // sessions back from the pool
+            if (fds[1].revents & POLLIN) {
+                char drain[256];
+                while (read(this->wake[0], drain, sizeof(drain)) > 0);
+                lock_guard<std::mutex> lock(this->mutex);
+                for (Session *session: this->returned) {
+                    if (session->closed) {
+                        close(session->fd);
+                        delete session;
+                    } else {
+                        idle[session->fd] = session;
+                    }
+                }
+                this->returned.clear();
+            }
+
+            if (fds[0].revents & POLLIN) {
+                int fd = accept(this->listen_fd, nullptr, nullptr);
+                if (fd >= 0)
+                    idle[fd] = new Session(fd);
+            }
+
+            // sessions with a request (or a hang-up) waiting
+            for (size_t i = 2; i < fds.size(); i++) {
+                if (fds[i].revents == 0)
+                    continue;
+                Session *session = idle[fds[i].fd];
+                idle.erase(fds[i].fd);
+                pool.submit([this, session] { this->serve(session); });
+            }
+        }
+    }  // the pool finishes the requests in progress
+
+    for (auto const &entry: idle) {
+        close(entry.first);
+        delete entry.second;
+    }
+    for (Session *session: this->returned) {
+        close(session->fd);
+        delete session;
+    }
+    this->returned.clear();
+    close(this->listen_fd);
+    if (this->address.find_first_not_of("0123456789") != string::npos)
+        unlink(this->address.c_str());
+}
+
+void SQLServer::serve(Session *session) {
+    try {
+        char type;
+        string sql;
+        if (!Frame::receive(session->fd, type, sql)) {
+            session->closed = true;
+        } else if (type != Frame::QUERY) {
+            Frame::send(session->fd, Frame::ERROR, "expected a query");
+            session->closed = true;
+        } else {
+            TransactionBlock::Scope scope(&session->block);
+            Trace::Scope trace_scope(&session->trace);
+            Responder(&this->engine, session->fd).run(sql);
+            Frame::send(session->fd, Frame::READY, "");
+        }
+    } catch (WireError &e) {
+        session->closed = true;
+    } catch (...) {
+        session->closed = true;  // e.g. out of memory; drop the session rather than the server
+    }
+    if (session->closed)
+        abandon(session);
+    give_back(session);
+}
+
+// under the engine lock, like a ROLLBACK statement
+void SQLServer::abandon(Session *session) {
+    if (!session->block.is_open())
+        return;
+    TransactionBlock::Scope scope(&session->block);
+    EngineLock engine_lock(&this->engine, session->block.get_transaction()->has_actions());
+    try {
+        session->block.rollback();
+    } catch (DbRelationError &e) {
+        // nothing more to be done about it
+    }
+}
+
+// SQLExecErrors while fetching go to fail
+void SQLServer::Responder::take(QueryResult *result) {
+    try {
+        FrameBuffer frames(this->fd);
+        ostream out(&frames);
+        {
+            ResultWriter writer(out, SQLExec::get_result_format());
+            writer.write_rows(*result);
+        }
+        if (!out)
+            throw WireError("connection lost");
+        Frame::send(this->fd, Frame::MESSAGE, result->get_message());
+    } catch (DbRelationError &e) {
+        delete result;
+        Frame::send(this->fd, Frame::ERROR, string("DbRelationError: ") + e.what());
+        return;
+    } catch (...) {
+        delete result;
+        throw;
+    }
+    delete result;
+}
+
+void SQLServer::Responder::fail(const string &message) {
+    Frame::send(this->fd, Frame::ERROR, message);
+}
+
+void SQLServer::give_back(Session *session) {
+    lock_guard<std::mutex> lock(this->mutex);
+    this->returned.push_back(session);
+    char c = 'r';
+    ssize_t ignored = write(this->wake[1], &c, 1);
+    (void) ignored;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file SQLServer.h - sql5300's server mode: many client sessions sharing one database
+ * SQLServer
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SQLExec.h"
+#include "Trace.h"
+#include "WireProtocol.h"
+
+/**
+ * @class SQLServer - accepts client connections on a socket and runs their statements (see
+ * WireProtocol.h for the protocol).
+ *
+ * One thread waits (with poll) on the listening socket and on every idle session. When a session
+ * has a request, it is handed to a ThreadPool worker, which reads the request, runs it, sends the
+ * answer and hands the session back to be waited on again. So any number of sessions can be open
+ * while only the pool's threads are busy, and parsing and network I/O for different sessions
+ * overlap. A worker whose statement waits for another session's locks doesn't count against the
+ * pool while it waits (see ThreadPool::Blocking), so the session it waits for can still be served.
+ *
+ * Statements that read or change rows (SELECT, SHOW, INSERT, UPDATE, DELETE, COPY, VACUUM, and the
+ * extensions that don't touch tables) run side by side, sharing the engine lock; the catalog caches
+ * and heap files are safe for that. Each reader sees only its own snapshot (see Transaction.h), so
+ * a long scan never holds up a writer, or a writer a scan, and writers lock just the rows they
+ * change (see LockManager.h), so they only wait for each other over the same rows, giving up the
+ * engine lock while they wait (see EngineLock). Statements that change the catalog (CREATE, DROP,
+ * ANALYZE) take the engine lock exclusively, so they run alone.
+ * Each session has its own TransactionBlock, so a transaction begun with BEGIN spans its requests
+ * until COMMIT or ROLLBACK, or until the session goes away, which rolls it back.
+ * Settings made with SET and PREPAREd statements are shared by all sessions.
+ */
+class SQLServer {
+public:
+    /**
+     * @param address       port number (on the loopback interface) or Unix-domain socket path
+     * @param thread_count  number of sessions that can be served at once
+     */
+    SQLServer(const std::string &address, size_t thread_count = std::thread::hardware_concurrency());
+
+    virtual ~SQLServer();
+
+    SQLServer(const SQLServer &other) = delete;
+
+    SQLServer &operator=(const SQLServer &other) = delete;
+
+    /**
+     * Serve clients until stop is called. Requests in progress are finished before returning.
+     */
+    virtual void run();
+
+    /**
+     * Make run return. Safe to call from any thread or from a signal handler.
+     */
+    virtual void stop();
+
+protected:
+    // runs a session's statements (see StatementRunner), sending their results and errors to its socket
+    class Responder : public StatementRunner {
+    public:
+        Responder(std::shared_timed_mutex *engine, int fd) : StatementRunner(engine), fd(fd) {}
+
+    protected:
+        int fd;
+
+        // rows go out as DATA frames as the ResultWriter fills its buffer, then the message
+        virtual void take(QueryResult *result);
+
+        virtual void fail(const std::string &message);
+    };
+
+    struct Session {
+        int fd;
+        bool closed;
+        TransactionBlock block;
+        Trace trace;
+
+        explicit Session(int fd) : fd(fd), closed(false), block(), trace() {}
+    };
+
+    std::string address;
+    size_t thread_count;
+    int listen_fd;
+    int wake[2];                        // a pipe; writing to it wakes up run's poll
+    std::atomic<bool> stopping;
+
+    std::mutex mutex;                   // guards returned
+    std::vector<Session *> returned;    // sessions whose request is done, to be waited on again
+
+    std::shared_timed_mutex engine;     // exclusive for changes to the catalog, shared for the rest
+
+    // on a pool thread: one request from a session
+    virtual void serve(Session *session);
+
+    // roll back what a closed session left open
+    virtual void abandon(Session *session);
+
+    virtual void give_back(Session *session);
+};
@@ -17,6 +17,12 @@ void initialize_schema_tables() {
     Indices indices;
     indices.create_if_not_exists();
     indices.close();
+    Statistics statistics;
+    statistics.create_if_not_exists();
+    statistics.close();
+    Histograms histograms;
+    histograms.create_if_not_exists();
+    histograms.close();
 
 }
 
@@ -48,7 +54,8 @@ bool is_acceptable_data_type(std::string dt) {
  */
 const Identifier Tables::TABLE_NAME = "_tables";
 Columns *Tables::columns_table = nullptr;
-std::map<Identifier, DbRelation *> Tables::table_cache;
+CatalogCache<Identifier, DbRelation> Tables::table_cache;
+std::atomic<uint64_t> Tables::catalog_version(0);
 
 // get the column name for _tables column
 ColumnNames &Tables::COLUMN_NAMES() {
@@ -69,11 +76,12 @@ ColumnAttributes &Tables::COLUMN_ATTRIBUTES() {
 }
 
 // ctor - we have a fixed table structure of just one column: table_name
+// (the cache doesn't own either of them)
 Tables::Tables() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
-    Tables::table_cache[TABLE_NAME] = this;
+    Tables::table_cache.put(TABLE_NAME, std::shared_ptr<DbRelation>(this, [](DbRelation *) {}));
     if (Tables::columns_table == nullptr)
         columns_table = new Columns();
-    Tables::table_cache[columns_table->TABLE_NAME] = columns_table;
+    Tables::table_cache.put(columns_table->TABLE_NAME, std::shared_ptr<DbRelation>(columns_table, [](DbRelation *) {}));
 }
 
 // Create the file and also, manually add schema tables.
@@ -86,6 +94,10 @@ void Tables::create() {
     insert(&row);
     row["table_name"] = Value("_indices");
     insert(&row);
+    row["table_name"] = Value("_statistics");
+    insert(&row);
+    row["table_name"] = Value("_histograms");
+    insert(&row);
 }
 
 // Manually check that table_name is unique.
@@ -96,6 +108,7 @@ Handle Tables::insert(const ValueDict *row) {
     delete handles;
     if (!unique)
         throw DbRelationError(row->at("table_name").s + " already exists");
+    catalog_changed();
     return HeapTable::insert(row);
 }
 
@@ -103,15 +116,14 @@ Handle Tables::insert(const ValueDict *row) {
 // NOTE: once the row is deleted, any reference to the table (from get_table() below) is gone! So drop the table first.
 void Tables::del(Handle handle) {
     // remove from cache, if there
-    ValueDict *row = project(handle);
+    ColumnNames key_columns = {"table_name"};
+    ValueDict *row = project(handle, &key_columns);
     Identifier table_name = row->at("table_name").s;
     delete row;
-    if (Tables::table_cache.find(table_name) != Tables::table_cache.end()) {
-        DbRelation *table = Tables::table_cache.at(table_name);
-        Tables::table_cache.erase(table_name);
-        delete table;
-    }
+    // (other sessions may still be using the table object; it goes when the last of them lets go)
+    Tables::table_cache.erase(table_name);
 
+    catalog_changed();
     HeapTable::del(handle);
 }
 
@@ -123,9 +135,10 @@ void Tables::get_columns(Identifier table_name, ColumnNames &column_names, Colum
     Handles *handles = Tables::columns_table->select(&where);
 
     ColumnAttribute column_attribute;
+    ColumnNames wanted = {"column_name", "data_type"};
     for (auto const &handle: *handles) {
         ValueDict *row = Tables::columns_table->project(
-                handle);  // get the row's values: {'column_name': <name>, 'data_type': <type>}
+                handle, &wanted);  // get the row's values: {'column_name': <name>, 'data_type': <type>}
 
         Identifier column_name = (*row)["column_name"].s;
         column_names.push_back(column_name);
@@ -149,18 +162,23 @@ void Tables::get_columns(Identifier table_name, ColumnNames &column_names, Colum
 }
 
 // Return a table for given table_name.
-DbRelation &Tables::get_table(Identifier table_name) {
+std::shared_ptr<DbRelation> Tables::get_table(Identifier table_name) {
     // if they are asking about a table we've once constructed, then just return that one
-    if (Tables::table_cache.find(table_name) != Tables::table_cache.end())
-        return *Tables::table_cache[table_name];
+    std::shared_ptr<DbRelation> cached;
+    if (Tables::table_cache.find(table_name, cached))
+        return cached;
 
-    // otherwise assume it is a HeapTable (for now)
+    // otherwise assume it is a HeapTable (for now); if another session builds it at the same time, use theirs
     ColumnNames column_names;
     ColumnAttributes column_attributes;
     get_columns(table_name, column_names, column_attributes);
-    DbRelation *table = new HeapTable(table_name, column_names, column_attributes);
-    Tables::table_cache[table_name] = table;
-    return *table;
+    std::shared_ptr<DbRelation> table = std::make_shared<HeapTable>(table_name, column_names, column_attributes);
+    return Tables::table_cache.insert(table_name, table);
+}
+
+void Tables::uncache(Identifier table_name) {
+    Tables::table_cache.erase(table_name);
+    catalog_changed();
 }
 
 
@@ -229,6 +247,42 @@ void Columns::create() {
     row["column_name"] = Value("is_unique");
     row["data_type"] = Value("BOOLEAN");
     insert(&row);
+
+    row["table_name"] = Value("_statistics");
+    row["data_type"] = Value("TEXT");
+    row["column_name"] = Value("table_name");
+    insert(&row);
+    row["column_name"] = Value("column_name");
+    insert(&row);
+    row["data_type"] = Value("INT");
+    row["column_name"] = Value("row_count");
+    insert(&row);
+    row["column_name"] = Value("block_count");
+    insert(&row);
+    row["column_name"] = Value("distinct_count");
+    insert(&row);
+    row["column_name"] = Value("null_count");
+    insert(&row);
+
+    row["table_name"] = Value("_histograms");
+    row["data_type"] = Value("TEXT");
+    row["column_name"] = Value("table_name");
+    insert(&row);
+    row["column_name"] = Value("column_name");
+    insert(&row);
+    row["column_name"] = Value("kind");
+    insert(&row);
+    row["column_name"] = Value("value_type");
+    insert(&row);
+    row["column_name"] = Value("text_value");
+    insert(&row);
+    row["data_type"] = Value("INT");
+    row["column_name"] = Value("seq");
+    insert(&row);
+    row["column_name"] = Value("int_value");
+    insert(&row);
+    row["column_name"] = Value("frequency");
+    insert(&row);
 }
 
 // Manually check that (table_name, column_name) is unique.
@@ -262,7 +316,7 @@ Handle Columns::insert(const ValueDict *row) {
  * ****************************
  */
 const Identifier Indices::TABLE_NAME = "_indices";
-std::map<std::pair<Identifier, Identifier>, DbIndex *> Indices::index_cache;
+CatalogCache<std::pair<Identifier, Identifier>, DbIndex> Indices::index_cache;
 
 // get the column name for _indices column
 ColumnNames &Indices::COLUMN_NAMES() {
@@ -319,6 +373,7 @@ Handle Indices::insert(const ValueDict *row) {
     delete handles;
     if (!unique)
         throw DbRelationError("duplicate index " + row->at("table_name").s + " " + row->at("index_name").s);
+    Tables::catalog_changed();
     return HeapTable::insert(row);
 }
 
@@ -330,11 +385,8 @@ void Indices::del(Handle handle) {
     Identifier table_name = row->at("table_name").s;
     Identifier index_name = row->at("index_name").s;
     std::pair<Identifier, Identifier> cache_key(table_name, index_name);
-    if (Indices::index_cache.find(cache_key) != Indices::index_cache.end()) {
-        DbIndex *index = Indices::index_cache.at(cache_key);
-        Indices::index_cache.erase(cache_key);
-        delete index;
-    }
+    Indices::index_cache.erase(cache_key);
+    Tables::catalog_changed();
     HeapTable::del(handle);
 }
 
@@ -379,34 +431,37 @@ public:
 
     void close() {}
 
-    Handles *lookup(ValueDict *key_values) const { return nullptr; }
+    Handles *lookup(ValueDict * /* key_values */) const { return nullptr; }
 
-    void insert(Handle handle) {}
+    void insert(Handle /* handle */) {}
 
-    void del(Handle handle) {}
+    void del(Handle /* handle */) {}
 };
 
 
 // Return a table for given table_name.
-DbIndex &Indices::get_index(Identifier table_name, Identifier index_name) {
+// The index holds on to its table for as long as it lives, as it refers to it.
+std::shared_ptr<DbIndex> Indices::get_index(Identifier table_name, Identifier index_name) {
     // if they are asking about an index we've once constructed, then just return that one
     std::pair<Identifier, Identifier> cache_key(table_name, index_name);
-    if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
-        return *Indices::index_cache[cache_key];
+    std::shared_ptr<DbIndex> cached;
+    if (Indices::index_cache.find(cache_key, cached))
+        return cached;
 
     // otherwise assume it is a DummyIndex (for now)
     ColumnNames column_names;
     bool is_hash, is_unique;
     get_columns(table_name, index_name, column_names, is_hash, is_unique);
-    DbRelation &table = Tables::get_table(table_name);
+    std::shared_ptr<DbRelation> table = Tables::get_table(table_name);
     DbIndex *index;
     if (is_hash) {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
+        index = new DummyIndex(*table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
     } else {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to BTreeIndex
+        index = new DummyIndex(*table, index_name, column_names, is_unique);  // FIXME - change to BTreeIndex
     }
-    Indices::index_cache[cache_key] = index;
-    return *index;
+    return Indices::index_cache.insert(cache_key, std::shared_ptr<DbIndex>(index, [table](DbIndex *index) {
+        delete index;
+    }));
 }
 
 IndexNames Indices::get_index_names(Identifier table_name) {
@@ -415,11 +470,241 @@ IndexNames Indices::get_index_names(Identifier table_name) {
     where["table_name"] = Value(table_name);
     where["seq_in_index"] = Value(1);  // only get the row for the first column if composite index
     Handles *handles = select(&where);
+    ColumnNames wanted = {"index_name"};
     for (auto const &handle: *handles) {
-        ValueDict *row = project(handle);
+        ValueDict *row = project(handle, &wanted);
         ret.push_back((*row)["index_name"].s);
         delete row;
     }
     delete handles;
     return ret;
 }
+
+
+/*
+ * *******************************
+ * Statistics class implementation
+ * *******************************
+ */
+const Identifier Statistics::TABLE_NAME = "_statistics";
+Histograms *Statistics::histograms_table = nullptr;
+CatalogCache<Identifier, TableStatistics> Statistics::statistics_cache;
+
+// get the column name for _statistics column
+ColumnNames &Statistics::COLUMN_NAMES() {
+    static ColumnNames cn;
+    if (cn.empty()) {
+        cn.push_back("table_name");
+        cn.push_back("column_name");
+        cn.push_back("row_count");
+        cn.push_back("block_count");
+        cn.push_back("distinct_count");
+        cn.push_back("null_count");
+    }
+    return cn;
+}
+
+// get the column attribute for _statistics column
+ColumnAttributes &Statistics::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes cas;
+    if (cas.empty()) {
+        ColumnAttribute ca(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // table_name
+        cas.push_back(ca);  // column_name
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // row_count
+        cas.push_back(ca);  // block_count
+        cas.push_back(ca);  // distinct_count
+        cas.push_back(ca);  // null_count
+    }
+    return cas;
+}
+
+// ctor - we have a fixed table structure
+Statistics::Statistics() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
+    if (Statistics::histograms_table == nullptr)
+        Statistics::histograms_table = new Histograms();
+}
+
+// SELECT * FROM _statistics WHERE table_name = <table_name>, cached until the table is analyzed again
+bool Statistics::get_statistics(Identifier table_name, TableStatistics &statistics) {
+    std::shared_ptr<TableStatistics> cached;
+    if (Statistics::statistics_cache.find(table_name, cached)) {
+        if (cached == nullptr)
+            return false;
+        statistics = *cached;
+        return true;
+    }
+
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = select(&where);
+    std::shared_ptr<TableStatistics> found;
+    for (auto const &handle: *handles) {
+        ValueDict *row = project(handle);
+        if (found == nullptr) {
+            found = std::make_shared<TableStatistics>();
+            found->row_count = (uint) row->at("row_count").n;
+            found->block_count = (uint) row->at("block_count").n;
+        }
+        ColumnStatistics &column = found->columns[row->at("column_name").s];
+        column.distinct_count = (uint) row->at("distinct_count").n;
+        column.null_count = (uint) row->at("null_count").n;
+        delete row;
+    }
+    delete handles;
+
+    if (found != nullptr) {
+        std::map<Identifier, ColumnHistogram> histograms;
+        Statistics::histograms_table->get_histograms(table_name, histograms);
+        for (auto const &histogram: histograms)
+            found->columns[histogram.first].histogram = histogram.second;
+    }
+
+    std::shared_ptr<TableStatistics> winner = Statistics::statistics_cache.insert(table_name, found);
+    if (winner == nullptr)
+        return false;
+    statistics = *winner;
+    return true;
+}
+
+// Replace all of the table's rows.
+void Statistics::set_statistics(Identifier table_name, const TableStatistics &statistics) {
+    del_statistics(table_name);
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    row["row_count"] = Value((int) statistics.row_count);
+    row["block_count"] = Value((int) statistics.block_count);
+    for (auto const &column: statistics.columns) {
+        row["column_name"] = Value(column.first);
+        row["distinct_count"] = Value((int) column.second.distinct_count);
+        row["null_count"] = Value((int) column.second.null_count);
+        insert(&row);
+        Statistics::histograms_table->add_histogram(table_name, column.first, column.second.histogram);
+    }
+    Statistics::statistics_cache.put(table_name, std::make_shared<TableStatistics>(statistics));
+    Tables::catalog_changed();
+}
+
+void Statistics::del_statistics(Identifier table_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = select(&where);
+    for (auto const &handle: *handles)
+        del(handle);
+    delete handles;
+    Statistics::histograms_table->del_histograms(table_name);
+
+    Statistics::statistics_cache.erase(table_name);
+    Tables::catalog_changed();
+}
+
+
+/*
+ * *******************************
+ * Histograms class implementation
+ * *******************************
+ */
+const Identifier Histograms::TABLE_NAME = "_histograms";
+
+// get the column name for _histograms column
+ColumnNames &Histograms::COLUMN_NAMES() {
+    static ColumnNames cn;
+    if (cn.empty()) {
+        cn.push_back("table_name");
+        cn.push_back("column_name");
+        cn.push_back("kind");
+        cn.push_back("seq");
+        cn.push_back("value_type");
+        cn.push_back("int_value");
+        cn.push_back("text_value");
+        cn.push_back("frequency");
+    }
+    return cn;
+}
+
+// get the column attribute for _histograms column
+ColumnAttributes &Histograms::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes cas;
+    if (cas.empty()) {
+        ColumnAttribute ca(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // table_name
+        cas.push_back(ca);  // column_name
+        cas.push_back(ca);  // kind
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // seq
+        ca.set_data_type(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // value_type
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // int_value
+        ca.set_data_type(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // text_value
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // frequency
+    }
+    return cas;
+}
+
+// ctor - we have a fixed table structure
+Histograms::Histograms() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
+}
+
+// SELECT * FROM _histograms WHERE table_name = <table_name>, reassembled in seq order
+void Histograms::get_histograms(Identifier table_name, std::map<Identifier, ColumnHistogram> &histograms) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = select(&where);
+    std::map<Identifier, std::map<int, std::pair<Value, double>>> mcvs, bounds;
+    for (auto const &handle: *handles) {
+        ValueDict *row = project(handle);
+        Value value;
+        if (row->at("value_type").s == "TEXT") {
+            value = Value(row->at("text_value").s);
+        } else {
+            value = Value(row->at("int_value").n);
+            if (row->at("value_type").s == "BOOLEAN")
+                value.data_type = ColumnAttribute::BOOLEAN;
+        }
+        auto &entries = row->at("kind").s == "mcv" ? mcvs : bounds;
+        entries[row->at("column_name").s][row->at("seq").n] = std::make_pair(value,
+                                                                              row->at("frequency").n / 1000000.0);
+        delete row;
+    }
+    delete handles;
+
+    for (auto const &column: mcvs)
+        for (auto const &entry: column.second)
+            histograms[column.first].mcv.push_back(entry.second);
+    for (auto const &column: bounds)
+        for (auto const &entry: column.second)
+            histograms[column.first].bounds.push_back(entry.second.first);
+}
+
+void Histograms::add_histogram(Identifier table_name, Identifier column_name, const ColumnHistogram &histogram) {
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    row["column_name"] = Value(column_name);
+    auto add = [&](const char *kind, int seq, const Value &value, double frequency) {
+        row["kind"] = Value(kind);
+        row["seq"] = Value(seq);
+        row["value_type"] = Value(value.data_type == ColumnAttribute::TEXT ? "TEXT" :
+                                  value.data_type == ColumnAttribute::BOOLEAN ? "BOOLEAN" : "INT");
+        row["int_value"] = Value(value.data_type == ColumnAttribute::TEXT ? 0 : value.n);
+        row["text_value"] = Value(value.data_type == ColumnAttribute::TEXT ? value.s : "");
+        row["frequency"] = Value((int) (frequency * 1000000));
+        insert(&row);
+    };
+    for (size_t i = 0; i < histogram.mcv.size(); i++)
+        add("mcv", (int) i, histogram.mcv[i].first, histogram.mcv[i].second);
+    for (size_t i = 0; i < histogram.bounds.size(); i++)
+        add("bound", (int) i, histogram.bounds[i], 0);
+}
+
+void Histograms::del_histograms(Identifier table_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles *handles = select(&where);
+    for (auto const &handle: *handles)
+        del(handle);
+    delete handles;
+}
@@ -2,12 +2,19 @@
  * @file schema_tables.h - schema table classes:
  * 		Columns
  * 		Tables
+ * 		Indices
+ * 		Statistics
+ * 		Histograms
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Winter 2023"
  */
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include "heap_storage.h"
+#include "CatalogCache.h"
+#include "Histogram.h"
 
 /**
  * Initialize access to the schema tables.
@@ -56,9 +63,30 @@ public:
     /**
      * Get the correctly instantiated DbRelation for a given table.
      * @param table_name  table to get
-     * @returns           instantiated DbRelation of the correct type
+     * @returns           instantiated DbRelation of the correct type (it lives as long as anyone
+     *                    holds it, even once the table is dropped)
      */
-    static DbRelation &get_table(Identifier table_name);
+    static std::shared_ptr<DbRelation> get_table(Identifier table_name);
+
+    /**
+     * Forget the DbRelation instantiated for a table (e.g., when its creation is undone), so that
+     * the next get_table builds it afresh from the catalog.
+     * @param table_name  table to forget
+     */
+    static void uncache(Identifier table_name);
+
+    /**
+     * Version of the catalog: changes whenever a table or index is created or dropped, or
+     * statistics are gathered, so anything derived from the catalog (like cached plans) can tell
+     * that it is stale.
+     * @returns  the current version
+     */
+    static uint64_t get_catalog_version() { return catalog_version.load(); }
+
+    /**
+     * Note a change to the catalog (bumps the catalog version).
+     */
+    static void catalog_changed() { catalog_version++; }
 
 protected:
     // hard-coded columns for _tables table
@@ -71,7 +99,9 @@ protected:
 
 private:
     // keep a cache of all the tables we've instantiated so far
-    static std::map<Identifier, DbRelation *> table_cache;
+    static CatalogCache<Identifier, DbRelation> table_cache;
+
+    static std::atomic<uint64_t> catalog_version;
 };
 
 
@@ -133,9 +163,9 @@ public:
      * Get the instantiated DbIndex for the given index.
      * @param table_name  what table the requested index is on
      * @param index_name  name of index (unique by table)
-     * @returns           DbIndex for requested index
+     * @returns           DbIndex for requested index (it lives as long as anyone holds it)
      */
-    virtual DbIndex &get_index(Identifier table_name, Identifier index_name);
+    virtual std::shared_ptr<DbIndex> get_index(Identifier table_name, Identifier index_name);
 
     /**
      * Get the list of indices on a given table.
@@ -155,5 +185,127 @@ protected:
     static ColumnAttributes &COLUMN_ATTRIBUTES();
 
 private:
-    static std::map<std::pair<Identifier, Identifier>, DbIndex *> index_cache;
+    static CatalogCache<std::pair<Identifier, Identifier>, DbIndex> index_cache;
+};
+
+
+/**
+ * @class ColumnStatistics - what ANALYZE found out about one column
+ */
+class ColumnStatistics {
+public:
+    ColumnStatistics() : distinct_count(0), null_count(0), histogram() {}
+
+    uint distinct_count;
+    uint null_count;
+    ColumnHistogram histogram;
+};
+
+/**
+ * @class TableStatistics - what ANALYZE found out about one table
+ */
+class TableStatistics {
+public:
+    TableStatistics() : row_count(0), block_count(0), columns() {}
+
+    uint row_count;
+    uint block_count;
+    std::map<Identifier, ColumnStatistics> columns;
+};
+
+class Histograms; // forward declare
+
+/**
+ * @class Statistics - The singleton table that stores the optimizer statistics gathered by ANALYZE,
+ * one row per column of each analyzed table. The columns' histograms are kept in _histograms.
+ */
+class Statistics : public HeapTable {
+public:
+    /**
+     * Name of the statistics table ("_statistics")
+     */
+    static const Identifier TABLE_NAME;
+
+    // ctor/dtor
+    Statistics();
+
+    virtual ~Statistics() {}
+
+    /**
+     * Get the statistics last stored for a table.
+     * @param table_name  table to look up
+     * @param statistics  returned by reference: the table's statistics
+     * @returns           false if the table has never been analyzed
+     */
+    virtual bool get_statistics(Identifier table_name, TableStatistics &statistics);
+
+    /**
+     * Replace the stored statistics for a table.
+     * @param table_name  table the statistics describe
+     * @param statistics  new statistics
+     */
+    virtual void set_statistics(Identifier table_name, const TableStatistics &statistics);
+
+    /**
+     * Forget the statistics for a table (e.g., when it is dropped).
+     * @param table_name  table to forget
+     */
+    virtual void del_statistics(Identifier table_name);
+
+protected:
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
+
+    // keep a reference to the histograms table
+    static Histograms *histograms_table;
+
+private:
+    // tables looked up so far; those never analyzed map to nullptr
+    static CatalogCache<Identifier, TableStatistics> statistics_cache;
+};
+
+
+/**
+ * @class Histograms - The singleton table that stores each analyzed column's most common values
+ * ("mcv" rows, with frequency in parts per million) and histogram bucket bounds ("bound" rows),
+ * in order of seq.
+ */
+class Histograms : public HeapTable {
+public:
+    /**
+     * Name of the histograms table ("_histograms")
+     */
+    static const Identifier TABLE_NAME;
+
+    // ctor/dtor
+    Histograms();
+
+    virtual ~Histograms() {}
+
+    /**
+     * Get the histograms of a table's columns.
+     * @param table_name  table to look up
+     * @param histograms  returned by reference: histogram of each column that has one
+     */
+    virtual void get_histograms(Identifier table_name, std::map<Identifier, ColumnHistogram> &histograms);
+
+    /**
+     * Store the histogram of one column.
+     * @param table_name   table of the column
+     * @param column_name  column the histogram describes
+     * @param histogram    the histogram
+     */
+    virtual void add_histogram(Identifier table_name, Identifier column_name, const ColumnHistogram &histogram);
+
+    /**
+     * Forget the histograms of all of a table's columns.
+     * @param table_name  table to forget
+     */
+    virtual void del_histograms(Identifier table_name);
+
+protected:
+    static ColumnNames &COLUMN_NAMES();
+
+    static ColumnAttributes &COLUMN_ATTRIBUTES();
 };
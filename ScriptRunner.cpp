@@ -0,0 +1,276 @@
+/**
+ * @file ScriptRunner.cpp - implementation of ScriptRunner
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <cctype>
+#include <sstream>
+#include "ScriptRunner.h"
+#include "QueryLog.h"
+
+using namespace std;
+using namespace hsql;
+
+const size_t ScriptRunner::QUEUE_DEPTH;
+const size_t ScriptRunner::BATCH_SIZE;
+
+ScriptRunner::ScriptRunner(istream &in, ostream &out)
+        : in(in), out(out), line(1), queue(), done(false), stopping(false), mutex(), changed(), reader(),
+          batch(), batch_owners(), batch_lines(), batch_sql(), errors(0), runner(*this), failure() {}
+
+ScriptRunner::~ScriptRunner() {
+    if (this->reader.joinable())
+        stop_reader();
+    for (Statement &statement: this->queue)
+        delete statement.parsed;
+    for (SQLParserResult *parsed: this->batch_owners)
+        delete parsed;
+}
+
+size_t ScriptRunner::run() {
+    this->reader = thread(&ScriptRunner::read_all, this);
+    TransactionBlock::Scope scope(&this->block);
+    Trace::Scope trace_scope(&this->trace);
+    try {
+        Statement statement;
+        while (next(statement))
+            execute(statement);
+        flush_batch();
+        this->reader.join();  // it has reached the end of the script, or failed
+        if (this->failure) {
+            try {
+                rethrow_exception(this->failure);
+            } catch (exception &e) {
+                report(this->line, string("script stopped: ") + e.what());
+            } catch (...) {
+                report(this->line, "script stopped: unknown error reading it");
+            }
+        }
+        if (this->block.is_open()) {
+            report(this->line, "transaction still open at the end of the script; rolled back");
+            try {
+                this->block.rollback();
+            } catch (DbRelationError &e) {
+                report(this->line, e.what());
+            }
+        }
+    } catch (...) {
+        if (this->reader.joinable())
+            stop_reader();
+        throw;
+    }
+    return this->errors;
+}
+
+// Statements end with a ; outside of quotes and -- comments. Reads through the stream buffer
+// directly, since scripts can be very long.
+bool ScriptRunner::read_statement(string &sql, size_t &start_line) {
+    sql.clear();
+    streambuf *buffer = this->in.rdbuf();
+    char quote = '\0';
+    bool comment = false;
+    int c;
+    while ((c = buffer->sbumpc()) != EOF) {
+        if (c == '\n')
+            this->line++;
+        if (comment) {
+            if (c == '\n') {
+                comment = false;
+                if (!sql.empty())
+                    sql += '\n';
+            }
+            continue;
+        }
+        if (quote != '\0') {
+            if (c == quote)
+                quote = '\0';
+        } else if (c == '\'' || c == '"' || c == '`') {
+            quote = (char) c;
+        } else if (c == '-' && buffer->sgetc() == '-') {
+            comment = true;
+            continue;
+        } else if (c == ';') {
+            if (sql.empty())
+                continue;
+            return true;
+        }
+        if (sql.empty()) {
+            if (isspace(c))
+                continue;
+            start_line = this->line;
+        }
+        sql += (char) c;
+    }
+    while (!sql.empty() && isspace((unsigned char) sql.back()))
+        sql.pop_back();
+    return !sql.empty();
+}
+
+void ScriptRunner::read_all() {
+    Trace::Scope trace_scope(&this->trace);
+    try {
+        string sql;
+        size_t start_line = 0;
+        while (read_statement(sql, start_line)) {
+            Statement statement{sql, start_line, nullptr};
+            if (!SQLExec::is_extension(sql)) {
+                Trace::Span span("parse", "parser");
+                statement.parsed = SQLParser::parseSQLString(sql);
+            }
+
+            unique_lock<std::mutex> lock(this->mutex);
+            this->changed.wait(lock, [this] { return this->queue.size() < QUEUE_DEPTH || this->stopping; });
+            if (this->stopping) {
+                delete statement.parsed;
+                return;
+            }
+            this->queue.push_back(statement);
+            this->changed.notify_all();
+        }
+    } catch (...) {
+        // the end of the script: anything queued still runs, then run reports it
+        this->failure = current_exception();
+    }
+    lock_guard<std::mutex> lock(this->mutex);
+    this->done = true;
+    this->changed.notify_all();
+}
+
+bool ScriptRunner::next(Statement &statement) {
+    unique_lock<std::mutex> lock(this->mutex);
+    this->changed.wait(lock, [this] { return !this->queue.empty() || this->done; });
+    if (this->queue.empty())
+        return false;
+    statement = this->queue.front();
+    this->queue.pop_front();
+    this->changed.notify_all();
+    return true;
+}
+
+void ScriptRunner::stop_reader() {
+    {
+        lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        this->changed.notify_all();
+    }
+    this->reader.join();
+}
+
+void ScriptRunner::execute(Statement &statement) {
+    // extensions aren't parsed
+    if (statement.parsed == nullptr) {
+        flush_batch();
+        this->runner.line = statement.line;
+        this->runner.run(statement.sql, [&statement] { return SQLExec::execute_extension(statement.sql); },
+                         StatementRunner::get_access(statement.sql));
+        return;
+    }
+
+    SQLParserResult *parsed = statement.parsed;
+    if (!parsed->isValid()) {
+        flush_batch();
+        report(statement.line, "INVALID SQL: " + statement.sql + "\n" + parsed->errorMsg());
+        delete parsed;
+        return;
+    }
+
+    // INSERTs wait in the batch until one that can't join it comes along
+    if (parsed->size() == 1 && parsed->getStatement(0)->type() == kStmtInsert) {
+        const InsertStatement *insert = (const InsertStatement *) parsed->getStatement(0);
+        if (!this->batch.empty() &&
+            (this->batch.size() >= BATCH_SIZE || !SQLExec::can_batch(this->batch.front(), insert)))
+            flush_batch();
+        this->batch.push_back(insert);
+        this->batch_owners.push_back(parsed);
+        this->batch_lines.push_back(statement.line);
+        this->batch_sql.push_back(statement.sql);
+        return;
+    }
+
+    flush_batch();
+    this->runner.line = statement.line;
+    try {
+        this->runner.run(statement.sql, parsed);
+    } catch (...) {
+        delete parsed;
+        throw;
+    }
+    delete parsed;
+}
+
+// A batch is checked completely before any of it is stored, so if it fails nothing has been
+// inserted; then its statements are run one at a time, to insert the good rows and report the bad.
+// A batch that goes in whole is timed as one statement, its first.
+void ScriptRunner::flush_batch() {
+    if (this->batch.empty())
+        return;
+    try {
+        QueryLog::Timing batch_timing(this->batch_sql.front());
+        try {
+            print(SQLExec::insert_batch(this->batch));
+        } catch (SQLExecError &e) {
+            batch_timing.cancel();
+            for (size_t i = 0; i < this->batch.size(); i++) {
+                const InsertStatement *insert = this->batch[i];
+                this->runner.line = this->batch_lines[i];
+                this->runner.run(this->batch_sql[i], [insert] { return SQLExec::execute(insert); },
+                                 StatementRunner::ROWS);
+            }
+        }
+    } catch (...) {
+        for (SQLParserResult *parsed: this->batch_owners)
+            delete parsed;
+        this->batch.clear();
+        this->batch_owners.clear();
+        this->batch_lines.clear();
+        this->batch_sql.clear();
+        throw;
+    }
+    for (SQLParserResult *parsed: this->batch_owners)
+        delete parsed;
+    this->batch.clear();
+    this->batch_owners.clear();
+    this->batch_lines.clear();
+    this->batch_sql.clear();
+}
+
+void ScriptRunner::print(QueryResult *result) {
+    try {
+        ResultWriter writer(this->out, SQLExec::get_result_format());
+        writer.write(*result);
+    } catch (...) {
+        delete result;
+        throw;
+    }
+    delete result;
+}
+
+void ScriptRunner::report(size_t line, const string &message) {
+    this->out << "line " << line << ": Error: " << message << endl;
+    this->errors++;
+}
+
+bool test_script_runner() {
+    // the INSERTs on lines 2 to 6 are one batch; the bad one on line 4 sends the batch back to
+    // running one statement at a time, so the good rows still go in and the error has its line
+    istringstream in("CREATE TABLE test_script_cpp (a INT, b TEXT);\n"
+                     "INSERT INTO test_script_cpp VALUES (1, 'one');\n"
+                     "INSERT INTO test_script_cpp VALUES (2, 'two');\n"
+                     "INSERT INTO test_script_cpp VALUES (3);\n"
+                     "INSERT INTO test_script_cpp VALUES (4, 'four');\n"
+                     "INSERT INTO test_script_cpp VALUES (5, 'five');\n"
+                     "SELECT * FROM test_script_cpp;\n"
+                     "INSERT INTO test_script_cpp VALUES (1, 'one');\n"
+                     "INSERT INTO test_script_cpp VALUES (2, 'two');\n"
+                     "DROP TABLE test_script_cpp;\n");
+    ostringstream out;
+    size_t errors = ScriptRunner(in, out).run();
+    string output = out.str();
+    bool fallback = errors == 1 && output.find("line 4: Error: ") != string::npos &&
+                    output.find("successfully returned 4 rows") != string::npos;
+    std::cout << "batch fallback ok" << std::endl;
+
+    // a batch with nothing wrong goes in whole
+    bool batched = output.find("successfully inserted 2 rows") != string::npos;
+    std::cout << "batch ok" << std::endl;
+    return fallback && batched;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file ScriptRunner.h - running a file of SQL statements without the interactive shell
+ * ScriptRunner
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SQLParser.h"
+#include "SQLExec.h"
+#include "Trace.h"
+
+/**
+ * @class ScriptRunner - runs a script of ;-terminated SQL statements, printing their results.
+ *
+ * Reading and parsing run on a thread of their own, up to QUEUE_DEPTH statements ahead of
+ * execution, so the parser's time overlaps the executor's. Consecutive INSERT ... VALUES
+ * statements into the same columns of the same table are executed together through
+ * SQLExec::insert_batch, up to BATCH_SIZE at a time. Since a batch's rows are all appended before
+ * any later statement runs, the results are the same as running the statements one by one.
+ *
+ * The script is one session: BEGIN ... COMMIT spans statements, and a transaction still open at
+ * the end of the script is rolled back (and reported as an error).
+ *
+ * Errors are reported with the line the statement starts on, and the script carries on. A
+ * failure to read or parse the script itself is reported as an error too, after the statements
+ * before it have run, and the script stops there.
+ */
+class ScriptRunner {
+public:
+    static const size_t QUEUE_DEPTH = 4096;
+    static const size_t BATCH_SIZE = 10000;
+
+    /**
+     * @param in   the script
+     * @param out  where results and errors go
+     */
+    ScriptRunner(std::istream &in, std::ostream &out);
+
+    virtual ~ScriptRunner();
+
+    ScriptRunner(const ScriptRunner &other) = delete;
+
+    ScriptRunner &operator=(const ScriptRunner &other) = delete;
+
+    /**
+     * Run the whole script.
+     * @returns  number of statements that failed
+     */
+    virtual size_t run();
+
+protected:
+    // a statement read from the script, parsed unless it is one of SQLExec's extensions
+    struct Statement {
+        std::string sql;
+        size_t line;                        // where it starts
+        hsql::SQLParserResult *parsed;      // nullptr for extensions and for the end of the script
+    };
+
+    // runs the script's statements (see StatementRunner), reporting errors at the line they start on
+    class Runner : public StatementRunner {
+    public:
+        explicit Runner(ScriptRunner &script) : StatementRunner(nullptr), line(0), script(script) {}
+
+        size_t line;                        // of the statement running
+
+    protected:
+        ScriptRunner &script;
+
+        virtual void take(QueryResult *result) { this->script.print(result); }
+
+        virtual void fail(const std::string &message) { this->script.report(this->line, message); }
+    };
+
+    std::istream &in;
+    std::ostream &out;
+    size_t line;                            // of the reader, as it reads
+
+    // statements parsed and waiting to run, shared by the two threads
+    std::deque<Statement> queue;
+    bool done;                              // the reader has reached the end
+    bool stopping;                          // the runner has given up; the reader should stop
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread reader;
+
+    // pending INSERT batch, and the parser results that own its statements
+    std::vector<const hsql::InsertStatement *> batch;
+    std::vector<hsql::SQLParserResult *> batch_owners;
+    std::vector<size_t> batch_lines;
+    std::vector<std::string> batch_sql;
+    size_t errors;
+    Runner runner;
+    std::exception_ptr failure;             // what stopped the reader early, if anything
+
+    TransactionBlock block;
+    Trace trace;                            // the script's, shared by the two threads
+
+    /**
+     * Read the next statement from the script (on the reader thread).
+     * @param sql          returned by reference: the statement, without its ;
+     * @param start_line   returned by reference: the line it starts on
+     * @returns            false at the end of the script
+     */
+    virtual bool read_statement(std::string &sql, size_t &start_line);
+
+    // reader thread: read and parse every statement, queueing them
+    virtual void read_all();
+
+    virtual bool next(Statement &statement);
+
+    virtual void execute(Statement &statement);
+
+    virtual void flush_batch();
+
+    virtual void stop_reader();
+
+    virtual void print(QueryResult *result);
+
+    virtual void report(size_t line, const std::string &message);
+};
+
+bool test_script_runner();
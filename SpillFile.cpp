@@ -0,0 +1,98 @@
+/**
+ * @file SpillFile.cpp - implementation of SpillFile
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include "SpillFile.h"
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+
+// unique within this process; the pid keeps concurrent processes sharing a DbEnv apart
+Identifier SpillFile::next_name() {
+    static atomic<uint> counter(0);
+    return "_spill_" + to_string(getpid()) + "_" + to_string(++counter);
+}
+
+// we only know how to marshal INT and TEXT, and BOOLEAN fits in an INT
+ColumnAttributes SpillFile::spill_attributes(const ColumnAttributes &column_attributes) {
+    ColumnAttributes attributes;
+    for (auto ca: column_attributes)
+        attributes.push_back(ColumnAttribute(ca.get_data_type() == ColumnAttribute::TEXT ? ColumnAttribute::TEXT
+                                                                                           : ColumnAttribute::INT));
+    return attributes;
+}
+
+SpillFile::SpillFile(const ColumnNames &column_names, const ColumnAttributes &column_attributes)
+        : HeapTable(next_name(), column_names, spill_attributes(column_attributes)), page(nullptr), row_count(0),
+          read_block(0), read_page(nullptr), read_ids(nullptr), read_position(0) {
+    this->file.create();  // creates block 1, which becomes our first page
+    memset(this->buffer, 0, sizeof(this->buffer));
+    Dbt block(this->buffer, sizeof(this->buffer));
+    this->page = new SlottedPage(block, this->file.get_last_block_id(), true);
+}
+
+SpillFile::~SpillFile() {
+    end_read();
+    delete this->page;
+    this->file.drop();
+}
+
+void SpillFile::append_row(const ValueDict *row) {
+    Dbt *data = marshal(row);
+    try {
+        this->page->add(data);
+    } catch (DbBlockNoRoomError &e) {
+        new_page();
+        this->page->add(data);
+    }
+    delete[] (char *) data->get_data();
+    delete data;
+    this->row_count++;
+}
+
+// write out the full page and start filling a freshly allocated block
+void SpillFile::new_page() {
+    flush();
+    SlottedPage *allocated = this->file.get_new();
+    BlockID block_id = allocated->get_block_id();
+    delete allocated;
+    delete this->page;
+    memset(this->buffer, 0, sizeof(this->buffer));
+    Dbt block(this->buffer, sizeof(this->buffer));
+    this->page = new SlottedPage(block, block_id, true);
+}
+
+void SpillFile::flush() {
+    this->file.put(this->page);
+}
+
+void SpillFile::rewind() {
+    flush();
+    end_read();
+    this->read_block = 0;
+}
+
+ValueDict *SpillFile::next() {
+    while (this->read_ids == nullptr || this->read_position >= this->read_ids->size()) {
+        if (this->read_block >= this->file.get_last_block_id())
+            return nullptr;
+        end_read();
+        this->read_page = this->file.get(++this->read_block);
+        this->read_ids = this->read_page->ids();
+        this->read_position = 0;
+    }
+    Dbt *data = this->read_page->get((*this->read_ids)[this->read_position++]);
+    ValueDict *row = unmarshal(data);
+    delete data;
+    return row;
+}
+
+void SpillFile::end_read() {
+    delete this->read_ids;
+    delete this->read_page;
+    this->read_ids = nullptr;
+    this->read_page = nullptr;
+    this->read_position = 0;
+}
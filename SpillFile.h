@@ -0,0 +1,77 @@
+/**
+ * @file SpillFile.h - temporary heap file for operators that overflow their memory budget
+ * SpillFile: HeapTable
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include "heap_storage.h"
+
+/**
+ * @class SpillFile - write-once, read-sequentially temporary table.
+ *
+ * Rows are marshaled with the usual HeapTable encoding and packed into a SlottedPage held in
+ * memory; a page is only written to the HeapFile once it is full, so a spill costs one block
+ * write per page rather than one per row. BOOLEAN columns are stored as INT.
+ * The underlying file is dropped when the SpillFile is destroyed.
+ *
+ *      append(row)   -- while writing
+ *      rewind()      -- flush and (re)start reading from the first row
+ *      next()        -- next row (freed by caller), or nullptr at end
+ */
+class SpillFile : public HeapTable {
+public:
+    SpillFile(const ColumnNames &column_names, const ColumnAttributes &column_attributes);
+
+    virtual ~SpillFile();
+
+    SpillFile(const SpillFile &other) = delete;
+
+    SpillFile(SpillFile &&temp) = delete;
+
+    SpillFile &operator=(const SpillFile &other) = delete;
+
+    SpillFile &operator=(SpillFile &&temp) = delete;
+
+    /**
+     * Add a row to the end of the file.
+     * @param row  row with a value for every column
+     */
+    virtual void append_row(const ValueDict *row);
+
+    /**
+     * Flush any buffered rows and position the reader at the first row.
+     */
+    virtual void rewind();
+
+    /**
+     * Read the next row.
+     * @returns  the row (freed by caller) or nullptr if no more rows
+     */
+    virtual ValueDict *next();
+
+    /**
+     * @returns  number of rows appended
+     */
+    virtual size_t size() const { return row_count; }
+
+protected:
+    char buffer[DbBlock::BLOCK_SZ];
+    SlottedPage *page;
+    size_t row_count;
+    BlockID read_block;
+    SlottedPage *read_page;
+    RecordIDs *read_ids;
+    size_t read_position;
+
+    virtual void new_page();
+
+    virtual void flush();
+
+    virtual void end_read();
+
+    static Identifier next_name();
+
+    static ColumnAttributes spill_attributes(const ColumnAttributes &column_attributes);
+};
@@ -3,6 +3,7 @@
  * DbBlock
  * DbFile
  * DbRelation
+ * IoCounters
  *
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Winter 2023"
@@ -230,6 +231,8 @@ public:
     bool operator==(const Value &other) const;
 
     bool operator!=(const Value &other) const;
+
+    bool operator<(const Value &other) const;
 };
 
 // More type aliases
@@ -320,8 +323,9 @@ public:
      * from an insert or select).
      * @param handle      the row to update
      * @param new_values  a dictionary keyed by column names for changing columns
+     * @returns           a handle to the updated row (which may have moved)
      */
-    virtual void update(const Handle handle, const ValueDict *new_values) = 0;
+    virtual Handle update(const Handle handle, const ValueDict *new_values) = 0;
 
     /**
      * Conceptually, execute: DELETE FROM <table_name> WHERE <handle>
@@ -344,6 +348,38 @@ public:
      */
     virtual Handles *select(const ValueDict *where) = 0;
 
+    /**
+     * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where> LIMIT <limit>,
+     * resuming just after the handle in cursor. Lets a caller scan incrementally and stop early.
+     * @param where   where-clause predicates (may be nullptr)
+     * @param cursor  in: last handle already returned (Handle(0, 0) to start from the beginning)
+     *                out: last handle returned by this call
+     * @param limit   maximum number of handles to return
+     * @returns       a pointer to a list of at most limit handles (freed by caller);
+     *                fewer than limit means the scan is finished
+     */
+    virtual Handles *select(const ValueDict *where, Handle &cursor, size_t limit);
+
+    /**
+     * Cheap estimate of the number of rows, without a full scan.
+     * @returns  estimated row count
+     */
+    virtual size_t estimate_row_count();
+
+    /**
+     * Handles of the rows in block_count blocks chosen uniformly at random (for ANALYZE).
+     * @param block_count  how many blocks to read (all of them if there are no more than this)
+     * @param seed         seed for the random choice
+     * @returns            a pointer to a list of handles (freed by caller)
+     */
+    virtual Handles *sample(size_t block_count, uint32_t seed);
+
+    /**
+     * Number of blocks a full scan reads (for costing).
+     * @returns  block count
+     */
+    virtual size_t get_block_count();
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle  row to get values from
@@ -465,3 +501,47 @@ protected:
     bool unique;
 };
 
+/**
+ * @class IoCounters - what reading from storage has cost a thread: blocks fetched from the files,
+ * records examined by selects, and bytes of records decoded into rows. How many of the blocks the
+ * buffer pool had without going to disk isn't counted per read; EXPLAIN ANALYZE works out
+ * buffer_hits for each operator as a whole (see Instrumented).
+ *
+ * Counting is off, and costs a thread-local load, unless the thread has current counters (set
+ * with Scope, as EXPLAIN ANALYZE does for the statement it runs).
+ */
+class IoCounters {
+public:
+    IoCounters() : blocks_read(0), buffer_hits(0), records_read(0), bytes_decoded(0) {}
+
+    uint64_t blocks_read;
+    uint64_t buffer_hits;
+    uint64_t records_read;
+    uint64_t bytes_decoded;
+
+    IoCounters &operator+=(const IoCounters &other);
+
+    IoCounters &operator-=(const IoCounters &other);
+
+    /**
+     * @returns  the current thread's counters, or nullptr if it isn't counting
+     */
+    static IoCounters *current();
+
+    /**
+     * @class Scope - makes counters the current thread's for as long as it lives
+     */
+    class Scope {
+    public:
+        explicit Scope(IoCounters *counters);
+
+        ~Scope();
+
+        Scope(const Scope &other) = delete;
+
+        Scope &operator=(const Scope &other) = delete;
+
+    protected:
+        IoCounters *previous;
+    };
+};
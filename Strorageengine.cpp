@@ -17,6 +17,15 @@ bool Value::operator!=(const Value &other) const {
     return !(*this == other);
 }
 
+// Orders by data type first, then by value (numeric for INT and BOOLEAN, lexicographic for TEXT).
+bool Value::operator<(const Value &other) const {
+    if (this->data_type != other.data_type)
+        return this->data_type < other.data_type;
+    if (this->data_type == ColumnAttribute::TEXT)
+        return this->s < other.s;
+    return this->n < other.n;
+}
+
 // Just pulls out the column names from a ValueDict and passes that to the usual form of project().
 ValueDict *DbRelation::project(Handle handle, const ValueDict *where) {
     ColumnNames t;
@@ -24,3 +33,63 @@ ValueDict *DbRelation::project(Handle handle, const ValueDict *where) {
         t.push_back(column.first);
     return this->project(handle, &t);
 }
+
+// Generic version: scan everything and keep the part after the cursor. Subclasses should do better.
+Handles *DbRelation::select(const ValueDict *where, Handle &cursor, size_t limit) {
+    Handles *all = where == nullptr ? this->select() : this->select(where);
+    Handles *handles = new Handles();
+    for (auto const &handle: *all)
+        if (handle > cursor && handles->size() < limit)
+            handles->push_back(handle);
+    delete all;
+    if (!handles->empty())
+        cursor = handles->back();
+    return handles;
+}
+
+size_t DbRelation::estimate_row_count() {
+    Handles *handles = this->select();
+    size_t count = handles->size();
+    delete handles;
+    return count;
+}
+
+// A relation that isn't stored in blocks is one block, so the sample is every row.
+Handles *DbRelation::sample(size_t /* block_count */, uint32_t /* seed */) {
+    return this->select();
+}
+
+// A relation that isn't stored in blocks costs about one block to scan.
+size_t DbRelation::get_block_count() {
+    return 1;
+}
+
+static thread_local IoCounters *current_counters = nullptr;
+
+IoCounters &IoCounters::operator+=(const IoCounters &other) {
+    this->blocks_read += other.blocks_read;
+    this->buffer_hits += other.buffer_hits;
+    this->records_read += other.records_read;
+    this->bytes_decoded += other.bytes_decoded;
+    return *this;
+}
+
+IoCounters &IoCounters::operator-=(const IoCounters &other) {
+    this->blocks_read -= other.blocks_read;
+    this->buffer_hits -= other.buffer_hits;
+    this->records_read -= other.records_read;
+    this->bytes_decoded -= other.bytes_decoded;
+    return *this;
+}
+
+IoCounters *IoCounters::current() {
+    return current_counters;
+}
+
+IoCounters::Scope::Scope(IoCounters *counters) : previous(current_counters) {
+    current_counters = counters;
+}
+
+IoCounters::Scope::~Scope() {
+    current_counters = this->previous;
+}
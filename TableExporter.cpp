@@ -0,0 +1,190 @@
+/**
+ * @file TableExporter.cpp - implementation of TableExporter
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include "TableExporter.h"
+#include "BulkLoader.h"
+#include "ResultWriter.h"
+
+using namespace std;
+
+const size_t TableExporter::BUFFER_SIZE;
+const char TableExporter::MAGIC[8] = {'S', 'Q', 'L', '5', '3', '0', '0', 'B'};
+const unsigned char TableExporter::VERSION;
+
+template<typename T>
+static void append(string &buffer, T n) {
+    buffer.append((const char *) &n, sizeof(n));
+}
+
+TableExporter::TableExporter(HeapTable &table, Format format, bool header)
+        : table(table), format(format), header(header) {}
+
+size_t TableExporter::save(const string &path) {
+    ofstream out(path, ios::out | ios::binary | ios::trunc);
+    if (!out)
+        throw DbRelationError("cannot open " + path + " for writing");
+    size_t count = this->format == BINARY ? save_binary(out) : save_csv(out);
+    out.close();
+    if (!out)
+        throw DbRelationError("error writing " + path);
+    return count;
+}
+
+size_t TableExporter::save_csv(ostream &out) {
+    ResultWriter writer(out, ResultWriter::CSV);
+    writer.begin(this->table.get_column_names(), this->header);
+    size_t count = 0;
+    this->table.scan_records([&](const Dbt &record) {
+        ValueDict *row = this->table.decode(record);
+        try {
+            writer.write(*row);
+        } catch (...) {
+            delete row;
+            throw;
+        }
+        delete row;
+        count++;
+    });
+    writer.flush();
+    if (!out)
+        throw DbRelationError("error writing export");
+    return count;
+}
+
+size_t TableExporter::save_binary(ostream &out) {
+    string buffer;
+    buffer.reserve(BUFFER_SIZE + DbBlock::BLOCK_SZ);
+
+    buffer.append(MAGIC, sizeof(TableExporter::MAGIC));
+    append<uint8_t>(buffer, VERSION);
+    const ColumnNames &column_names = this->table.get_column_names();
+    const ColumnAttributes &column_attributes = this->table.get_column_attributes();
+    append<uint16_t>(buffer, (uint16_t) column_names.size());
+    for (size_t i = 0; i < column_names.size(); i++) {
+        ColumnAttribute attribute = column_attributes[i];
+        switch (attribute.get_data_type()) {
+            case ColumnAttribute::INT:
+                append<uint8_t>(buffer, 0);
+                break;
+            case ColumnAttribute::TEXT:
+                append<uint8_t>(buffer, 1);
+                break;
+            default:
+                throw DbRelationError("can only export INT and TEXT columns");
+        }
+        append<uint16_t>(buffer, (uint16_t) column_names[i].size());
+        buffer += column_names[i];
+    }
+
+    // records go out as stored: a record fits in a block, so its size fits in a u16
+    size_t count = 0;
+    this->table.scan_records([&](const Dbt &record) {
+        append<uint16_t>(buffer, (uint16_t) record.get_size());
+        buffer.append((const char *) record.get_data(), record.get_size());
+        count++;
+        if (buffer.size() >= BUFFER_SIZE) {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+            if (!out)
+                throw DbRelationError("error writing export");
+        }
+    });
+    out.write(buffer.data(), buffer.size());
+    return count;
+}
+
+// Rows of a table as "a|b" strings, in file order.
+static vector<string> test_rows(HeapTable &table) {
+    vector<string> rows;
+    table.scan_records([&](const Dbt &record) {
+        ValueDict *row = table.decode(record);
+        rows.push_back(to_string(row->at("a").n) + "|" + row->at("b").s);
+        delete row;
+    });
+    return rows;
+}
+
+template<typename T>
+static T take(const string &bytes, size_t &position) {
+    T n = 0;
+    if (position + sizeof(n) <= bytes.size())
+        memcpy(&n, bytes.data() + position, sizeof(n));
+    position += sizeof(n);
+    return n;
+}
+
+bool test_table_exporter() {
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable table("_test_export_cpp", column_names, column_attributes);
+    HeapTable copy("_test_import_cpp", column_names, column_attributes);
+    const string path = "_test_export_cpp.out";
+    table.create();
+    copy.create();
+    bool ok = true;
+    try {
+        vector<pair<int32_t, string>> values = {{INT_MIN, ""}, {0, "x,y"}, {1, "say \"hi\""}, {2, "line\nbreak\r\n"},
+                                                {INT_MAX, string(1000, 'z')}, {-3, " spaced "}};
+        for (int32_t i = 0; i < 2000; i++)
+            values.push_back(make_pair(i, "row " + to_string(i)));
+        for (auto const &value: values) {
+            ValueDict row;
+            row["a"] = Value(value.first);
+            row["b"] = Value(value.second);
+            table.insert(&row);
+        }
+        vector<string> expected = test_rows(table);
+
+        // BINARY: the header describes the columns, then each record decodes to its row again
+        ok = ok && TableExporter(table, TableExporter::BINARY).save(path) == values.size();
+        string bytes;
+        {
+            ifstream in(path, ios::binary);
+            bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        }
+        const size_t magic_size = sizeof(TableExporter::MAGIC);
+        size_t position = magic_size;
+        ok = ok && bytes.compare(0, magic_size, TableExporter::MAGIC, magic_size) == 0;
+        ok = ok && take<uint8_t>(bytes, position) == TableExporter::VERSION && take<uint16_t>(bytes, position) == 2;
+        for (size_t i = 0; i < column_names.size(); i++) {
+            ok = ok && take<uint8_t>(bytes, position) == i;  // INT, then TEXT
+            uint16_t size = take<uint16_t>(bytes, position);
+            ok = ok && bytes.compare(position, size, column_names[i]) == 0;
+            position += size;
+        }
+        vector<string> exported;
+        while (ok && position < bytes.size()) {
+            uint16_t size = take<uint16_t>(bytes, position);
+            ok = position + size <= bytes.size();
+            string record = bytes.substr(position, size);
+            position += size;
+            Dbt dbt((void *) record.data(), size);
+            ValueDict *row = table.decode(dbt);
+            exported.push_back(to_string(row->at("a").n) + "|" + row->at("b").s);
+            delete row;
+        }
+        ok = ok && exported == expected;
+        std::cout << "binary round trip ok" << std::endl;
+
+        // CSV with a header loads back into an identical table
+        ok = ok && TableExporter(table, TableExporter::CSV, true).save(path) == values.size();
+        ok = ok && BulkLoader(copy, {}, true).load(path) == values.size() && test_rows(copy) == expected;
+        std::cout << "csv round trip ok" << std::endl;
+    } catch (...) {
+        remove(path.c_str());
+        table.drop();
+        copy.drop();
+        throw;
+    }
+    remove(path.c_str());
+    table.drop();
+    copy.drop();
+    return ok;
+}
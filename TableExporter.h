@@ -0,0 +1,67 @@
+/**
+ * @file TableExporter.h - writing tables out to files in bulk (COPY ... TO)
+ * TableExporter
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <string>
+#include "heap_storage.h"
+
+/**
+ * @class TableExporter - writes a whole table to a file.
+ *
+ * The table is streamed a block at a time (HeapTable::scan_records), so memory use doesn't grow with
+ * the table, and output is built in a large buffer that is written out in BUFFER_SIZE pieces.
+ *
+ * Formats:
+ *      CSV     one line per row, fields in column order, quoted as in RFC 4180 (via ResultWriter),
+ *              optionally preceded by a header line; loadable with COPY ... FROM
+ *      BINARY  the records exactly as the table stores them, with no decoding at all:
+ *                  "SQL5300B" magic, u8 format version (1), u16 column count,
+ *                  per column: u8 type (0 INT, 1 TEXT), u16 name length, name bytes,
+ *                  per row: u16 record length, record (INT: 4-byte int, TEXT: u16 length + bytes)
+ *              All integers are in the machine's byte order.
+ */
+class TableExporter {
+public:
+    enum Format {
+        CSV, BINARY
+    };
+
+    static const size_t BUFFER_SIZE = 1024 * 1024;
+    static const char MAGIC[8];
+    static const unsigned char VERSION = 1;
+
+    /**
+     * @param table   table to export
+     * @param format  how to write it
+     * @param header  whether to start a CSV file with a header line
+     */
+    TableExporter(HeapTable &table, Format format = CSV, bool header = false);
+
+    virtual ~TableExporter() {}
+
+    TableExporter(const TableExporter &other) = delete;
+
+    TableExporter &operator=(const TableExporter &other) = delete;
+
+    /**
+     * Export the table.
+     * @param path  file to write (replaced if it exists)
+     * @returns     number of rows written
+     */
+    virtual size_t save(const std::string &path);
+
+protected:
+    HeapTable &table;
+    Format format;
+    bool header;
+
+    virtual size_t save_csv(std::ostream &out);
+
+    virtual size_t save_binary(std::ostream &out);
+};
+
+bool test_table_exporter();
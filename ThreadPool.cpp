@@ -0,0 +1,86 @@
+/**
+ * @file ThreadPool.cpp - implementation of ThreadPool
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include "ThreadPool.h"
+
+using namespace std;
+
+static thread_local ThreadPool *current_pool = nullptr;
+
+ThreadPool::ThreadPool(size_t thread_count)
+        : threads(), tasks(), stopping(false), mutex(), changed(), thread_count(max((size_t) 1, thread_count)),
+          idle(0), blocked(0) {
+    lock_guard<std::mutex> lock(this->mutex);
+    for (size_t i = 0; i < this->thread_count; i++)
+        this->threads.push_back(thread(&ThreadPool::work, this));
+}
+
+// a task still running may start another thread, so the list can grow as we join it
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+        this->changed.notify_all();
+    }
+    for (size_t i = 0;; i++) {
+        thread worker;
+        {
+            lock_guard<std::mutex> lock(this->mutex);
+            if (i == this->threads.size())
+                break;
+            worker = move(this->threads[i]);
+        }
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(Task task) {
+    lock_guard<std::mutex> lock(this->mutex);
+    this->tasks.push_back(move(task));
+    this->changed.notify_one();
+    grow();
+}
+
+void ThreadPool::grow() {
+    if (this->idle == 0 && !this->tasks.empty() && this->threads.size() - this->blocked < this->thread_count)
+        this->threads.push_back(thread(&ThreadPool::work, this));
+}
+
+ThreadPool::Blocking::Blocking() : pool(current_pool) {
+    if (this->pool == nullptr)
+        return;
+    lock_guard<std::mutex> lock(this->pool->mutex);
+    this->pool->blocked++;
+    this->pool->grow();
+}
+
+ThreadPool::Blocking::~Blocking() {
+    if (this->pool == nullptr)
+        return;
+    lock_guard<std::mutex> lock(this->pool->mutex);
+    this->pool->blocked--;
+}
+
+// run tasks until told to stop and there are none left
+void ThreadPool::work() {
+    current_pool = this;
+    while (true) {
+        Task task;
+        {
+            unique_lock<std::mutex> lock(this->mutex);
+            this->idle++;
+            this->changed.wait(lock, [this] { return !this->tasks.empty() || this->stopping; });
+            this->idle--;
+            if (this->tasks.empty())
+                return;
+            task = move(this->tasks.front());
+            this->tasks.pop_front();
+        }
+        try {
+            task();
+        } catch (...) {
+            // the task is responsible for its own errors
+        }
+    }
+}
@@ -0,0 +1,81 @@
+/**
+ * @file ThreadPool.h - a fixed set of worker threads running queued tasks
+ * ThreadPool
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class ThreadPool - runs submitted tasks on a fixed number of threads, in the order submitted.
+ * The destructor waits for the tasks already submitted to finish.
+ *
+ * A task that waits for another task to do something first (e.g., to release a lock) says so with
+ * a Blocking. While it waits, it doesn't count against the thread count: if tasks are queued and
+ * no thread is free for them, the pool starts another thread, so that waiting tasks can't hold
+ * every thread while the one they wait for is still in the queue. Threads started this way stay
+ * in the pool until it goes.
+ */
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    /**
+     * @param thread_count  number of worker threads (at least 1)
+     */
+    explicit ThreadPool(size_t thread_count);
+
+    virtual ~ThreadPool();
+
+    ThreadPool(const ThreadPool &other) = delete;
+
+    ThreadPool &operator=(const ThreadPool &other) = delete;
+
+    /**
+     * Queue a task to run on one of the threads. Exceptions thrown by tasks are ignored.
+     * @param task  the task
+     */
+    virtual void submit(Task task);
+
+    virtual size_t get_thread_count() const { return this->thread_count; }
+
+    /**
+     * @class Blocking - for as long as it lives, the task running on this thread is waiting (does
+     * nothing on a thread that isn't a pool's)
+     */
+    class Blocking {
+    public:
+        Blocking();
+
+        ~Blocking();
+
+        Blocking(const Blocking &other) = delete;
+
+        Blocking &operator=(const Blocking &other) = delete;
+
+    protected:
+        ThreadPool *pool;
+    };
+
+protected:
+    std::vector<std::thread> threads;
+    std::deque<Task> tasks;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t thread_count;        // threads to keep running tasks
+    size_t idle;                // threads waiting for a task
+    size_t blocked;             // threads whose task is waiting (see Blocking)
+
+    virtual void work();
+
+    // under mutex: start another thread if the queued tasks have none to run them
+    virtual void grow();
+};
@@ -0,0 +1,109 @@
+/**
+ * @file Trace.cpp - implementation of Trace
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <cstdio>
+#include <unistd.h>
+#include "Trace.h"
+
+using namespace std;
+
+const size_t Trace::MAX_EVENTS;
+
+static thread_local Trace *session_trace = nullptr;
+
+// small numbers for the threads, in the order they first record something, for the timeline's rows
+static unsigned thread_number() {
+    static atomic<unsigned> next(1);
+    static thread_local unsigned number = next++;
+    return number;
+}
+
+static string escape(const char *text) {
+    string escaped;
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            escaped += '\\';
+            escaped += *c;
+        } else if ((unsigned char) *c < ' ') {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned char) *c);
+            escaped += code;
+        } else {
+            escaped += *c;
+        }
+    }
+    return escaped;
+}
+
+Trace::~Trace() {
+    stop();
+}
+
+bool Trace::start(const string &path) {
+    lock_guard<std::mutex> lock(this->mutex);
+    if (this->on)
+        finish();
+    this->out.open(path, ios::trunc);
+    if (!this->out)
+        return false;
+    this->out << "[\n";
+    this->events = this->dropped = 0;
+    this->epoch = chrono::steady_clock::now();
+    this->on = true;
+    return true;
+}
+
+void Trace::stop() {
+    lock_guard<std::mutex> lock(this->mutex);
+    if (this->on)
+        finish();
+}
+
+// A span that started before the trace was stopped may still end after; it is dropped quietly.
+void Trace::add(const char *name, const char *category, chrono::steady_clock::time_point start,
+                chrono::steady_clock::time_point end) {
+    unsigned tid = thread_number();
+    lock_guard<std::mutex> lock(this->mutex);
+    if (!this->on)
+        return;
+    if (this->events >= MAX_EVENTS) {
+        this->dropped++;
+        return;
+    }
+    auto ts = chrono::duration_cast<chrono::nanoseconds>(start - this->epoch).count();
+    auto dur = chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+    char times[64];
+    snprintf(times, sizeof(times), "\"ts\": %.3f, \"dur\": %.3f", ts / 1000.0, dur / 1000.0);
+    this->out << (this->events++ == 0 ? "" : ",\n") << "{\"name\": \"" << escape(name) << "\", \"cat\": \""
+              << category << "\", \"ph\": \"X\", " << times << ", \"pid\": " << getpid() << ", \"tid\": " << tid
+              << "}";
+}
+
+void Trace::finish() {
+    if (this->dropped > 0) {
+        string note = "trace full: " + to_string(this->dropped) + " more events dropped";
+        this->out << (this->events == 0 ? "" : ",\n") << "{\"name\": \"" << note
+                  << "\", \"ph\": \"i\", \"s\": \"g\", \"ts\": 0, \"pid\": " << getpid() << ", \"tid\": 0}";
+    }
+    this->out << "\n]\n";
+    this->out.close();
+    this->on = false;
+}
+
+Trace *Trace::session() {
+    return session_trace;
+}
+
+Trace *Trace::current() {
+    Trace *trace = session_trace;
+    return trace != nullptr && trace->on.load(memory_order_relaxed) ? trace : nullptr;
+}
+
+Trace::Scope::Scope(Trace *trace) : previous(session_trace) {
+    session_trace = trace;
+}
+
+Trace::Scope::~Scope() {
+    session_trace = this->previous;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file Trace.h - timelines of what a session's statements did, for chrome://tracing
+ * Trace
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+/**
+ * @class Trace - spans of time a session spent in each statement and, inside those, parsing,
+ * planning, each call to each operator, each block read or written and each record encoded or
+ * decoded. Written as they end to a file in Chrome's trace event format (a JSON array of complete
+ * events), for chrome://tracing or Perfetto to show on a timeline, one row per thread.
+ *
+ * Each session (the shell, a script, a server connection) has a Trace, made the current thread's
+ * with a Scope while the session runs. SET TRACE 'file' turns it on, SET TRACE off turns it off
+ * and finishes the file. While it is off a Span costs a thread-local load and a test, and plans
+ * aren't wrapped in Traced at all.
+ *
+ * A trace stops recording after MAX_EVENTS events, noting how many more it dropped, so that a
+ * forgotten trace can't fill the disk.
+ */
+class Trace {
+public:
+    static const size_t MAX_EVENTS = 1000000;
+
+    Trace() : mutex(), out(), on(false), events(0), dropped(0), epoch() {}
+
+    virtual ~Trace();
+
+    Trace(const Trace &other) = delete;
+
+    Trace &operator=(const Trace &other) = delete;
+
+    /**
+     * Start recording, to a new file (finishing the one being recorded to, if any).
+     * @param path  the file
+     * @returns     false if the file can't be written
+     */
+    virtual bool start(const std::string &path);
+
+    /**
+     * Stop recording and finish the file.
+     */
+    virtual void stop();
+
+    /**
+     * @returns  the current thread's session's trace, or nullptr if there is none
+     */
+    static Trace *session();
+
+    /**
+     * @returns  the current thread's session's trace if it is recording, else nullptr
+     */
+    static Trace *current();
+
+    /**
+     * @class Scope - makes a session's trace the current thread's for as long as it lives
+     */
+    class Scope {
+    public:
+        explicit Scope(Trace *trace);
+
+        ~Scope();
+
+        Scope(const Scope &other) = delete;
+
+        Scope &operator=(const Scope &other) = delete;
+
+    protected:
+        Trace *previous;
+    };
+
+    /**
+     * @class Span - records the time from its construction to its destruction, if the current
+     * thread's trace was recording when it was made
+     */
+    class Span {
+    public:
+        /**
+         * @param name      what is being timed (must outlive the span)
+         * @param category  a group of spans that can be picked out together (e.g. "io")
+         */
+        Span(const char *name, const char *category) : trace(current()), name(name), category(category),
+                                                       start() {
+            if (trace != nullptr)
+                start = std::chrono::steady_clock::now();
+        }
+
+        ~Span() {
+            if (trace != nullptr)
+                trace->add(name, category, start, std::chrono::steady_clock::now());
+        }
+
+        Span(const Span &other) = delete;
+
+        Span &operator=(const Span &other) = delete;
+
+    protected:
+        Trace *trace;
+        const char *name;
+        const char *category;
+        std::chrono::steady_clock::time_point start;
+    };
+
+protected:
+    std::mutex mutex;           // guards all but on (threads of a session, e.g. a script's reader, share it)
+    std::ofstream out;
+    std::atomic<bool> on;
+    size_t events;
+    size_t dropped;
+    std::chrono::steady_clock::time_point epoch;   // the file's time 0
+
+    virtual void add(const char *name, const char *category, std::chrono::steady_clock::time_point start,
+                     std::chrono::steady_clock::time_point end);
+
+    // with the mutex held
+    virtual void finish();
+};
@@ -0,0 +1,574 @@
+/**
+ * @file Transaction.cpp - implementation of Snapshot, Transaction, TransactionManager and
+ * TransactionBlock
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <unistd.h>
+#include "Transaction.h"
+#include "LockManager.h"
+#include "heap_storage.h"
+#include "Trace.h"
+
+using namespace std;
+
+const TransactionID TransactionManager::FROZEN;
+const TransactionID TransactionManager::ABORTED;
+const TransactionID TransactionManager::FIRST;
+const TransactionID TransactionManager::ID_BLOCK;
+const char *const TransactionManager::ID_FILE = "_transaction_ids";
+const char *const TransactionManager::ABORTED_FILE = "_aborted_transactions";
+const char *const TransactionManager::LOG_FILE = "_transaction_log";
+
+mutex TransactionManager::mutex;
+TransactionID TransactionManager::next_id = 0;
+TransactionID TransactionManager::reserved = 0;
+set<TransactionID> TransactionManager::running;
+multiset<TransactionID> TransactionManager::oldest;
+AbortedIds TransactionManager::aborted;
+mutex TransactionManager::flush_mutex;
+condition_variable TransactionManager::flushed;
+set<HeapTable *> TransactionManager::pending;
+vector<TransactionID> TransactionManager::committing;
+uint64_t TransactionManager::next_batch = 1;
+uint64_t TransactionManager::flushed_through = 0;
+bool TransactionManager::flushing = false;
+map<uint64_t, size_t> TransactionManager::waiting;
+map<uint64_t, string> TransactionManager::failed_batches;
+mutex TransactionManager::log_mutex;
+int TransactionManager::log = -1;
+
+static thread_local Transaction *current_transaction = nullptr;
+static thread_local TransactionBlock *current_block = nullptr;
+
+bool AbortedIds::contains(TransactionID xid) const {
+    if (this->ranges.empty())
+        return false;
+    auto after = upper_bound(this->ranges.begin(), this->ranges.end(), make_pair(xid, numeric_limits<TransactionID>::max()));
+    return after != this->ranges.begin() && prev(after)->second >= xid;
+}
+
+void AbortedIds::insert(TransactionID first, TransactionID last) {
+    auto range = lower_bound(this->ranges.begin(), this->ranges.end(), make_pair(first, first));
+    if (range != this->ranges.begin() && prev(range)->second + 1 >= first)
+        range--;
+    auto end = range;
+    while (end != this->ranges.end() && end->first <= last + 1) {
+        first = min(first, end->first);
+        last = max(last, end->second);
+        end++;
+    }
+    range = this->ranges.erase(range, end);
+    this->ranges.insert(range, make_pair(first, last));
+}
+
+bool Snapshot::sees(TransactionID xid) const {
+    if (xid == TransactionManager::FROZEN)
+        return true;
+    if (xid == TransactionManager::ABORTED)
+        return false;
+    if (xid == this->own)
+        return true;
+    if (xid >= this->xmax)
+        return false;
+    if (this->aborted.contains(xid))
+        return false;
+    return xid < this->xmin || !binary_search(this->active.begin(), this->active.end(), xid);
+}
+
+bool Snapshot::deleted(TransactionID xmax) const {
+    if (xmax == TransactionManager::FROZEN)
+        return false;
+    return !this->aborted.contains(xmax);
+}
+
+Transaction::~Transaction() {
+    if (!this->finished) {
+        try {
+            abort();
+        } catch (DbRelationError &e) {
+            // nothing more to be done about it
+        }
+    }
+}
+
+TransactionID Transaction::get_id() {
+    if (this->id == TransactionManager::FROZEN) {
+        this->id = TransactionManager::assign_id();
+        this->snapshot.own = this->id;
+    }
+    return this->id;
+}
+
+bool Transaction::has_id() const {
+    return this->id != TransactionManager::FROZEN;
+}
+
+void Transaction::remember(const Change &change) {
+    this->changes.push_back(change);
+}
+
+void Transaction::on_abort(const function<void()> &undo) {
+    add_action(undo, false);
+}
+
+void Transaction::on_commit(const function<void()> &action) {
+    add_action(action, true);
+}
+
+void Transaction::add_action(const function<void()> &action, bool at_commit) {
+    this->actions.push_back(Action{action, at_commit});
+    remember(Change(Change::ACTION, nullptr, Handle(this->actions.size() - 1, 0)));
+}
+
+// Newest first. Each change is forgotten before it is undone, so a failed undo isn't tried twice.
+void Transaction::rollback_to(size_t savepoint) {
+    while (this->changes.size() > savepoint) {
+        Change change = this->changes.back();
+        this->changes.pop_back();
+        if (change.kind == Change::ACTION) {
+            Action action = this->actions[change.handle.first];
+            this->actions.resize(change.handle.first);
+            if (!action.at_commit)
+                action.run();
+        } else {
+            change.table->undo(change, this->id);
+        }
+    }
+}
+
+// The tables are written out before the commit is visible, so no one can see (or build on) a
+// change that a crash could still lose.
+void Transaction::commit() {
+    if (this->finished)
+        return;
+    set<HeapTable *> tables;
+    for (const Change &change: this->changes)
+        if (change.table != nullptr)
+            tables.insert(change.table);
+    try {
+        TransactionManager::flush(this->id, tables);
+    } catch (DbRelationError &e) {
+        abort();
+        throw;
+    }
+    vector<Action> actions;
+    actions.swap(this->actions);
+    this->changes.clear();
+    TransactionManager::finish(this);
+    for (const Action &action: actions)
+        if (action.at_commit)
+            action.run();
+}
+
+// The transaction is still running until the undoing is done, so no one sees half of it. If the
+// undoing fails, the records still stamped with its id would look committed once it finished, so
+// the id is kept as aborted first.
+void Transaction::abort() {
+    if (this->finished)
+        return;
+    try {
+        rollback_to(0);
+    } catch (...) {
+        this->changes.clear();
+        this->actions.clear();
+        if (this->id != TransactionManager::FROZEN)
+            TransactionManager::keep_aborted(this->id);
+        TransactionManager::finish(this);
+        throw;
+    }
+    if (this->id != TransactionManager::FROZEN)
+        TransactionManager::write_log("abort " + to_string(this->id) + "\n", false);
+    TransactionManager::finish(this);
+}
+
+shared_ptr<Transaction> TransactionManager::begin() {
+    shared_ptr<Transaction> transaction(new Transaction());
+    lock_guard<std::mutex> lock(TransactionManager::mutex);
+    transaction->snapshot = take_snapshot();
+    TransactionManager::oldest.insert(transaction->snapshot.xmin);
+    return transaction;
+}
+
+AbortedIds TransactionManager::get_aborted() {
+    lock_guard<std::mutex> lock(TransactionManager::mutex);
+    if (TransactionManager::next_id == 0)
+        reserve_ids();
+    return TransactionManager::aborted;
+}
+
+Transaction *TransactionManager::current() {
+    return current_transaction;
+}
+
+Snapshot TransactionManager::snapshot() {
+    if (current_transaction != nullptr)
+        return current_transaction->get_snapshot();
+    lock_guard<std::mutex> lock(TransactionManager::mutex);
+    return take_snapshot();
+}
+
+TransactionID TransactionManager::horizon() {
+    lock_guard<std::mutex> lock(TransactionManager::mutex);
+    if (TransactionManager::next_id == 0)
+        reserve_ids();
+    if (TransactionManager::oldest.empty())
+        return TransactionManager::next_id;
+    return *TransactionManager::oldest.begin();
+}
+
+// The first to arrive while no flush is running flushes the batch collected so far, its own tables
+// and everyone else's; the others wait. Whoever arrives during that flush joins the next batch.
+// The batch's commits are logged only once all its tables are on disk. A transaction that changed
+// no table has nothing to lose, so its commit needn't wait for the log to be synced.
+void TransactionManager::flush(TransactionID id, const set<HeapTable *> &tables) {
+    if (tables.empty()) {
+        if (id != FROZEN)
+            write_log("commit " + to_string(id) + "\n", false);
+        return;
+    }
+    Trace::Span span("commit flush", "io");
+    unique_lock<std::mutex> lock(TransactionManager::flush_mutex);
+    TransactionManager::pending.insert(tables.begin(), tables.end());
+    TransactionManager::committing.push_back(id);
+    uint64_t batch = TransactionManager::next_batch;
+    TransactionManager::waiting[batch]++;
+    while (TransactionManager::flushed_through < batch) {
+        if (TransactionManager::flushing) {
+            TransactionManager::flushed.wait(lock);
+            continue;
+        }
+        TransactionManager::flushing = true;
+        set<HeapTable *> flushing;
+        flushing.swap(TransactionManager::pending);
+        vector<TransactionID> committing;
+        committing.swap(TransactionManager::committing);
+        uint64_t flushing_batch = TransactionManager::next_batch++;
+        lock.unlock();
+        string error;
+        try {
+            for (HeapTable *table: flushing)
+                table->sync();
+            string lines;
+            for (TransactionID committed: committing)
+                lines += "commit " + to_string(committed) + "\n";
+            write_log(lines, true);
+        } catch (DbException &e) {
+            error = e.what();
+        } catch (DbRelationError &e) {
+            error = e.what();
+        }
+        lock.lock();
+        if (!error.empty())
+            TransactionManager::failed_batches[flushing_batch] = error;
+        TransactionManager::flushing = false;
+        TransactionManager::flushed_through = flushing_batch;
+        TransactionManager::flushed.notify_all();
+    }
+    string error;
+    auto failed = TransactionManager::failed_batches.find(batch);
+    if (failed != TransactionManager::failed_batches.end())
+        error = failed->second;
+    if (--TransactionManager::waiting[batch] == 0) {  // the last of the batch to be told
+        TransactionManager::waiting.erase(batch);
+        TransactionManager::failed_batches.erase(batch);
+    }
+    if (!error.empty())
+        throw DbRelationError("could not write changes to disk: " + error);
+}
+
+TransactionManager::Scope::Scope(Transaction *transaction) : previous(current_transaction) {
+    if (transaction != nullptr)
+        current_transaction = transaction;
+}
+
+TransactionManager::Scope::~Scope() {
+    current_transaction = this->previous;
+}
+
+TransactionID TransactionManager::assign_id() {
+    lock_guard<std::mutex> lock(TransactionManager::mutex);
+    if (TransactionManager::next_id == 0 || TransactionManager::next_id >= TransactionManager::reserved)
+        reserve_ids();
+    TransactionID id = TransactionManager::next_id++;
+    TransactionManager::running.insert(id);
+    return id;
+}
+
+// Locks go only once the transaction has finished, so a writer that was waiting for one of its
+// rows sees that it committed (and gives up) or that the row is as it was (and goes ahead).
+void TransactionManager::finish(Transaction *transaction) {
+    {
+        lock_guard<std::mutex> lock(TransactionManager::mutex);
+        transaction->finished = true;
+        if (transaction->id != FROZEN)
+            TransactionManager::running.erase(transaction->id);
+        auto found = TransactionManager::oldest.find(transaction->snapshot.xmin);
+        if (found != TransactionManager::oldest.end())
+            TransactionManager::oldest.erase(found);
+    }
+    if (transaction->id != FROZEN)
+        LockManager::release_all(transaction->id);
+}
+
+// Doesn't throw, since the transaction must still finish. If the file can't be written, this run
+// at least doesn't take the records for committed ones.
+void TransactionManager::keep_aborted(TransactionID id) {
+    lock_guard<std::mutex> lock(TransactionManager::mutex);
+    TransactionManager::aborted.insert(id);
+    try {
+        write_file(ABORTED_FILE, to_string(id) + "\n", true);
+    } catch (DbRelationError &e) {
+        // nothing more to be done about it
+    }
+}
+
+// with the mutex held
+Snapshot TransactionManager::take_snapshot() {
+    if (TransactionManager::next_id == 0)
+        reserve_ids();
+    Snapshot snapshot;
+    snapshot.xmax = TransactionManager::next_id;
+    snapshot.xmin = TransactionManager::running.empty() ? snapshot.xmax : *TransactionManager::running.begin();
+    snapshot.active.assign(TransactionManager::running.begin(), TransactionManager::running.end());
+    snapshot.aborted = TransactionManager::aborted;
+    return snapshot;
+}
+
+// With the mutex held: record the end of the next block of ids before handing any of them out.
+// The first time, carry on from where the last run's reservation ended, with the ids it didn't
+// commit. The reservation is synced, so no id stamped on disk can be handed out again.
+void TransactionManager::reserve_ids() {
+    TransactionID next_id = TransactionManager::next_id, reserved = TransactionManager::reserved;
+    bool starting = next_id == 0;
+    if (starting) {
+        ifstream in(TransactionManager::path(ID_FILE));
+        TransactionID saved = 0;
+        if (!(in >> saved) || saved < FIRST)
+            saved = FIRST;
+        ifstream aborted_in(TransactionManager::path(ABORTED_FILE));
+        string line;
+        while (getline(aborted_in, line)) {
+            istringstream entry(line);
+            TransactionID first, last;
+            if (!(entry >> first))
+                continue;
+            TransactionManager::aborted.insert(first, entry >> last ? last : first);
+        }
+        recover(saved);
+        next_id = reserved = saved;
+    } else if (next_id < reserved) {
+        return;
+    }
+    reserved += ID_BLOCK;
+    write_file(ID_FILE, to_string(reserved) + "\n", false);
+    if (starting) {
+        write_file(LOG_FILE, "first " + to_string(next_id) + "\n", false);
+        lock_guard<std::mutex> log_lock(TransactionManager::log_mutex);
+        TransactionManager::log = ::open(TransactionManager::path(LOG_FILE).c_str(), O_WRONLY | O_APPEND);
+        if (TransactionManager::log < 0)
+            throw DbRelationError("could not open " + TransactionManager::path(LOG_FILE));
+    }
+    TransactionManager::next_id = next_id;
+    TransactionManager::reserved = reserved;
+}
+
+// The log lists the ids the run before finished, from the first it could hand out. Between them,
+// and from the last of them up to where its reservation ended, are the ids it never finished (or
+// never used); any of their records that reached the disk must count for nothing. A crash in here
+// only means doing it again, as the log is started afresh only after the reservation it covers.
+void TransactionManager::recover(TransactionID reserved) {
+    ifstream in(TransactionManager::path(LOG_FILE));
+    string word;
+    TransactionID id, first = FROZEN;
+    set<TransactionID> finished;
+    while (in >> word >> id) {
+        if (word == "first")
+            first = id;
+        else
+            finished.insert(id);
+    }
+    if (first < FIRST)
+        return;  // no log: nothing was handed out, or it was by a version before there was one
+    AbortedIds lost;
+    TransactionID next = first;
+    for (TransactionID done: finished) {
+        if (done < next)
+            continue;
+        if (done > next)
+            lost.insert(next, done - 1);
+        next = done + 1;
+    }
+    if (next < reserved)
+        lost.insert(next, reserved - 1);
+    string lines;
+    for (auto &range: lost.ranges) {
+        TransactionManager::aborted.insert(range.first, range.second);
+        lines += to_string(range.first) + " " + to_string(range.second) + "\n";
+    }
+    if (!lines.empty())
+        write_file(ABORTED_FILE, lines, true);
+}
+
+// Holding only log_mutex, so that the abort of one transaction doesn't wait for the commits of others
+// to be synced any longer than it takes to append its line.
+void TransactionManager::write_log(const string &lines, bool sync) {
+    lock_guard<std::mutex> lock(TransactionManager::log_mutex);
+    if (TransactionManager::log < 0)
+        return;  // no id has been handed out, so there is nothing to log
+    bool written = ::write(TransactionManager::log, lines.data(), lines.size()) == (ssize_t) lines.size();
+    if (sync && (!written || ::fsync(TransactionManager::log) != 0))
+        throw DbRelationError("could not write " + TransactionManager::path(LOG_FILE));
+}
+
+void TransactionManager::write_file(const char *file, const string &text, bool append) {
+    string path = TransactionManager::path(file);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+    bool written = fd >= 0 && ::write(fd, text.data(), text.size()) == (ssize_t) text.size() && ::fsync(fd) == 0;
+    if (fd >= 0)
+        ::close(fd);
+    if (!written)
+        throw DbRelationError("could not write " + path);
+}
+
+string TransactionManager::path(const char *file) {
+    const char *home = nullptr;
+    _DB_ENV->get_home(&home);
+    return string(home == nullptr ? "." : home) + "/" + file;
+}
+
+TransactionBlock::~TransactionBlock() {
+    if (this->transaction != nullptr) {
+        try {
+            rollback();
+        } catch (DbRelationError &e) {
+            // nothing more to be done about it
+        }
+    }
+}
+
+void TransactionBlock::begin() {
+    if (this->transaction != nullptr)
+        throw DbRelationError("a transaction is already in progress");
+    this->transaction = TransactionManager::begin();
+    if (current_block == this)
+        current_transaction = this->transaction.get();
+}
+
+void TransactionBlock::commit() {
+    end()->commit();
+}
+
+void TransactionBlock::rollback() {
+    end()->abort();
+}
+
+TransactionBlock *TransactionBlock::current() {
+    return current_block;
+}
+
+// the block's transaction, which is no longer the block's (nor current)
+shared_ptr<Transaction> TransactionBlock::end() {
+    if (this->transaction == nullptr)
+        throw DbRelationError("no transaction is in progress");
+    if (current_block == this)
+        current_transaction = nullptr;
+    shared_ptr<Transaction> transaction;
+    transaction.swap(this->transaction);
+    return transaction;
+}
+
+TransactionBlock::Scope::Scope(TransactionBlock *block)
+        : previous(current_block), transaction_scope(block->get_transaction()) {
+    current_block = block;
+}
+
+TransactionBlock::Scope::~Scope() {
+    current_block = this->previous;
+}
+
+bool test_transactions() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("_test_transactions_cpp", column_names, column_attributes);
+    table.create_if_not_exists();
+
+    // how many rows a transaction sees (or, for nullptr, one that begins now)
+    auto visible = [&table](Transaction *transaction) {
+        TransactionManager::Scope scope(transaction);
+        Handles *handles = table.select();
+        size_t count = handles->size();
+        delete handles;
+        return count;
+    };
+    auto insert = [&table](Transaction *transaction, int a) {
+        TransactionManager::Scope scope(transaction);
+        ValueDict row;
+        row["a"] = Value(a);
+        table.insert(&row);
+    };
+
+    // snapshot visibility: a transaction doesn't see what commits after it began
+    shared_ptr<Transaction> t1 = TransactionManager::begin(), t2 = TransactionManager::begin();
+    insert(t1.get(), 1);
+    size_t before_commit = visible(t2.get());
+    t1->commit();
+    size_t after_commit = visible(t2.get()), later = visible(nullptr);
+    t2->commit();
+    std::cout << "snapshot ok" << std::endl;
+
+    // first writer wins: a row deleted by a transaction we can't see can't be deleted again
+    shared_ptr<Transaction> t3 = TransactionManager::begin(), t4 = TransactionManager::begin();
+    Handles *handles = table.select();
+    Handle row = handles->at(0);
+    delete handles;
+    {
+        TransactionManager::Scope scope(t3.get());
+        table.del(row);
+    }
+    t3->commit();
+    bool conflict = false;
+    try {
+        TransactionManager::Scope scope(t4.get());
+        table.del(row);
+    } catch (TransactionConflict &e) {
+        conflict = true;
+    }
+    t4->abort();
+    std::cout << "first writer wins ok" << std::endl;
+
+    // abort undoes everything, rollback_to only what came after the savepoint
+    shared_ptr<Transaction> t5 = TransactionManager::begin();
+    insert(t5.get(), 2);
+    t5->abort();
+    size_t after_abort = visible(nullptr);
+    shared_ptr<Transaction> t6 = TransactionManager::begin();
+    insert(t6.get(), 3);
+    size_t savepoint = t6->savepoint();
+    insert(t6.get(), 4);
+    t6->rollback_to(savepoint);
+    size_t after_rollback = visible(t6.get());
+    t6->commit();
+    size_t committed = visible(nullptr);
+    std::cout << "rollback ok" << std::endl;
+
+    // aborted ids (as recovery leaves them) are kept as merged ranges
+    AbortedIds aborted;
+    aborted.insert(10, 19);
+    aborted.insert(30);
+    aborted.insert(20, 29);
+    bool merged = aborted.ranges.size() == 1 && aborted.contains(10) && aborted.contains(30) &&
+                  !aborted.contains(9) && !aborted.contains(31);
+    std::cout << "aborted ids ok" << std::endl;
+
+    table.drop();
+    return before_commit == 0 && after_commit == 0 && later == 1 && conflict && after_abort == 0 &&
+           after_rollback == 1 && committed == 1 && merged;
+}
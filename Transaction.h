@@ -0,0 +1,450 @@
+/**
+ * @file Transaction.h - multi-version concurrency control
+ * TransactionID, Snapshot, Change, Transaction, TransactionManager
+ *
+ * Every record carries the id of the transaction that created it (xmin) and of the one that
+ * deleted it (xmax, FROZEN if none); see SlottedPage. Deleting or updating a record doesn't remove
+ * it, it just stamps its xmax (an update also adds the new version), so a reader can always find
+ * the version that was current when it started. What it may see is decided by its Snapshot, taken
+ * when its transaction begins: the changes of transactions that had committed by then, and its own.
+ * Readers take no locks and never wait for writers, nor writers for readers. Writers lock the rows
+ * they change (see LockManager.h) until they finish.
+ *
+ * Versions that no snapshot can see any more are removed by VACUUM (HeapTable::vacuum).
+ *
+ * Pages can reach the disk before their transaction finishes (a commit syncs whole tables, and the
+ * buffer pool writes out dirty pages when it likes), so after a crash the ids of the transactions
+ * it cut off count as aborted (see TransactionManager::recover).
+ *
+ * A transaction's write set doubles as its undo log: aborting walks it backwards. Changes outside
+ * the heap files (creating or dropping a table's file, the catalog caches) go in it too, as
+ * actions to take on abort or, for what can't be undone (removing a file), deferred to commit.
+ * So DDL is as atomic as DML, and a session's explicit transaction (TransactionBlock) can be
+ * rolled back whatever it did.
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "storage_engine.h"
+
+class HeapTable; // forward declare
+
+typedef u_int32_t TransactionID;
+
+/**
+ * @class TransactionConflict - a transaction can't go on because of another one: it changed the
+ * same row first, or the two would wait for each other's locks forever. Trying again from the
+ * start (with a new snapshot) may well succeed.
+ */
+class TransactionConflict : public DbRelationError {
+public:
+    explicit TransactionConflict(std::string s) : DbRelationError(s) {}
+};
+
+/**
+ * @class AbortedIds - the transactions that never committed although records may still be stamped
+ * with their ids: those whose abort failed partway, and those a crash cut off. Kept as ranges, as
+ * a crashed run leaves whole stretches of ids it reserved but is not known to have finished.
+ */
+class AbortedIds {
+public:
+    AbortedIds() : ranges() {}
+
+    /**
+     * @param xid  a transaction id
+     * @returns    whether it is one of them
+     */
+    bool contains(TransactionID xid) const;
+
+    /**
+     * Add the ids from first to last (inclusive), merging with the ranges they touch.
+     */
+    void insert(TransactionID first, TransactionID last);
+
+    void insert(TransactionID id) { insert(id, id); }
+
+    bool empty() const { return ranges.empty(); }
+
+    // first and last of each, sorted and disjoint
+    std::vector<std::pair<TransactionID, TransactionID>> ranges;
+};
+
+/**
+ * @class Snapshot - which transactions' changes a transaction can see: those that committed before
+ * it began. Ids below xmin had all finished then, ids from xmax on hadn't started, and those in
+ * between had finished unless they are in active. Of those that had finished, the ones in aborted
+ * didn't commit.
+ */
+class Snapshot {
+public:
+    Snapshot() : xmin(0), xmax(0), active(), aborted(), own(0) {}
+
+    TransactionID xmin;
+    TransactionID xmax;
+    std::vector<TransactionID> active;  // sorted
+    AbortedIds aborted;                 // see TransactionManager::get_aborted
+    TransactionID own;                  // the transaction's own id, once it has one
+
+    /**
+     * @param xid  a transaction id from a record's stamp
+     * @returns    whether the transaction's changes are visible
+     */
+    bool sees(TransactionID xid) const;
+
+    /**
+     * @param xmax  a record's deleter
+     * @returns     whether someone deleted the record, whether or not we can see it: a deletion
+     *              left stamped by an aborted transaction doesn't count
+     */
+    bool deleted(TransactionID xmax) const;
+
+    /**
+     * @param xmin  the record's creator
+     * @param xmax  the record's deleter (FROZEN if none)
+     * @returns     whether the record is visible: created and not yet deleted, as far as we can see
+     */
+    bool visible(TransactionID xmin, TransactionID xmax) const {
+        return sees(xmin) && (xmax == 0 || !sees(xmax));
+    }
+};
+
+/**
+ * @class Change - an entry in a transaction's write set, so that it can be undone
+ */
+class Change {
+public:
+    enum Kind {
+        INSERTED,   // a record added
+        DELETED,    // a record's xmax stamped
+        APPENDED,   // a whole block of records added (bulk loading)
+        ACTION      // something to do on abort or commit (see Transaction::on_abort, on_commit)
+    };
+
+    Change(Kind kind, HeapTable *table, Handle handle) : kind(kind), table(table), handle(handle) {}
+
+    Kind kind;
+    HeapTable *table;   // nullptr for ACTION
+    Handle handle;      // for APPENDED, just the block id matters; for ACTION, the action's index
+};
+
+/**
+ * @class Transaction - a unit of work: its snapshot, and what it has changed.
+ *
+ * A transaction only gets an id when it first writes, so read-only ones don't use ids up.
+ * Aborting one undoes its changes in the records themselves (its new records get xmin ABORTED and
+ * its deletions are unstamped) before anyone can see it has finished, so aborted transactions
+ * needn't be remembered. Only if the undoing fails partway is the id kept as aborted (see
+ * TransactionManager::get_aborted), so that what is left of its changes counts for nothing.
+ *
+ * Nothing is written out to disk while a transaction runs; committing syncs each table it changed
+ * once (see TransactionManager::flush), however many rows it changed.
+ */
+class Transaction {
+public:
+    virtual ~Transaction();
+
+    Transaction(const Transaction &other) = delete;
+
+    Transaction &operator=(const Transaction &other) = delete;
+
+    /**
+     * @returns  this transaction's id, giving it one if it doesn't have one yet
+     */
+    virtual TransactionID get_id();
+
+    /**
+     * @returns  whether this transaction has an id yet (only those that have written do)
+     */
+    virtual bool has_id() const;
+
+    virtual const Snapshot &get_snapshot() const { return snapshot; }
+
+    /**
+     * Note a change, to be undone if this transaction aborts.
+     * @param change  the change
+     */
+    virtual void remember(const Change &change);
+
+    /**
+     * Note something to do if this transaction aborts, in its place among the changes (so after
+     * undoing the changes made since, and before undoing those made before).
+     * @param undo  undoes something done outside the heap files
+     */
+    virtual void on_abort(const std::function<void()> &undo);
+
+    /**
+     * Note something to do once this transaction commits (and not at all if it aborts).
+     * @param action  the action, e.g. removing a dropped table's file
+     */
+    virtual void on_commit(const std::function<void()> &action);
+
+    /**
+     * @returns  whether any actions were noted (which only DDL does)
+     */
+    virtual bool has_actions() const { return !actions.empty(); }
+
+    /**
+     * @returns  a point to roll back to, undoing only what is done after it
+     */
+    virtual size_t savepoint() const { return changes.size(); }
+
+    /**
+     * Undo the changes made since a savepoint, leaving the transaction running.
+     * @param savepoint  from savepoint()
+     */
+    virtual void rollback_to(size_t savepoint);
+
+    /**
+     * Write the changed tables out to disk, make the changes visible to transactions that begin
+     * from now on, release the locks, and then take the actions noted with on_commit.
+     * @throws DbRelationError  if the tables couldn't be written (the transaction is aborted)
+     */
+    virtual void commit();
+
+    /**
+     * Undo the changes, and release the locks.
+     * @throws DbRelationError  if a change couldn't be undone (the transaction is still finished,
+     *                          as aborted)
+     */
+    virtual void abort();
+
+    virtual bool is_finished() const { return finished; }
+
+protected:
+    friend class TransactionManager;
+
+    struct Action {
+        std::function<void()> run;
+        bool at_commit;     // or at abort
+    };
+
+    Snapshot snapshot;
+    TransactionID id;           // FROZEN until the first write
+    std::vector<Change> changes;
+    std::vector<Action> actions;
+    bool finished;
+
+    Transaction() : snapshot(), id(0), changes(), actions(), finished(false) {}
+
+    virtual void add_action(const std::function<void()> &action, bool at_commit);
+};
+
+/**
+ * @class TransactionManager - hands out transaction ids and snapshots, and keeps track of which
+ * transactions are running.
+ *
+ * Ids are reserved in blocks of ID_BLOCK in a small file in the database environment's home, so
+ * that ids keep growing across restarts. Each run also appends to LOG_FILE the ids of the
+ * transactions that finish: commits are synced there, with the batch's tables, before they are
+ * reported (see flush); aborts are not, as a lost one only makes a transaction whose changes were
+ * undone look aborted. Everything stamped by an earlier run counts as committed, but for the ids
+ * listed in ABORTED_FILE: those whose abort failed partway, and those recover found the run
+ * before had handed out (or reserved) without finishing.
+ *
+ * Each thread has a current transaction (set with Scope), which is what HeapTable reads and
+ * writes on behalf of. Without one, a read sees everything committed so far, an insert is
+ * visible to everyone at once and a delete takes effect at once, as before there were transactions.
+ */
+class TransactionManager {
+public:
+    static const TransactionID FROZEN = 0;      // no transaction: created before anyone looked, or not deleted
+    static const TransactionID ABORTED = 1;     // the creator aborted: visible to no one
+    static const TransactionID FIRST = 2;
+    static const TransactionID ID_BLOCK = 65536;
+    static const char *const ID_FILE;
+    static const char *const ABORTED_FILE;
+    static const char *const LOG_FILE;
+
+    /**
+     * Start a transaction, with a snapshot of what has committed so far.
+     * @returns  the new transaction
+     */
+    static std::shared_ptr<Transaction> begin();
+
+    /**
+     * @returns  the current thread's transaction, or nullptr
+     */
+    static Transaction *current();
+
+    /**
+     * @returns  the current transaction's snapshot, or one of what has committed so far
+     */
+    static Snapshot snapshot();
+
+    /**
+     * @returns  the oldest xmin of any running transaction's snapshot: a version deleted by a
+     *           transaction before this is invisible to everyone
+     */
+    static TransactionID horizon();
+
+    /**
+     * @returns  the transactions whose records may still be stamped with their ids though they
+     *           never committed (their abort failed partway, or a crash cut them off)
+     */
+    static AbortedIds get_aborted();
+
+    /**
+     * Write tables out to disk for a committing transaction, and then its commit to LOG_FILE.
+     * Commits are flushed in batches: if another flush is already running, the tables wait for it
+     * to end and are then flushed, all in one go, with those of every other transaction that
+     * committed meanwhile. So a table many transactions changed is synced once for all of them,
+     * and so is the log.
+     * @param id      the transaction's id (FROZEN if it has none)
+     * @param tables  the tables the transaction changed
+     * @throws DbRelationError  if the batch couldn't be written
+     */
+    static void flush(TransactionID id, const std::set<HeapTable *> &tables);
+
+    /**
+     * @class Scope - makes a transaction the current thread's for as long as it lives
+     */
+    class Scope {
+    public:
+        /**
+         * @param transaction  the transaction (if nullptr, the current one stays current)
+         */
+        explicit Scope(Transaction *transaction);
+
+        ~Scope();
+
+        Scope(const Scope &other) = delete;
+
+        Scope &operator=(const Scope &other) = delete;
+
+    protected:
+        Transaction *previous;
+    };
+
+protected:
+    friend class Transaction;
+
+    static std::mutex mutex;                    // guards everything below
+    static TransactionID next_id;
+    static TransactionID reserved;              // ids up to here are recorded in ID_FILE
+    static std::set<TransactionID> running;     // ids of running transactions that have one
+    static std::multiset<TransactionID> oldest; // snapshot xmin of each running transaction
+    static AbortedIds aborted;                  // as listed in ABORTED_FILE
+
+    static std::mutex flush_mutex;              // guards everything below
+    static std::condition_variable flushed;
+    static std::set<HeapTable *> pending;       // tables of the batch waiting to be flushed
+    static std::vector<TransactionID> committing;  // and the ids of its transactions
+    static uint64_t next_batch;                 // the number of that batch
+    static uint64_t flushed_through;            // every batch up to here has been flushed
+    static bool flushing;
+    static std::map<uint64_t, size_t> waiting; // committers in each batch not yet told how it went
+    static std::map<uint64_t, std::string> failed_batches;  // until all of its committers are told
+
+    static std::mutex log_mutex;                // guards log
+    static int log;                             // LOG_FILE, open for appending (-1 until reserve_ids)
+
+    static TransactionID assign_id();
+
+    static void finish(Transaction *transaction);
+
+    // record that a transaction's abort failed, before it finishes
+    static void keep_aborted(TransactionID id);
+
+    static std::string path(const char *file);
+
+    static Snapshot take_snapshot();
+
+    static void reserve_ids();
+
+    /**
+     * With the mutex held, before this run hands out any id: count the ids the run before handed
+     * out (or reserved) without finishing as aborted, and start LOG_FILE afresh.
+     * @param reserved  where the run before's reservation ended
+     */
+    static void recover(TransactionID reserved);
+
+    // append lines to LOG_FILE, synced if asked (and if not, failures are ignored)
+    static void write_log(const std::string &lines, bool sync);
+
+    // replace (or append to) a file in the environment's home, synced
+    static void write_file(const char *file, const std::string &text, bool append);
+};
+
+/**
+ * @class TransactionBlock - a session's explicit transaction: begun with BEGIN, it spans the
+ * session's statements until COMMIT or ROLLBACK. Outside one, each statement is a transaction of
+ * its own (see SQLExec::autocommit).
+ *
+ * Each session (the shell, a script, a server connection) has a block and runs its statements in
+ * its Scope, which makes its transaction, if any, the current one. A block that is destroyed with
+ * its transaction still open rolls it back.
+ */
+class TransactionBlock {
+public:
+    TransactionBlock() : transaction() {}
+
+    virtual ~TransactionBlock();
+
+    TransactionBlock(const TransactionBlock &other) = delete;
+
+    TransactionBlock &operator=(const TransactionBlock &other) = delete;
+
+    /**
+     * Start a transaction, to be the current one for the rest of the block's Scope.
+     * @throws DbRelationError  if one is open already
+     */
+    virtual void begin();
+
+    /**
+     * Commit the open transaction.
+     * @throws DbRelationError  if there isn't one
+     */
+    virtual void commit();
+
+    /**
+     * Roll back the open transaction.
+     * @throws DbRelationError  if there isn't one
+     */
+    virtual void rollback();
+
+    virtual bool is_open() const { return transaction != nullptr; }
+
+    /**
+     * @returns  the open transaction, or nullptr
+     */
+    virtual Transaction *get_transaction() const { return transaction.get(); }
+
+    /**
+     * @returns  the current thread's block, or nullptr
+     */
+    static TransactionBlock *current();
+
+    /**
+     * @class Scope - makes a block the current thread's (and its transaction the current one) for
+     * as long as it lives
+     */
+    class Scope {
+    public:
+        explicit Scope(TransactionBlock *block);
+
+        ~Scope();
+
+        Scope(const Scope &other) = delete;
+
+        Scope &operator=(const Scope &other) = delete;
+
+    protected:
+        TransactionBlock *previous;
+        TransactionManager::Scope transaction_scope;
+    };
+
+protected:
+    std::shared_ptr<Transaction> transaction;
+
+    virtual std::shared_ptr<Transaction> end();
+};
+
+bool test_transactions();
@@ -0,0 +1,260 @@
+/**
+ * @file WireProtocol.cpp - implementation of the server mode's protocol
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include "WireProtocol.h"
+
+using namespace std;
+
+const char Frame::QUERY;
+const char Frame::DATA;
+const char Frame::MESSAGE;
+const char Frame::ERROR;
+const char Frame::READY;
+const size_t Frame::MAX_PAYLOAD;
+const size_t FrameBuffer::BUFFER_SIZE;
+
+static void send_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            throw WireError(string("send failed: ") + strerror(errno));
+        data += sent;
+        size -= sent;
+    }
+}
+
+// returns the number of bytes read, which is less than size only if the connection closed
+static size_t receive_all(int fd, char *data, size_t size) {
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = ::recv(fd, data + got, size - got, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw WireError(string("receive failed: ") + strerror(errno));
+        if (n == 0)
+            break;
+        got += n;
+    }
+    return got;
+}
+
+void Frame::send(int fd, char type, const string &payload) {
+    // one send per frame, so a small frame isn't held back waiting for the rest of it
+    string frame(5, type);
+    uint32_t length = htonl((uint32_t) payload.size());
+    memcpy(&frame[1], &length, sizeof(length));
+    frame += payload;
+    send_all(fd, frame.data(), frame.size());
+}
+
+bool Frame::receive(int fd, char &type, string &payload) {
+    char header[5];
+    size_t got = receive_all(fd, header, sizeof(header));
+    if (got == 0)
+        return false;
+    if (got < sizeof(header))
+        throw WireError("connection closed in a frame");
+    type = header[0];
+    uint32_t length;
+    memcpy(&length, header + 1, sizeof(length));
+    length = ntohl(length);
+    if (length > MAX_PAYLOAD)
+        throw WireError("frame too large");
+    payload.resize(length);
+    if (receive_all(fd, &payload[0], length) < length)
+        throw WireError("connection closed in a frame");
+    return true;
+}
+
+FrameBuffer::FrameBuffer(int fd) : fd(fd), buffer() {
+    this->buffer.reserve(BUFFER_SIZE);
+}
+
+FrameBuffer::int_type FrameBuffer::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+    this->buffer += traits_type::to_char_type(c);
+    if (this->buffer.size() >= BUFFER_SIZE && sync() != 0)
+        return traits_type::eof();
+    return c;
+}
+
+streamsize FrameBuffer::xsputn(const char *s, streamsize n) {
+    this->buffer.append(s, n);
+    if (this->buffer.size() >= BUFFER_SIZE && sync() != 0)
+        return 0;
+    return n;
+}
+
+int FrameBuffer::sync() {
+    if (this->buffer.empty())
+        return 0;
+    try {
+        Frame::send(this->fd, Frame::DATA, this->buffer);
+    } catch (WireError &e) {
+        return -1;
+    }
+    this->buffer.clear();
+    return 0;
+}
+
+static bool is_port(const string &address) {
+    return !address.empty() && address.size() <= 5 && address.find_first_not_of("0123456789") == string::npos;
+}
+
+static sockaddr_un unix_address(const string &path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        throw WireError("socket path too long: " + path);
+    strcpy(address.sun_path, path.c_str());
+    return address;
+}
+
+static sockaddr_in loopback_address(const string &port) {
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t) stoi(port));
+    return address;
+}
+
+int listen_on(const string &address) {
+    bool tcp = is_port(address);
+    int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw WireError(string("socket failed: ") + strerror(errno));
+    int result;
+    if (tcp) {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in in = loopback_address(address);
+        result = ::bind(fd, (sockaddr *) &in, sizeof(in));
+    } else {
+        sockaddr_un un = unix_address(address);
+        unlink(address.c_str());
+        result = ::bind(fd, (sockaddr *) &un, sizeof(un));
+    }
+    if (result < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        string error = strerror(errno);
+        close(fd);
+        throw WireError("cannot listen on " + address + ": " + error);
+    }
+    return fd;
+}
+
+int connect_to(const string &address) {
+    bool tcp = is_port(address);
+    int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw WireError(string("socket failed: ") + strerror(errno));
+    int result;
+    if (tcp) {
+        sockaddr_in in = loopback_address(address);
+        result = ::connect(fd, (sockaddr *) &in, sizeof(in));
+    } else {
+        sockaddr_un un = unix_address(address);
+        result = ::connect(fd, (sockaddr *) &un, sizeof(un));
+    }
+    if (result < 0) {
+        string error = strerror(errno);
+        close(fd);
+        throw WireError("cannot connect to " + address + ": " + error);
+    }
+    return fd;
+}
+
+bool test_wire_protocol() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        throw WireError(string("socketpair failed: ") + strerror(errno));
+    bool ok = true;
+    try {
+        // a frame is its type, its length in network byte order, and its payload
+        Frame::send(fds[0], Frame::MESSAGE, string("a\0c", 3));
+        char raw[8];
+        ok = ok && receive_all(fds[1], raw, sizeof(raw)) == sizeof(raw) && memcmp(raw, "M\0\0\0\3a\0c", 8) == 0;
+
+        // frames come back whole and in order, whatever their sizes (the big one from another thread)
+        string big(3 * 1024 * 1024 + 7, 'x');
+        thread sender([&] {
+            Frame::send(fds[0], Frame::QUERY, "");
+            Frame::send(fds[0], Frame::DATA, big);
+            Frame::send(fds[0], Frame::READY, "z");
+        });
+        char type;
+        string payload;
+        bool query = Frame::receive(fds[1], type, payload) && type == Frame::QUERY && payload.empty();
+        bool data = Frame::receive(fds[1], type, payload) && type == Frame::DATA && payload == big;
+        bool ready = Frame::receive(fds[1], type, payload) && type == Frame::READY && payload == "z";
+        sender.join();
+        ok = ok && query && data && ready;
+        std::cout << "frames ok" << std::endl;
+
+        // a FrameBuffer sends a DATA frame per flush, and per BUFFER_SIZE bytes, and none for nothing
+        {
+            FrameBuffer frames(fds[0]);
+            ostream out(&frames);
+            out << "row " << 1 << '\n';
+            out.flush();
+            out.flush();
+            out << string(FrameBuffer::BUFFER_SIZE, 'y');
+            out << "!";
+            out.flush();
+        }
+        ok = ok && Frame::receive(fds[1], type, payload) && type == Frame::DATA && payload == "row 1\n";
+        ok = ok && Frame::receive(fds[1], type, payload) && payload == string(FrameBuffer::BUFFER_SIZE, 'y');
+        ok = ok && Frame::receive(fds[1], type, payload) && payload == "!";
+        std::cout << "frame buffer ok" << std::endl;
+
+        // a length beyond MAX_PAYLOAD is refused before anything is allocated for it
+        uint32_t length = htonl((uint32_t) Frame::MAX_PAYLOAD + 1);
+        string header(1, Frame::DATA);
+        header.append((const char *) &length, sizeof(length));
+        send_all(fds[0], header.data(), header.size());
+        bool refused = false;
+        try {
+            Frame::receive(fds[1], type, payload);
+        } catch (WireError &e) {
+            refused = true;
+        }
+        ok = ok && refused;
+
+        // closing between frames ends the stream; closing inside one is an error
+        send_all(fds[0], "D\0\0\0\5ab", 7);
+        close(fds[0]);
+        fds[0] = -1;
+        bool truncated = false;
+        try {
+            Frame::receive(fds[1], type, payload);
+        } catch (WireError &e) {
+            truncated = true;
+        }
+        ok = ok && truncated && !Frame::receive(fds[1], type, payload);
+        std::cout << "closing ok" << std::endl;
+    } catch (...) {
+        if (fds[0] >= 0)
+            close(fds[0]);
+        close(fds[1]);
+        throw;
+    }
+    if (fds[0] >= 0)
+        close(fds[0]);
+    close(fds[1]);
+    return ok;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file WireProtocol.h - the client/server protocol for sql5300's server mode
+ * WireError, Frame, FrameBuffer, and the socket helpers listen_on and connect_to
+ *
+ * Everything sent either way is a frame: a one-byte type, a four-byte payload length in network
+ * byte order, then the payload. A client sends a QUERY frame with the text of a statement. The
+ * server answers each statement in it with any number of DATA frames (the formatted rows, in the
+ * format chosen with SET FORMAT) followed by a MESSAGE frame ("successfully returned ...") or an
+ * ERROR frame, and ends its answer to the query with a READY frame.
+ *
+ * Addresses are either a TCP port number, for the loopback interface, or the path of a Unix-domain
+ * socket.
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+
+/**
+ * @class WireError - a connection failed or the other side broke the protocol
+ */
+class WireError : public std::runtime_error {
+public:
+    explicit WireError(std::string s) : runtime_error(s) {}
+};
+
+/**
+ * @class Frame - frame types, and reading and writing frames on a socket
+ */
+class Frame {
+public:
+    static const char QUERY = 'Q';
+    static const char DATA = 'D';
+    static const char MESSAGE = 'M';
+    static const char ERROR = 'E';
+    static const char READY = 'Z';
+
+    static const size_t MAX_PAYLOAD = 64 * 1024 * 1024;
+
+    /**
+     * Send a whole frame.
+     * @param fd       the socket
+     * @param type     the frame type
+     * @param payload  its contents
+     */
+    static void send(int fd, char type, const std::string &payload);
+
+    /**
+     * Receive a whole frame, waiting for it.
+     * @param fd       the socket
+     * @param type     returned by reference: the frame type
+     * @param payload  returned by reference: its contents
+     * @returns        false if the other side closed the connection between frames
+     */
+    static bool receive(int fd, char &type, std::string &payload);
+};
+
+/**
+ * @class FrameBuffer - a stream buffer that sends what is written to it as DATA frames, one per
+ * flush (or per BUFFER_SIZE bytes), so that a ResultWriter can write straight to a client.
+ */
+class FrameBuffer : public std::streambuf {
+public:
+    static const size_t BUFFER_SIZE = 64 * 1024;
+
+    explicit FrameBuffer(int fd);
+
+    virtual ~FrameBuffer() {}
+
+    FrameBuffer(const FrameBuffer &other) = delete;
+
+    FrameBuffer &operator=(const FrameBuffer &other) = delete;
+
+protected:
+    int fd;
+    std::string buffer;
+
+    virtual int_type overflow(int_type c);
+
+    virtual std::streamsize xsputn(const char *s, std::streamsize n);
+
+    virtual int sync();
+};
+
+/**
+ * Open a listening socket.
+ * @param address  port number or socket path (an old socket file at the path is replaced)
+ * @returns        the socket
+ */
+int listen_on(const std::string &address);
+
+/**
+ * Connect to a server.
+ * @param address  port number or socket path
+ * @returns        the socket
+ */
+int connect_to(const std::string &address);
+
+bool test_wire_protocol();
@@ -0,0 +1,433 @@
+/**
+ * @file Workload.cpp - implementation of Workload
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+#include "Workload.h"
+
+using namespace std;
+using namespace hsql;
+
+const char *const Workload::TABLE = "usertable";
+
+static const vector<string> NAMES = {"ycsb-a", "ycsb-b", "ycsb-c", "ycsb-d", "ycsb-e", "ycsb-f", "load",
+                                     "analytics", "ddl"};
+static const vector<string> DISTRIBUTIONS = {"uniform", "zipfian", "latest"};
+
+static uint64_t to_count(const string &name, const string &value) {
+    try {
+        size_t end;
+        unsigned long long n = stoull(value, &end);
+        if (end == value.size() && value[0] != '-')
+            return n;
+    } catch (logic_error &e) {
+        // reported below
+    }
+    throw WorkloadError("bad value for " + name + ": " + value);
+}
+
+static double to_number(const string &name, const string &value) {
+    try {
+        size_t end;
+        double n = stod(value, &end);
+        if (end == value.size())
+            return n;
+    } catch (logic_error &e) {
+        // reported below
+    }
+    throw WorkloadError("bad value for " + name + ": " + value);
+}
+
+Workload::Options Workload::parse(const vector<string> &args) {
+    if (args.empty())
+        throw WorkloadError("which workload?");
+    Options options;
+    options.name = args[0];
+    for (size_t i = 1; i < args.size(); i++) {
+        size_t equals = args[i].find('=');
+        if (equals == string::npos)
+            throw WorkloadError("expected name=value, not " + args[i]);
+        string name = args[i].substr(0, equals), value = args[i].substr(equals + 1);
+        if (name == "threads")
+            options.threads = to_count(name, value);
+        else if (name == "seconds")
+            options.seconds = to_number(name, value);
+        else if (name == "operations")
+            options.operations = to_count(name, value);
+        else if (name == "records")
+            options.records = to_count(name, value);
+        else if (name == "fields")
+            options.fields = to_count(name, value);
+        else if (name == "field_length")
+            options.field_length = to_count(name, value);
+        else if (name == "distribution")
+            options.distribution = value;
+        else if (name == "theta")
+            options.theta = to_number(name, value);
+        else if (name == "scan_length")
+            options.scan_length = to_count(name, value);
+        else if (name == "seed")
+            options.seed = to_count(name, value);
+        else
+            throw WorkloadError("unknown option " + name);
+    }
+    return options;
+}
+
+Workload::Options Workload::checked(const Options &options) {
+    Options checked = options;
+    if (find(NAMES.begin(), NAMES.end(), options.name) == NAMES.end())
+        throw WorkloadError("unknown workload " + options.name);
+    if (find(DISTRIBUTIONS.begin(), DISTRIBUTIONS.end(), options.distribution) == DISTRIBUTIONS.end())
+        throw WorkloadError("unknown distribution " + options.distribution);
+    if (options.threads == 0 || options.records == 0 || options.fields == 0 || options.field_length == 0 ||
+        options.scan_length == 0)
+        throw WorkloadError("threads, records, fields, field_length and scan_length must be at least 1");
+    if (!(options.theta > 0 && options.theta < 1))
+        throw WorkloadError("theta must be between 0 and 1");
+    if (!(options.seconds > 0) && options.operations == 0)
+        throw WorkloadError("give seconds or operations, so the run ends");
+    if (options.name == "ycsb-d")
+        checked.distribution = "latest";
+    return checked;
+}
+
+Workload::Workload(const Options &options) : options(checked(options)), zipfian(options.records, options.theta),
+                                             next_key(0), issued(0), deadline(), engine() {
+}
+
+void Workload::run(ostream &out) {
+    if (this->options.name != "ddl")
+        load(out);
+    if (this->options.name == "load")
+        return;
+
+    this->issued = 0;
+    this->deadline = this->options.seconds > 0
+                     ? chrono::steady_clock::now() +
+                       chrono::duration_cast<chrono::steady_clock::duration>(
+                               chrono::duration<double>(this->options.seconds))
+                     : chrono::steady_clock::time_point::max();
+    if (this->options.name == "analytics")
+        drive("run", [this](Session &session) { return proceed() && analytics(session); }, out);
+    else if (this->options.name == "ddl")
+        drive("run", [this](Session &session) { return proceed() && ddl(session); }, out);
+    else
+        drive("run", [this](Session &session) { return proceed() && ycsb(session); }, out);
+}
+
+bool Workload::proceed() {
+    if (this->options.operations != 0 && this->issued++ >= this->options.operations)
+        return false;
+    return chrono::steady_clock::now() < this->deadline;
+}
+
+// each thread inserts the next key until there are records of them
+void Workload::load(ostream &out) {
+    execute_quietly(string("DROP TABLE ") + TABLE);
+    string create = string("CREATE TABLE ") + TABLE + " (ycsb_key INT";
+    for (size_t i = 0; i < this->options.fields; i++)
+        create += ", field" + to_string(i) + " TEXT";
+    execute(create + ")");
+
+    this->next_key = 0;
+    drive("load", [this](Session &session) {
+        uint64_t key = this->next_key++;
+        if (key >= this->options.records)
+            return false;
+        timed(session, "INSERT", [this, key](Session &session) { execute(insert_statement(key, session)); });
+        return true;
+    }, out);
+    this->next_key = this->options.records;
+}
+
+void Workload::drive(const string &phase, const function<bool(Session &session)> &operation, ostream &out) {
+    vector<Session *> sessions;
+    for (size_t i = 0; i < this->options.threads; i++)
+        sessions.push_back(new Session(i, this->options.seed + i));
+    mutex failure_mutex;
+    exception_ptr failure;
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (Session *session: sessions) {
+        threads.emplace_back([this, session, &operation, &failure_mutex, &failure]() {
+            try {
+                while (operation(*session)) {}
+            } catch (...) {
+                lock_guard<mutex> lock(failure_mutex);
+                if (!failure)
+                    failure = current_exception();
+            }
+            // roll back what a failed read-modify-write left open, as SQLServer::abandon does
+            if (session->block.is_open()) {
+                TransactionBlock::Scope scope(&session->block);
+                execute_quietly("ROLLBACK");
+            }
+        });
+    }
+    for (thread &t: threads)
+        t.join();
+    auto elapsed = chrono::steady_clock::now() - start;
+
+    try {
+        if (failure)
+            rethrow_exception(failure);
+        report(phase, sessions, elapsed, out);
+    } catch (...) {
+        for (Session *session: sessions)
+            delete session;
+        throw;
+    }
+    for (Session *session: sessions)
+        delete session;
+}
+
+// Statements that fail as a client would see them fail count against the operation; anything
+// else (out of memory, a Berkeley DB failure) stops the workload.
+void Workload::timed(Session &session, const string &name, const Operation &statements) {
+    TransactionBlock::Scope scope(&session.block);
+    Samples &samples = session.samples[name];
+    auto start = chrono::steady_clock::now();
+    try {
+        statements(session);
+    } catch (SQLExecError &e) {
+        samples.errors++;
+        return;
+    } catch (DbRelationError &e) {
+        samples.errors++;
+        return;
+    }
+    auto elapsed = chrono::steady_clock::now() - start;
+    samples.latencies.push_back((uint64_t) chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+}
+
+void Workload::execute(const string &sql) {
+    Discarder(&this->engine).run(sql);
+}
+
+void Workload::Discarder::take(QueryResult *result) {
+    try {
+        ValueDicts *rows;
+        while (!(rows = result->fetch())->empty()) {
+            for (ValueDict *row: *rows)
+                delete row;
+            delete rows;
+        }
+        delete rows;
+    } catch (...) {
+        delete result;
+        throw;
+    }
+    delete result;
+}
+
+// the operation fails with it
+void Workload::Discarder::fail(const string &message) {
+    throw SQLExecError(message);
+}
+
+void Workload::execute_quietly(const string &sql) {
+    try {
+        execute(sql);
+    } catch (SQLExecError &e) {
+        // nothing more to be done about it
+    } catch (DbRelationError &e) {
+        // nothing more to be done about it
+    }
+}
+
+bool Workload::ycsb(Session &session) {
+    auto read = [this](uint64_t key) {
+        return [this, key](Session &) {
+            execute(string("SELECT * FROM ") + TABLE + " WHERE ycsb_key = " + to_string(key));
+        };
+    };
+    auto update = [this](uint64_t key) {
+        return [this, key](Session &session) {
+            size_t field = uniform_int_distribution<size_t>(0, this->options.fields - 1)(session.random);
+            execute(string("UPDATE ") + TABLE + " SET field" + to_string(field) + " = '" + field_value(session) +
+                    "' WHERE ycsb_key = " + to_string(key));
+        };
+    };
+
+    char kind = this->options.name.back();
+    double p = uniform_real_distribution<double>(0, 1)(session.random);
+    if ((kind == 'd' || kind == 'e') && p >= 0.95) {
+        uint64_t key = this->next_key++;
+        timed(session, "INSERT", [this, key](Session &session) { execute(insert_statement(key, session)); });
+        return true;
+    }
+
+    uint64_t key = choose_key(session);
+    if (kind == 'e') {
+        size_t length = uniform_int_distribution<size_t>(1, this->options.scan_length)(session.random);
+        timed(session, "SCAN", [this, key, length](Session &) {
+            execute(string("SELECT * FROM ") + TABLE + " WHERE ycsb_key >= " + to_string(key) +
+                    " AND ycsb_key < " + to_string(key + length));
+        });
+    } else if ((kind == 'a' && p >= 0.5) || (kind == 'b' && p >= 0.95)) {
+        timed(session, "UPDATE", update(key));
+    } else if (kind == 'f' && p >= 0.5) {
+        timed(session, "READ-MODIFY-WRITE", [this, read, update, key](Session &session) {
+            execute("BEGIN");
+            read(key)(session);
+            update(key)(session);
+            execute("COMMIT");
+        });
+        if (session.block.is_open()) {
+            TransactionBlock::Scope scope(&session.block);
+            execute_quietly("ROLLBACK");
+        }
+    } else {
+        timed(session, "READ", read(key));
+    }
+    return true;
+}
+
+bool Workload::analytics(Session &session) {
+    double p = uniform_real_distribution<double>(0, 1)(session.random);
+    if (p < 1.0 / 3) {
+        timed(session, "COUNT", [this](Session &) {
+            execute(string("SELECT COUNT(*) FROM ") + TABLE);
+        });
+    } else if (p < 2.0 / 3) {
+        timed(session, "GROUP BY", [this](Session &) {
+            execute(string("SELECT field0, COUNT(*), MIN(ycsb_key), MAX(ycsb_key) FROM ") + TABLE +
+                    " GROUP BY field0");
+        });
+    } else {
+        uint64_t key = choose_key(session);
+        uint64_t length = max((uint64_t) 1, (uint64_t) this->options.records / 10);
+        timed(session, "RANGE SCAN", [this, key, length](Session &) {
+            execute(string("SELECT ycsb_key, field0 FROM ") + TABLE + " WHERE ycsb_key >= " + to_string(key) +
+                    " AND ycsb_key < " + to_string(key + length));
+        });
+    }
+    return true;
+}
+
+// tables are named for the session, so sessions churn side by side
+bool Workload::ddl(Session &session) {
+    string table = "churn_" + to_string(session.number) + "_" + to_string(session.tables++);
+    timed(session, "CREATE TABLE", [this, &table](Session &) {
+        execute("CREATE TABLE " + table + " (id INT, data TEXT)");
+    });
+    timed(session, "INSERT", [this, &table](Session &session) {
+        execute("INSERT INTO " + table + " VALUES (1, '" + field_value(session) + "')");
+    });
+    timed(session, "SELECT", [this, &table](Session &) {
+        execute("SELECT * FROM " + table);
+    });
+    timed(session, "DROP TABLE", [this, &table](Session &) {
+        execute("DROP TABLE " + table);
+    });
+    return true;
+}
+
+// FNV-1a, to scatter zipfian ranks over the keys
+static uint64_t scramble(uint64_t rank) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; i++) {
+        hash ^= rank & 0xff;
+        hash *= 0x100000001b3ULL;
+        rank >>= 8;
+    }
+    return hash;
+}
+
+uint64_t Workload::choose_key(Session &session) {
+    if (this->options.distribution == "uniform")
+        return uniform_int_distribution<uint64_t>(0, this->options.records - 1)(session.random);
+    uint64_t rank = this->zipfian.next(session.random);
+    if (this->options.distribution == "zipfian")
+        return scramble(rank) % this->options.records;
+    uint64_t newest = this->next_key - 1;
+    return rank <= newest ? newest - rank : 0;
+}
+
+// one letter over and over, so that field0 has at most 26 values to GROUP BY
+string Workload::field_value(Session &session) {
+    char letter = (char) ('a' + uniform_int_distribution<int>(0, 25)(session.random));
+    return string(this->options.field_length, letter);
+}
+
+string Workload::insert_statement(uint64_t key, Session &session) {
+    string sql = string("INSERT INTO ") + TABLE + " VALUES (" + to_string(key);
+    for (size_t i = 0; i < this->options.fields; i++)
+        sql += ", '" + field_value(session) + "'";
+    return sql + ")";
+}
+
+Workload::ZipfianGenerator::ZipfianGenerator(uint64_t n, double theta)
+        : n(n), theta(theta), zetan(0), alpha(1 / (1 - theta)), eta(0) {
+    for (uint64_t i = 1; i <= n; i++)
+        this->zetan += 1 / pow((double) i, theta);
+    double zeta2 = 1 + 1 / pow(2.0, theta);
+    this->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / this->zetan);
+}
+
+uint64_t Workload::ZipfianGenerator::next(mt19937_64 &random) const {
+    double u = uniform_real_distribution<double>(0, 1)(random);
+    double uz = u * this->zetan;
+    if (uz < 1)
+        return 0;
+    if (uz < 1 + pow(0.5, this->theta))
+        return 1;
+    return min(this->n - 1, (uint64_t) (this->n * pow(this->eta * u - this->eta + 1, this->alpha)));
+}
+
+// nearest rank
+static double percentile_ms(const vector<uint64_t> &sorted, double fraction) {
+    size_t rank = max((size_t) 1, (size_t) ceil(fraction * sorted.size()));
+    return sorted[rank - 1] / 1e6;
+}
+
+void Workload::report(const string &phase, const vector<Session *> &sessions,
+                      chrono::steady_clock::duration elapsed, ostream &out) const {
+    SamplesByOperation all;
+    for (Session *session: sessions) {
+        for (auto const &entry: session->samples) {
+            Samples &samples = all[entry.first];
+            samples.latencies.insert(samples.latencies.end(), entry.second.latencies.begin(),
+                                     entry.second.latencies.end());
+            samples.errors += entry.second.errors;
+        }
+    }
+    double seconds = chrono::duration<double>(elapsed).count();
+    uint64_t ops = 0, errors = 0;
+    for (auto const &entry: all) {
+        ops += entry.second.latencies.size();
+        errors += entry.second.errors;
+    }
+
+    out << fixed << setprecision(3);
+    out << this->options.name << " " << phase << ": " << ops << " operations in " << seconds << " s ("
+        << setprecision(1) << ops / seconds << " ops/s) from " << this->options.threads << " threads, "
+        << errors << " errors" << endl;
+    out << "  " << left << setw(18) << "operation" << right << setw(10) << "ops" << setw(8) << "errors"
+        << setw(12) << "ops/s" << setw(10) << "mean_ms" << setw(10) << "p50_ms" << setw(10) << "p95_ms"
+        << setw(10) << "p99_ms" << setw(10) << "p99.9_ms" << setw(10) << "max_ms" << endl;
+    for (auto &entry: all) {
+        vector<uint64_t> &latencies = entry.second.latencies;
+        sort(latencies.begin(), latencies.end());
+        out << "  " << left << setw(18) << entry.first << right << setw(10) << latencies.size() << setw(8)
+            << entry.second.errors << setprecision(1) << setw(12) << latencies.size() / seconds
+            << setprecision(3);
+        if (latencies.empty()) {
+            out << endl;
+            continue;
+        }
+        double total = 0;
+        for (uint64_t latency: latencies)
+            total += latency;
+        out << setw(10) << total / latencies.size() / 1e6 << setw(10) << percentile_ms(latencies, 0.5)
+            << setw(10) << percentile_ms(latencies, 0.95) << setw(10) << percentile_ms(latencies, 0.99)
+            << setw(10) << percentile_ms(latencies, 0.999) << setw(10) << latencies.back() / 1e6 << endl;
+    }
+}
@@ -0,0 +1,211 @@
+/**
+ * @file Workload.h - synthetic load for measuring sql5300's throughput and latency
+ * WorkloadError, Workload
+ *
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "SQLExec.h"
+
+/**
+ * @class WorkloadError - a workload that can't be set up or run as asked
+ */
+class WorkloadError : public std::runtime_error {
+public:
+    explicit WorkloadError(std::string s) : runtime_error(s) {}
+};
+
+/**
+ * @class Workload - runs a mix of statements from some number of threads for a while, the way
+ * clients would, and reports how many it got through and how long each kind took.
+ *
+ * Workloads (by name):
+ *   ycsb-a ... ycsb-f  the YCSB core workloads over usertable (ycsb_key INT, field0 TEXT, ...):
+ *                      a 50% read/50% update, b 95/5 read/update, c read only, d 95% read of
+ *                      the latest keys/5% insert, e 95% short range scan/5% insert, f 50%
+ *                      read/50% read-modify-write (BEGIN, SELECT, UPDATE, COMMIT)
+ *   load               just the loading of usertable that the others begin with
+ *   analytics          counts, GROUP BY aggregates and wide range scans over usertable
+ *   ddl                each operation creates a table, inserts into it, reads it and drops it
+ *
+ * Every statement goes through a StatementRunner, as a server session's do, and all its rows are
+ * fetched, under an engine lock of the workload's own, so the threads interleave as server
+ * sessions would. Each thread is a session with its own
+ * TransactionBlock. Statements are recorded in the QueryLog as usual.
+ *
+ * Keys are chosen by the distribution option: uniform, zipfian (the popular keys scattered over
+ * the key space, as YCSB scrambles them) or latest (zipfian over how recently the key was
+ * inserted; ycsb-d always uses it). usertable is dropped and reloaded with records rows before
+ * each workload but ddl, the load taking as long as it takes; then the workload runs for seconds,
+ * or for operations operations, whichever ends first.
+ *
+ * Latencies are kept exactly, per thread, so recording one takes no lock; the report gives the
+ * throughput and percentiles of each kind of operation, for the load phase and the run.
+ */
+class Workload {
+public:
+    static const char *const TABLE;  // usertable
+
+    /**
+     * @struct Options - how to run a workload, each settable on the command line as name=value
+     */
+    struct Options {
+        std::string name;               // which workload
+        size_t threads = 1;             // sessions running at once
+        double seconds = 10;            // how long to run (after loading)
+        uint64_t operations = 0;        // or stop after this many operations (0 for no limit)
+        size_t records = 1000;          // rows loaded into usertable
+        size_t fields = 10;             // TEXT columns in usertable
+        size_t field_length = 100;      // characters in each
+        std::string distribution = "zipfian";  // uniform, zipfian or latest
+        double theta = 0.99;            // zipfian skew: larger is more skewed (0 < theta < 1)
+        size_t scan_length = 10;        // keys in a ycsb-e scan
+        uint64_t seed = 5300;           // for the random choices, so runs can be repeated
+    };
+
+    /**
+     * Parse the workload's name and name=value options.
+     * @param args  e.g. {"ycsb-a", "threads=4", "seconds=30"}
+     * @returns     the options
+     */
+    static Options parse(const std::vector<std::string> &args);
+
+    /**
+     * @param options  how to run it
+     */
+    explicit Workload(const Options &options);
+
+    virtual ~Workload() {}
+
+    Workload(const Workload &other) = delete;
+
+    Workload &operator=(const Workload &other) = delete;
+
+    /**
+     * Load usertable (unless the workload doesn't use it) and run the workload.
+     * @param out  where to write the report
+     */
+    virtual void run(std::ostream &out);
+
+protected:
+    /**
+     * @class ZipfianGenerator - integers from 0 to n-1, 0 the most likely, with probability
+     * falling off as 1/(i+1)^theta, by the method of Gray et al., "Quickly Generating
+     * Billion-Record Synthetic Databases" (as YCSB does it)
+     */
+    class ZipfianGenerator {
+    public:
+        ZipfianGenerator(uint64_t n, double theta);
+
+        uint64_t next(std::mt19937_64 &random) const;
+
+    protected:
+        uint64_t n;
+        double theta;
+        double zetan;
+        double alpha;
+        double eta;
+    };
+
+    // the latencies of one kind of operation on one thread, in nanoseconds
+    struct Samples {
+        std::vector<uint64_t> latencies;
+        uint64_t errors = 0;
+    };
+    typedef std::map<std::string, Samples> SamplesByOperation;
+
+    // one thread's means of running statements
+    struct Session {
+        size_t number;
+        std::mt19937_64 random;
+        TransactionBlock block;
+        SamplesByOperation samples;
+        uint64_t tables;                // made by ddl so far
+
+        Session(size_t number, uint64_t seed) : number(number), random(seed), block(), samples(), tables(0) {}
+    };
+
+    // an operation run from a Session
+    typedef std::function<void(Session &session)> Operation;
+
+    Options options;
+    ZipfianGenerator zipfian;
+    std::atomic<uint64_t> next_key;     // the key the next insert gets
+    std::atomic<uint64_t> issued;       // operations started, to stop at options.operations
+    std::chrono::steady_clock::time_point deadline;  // when to stop
+    std::shared_timed_mutex engine;     // as SQLServer::engine
+
+    /**
+     * Run operations from options.threads sessions and report how they went.
+     * @param phase      "load" or "run", for the report
+     * @param operation  picks an operation and runs it, returning false when there are no more
+     * @param out        where to report
+     */
+    virtual void drive(const std::string &phase, const std::function<bool(Session &session)> &operation,
+                       std::ostream &out);
+
+    /**
+     * Time an operation and record how it went, as a failure if one of its statements failed.
+     * @param session     whose
+     * @param name        the kind of operation, e.g. "READ"
+     * @param statements  runs its statements
+     */
+    virtual void timed(Session &session, const std::string &name, const Operation &statements);
+
+    // runs statements as a server session would, fetching all the rows and throwing their errors
+    class Discarder : public StatementRunner {
+    public:
+        explicit Discarder(std::shared_timed_mutex *engine) : StatementRunner(engine) {}
+
+    protected:
+        virtual void take(QueryResult *result);
+
+        virtual void fail(const std::string &message);
+    };
+
+    /**
+     * Run a statement (or several) as a server session would, fetching all the rows.
+     * @param sql  the statement
+     * @throws SQLExecError  if one failed
+     */
+    virtual void execute(const std::string &sql);
+
+    // statements whose failure doesn't matter (e.g. DROP TABLE of a table that may not exist)
+    virtual void execute_quietly(const std::string &sql);
+
+    // options, checked, with what they imply filled in
+    static Options checked(const Options &options);
+
+    // whether to start another operation of the run
+    virtual bool proceed();
+
+    virtual void load(std::ostream &out);
+
+    virtual bool ycsb(Session &session);
+
+    virtual bool analytics(Session &session);
+
+    virtual bool ddl(Session &session);
+
+    // next key to read, update or scan from
+    virtual uint64_t choose_key(Session &session);
+
+    virtual std::string field_value(Session &session);
+
+    virtual std::string insert_statement(uint64_t key, Session &session);
+
+    virtual void report(const std::string &phase, const std::vector<Session *> &sessions,
+                        std::chrono::steady_clock::duration elapsed, std::ostream &out) const;
+};
@@ -9,8 +9,15 @@
  */
 
 #include "heap_storage.h"
+#include <algorithm>
+#include <random>
 #include <cstring>
+#include <iostream>
 #include "db_cxx.h"
+#include "Arena.h"
+#include "LockManager.h"
+#include "Metrics.h"
+#include "Trace.h"
 
 using u16 = u_int16_t;
 using u32 = u_int32_t;
@@ -27,16 +34,35 @@ SlottedPage::SlottedPage(Dbt& block, BlockID block_id, bool is_new) : DbBlock(bl
     }
 }
 
-RecordID SlottedPage::add(const Dbt* data) {
-    if (!has_room(data->get_size()))
+// A page read by HeapFile::get owns its copy of the block.
+SlottedPage::~SlottedPage() {
+    if (this->block.get_flags() & DB_DBT_USERMEM)
+        Arena::release(this->block.get_data());
+}
+
+void* SlottedPage::operator new(size_t size) {
+    return Arena::allocate(size);
+}
+
+void SlottedPage::operator delete(void* memory) {
+    Arena::release(memory);
+}
+
+RecordID SlottedPage::add(const Dbt* data) throw(DbBlockNoRoomError) {
+    return this->add(data, TransactionManager::FROZEN);
+}
+
+RecordID SlottedPage::add(const Dbt* data, TransactionID xmin) throw(DbBlockNoRoomError) {
+    u16 size = (u16)(STAMP_SIZE + data->get_size());
+    if (!has_room(size))
         throw DbBlockNoRoomError("not enough room for new record");
     u16 id = ++this->num_records;
-    u16 size = (u16)data->get_size();
     this->end_free -= size;
     u16 loc = this->end_free + 1;
     put_header();
     put_header(id, size, loc);
-    std::memcpy(this->address(loc), data->get_data(), size);
+    this->put_stamp(id, xmin, TransactionManager::FROZEN);
+    std::memcpy(this->address(loc + STAMP_SIZE), data->get_data(), data->get_size());
     return id;
 }
 
@@ -44,21 +70,26 @@ Dbt* SlottedPage::get(RecordID record_id) const {
     u16 size, loc;
     this->get_header(size, loc, record_id);
     if (!loc) return nullptr; // Tombstone
-    return new Dbt(this->address(loc), size);
+    return new Dbt(this->address(loc + STAMP_SIZE), size - STAMP_SIZE);
 }
 
-void SlottedPage::put(RecordID record_id, const Dbt& data) {
+// The stamp stays with the record.
+void SlottedPage::put(RecordID record_id, const Dbt& data) throw(DbBlockNoRoomError) {
     u16 size, loc;
     this->get_header(size, loc, record_id);
-    u16 new_size = sizeof(data);
+    u16 new_size = (u16)(STAMP_SIZE + data.get_size());
+    char stamp[STAMP_SIZE];
+    std::memcpy(stamp, this->address(loc), STAMP_SIZE);
     if (new_size > size) {
         u16 extra = new_size - size;
         if (!this->has_room(extra))
             throw DbBlockNoRoomError("not enough room in block");
-        this->slide(loc + new_size, loc + size);
-        std::memcpy(this->address(loc - extra), data.get_data(), new_size);
+        this->slide(loc, loc - extra);
+        loc -= extra;
+        std::memcpy(this->address(loc), stamp, STAMP_SIZE);
+        std::memcpy(this->address(loc + STAMP_SIZE), data.get_data(), data.get_size());
     } else {
-        std::memcpy(this->address(loc), data.get_data(), new_size);
+        std::memcpy(this->address(loc + STAMP_SIZE), data.get_data(), data.get_size());
         this->slide(loc + new_size, loc + size);
     }
     this->get_header(size, loc, record_id);
@@ -72,6 +103,25 @@ void SlottedPage::del(RecordID record_id) {
     this->slide(loc, loc + size);
 }
 
+bool SlottedPage::get_stamp(RecordID record_id, TransactionID& xmin, TransactionID& xmax) const {
+    if (record_id == 0 || record_id > this->num_records)
+        return false;
+    u16 size, loc;
+    this->get_header(size, loc, record_id);
+    if (!loc)
+        return false;
+    std::memcpy(&xmin, this->address(loc), sizeof(xmin));
+    std::memcpy(&xmax, this->address(loc + sizeof(xmin)), sizeof(xmax));
+    return true;
+}
+
+void SlottedPage::put_stamp(RecordID record_id, TransactionID xmin, TransactionID xmax) {
+    u16 size, loc;
+    this->get_header(size, loc, record_id);
+    std::memcpy(this->address(loc), &xmin, sizeof(xmin));
+    std::memcpy(this->address(loc + sizeof(xmin)), &xmax, sizeof(xmax));
+}
+
 RecordIDs* SlottedPage::ids(void) const {
     RecordIDs* record_ids = new RecordIDs();
     for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
@@ -104,15 +154,18 @@ bool SlottedPage::has_room(u16 size) const
     return size + 4 <= available;
 }
 
+// A negative shift (end before start) makes room for a record to grow.
 void SlottedPage::slide(u16 start, u16 end) {
-    u16 shift = end - start;
+    int shift = (int)end - (int)start;
     if (!shift) return;
     
     // Slide data
     void* old_loc = this->address(this->end_free + 1);
-    void* new_loc = this->address(this->end_free + shift + 1);
+    void* new_loc = this->address((u16)(this->end_free + 1 + shift));
     u16 bytes = start - (this->end_free + 1);
     std::memmove(new_loc, old_loc, bytes);
+    Metrics::count(Metrics::SLIDES);
+    Metrics::count(Metrics::SLIDE_BYTES, bytes);
 
     // Fixup headers
     RecordIDs* record_ids = this->ids();
@@ -120,12 +173,12 @@ void SlottedPage::slide(u16 start, u16 end) {
         u16 size, loc;
         this->get_header(size, loc, record_id);
         if (loc <= start) {
-            loc += shift;
+            loc = (u16)(loc + shift);
             this->put_header(record_id, size, loc);
         }
     }
     delete record_ids;
-    this->end_free += shift;
+    this->end_free = (u16)(this->end_free + shift);
     this->put_header(); // Update main block header
 }
 
@@ -147,6 +200,16 @@ void* SlottedPage::address(u16 offset) const
 
 // Begin Heap File Functions
 
+// Buffer pool misses so far, across the environment.
+uint64_t HeapFile::cache_misses() {
+    DB_MPOOL_STAT* stat = nullptr;
+    if (_DB_ENV->memp_stat(&stat, nullptr, 0) != 0 || stat == nullptr)
+        return 0;
+    uint64_t misses = stat->st_cache_miss;
+    free(stat);
+    return misses;
+}
+
 void HeapFile::create(void) {
     u32 flags = DB_CREATE | DB_EXCL;
     this->db_open(flags);
@@ -170,28 +233,47 @@ void HeapFile::open(void) {
 }
 
 void HeapFile::close(void) {
+    std::lock_guard<std::mutex> lock(this->latch);
     this->db.close(0);
     this->closed = true;
 }
 
+void HeapFile::sync(void) {
+    std::lock_guard<std::mutex> lock(this->latch);
+    if (this->closed) return;
+    Trace::Span span("HeapFile::sync", "io");
+    Metrics::Stopwatch stopwatch(Metrics::SYNC);
+    Metrics::count(Metrics::SYNCS);
+    this->db.sync(0);
+}
+
 SlottedPage* HeapFile::get_new(void) {
     char block[DbBlock::BLOCK_SZ];
     std::memset(block, 0, sizeof(block));
     Dbt data(block, sizeof(block));
-
-    int block_id = ++this->last;
-    Dbt key(&block_id, sizeof(block_id));
-
-    // write out an empty block and read it back in so Berkeley DB is managing the memory
-    SlottedPage* page = new SlottedPage(data, this->last, true);
-    this->db.put(nullptr, &key, &data, 0); // write it out with initialization applied
-    this->db.get(nullptr, &key, &data, 0);
-    return page;
+    SlottedPage* page = new SlottedPage(data, 0, true); // initialize it
+    delete page;
+    return this->get(this->append(&data));
 }
 
 SlottedPage* HeapFile::get(BlockID block_id) {
     Dbt key(&block_id, sizeof(block_id)), block;
-    this->db.get(NULL, &key, &block, 0);
+    // a copy of its own, which the page gives back, so threads can share the handle
+    block.set_data(Arena::allocate(DbBlock::BLOCK_SZ));
+    block.set_ulen(DbBlock::BLOCK_SZ);
+    block.set_flags(DB_DBT_USERMEM);
+    try {
+        Trace::Span span("HeapFile::get", "io");
+        Metrics::Stopwatch stopwatch(Metrics::PAGE_GET);
+        this->db.get(NULL, &key, &block, 0);
+    } catch (...) {
+        Arena::release(block.get_data());
+        throw;
+    }
+    Metrics::count(Metrics::PAGE_GETS);
+    IoCounters* counters = IoCounters::current();
+    if (counters != nullptr)
+        counters->blocks_read++;
     return new SlottedPage(block, block_id);
 }
 
@@ -199,27 +281,45 @@ void HeapFile::put(DbBlock* block) {
     BlockID block_id = block->get_block_id();
     Dbt key(&block_id, sizeof(block_id));
     Dbt* data = block->get_block();
+    Trace::Span span("HeapFile::put", "io");
+    Metrics::Stopwatch stopwatch(Metrics::PAGE_PUT);
+    Metrics::count(Metrics::PAGE_PUTS);
+    this->db.put(NULL, &key, data, 0);
+}
+
+BlockID HeapFile::append(Dbt* data) {
+    std::lock_guard<std::mutex> lock(this->latch);
+    BlockID block_id = this->last.load() + 1;
+    Dbt key(&block_id, sizeof(block_id));
     this->db.put(NULL, &key, data, 0);
+    this->last.store(block_id, std::memory_order_release); // only now can readers see it
+    Metrics::count(Metrics::BLOCKS_ALLOCATED);
+    return block_id;
 }
 
 BlockIDs* HeapFile::block_ids() const
 {
     BlockIDs* block_ids = new BlockIDs();
-    for (BlockID block_id = 1; block_id <= this->last; block_id++)
+    BlockID last = this->last.load(std::memory_order_acquire);
+    for (BlockID block_id = 1; block_id <= last; block_id++)
         block_ids->push_back(block_id);
     return block_ids;
 }
 
 void HeapFile::db_open(uint flags) {
     if (!this->closed) return;
+    std::unique_lock<std::mutex> lock(this->latch);
+    if (!this->closed) return; // another thread opened it while we waited
     this->db.set_message_stream(_DB_ENV->get_message_stream());
     this->db.set_error_stream(_DB_ENV->get_error_stream());
     this->db.set_re_len(DbBlock::BLOCK_SZ);
     this->dbfilename = this->name + ".db";
-    if (this->db.open(NULL, this->dbfilename.c_str(), NULL, DB_RECNO, flags, 0))
+    if (this->db.open(NULL, this->dbfilename.c_str(), NULL, DB_RECNO, flags | DB_THREAD, 0)) {
+        lock.unlock();
         this->close();
-    else
+    } else {
         this->closed = false;
+    }
 }
 
 // End Heap File Functions
@@ -228,7 +328,18 @@ void HeapFile::db_open(uint flags) {
 
 HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes)
     : DbRelation(table_name, column_names, column_attributes), file(table_name)
-{}
+{
+    // Offsets are known up to and including the first variable-width (TEXT) column
+    int offset = 0;
+    for (uint col_num = 0; col_num < this->column_names.size(); col_num++) {
+        this->column_index[this->column_names[col_num]] = col_num;
+        this->fixed_offsets.push_back(offset);
+        if (offset >= 0 && this->column_attributes[col_num].get_data_type() == ColumnAttribute::DataType::INT)
+            offset += sizeof(int32_t);
+        else
+            offset = -1;
+    }
+}
 
 void HeapTable::create() {
     try {
@@ -262,6 +373,10 @@ void HeapTable::close() {
     this->file.close();
 }
 
+void HeapTable::sync() {
+    this->file.sync();
+}
+
 Handle HeapTable::insert(const ValueDict* row) {
     this->open();
     ValueDict* full_row = this->validate(row);
@@ -270,32 +385,73 @@ Handle HeapTable::insert(const ValueDict* row) {
     return handle;
 }
 
-void HeapTable::update(const Handle handle, const ValueDict* new_values) {
-    // FIXME
-    throw DbRelationError("could not update record");
-    
-    BlockID block_id = handle.first;
-    RecordID record_id = handle.second;
-    SlottedPage* block = this->file.get(block_id);
+// The new version is a new record; the old one is deleted (see del), so it is still there for
+// transactions that began before this one commits.
+Handle HeapTable::update(const Handle handle, const ValueDict* new_values) {
+    this->open();
     ValueDict* row = this->project(handle);
-    for(ValueDict::const_iterator it = new_values->begin(); it != new_values->end(); it++)
-        (*row)[it->first] = it->second;
-    ValueDict* full_row = this->validate(row);
-    block->put(record_id, *this->marshal(full_row));
-    this->file.put(block);
-    delete block;
+    ValueDict* full_row;
+    try {
+        for (auto const& column: *new_values) {
+            if (this->column_index.find(column.first) == this->column_index.end())
+                throw DbRelationError("unknown column " + column.first);
+            (*row)[column.first] = column.second;
+        }
+        full_row = this->validate(row);
+    } catch (...) {
+        delete row;
+        throw;
+    }
+    delete row;
+    try {
+        this->del(handle);
+        Handle new_handle = this->append(full_row);
+        delete full_row;
+        return new_handle;
+    } catch (...) {
+        delete full_row;
+        throw;
+    }
 }
 
+// In a transaction, the record is only stamped as deleted, as transactions that began before this
+// one commits should still see it; VACUUM removes it later. Without one, it goes at once.
+// The row lock is taken before the latch, as it may mean waiting for another writer to finish.
 void HeapTable::del(const Handle handle) {
-    // FIXME
-    throw DbRelationError("could not delete record");
-
+    this->open();
+    Transaction* transaction = TransactionManager::current();
+    if (transaction != nullptr)
+        LockManager::lock_row(transaction, this->table_name, handle, LockManager::X);
+    std::lock_guard<std::mutex> lock(this->write_latch);
     BlockID block_id = handle.first;
     RecordID record_id = handle.second;
     SlottedPage* block = this->file.get(block_id);
-    block->del(record_id);
-    this->file.put(block);
+    try {
+        if (transaction == nullptr) {
+            block->del(record_id);
+        } else {
+            TransactionID xmin, xmax;
+            if (!block->get_stamp(record_id, xmin, xmax))
+                throw DbRelationError("no such row");
+            TransactionID id = transaction->get_id();
+            if (xmax == id) {
+                delete block;  // already deleted
+                return;
+            }
+            // first writer wins: a row changed by a transaction we can't see can't be changed again
+            // (with the row lock held, that transaction has finished, and committed)
+            if (transaction->get_snapshot().deleted(xmax) || !transaction->get_snapshot().sees(xmin))
+                throw TransactionConflict("could not serialize: row was changed by a concurrent transaction");
+            block->put_stamp(record_id, xmin, id);
+        }
+        this->file.put(block);
+    } catch (...) {
+        delete block;
+        throw;
+    }
     delete block;
+    if (transaction != nullptr)
+        transaction->remember(Change(Change::DELETED, this, handle));
 }
 
 Handles* HeapTable::select() {
@@ -303,17 +459,17 @@ Handles* HeapTable::select() {
 }
 
 Handles* HeapTable::select(const ValueDict* where) {
-    // FIXME: ignoring where, limit, order, and group
-    if (where)
-        throw DbRelationError("cannot handle where clauses yet");
-    
+    // FIXME: ignoring limit, order, and group
+    this->open();
+    Snapshot snapshot = TransactionManager::snapshot();
     Handles* handles = new Handles();
     BlockIDs* block_ids = file.block_ids();
     for (auto const& block_id: *block_ids) {
         SlottedPage* block = file.get(block_id);
-        RecordIDs* record_ids = block->ids();
+        RecordIDs* record_ids = this->visible(block, snapshot);
         for (auto const& record_id: *record_ids)
-            handles->push_back(Handle(block_id, record_id));
+            if (this->selected(Handle(block_id, record_id), where))
+                handles->push_back(Handle(block_id, record_id));
         delete record_ids;
         delete block;
     }
@@ -321,8 +477,82 @@ Handles* HeapTable::select(const ValueDict* where) {
     return handles;
 }
 
+// Walk blocks from the cursor on, stopping as soon as limit rows qualify.
+Handles* HeapTable::select(const ValueDict* where, Handle& cursor, size_t limit) {
+    this->open();
+    Snapshot snapshot = TransactionManager::snapshot();
+    Handles* handles = new Handles();
+    BlockID last = this->file.get_last_block_id();
+    for (BlockID block_id = std::max(cursor.first, (BlockID)1); block_id <= last && handles->size() < limit; block_id++) {
+        SlottedPage* block = this->file.get(block_id);
+        RecordIDs* record_ids = this->visible(block, snapshot);
+        for (auto const& record_id: *record_ids) {
+            if (handles->size() >= limit)
+                break;
+            if (block_id == cursor.first && record_id <= cursor.second)
+                continue;
+            if (this->selected(Handle(block_id, record_id), where))
+                handles->push_back(Handle(block_id, record_id));
+        }
+        delete record_ids;
+        delete block;
+    }
+    if (!handles->empty())
+        cursor = handles->back();
+    return handles;
+}
+
+// Assume the blocks are about as full as the first one.
+size_t HeapTable::estimate_row_count() {
+    this->open();
+    BlockID last = this->file.get_last_block_id();
+    if (last == 0)
+        return 0;
+    SlottedPage* block = this->file.get(1);
+    RecordIDs* record_ids = block->ids();
+    size_t per_block = record_ids->size();
+    delete record_ids;
+    delete block;
+    return per_block * last;
+}
+
+size_t HeapTable::get_block_count() {
+    this->open();
+    return this->file.get_last_block_id();
+}
+
+// Reservoir-sample the block ids (no I/O needed for that), then read just the chosen blocks, in order.
+Handles* HeapTable::sample(size_t block_count, uint32_t seed) {
+    this->open();
+    std::mt19937 random(seed);
+    BlockIDs chosen;
+    BlockID last = this->file.get_last_block_id();
+    for (BlockID block_id = 1; block_id <= last; block_id++) {
+        if (chosen.size() < block_count) {
+            chosen.push_back(block_id);
+        } else {
+            size_t slot = std::uniform_int_distribution<size_t>(0, block_id - 1)(random);
+            if (slot < block_count)
+                chosen[slot] = block_id;
+        }
+    }
+    std::sort(chosen.begin(), chosen.end());
+
+    Snapshot snapshot = TransactionManager::snapshot();
+    Handles* handles = new Handles();
+    for (auto const& block_id: chosen) {
+        SlottedPage* block = this->file.get(block_id);
+        RecordIDs* record_ids = this->visible(block, snapshot);
+        for (auto const& record_id: *record_ids)
+            handles->push_back(Handle(block_id, record_id));
+        delete record_ids;
+        delete block;
+    }
+    return handles;
+}
+
 ValueDict* HeapTable::project(Handle handle) {
-    return this->project(handle, nullptr);
+    return this->project(handle, (const ColumnNames*) nullptr);
 }
 
 ValueDict* HeapTable::project(Handle handle, const ColumnNames* column_names) {
@@ -330,19 +560,46 @@ ValueDict* HeapTable::project(Handle handle, const ColumnNames* column_names) {
     RecordID record_id = handle.second;
     SlottedPage* block = this->file.get(block_id);
     Dbt* record = block->get(record_id);
-    ValueDict* row = this->unmarshal(record);
+    ValueDict* row = this->unmarshal(record, column_names);
     delete block;
     delete record;
-    if (column_names) {
-        ValueDict* temp_row = new ValueDict();
-        for (Identifier& column_name : this->column_names)
-            (*temp_row)[column_name] = (*row)[column_name];
-        delete row;
-        row = temp_row;   
-    }
     return row;
 }
 
+// The records of a block that a snapshot can see.
+RecordIDs* HeapTable::visible(const SlottedPage* block, const Snapshot& snapshot) const
+{
+    RecordIDs* record_ids = block->ids();
+    auto keep = record_ids->begin();
+    for (RecordID record_id : *record_ids) {
+        TransactionID xmin, xmax;
+        if (block->get_stamp(record_id, xmin, xmax) && snapshot.visible(xmin, xmax))
+            *keep++ = record_id;
+    }
+    record_ids->erase(keep, record_ids->end());
+    return record_ids;
+}
+
+// Equality match on every column named in where (no where means every row qualifies).
+bool HeapTable::selected(Handle handle, const ValueDict* where) {
+    IoCounters* counters = IoCounters::current();
+    if (counters != nullptr)
+        counters->records_read++;
+    if (where == nullptr)
+        return true;
+    ValueDict* row = this->project(handle, where);
+    bool is_selected = true;
+    for (auto const& column: *where) {
+        ValueDict::const_iterator value = row->find(column.first);
+        if (value == row->end() || value->second != column.second) {
+            is_selected = false;
+            break;
+        }
+    }
+    delete row;
+    return is_selected;
+}
+
 ValueDict* HeapTable::validate(const ValueDict* row) const
 {
     ValueDict* full_row = new ValueDict();
@@ -355,26 +612,239 @@ ValueDict* HeapTable::validate(const ValueDict* row) const
     return full_row;
 }
 
+// New rows need no row locks, as no one else can see them until we commit.
 Handle HeapTable::append(const ValueDict* row) {
+    Transaction* transaction = TransactionManager::current();
+    TransactionID xmin = TransactionManager::FROZEN;
+    if (transaction != nullptr) {
+        LockManager::lock_table(transaction, this->table_name, LockManager::IX);
+        xmin = transaction->get_id();
+    }
     Dbt* data = this->marshal(row);
-    SlottedPage* block = this->file.get(this->file.get_last_block_id());
-    RecordID record_id;
-    try {
-        record_id = block->add(data);
-    } catch (DbBlockNoRoomError& e) {
-        block = this->file.get_new();
-        record_id = block->add(data);
+    Handle handle;
+    {
+        std::lock_guard<std::mutex> lock(this->write_latch);
+        SlottedPage* block = this->file.get(this->file.get_last_block_id());
+        RecordID record_id;
+        try {
+            record_id = block->add(data, xmin);
+        } catch (DbBlockNoRoomError& e) {
+            delete block;
+            block = this->file.get_new();
+            record_id = block->add(data, xmin);
+        }
+        this->file.put(block);
+        handle = Handle(block->get_block_id(), record_id);
+        delete block;
     }
-    this->file.put(block);
     delete[] (char*)data->get_data();
     delete data;
+    if (transaction != nullptr)
+        transaction->remember(Change(Change::INSERTED, this, handle));
+    return handle;
+}
+
+std::vector<char*>* HeapTable::pack_pages(const ValueDicts& rows) const
+{
+    Trace::Span span("pack_pages", "codec");
+    std::vector<char*>* pages = new std::vector<char*>();
+    SlottedPage* page = nullptr;
+    try {
+        for (const ValueDict* row : rows) {
+            // marshal needs the row to fit in a block (with its 4-byte header, plus the 4-byte page header)
+            size_t size = 0;
+            for (uint i = 0; i < this->column_names.size(); i++) {
+                ColumnAttribute ca = this->column_attributes[i];
+                size += ca.get_data_type() == ColumnAttribute::DataType::TEXT
+                        ? sizeof(u16) + row->at(this->column_names[i]).s.length() : sizeof(int32_t);
+            }
+            if (size + 8 + SlottedPage::STAMP_SIZE > DbBlock::BLOCK_SZ)
+                throw DbRelationError("row too large for a block");
+
+            Dbt* data = this->marshal(row);
+            for (int attempt = 0; ; attempt++) {
+                if (page == nullptr) {
+                    char* bytes = new char[DbBlock::BLOCK_SZ];
+                    std::memset(bytes, 0, DbBlock::BLOCK_SZ);
+                    pages->push_back(bytes);
+                    Dbt block(bytes, DbBlock::BLOCK_SZ);
+                    page = new SlottedPage(block, 0, true);
+                }
+                try {
+                    page->add(data);
+                    break;
+                } catch (DbBlockNoRoomError& e) {
+                    delete page;  // the page is full; its bytes stay in pages
+                    page = nullptr;
+                    if (attempt > 0)
+                        throw DbRelationError("row too large for a block");
+                }
+            }
+            delete[] (char*)data->get_data();
+            delete data;
+        }
+    } catch (...) {
+        delete page;
+        for (char* bytes : *pages)
+            delete[] bytes;
+        delete pages;
+        throw;
+    }
+    delete page;
+    return pages;
+}
+
+// Pages are packed before we know who is loading them, so they are stamped here.
+size_t HeapTable::append_pages(const std::vector<char*>& pages, Handles* handles)
+{
+    this->open();
+    Transaction* transaction = TransactionManager::current();
+    TransactionID xmin = TransactionManager::FROZEN;
+    if (transaction != nullptr) {
+        LockManager::lock_table(transaction, this->table_name, LockManager::IX);
+        xmin = transaction->get_id();
+    }
+    std::lock_guard<std::mutex> lock(this->write_latch);
+    size_t count = 0;
+    for (char* bytes : pages) {
+        Dbt data(bytes, DbBlock::BLOCK_SZ);
+        SlottedPage page(data, 0);
+        RecordIDs* record_ids = page.ids();
+        if (xmin != TransactionManager::FROZEN)
+            for (RecordID record_id : *record_ids)
+                page.put_stamp(record_id, xmin, TransactionManager::FROZEN);
+        BlockID block_id;
+        try {
+            block_id = this->file.append(&data);
+        } catch (...) {
+            delete record_ids;
+            throw;
+        }
+        if (transaction != nullptr)
+            transaction->remember(Change(Change::APPENDED, this, Handle(block_id, 0)));
+        count += record_ids->size();
+        if (handles != nullptr)
+            for (RecordID record_id : *record_ids)
+                handles->push_back(Handle(block_id, record_id));
+        delete record_ids;
+    }
+    return count;
+}
+
+void HeapTable::scan_records(const std::function<void(const Dbt& record)>& visit)
+{
+    this->open();
+    Snapshot snapshot = TransactionManager::snapshot();
+    BlockID last = this->file.get_last_block_id();
+    for (BlockID block_id = 1; block_id <= last; block_id++) {
+        SlottedPage* block = this->file.get(block_id);
+        RecordIDs* record_ids = this->visible(block, snapshot);
+        try {
+            for (RecordID record_id : *record_ids) {
+                Dbt* record = block->get(record_id);
+                if (record == nullptr)
+                    continue;
+                try {
+                    visit(*record);
+                } catch (...) {
+                    delete record;
+                    throw;
+                }
+                delete record;
+            }
+        } catch (...) {
+            delete record_ids;
+            delete block;
+            throw;
+        }
+        delete record_ids;
+        delete block;
+    }
+}
+
+ValueDict* HeapTable::decode(const Dbt& record) const
+{
+    return this->unmarshal(const_cast<Dbt*>(&record));
+}
+
+void HeapTable::undo(const Change& change, TransactionID xid)
+{
+    this->open();
+    std::lock_guard<std::mutex> lock(this->write_latch);
+    SlottedPage* block = this->file.get(change.handle.first);
+    RecordIDs* record_ids = change.kind == Change::APPENDED ? block->ids() : new RecordIDs(1, change.handle.second);
+    try {
+        for (RecordID record_id : *record_ids) {
+            TransactionID xmin, xmax;
+            if (!block->get_stamp(record_id, xmin, xmax))
+                continue;
+            if (change.kind == Change::DELETED && xmax == xid)
+                block->put_stamp(record_id, xmin, TransactionManager::FROZEN);
+            else if (change.kind != Change::DELETED && xmin == xid)
+                block->put_stamp(record_id, TransactionManager::ABORTED, xmax);
+        }
+        this->file.put(block);
+    } catch (...) {
+        delete record_ids;
+        delete block;
+        throw;
+    }
+    delete record_ids;
     delete block;
-    return Handle(this->file.get_last_block_id(), record_id);
+}
+
+// A version deleted before the horizon is deleted as far as every running transaction can see
+// (its deleter committed, since an aborting one unstamps its deletions before it finishes, or is
+// kept as aborted if it couldn't). What such an aborted transaction left is cleaned up here too:
+// its versions go, and its deletions are unstamped.
+// The latch is taken a block at a time, so writers aren't held up for the whole table.
+size_t HeapTable::vacuum(TransactionID horizon, const std::function<void(Handle handle)>& removing)
+{
+    this->open();
+    AbortedIds aborted = TransactionManager::get_aborted();
+    auto was_aborted = [&aborted](TransactionID xid) {
+        return xid == TransactionManager::ABORTED || aborted.contains(xid);
+    };
+    size_t count = 0;
+    BlockID last = this->file.get_last_block_id();
+    for (BlockID block_id = 1; block_id <= last; block_id++) {
+        std::lock_guard<std::mutex> lock(this->write_latch);
+        SlottedPage* block = this->file.get(block_id);
+        RecordIDs* record_ids = block->ids();
+        size_t removed = 0;
+        bool unstamped = false;
+        try {
+            for (RecordID record_id : *record_ids) {
+                TransactionID xmin, xmax;
+                if (!block->get_stamp(record_id, xmin, xmax))
+                    continue;
+                if (was_aborted(xmin) || (xmax != TransactionManager::FROZEN && !was_aborted(xmax) && xmax < horizon)) {
+                    removing(Handle(block_id, record_id));
+                    block->del(record_id);
+                    removed++;
+                } else if (xmax != TransactionManager::FROZEN && was_aborted(xmax)) {
+                    block->put_stamp(record_id, xmin, TransactionManager::FROZEN);
+                    unstamped = true;
+                }
+            }
+            if (removed > 0 || unstamped)
+                this->file.put(block);
+        } catch (...) {
+            delete record_ids;
+            delete block;
+            throw;
+        }
+        delete record_ids;
+        delete block;
+        count += removed;
+    }
+    return count;
 }
 
 Dbt* HeapTable::marshal(const ValueDict* row) const
 {
-    char* bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
+    Trace::Span span("marshal", "codec");
+    char bytes[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
     uint offset = 0;
     uint col_num = 0;
     for (auto const& column_name: this->column_names) {
@@ -396,13 +866,15 @@ Dbt* HeapTable::marshal(const ValueDict* row) const
     }
     char* right_size_bytes = new char[offset];
     std::memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
+    Metrics::count(Metrics::MARSHALS);
+    Metrics::count(Metrics::MARSHAL_BYTES, offset);
     Dbt* data = new Dbt(right_size_bytes, offset);
     return data;
 }
 
 ValueDict* HeapTable::unmarshal(Dbt* data) const
 {
+    Trace::Span span("unmarshal", "codec");
     ValueDict* row = new ValueDict();
     char* bytes = (char*)data->get_data();
     uint offset = 0;
@@ -423,6 +895,67 @@ ValueDict* HeapTable::unmarshal(Dbt* data) const
             throw DbRelationError("Only know how to unmarshal INT and TEXT");
         }
     }
+    Metrics::count(Metrics::UNMARSHALS);
+    Metrics::count(Metrics::UNMARSHAL_BYTES, offset);
+    IoCounters* counters = IoCounters::current();
+    if (counters != nullptr)
+        counters->bytes_decoded += offset;
+    return row;
+}
+
+// Decode only the requested columns. Columns in the fixed-width prefix are read straight from
+// their precomputed offsets; past that, we only walk as far as the last requested column.
+ValueDict* HeapTable::unmarshal(Dbt* data, const ColumnNames* column_names) const
+{
+    if (column_names == nullptr)
+        return this->unmarshal(data);
+    Trace::Span span("unmarshal", "codec");
+    ValueDict* row = new ValueDict();
+    if (column_names->empty())
+        return row;
+
+    std::vector<bool> wanted(this->column_names.size(), false);
+    uint first = this->column_names.size(), last = 0;
+    for (auto const& column_name: *column_names) {
+        auto it = this->column_index.find(column_name);
+        if (it == this->column_index.end()) {
+            delete row;
+            throw DbRelationError("unknown column " + column_name);
+        }
+        wanted[it->second] = true;
+        first = std::min(first, it->second);
+        last = std::max(last, it->second);
+    }
+
+    // start at the first wanted column if its offset is known, else at the last column whose offset is
+    uint col_num = first;
+    while (this->fixed_offsets[col_num] < 0)
+        col_num--;
+    char* bytes = (char*)data->get_data();
+    uint start = this->fixed_offsets[col_num];
+    uint offset = start;
+    for (; col_num <= last; col_num++) {
+        ColumnAttribute ca = this->column_attributes[col_num];
+        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
+            if (wanted[col_num])
+                (*row)[this->column_names[col_num]] = Value(*(int32_t*)(bytes + offset));
+            offset += sizeof(int32_t);
+        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
+            u16 size = *(u16*)(bytes + offset);
+            offset += sizeof(u16);
+            if (wanted[col_num])
+                (*row)[this->column_names[col_num]] = Value(std::string(bytes + offset, size));
+            offset += size;
+        } else {
+            delete row;
+            throw DbRelationError("Only know how to unmarshal INT and TEXT");
+        }
+    }
+    Metrics::count(Metrics::UNMARSHALS);
+    Metrics::count(Metrics::UNMARSHAL_BYTES, offset - start);
+    IoCounters* counters = IoCounters::current();
+    if (counters != nullptr)
+        counters->bytes_decoded += offset - start;
     return row;
 }
 
@@ -465,17 +998,19 @@ bool test_heap_storage() {
     Value value_a = (*result)["a"], value_b = (*result)["b"];
     std::cout << "project ok" << std::endl;
     
-    // Update and delete (expect exceptions thrown)
-    try {
-        table.update((*handles)[0], nullptr);
-    } catch (DbRelationError &e) {
-        std::cout << "update ok" << std::endl;
-    }
-    try {
-        table.del((*handles)[0]);
-    } catch (DbRelationError &e) {
-        std::cout << "delete ok" << std::endl;
-    }
+    // Update and delete
+    ValueDict new_values;
+    new_values["a"] = Value(13);
+    Handle updated = table.update((*handles)[0], &new_values);
+    ValueDict* changed = table.project(updated);
+    Value value_changed = (*changed)["a"];
+    delete changed;
+    std::cout << "update ok" << std::endl;
+    table.del(updated);
+    Handles* remaining = table.select();
+    size_t remaining_count = remaining->size();
+    delete remaining;
+    std::cout << "delete ok" << std::endl;
 
     // Drop table
     table.drop();
@@ -485,10 +1020,84 @@ bool test_heap_storage() {
     delete handles;
 
     // Test projection results
-    if (value_a.n != 12)
+    if (value_a.n != 12 || value_changed.n != 13 || remaining_count != 0)
         return false;
     if (value_b.s != "Hello!")
 		return false;
 
     return true;
 }
+
+bool test_projection() {
+    // the fixed-width prefix is a and b; c is the first TEXT, so d and e are found by walking
+    ColumnNames column_names = {"a", "b", "c", "d", "e"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable table("_test_projection_cpp", column_names, column_attributes);
+    table.create();
+    bool ok = true;
+    try {
+        ValueDict row;
+        row["a"] = Value(1);
+        row["b"] = Value(-2);
+        row["c"] = Value(std::string("x\0y", 3));
+        row["d"] = Value(4);
+        row["e"] = Value("");
+        table.insert(&row);
+        row["c"] = Value("");
+        row["e"] = Value(std::string(300, 'e'));
+        table.insert(&row);
+
+        // every subset of the columns decodes to the same values as the whole row
+        Handles* handles = table.select();
+        for (auto const& handle: *handles) {
+            ValueDict* full = table.project(handle);
+            for (uint subset = 0; subset < (1U << column_names.size()); subset++) {
+                ColumnNames wanted;
+                for (uint i = 0; i < column_names.size(); i++)
+                    if (subset & (1U << i))
+                        wanted.push_back(column_names[i]);
+                ValueDict* projected = table.project(handle, &wanted);
+                ok = ok && projected->size() == wanted.size();
+                for (auto const& column_name: wanted)
+                    ok = ok && projected->at(column_name) == full->at(column_name);
+                delete projected;
+            }
+            delete full;
+        }
+        std::cout << "project subsets ok" << std::endl;
+
+        // a fixed-offset column is read on its own; one past a TEXT walks from that TEXT
+        IoCounters counters;
+        {
+            IoCounters::Scope scope(&counters);
+            ColumnNames b = {"b"};
+            delete table.project(handles->front(), &b);
+        }
+        ok = ok && counters.bytes_decoded == sizeof(int32_t);
+        counters = IoCounters();
+        {
+            IoCounters::Scope scope(&counters);
+            ColumnNames d = {"d"};
+            delete table.project(handles->front(), &d);
+        }
+        ok = ok && counters.bytes_decoded == sizeof(u16) + 3 + sizeof(int32_t);
+        std::cout << "fixed offsets ok" << std::endl;
+
+        bool unknown = false;
+        try {
+            ColumnNames z = {"z"};
+            delete table.project(handles->front(), &z);
+        } catch (DbRelationError& e) {
+            unknown = true;
+        }
+        ok = ok && unknown;
+        delete handles;
+    } catch (...) {
+        table.drop();
+        throw;
+    }
+    table.drop();
+    return ok;
+}
@@ -9,8 +9,12 @@
  */
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <mutex>
 #include "db_cxx.h"
 #include "storage_engine.h"
+#include "Transaction.h"
 
 /**
  * @class SlottedPage - heap file implementation of DbBlock.
@@ -25,25 +29,60 @@
             Bytes 0x04 - 0x05: size of record 1
             Bytes 0x06 - 0x07: offset to record 1
             etc.
+        Each record starts with its version stamp (see Transaction.h): 4 bytes for the id of the
+        transaction that created it (xmin), then 4 for the one that deleted it (xmax). The size in
+        the record's header includes the stamp; get() and put() deal with the data after it.
  *
  */
 class SlottedPage : public DbBlock {
 public:
+	static const uint16_t STAMP_SIZE = 2 * sizeof(TransactionID);
+
 	SlottedPage(Dbt &block, BlockID block_id, bool is_new=false);
 	// Big 5 - we only need the destructor, copy-ctor, move-ctor, and op= are unnecessary
 	// but we delete them explicitly just to make sure we don't use them accidentally
-	virtual ~SlottedPage() {}
+	virtual ~SlottedPage();
 	SlottedPage(const SlottedPage& other) = delete;
 	SlottedPage(SlottedPage&& temp) = delete;
 	SlottedPage& operator=(const SlottedPage& other) = delete;
 	SlottedPage& operator=(SlottedPage& temp) = delete;
 
+	// from the statement's Arena, if there is one
+	static void* operator new(size_t size);
+	static void operator delete(void* memory);
+
 	virtual RecordID add(const Dbt* data) throw(DbBlockNoRoomError);
 	virtual Dbt* get(RecordID record_id) const;
 	virtual void put(RecordID record_id, const Dbt &data) throw(DbBlockNoRoomError);
 	virtual void del(RecordID record_id);
 	virtual RecordIDs* ids(void) const;
 
+	/**
+	 * Add a new record, created by the given transaction.
+	 * @param data  the data to store for the new record
+	 * @param xmin  the creating transaction
+	 * @returns     the new RecordID for the new record
+	 * @throws      DbBlockNoRoomError if insufficient room in the block
+	 */
+	virtual RecordID add(const Dbt* data, TransactionID xmin) throw(DbBlockNoRoomError);
+
+	/**
+	 * Read a record's version stamp.
+	 * @param record_id  which record
+	 * @param xmin       returned by reference: the creating transaction
+	 * @param xmax       returned by reference: the deleting transaction (FROZEN if none)
+	 * @returns          false if there is no such record
+	 */
+	virtual bool get_stamp(RecordID record_id, TransactionID &xmin, TransactionID &xmax) const;
+
+	/**
+	 * Change a record's version stamp.
+	 * @param record_id  which record
+	 * @param xmin       the creating transaction
+	 * @param xmax       the deleting transaction (FROZEN if none)
+	 */
+	virtual void put_stamp(RecordID record_id, TransactionID xmin, TransactionID xmax);
+
 protected:
 	uint16_t num_records;
 	uint16_t end_free;
@@ -83,16 +122,36 @@ public:
 	virtual void put(DbBlock* block);
 	virtual BlockIDs* block_ids() const;
 
+	/**
+	 * Add a block that was filled in memory to the end of the file.
+	 * @param data  the block's BLOCK_SZ bytes
+	 * @returns     the new block's id
+	 */
+	virtual BlockID append(Dbt* data);
+
 	/**
 	 * Get the id of the current final block in the heap file.
 	 * @returns  block id of last block
 	 */
-	virtual uint32_t get_last_block_id() {return last;}
+	virtual uint32_t get_last_block_id() {return last.load(std::memory_order_acquire);}
+
+	/**
+	 * Write the file's changed blocks out to disk.
+	 */
+	virtual void sync(void);
+
+	/**
+	 * Buffer pool misses so far. The pool is the environment's, so this counts other sessions'
+	 * misses too. Costs a statistics call into Berkeley DB, so it isn't for every block read.
+	 * @returns  the environment's count of pages not found in the pool
+	 */
+	static uint64_t cache_misses();
 
 protected:
 	std::string dbfilename;
-	uint32_t last;
-	bool closed;
+	std::atomic<uint32_t> last;   // only grows once a block is written, so readers never see a missing one
+	std::atomic<bool> closed;
+	std::mutex latch;             // serializes opening, closing and block allocation
 	Db db;
 	virtual void db_open(uint flags=0);
 	virtual uint32_t get_block_count();
@@ -119,22 +178,84 @@ public:
 	virtual void close();
 
 	virtual Handle insert(const ValueDict* row);
-	virtual void update(const Handle handle, const ValueDict* new_values);
+	virtual Handle update(const Handle handle, const ValueDict* new_values);
 	virtual void del(const Handle handle);
 
 	virtual Handles* select();
 	virtual Handles* select(const ValueDict* where);
+	virtual Handles* select(const ValueDict* where, Handle& cursor, size_t limit);
+	virtual size_t estimate_row_count();
+	virtual size_t get_block_count();
+	virtual Handles* sample(size_t block_count, uint32_t seed);
 	virtual ValueDict* project(Handle handle);
 	virtual ValueDict* project(Handle handle, const ColumnNames* column_names);
 	using DbRelation::project;
 
+	/**
+	 * Bulk loading, step 1: encode rows into new pages. Doesn't touch the file, so several threads
+	 * can pack at once.
+	 * @param rows  rows with a value for every column
+	 * @returns     full pages of BLOCK_SZ bytes each, in row order (freed by caller with delete[])
+	 */
+	virtual std::vector<char*>* pack_pages(const ValueDicts& rows) const;
+
+	/**
+	 * Bulk loading, step 2: add packed pages to the end of the table, whole.
+	 * @param pages    pages from pack_pages, in order (still freed by caller)
+	 * @param handles  if not nullptr, the handles of the new records are appended to it
+	 * @returns        number of records added
+	 */
+	virtual size_t append_pages(const std::vector<char*>& pages, Handles* handles = nullptr);
+
+	/**
+	 * Exporting: visit every record in file order, reading each block once and keeping nothing
+	 * between blocks, so a whole table streams in constant memory.
+	 * @param visit  called with each record's encoded bytes (only valid during the call)
+	 */
+	virtual void scan_records(const std::function<void(const Dbt& record)>& visit);
+
+	/**
+	 * Decode a record passed to a scan_records visitor.
+	 * @param record  the record's bytes
+	 * @returns       the row (freed by caller)
+	 */
+	virtual ValueDict* decode(const Dbt& record) const;
+
+	/**
+	 * Undo a change made by an aborting transaction: its new records become invisible to everyone,
+	 * and the records it deleted are no longer deleted.
+	 * @param change  an entry of the transaction's write set
+	 * @param xid     the transaction
+	 */
+	virtual void undo(const Change& change, TransactionID xid);
+
+	/**
+	 * Remove the record versions that no transaction can see any more: those whose creator
+	 * aborted, and those deleted by a transaction before horizon. The others keep their handles.
+	 * @param horizon   from TransactionManager::horizon()
+	 * @param removing  called with each version's handle just before it is removed
+	 * @returns         number of versions removed
+	 */
+	virtual size_t vacuum(TransactionID horizon, const std::function<void(Handle handle)>& removing);
+
+	/**
+	 * Write the table's changed blocks out to disk (when a transaction that changed it commits).
+	 */
+	virtual void sync();
+
 protected:
 	HeapFile file;
+	std::mutex write_latch;                   // one writer at a time changes a block (reads need no latch)
+	std::map<Identifier, uint> column_index;  // position of each column in a record
+	std::vector<int> fixed_offsets;           // byte offset of each column preceded only by fixed-width ones, else -1
 	virtual ValueDict* validate(const ValueDict* row) const;
 	virtual Handle append(const ValueDict* row);
 	virtual Dbt* marshal(const ValueDict* row) const;
 	virtual ValueDict* unmarshal(Dbt* data) const;
+	virtual ValueDict* unmarshal(Dbt* data, const ColumnNames* column_names) const;
 	virtual bool selected(Handle handle, const ValueDict* where);
+	virtual RecordIDs* visible(const SlottedPage* block, const Snapshot& snapshot) const;
 };
 
 bool test_heap_storage();
+bool test_projection();